@@ -1,21 +1,62 @@
 ﻿// Shadows Over The Thames - Изометрическая игра с 3D NPC (ВЕРСИЯ С ПОДДЕРЖКОЙ MTL)
+//
+// С ASSET_COOKER тот же файл собирается в консольный кукер ассетов без графики
+// (см. раздел "ПОДГОТОВКА АССЕТОВ"), например на Linux:
+//   g++ -std=c++17 -O2 -DASSET_COOKER -I<DirectXMath> -I<DirectX-Headers>/include/wsl/stubs
+//       "Shadows Over The Thames.cpp" -lassimp -lpthread -o thames-cook
+#ifdef _WIN32
 #include <windows.h>
+#endif
+#ifndef ASSET_COOKER
 #include <d3d11.h>
 #include <d3dcompiler.h>
-#include <DirectXMath.h>
 #include <wincodec.h>
+#endif
+#include <DirectXMath.h>
 #include <vector>
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <unordered_map>
 #include <memory>
 #include <string>
 #include <cmath>
 #include <algorithm>
 #include <filesystem>
+#include <string_view>
+#include <charconv>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cfloat>
+#include <climits>
+#include <cstring>
+#include <cstdio>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MIPS_USE_SSE2 1
+#else
+#define MIPS_USE_SSE2 0
+#endif
+#ifdef ASSET_COOKER
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#endif
 
 // Добавьте этот дефайн для аннотаций SAL
 #define _In_
@@ -26,10 +67,181 @@
 #define _Inout_
 #define _Inout_opt_
 
+#ifndef ASSET_COOKER
 #pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "dxgi.lib")
 #pragma comment(lib, "d3dcompiler.lib")
 #pragma comment(lib, "windowscodecs.lib")
+#endif
+
+#ifndef _WIN32
+// Без Windows SDK (кукер на Linux): отладочный вывод идёт в stderr
+typedef uint8_t BYTE;
+
+inline void OutputDebugStringA(const char* text) {
+    fputs(text, stderr);
+}
+
+// wchar_t здесь - UTF-32; имена файлов и вывод - UTF-8 независимо от локали
+// (std::filesystem::path переводит через локаль и бросает исключение на "C")
+inline std::string WideToUtf8(const std::wstring& text) {
+    std::string utf8;
+    utf8.reserve(text.size());
+    for (wchar_t wc : text) {
+        uint32_t c = (uint32_t)wc;
+        if (c < 0x80) {
+            utf8 += (char)c;
+        }
+        else if (c < 0x800) {
+            utf8 += (char)(0xC0 | (c >> 6));
+            utf8 += (char)(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000) {
+            utf8 += (char)(0xE0 | (c >> 12));
+            utf8 += (char)(0x80 | ((c >> 6) & 0x3F));
+            utf8 += (char)(0x80 | (c & 0x3F));
+        }
+        else {
+            utf8 += (char)(0xF0 | (c >> 18));
+            utf8 += (char)(0x80 | ((c >> 12) & 0x3F));
+            utf8 += (char)(0x80 | ((c >> 6) & 0x3F));
+            utf8 += (char)(0x80 | (c & 0x3F));
+        }
+    }
+    return utf8;
+}
+
+// Неверные последовательности заменяются на U+FFFD
+inline std::wstring Utf8ToWide(const std::string& text) {
+    std::wstring wide;
+    wide.reserve(text.size());
+    for (size_t i = 0; i < text.size();) {
+        unsigned char lead = (unsigned char)text[i];
+        int length = (lead < 0x80) ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+        if (length == 0 || i + length > text.size()) {
+            wide += (wchar_t)0xFFFD;
+            i++;
+            continue;
+        }
+
+        uint32_t c = (length == 1) ? lead : (lead & (0xFF >> (length + 1)));
+        bool valid = true;
+        for (int k = 1; k < length; k++) {
+            unsigned char next = (unsigned char)text[i + k];
+            if ((next & 0xC0) != 0x80) {
+                valid = false;
+                break;
+            }
+            c = (c << 6) | (next & 0x3F);
+        }
+        wide += valid ? (wchar_t)c : (wchar_t)0xFFFD;
+        i += valid ? length : 1;
+    }
+    return wide;
+}
+
+inline void OutputDebugStringW(const wchar_t* text) {
+    fputs(WideToUtf8(text).c_str(), stderr);
+}
+
+template <size_t N, typename... Args>
+int sprintf_s(char (&buffer)[N], const char* format, Args... args) {
+    return snprintf(buffer, N, format, args...);
+}
+
+template <typename... Args>
+int sprintf_s(char* buffer, size_t size, const char* format, Args... args) {
+    return snprintf(buffer, size, format, args...);
+}
+#endif
+
+#ifdef ASSET_COOKER
+// Кукер собирается без d3d11.h. Кэшу состояний конвейера и командному буферу рендера
+// (и их проверке в --selftest) хватает этих объявлений: описания разложены как в d3d11.h,
+// перечисления в описаниях - UINT, остальные ресурсы - непрозрачные указатели
+#ifndef _WIN32
+typedef int32_t HRESULT;
+typedef int32_t INT;
+typedef int32_t BOOL;
+typedef uint32_t UINT;
+typedef uint8_t UINT8;
+#define S_OK ((HRESULT)0)
+#define E_FAIL ((HRESULT)0x80004005)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#endif
+
+struct ID3D11DeviceChild {
+    virtual unsigned long AddRef() = 0;
+    virtual unsigned long Release() = 0;
+};
+struct ID3D11SamplerState : ID3D11DeviceChild {};
+struct ID3D11RasterizerState : ID3D11DeviceChild {};
+struct ID3D11BlendState : ID3D11DeviceChild {};
+
+struct D3D11_SAMPLER_DESC {
+    UINT Filter;
+    UINT AddressU;
+    UINT AddressV;
+    UINT AddressW;
+    float MipLODBias;
+    UINT MaxAnisotropy;
+    UINT ComparisonFunc;
+    float BorderColor[4];
+    float MinLOD;
+    float MaxLOD;
+};
+
+struct D3D11_RASTERIZER_DESC {
+    UINT FillMode;
+    UINT CullMode;
+    BOOL FrontCounterClockwise;
+    INT DepthBias;
+    float DepthBiasClamp;
+    float SlopeScaledDepthBias;
+    BOOL DepthClipEnable;
+    BOOL ScissorEnable;
+    BOOL MultisampleEnable;
+    BOOL AntialiasedLineEnable;
+};
+
+struct D3D11_RENDER_TARGET_BLEND_DESC {
+    BOOL BlendEnable;
+    UINT SrcBlend;
+    UINT DestBlend;
+    UINT BlendOp;
+    UINT SrcBlendAlpha;
+    UINT DestBlendAlpha;
+    UINT BlendOpAlpha;
+    UINT8 RenderTargetWriteMask;
+};
+
+struct D3D11_BLEND_DESC {
+    BOOL AlphaToCoverageEnable;
+    BOOL IndependentBlendEnable;
+    D3D11_RENDER_TARGET_BLEND_DESC RenderTarget[8];
+};
+
+struct ID3D11Buffer;
+struct ID3D11ShaderResourceView;
+struct ID3D11VertexShader;
+struct ID3D11PixelShader;
+struct ID3D11InputLayout;
+
+enum D3D11_PRIMITIVE_TOPOLOGY {
+    D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST = 4
+};
+
+enum DXGI_FORMAT {
+    DXGI_FORMAT_R32_UINT = 42
+};
+
+struct ID3D11Device {
+    virtual HRESULT CreateSamplerState(const D3D11_SAMPLER_DESC* desc, ID3D11SamplerState** state) = 0;
+    virtual HRESULT CreateRasterizerState(const D3D11_RASTERIZER_DESC* desc, ID3D11RasterizerState** state) = 0;
+    virtual HRESULT CreateBlendState(const D3D11_BLEND_DESC* desc, ID3D11BlendState** state) = 0;
+};
+#endif
 
 using namespace DirectX;
 // ==================== КОНСТАНТЫ И МАКРОСЫ ====================
@@ -37,6 +249,7 @@ const int SCREEN_WIDTH = 1280;
 const int SCREEN_HEIGHT = 720;
 const float CAMERA_DISTANCE = 15.0f;
 const float CAMERA_HEIGHT = 10.0f;
+const float LOD_ERROR_PIXELS = 1.0f; // Допустимая ошибка LOD на экране
 
 // Отладочный вывод
 #define DEBUG_LOG(msg) OutputDebugStringA((std::string("[DEBUG] ") + msg + "\n").c_str())
@@ -44,6 +257,9 @@ const float CAMERA_HEIGHT = 10.0f;
 #define DEBUG_ERROR(msg) OutputDebugStringA((std::string("[ERROR] ") + msg + "\n").c_str())
 #define DEBUG_WARNING(msg) OutputDebugStringA((std::string("[WARNING] ") + msg + "\n").c_str())
 #define DEBUG_SUCCESS(msg) OutputDebugStringA((std::string("[SUCCESS] ") + msg + "\n").c_str())
+#define DEBUG_ERROR_W(msg) OutputDebugStringW((std::wstring(L"[ERROR] ") + msg + L"\n").c_str())
+#define DEBUG_WARNING_W(msg) OutputDebugStringW((std::wstring(L"[WARNING] ") + msg + L"\n").c_str())
+#define DEBUG_SUCCESS_W(msg) OutputDebugStringW((std::wstring(L"[SUCCESS] ") + msg + L"\n").c_str())
 // ==================== СИСТЕМА АНИМАЦИИ ====================
 
 // Структура для вершин с анимацией (скиннинг)
@@ -61,6 +277,19 @@ struct AnimatedVertex {
     }
 };
 
+// Влияние костей на вершину - скиннинговая часть AnimatedVertex отдельным потоком,
+// параллельным Mesh::vertices (статические меши его не хранят)
+struct VertexSkin {
+    BYTE boneIndices[4];
+    float boneWeights[4];
+};
+
+// Кость скелета: имя и матрица из пространства меша в пространство кости (inverse bind pose)
+struct Bone {
+    std::string name;
+    XMFLOAT4X4 offset;
+};
+
 // Простая система анимации (без скелета, трансформация всей модели)
 class SimpleAnimator {
 private:
@@ -137,84 +366,80 @@ public:
 class FileSystemHelper {
 public:
     static std::wstring GetExecutableDirectory() {
+#ifdef _WIN32
         wchar_t buffer[MAX_PATH];
         GetModuleFileNameW(nullptr, buffer, MAX_PATH);
         std::wstring exePath = buffer;
+#else
+        std::error_code ec;
+        std::wstring exePath = FromPath(std::filesystem::read_symlink("/proc/self/exe", ec));
+#endif
         size_t pos = exePath.find_last_of(L"\\/");
         return (pos != std::wstring::npos) ? exePath.substr(0, pos + 1) : L".\\";
     }
 
-    // Добавляем этот метод
-    static std::wstring FindFile(const std::wstring& filename) {
-        // Попробуем несколько мест
-        std::vector<std::wstring> searchPaths = {
-            filename,  // Прямой путь
-            GetExecutableDirectory() + filename,  // Рядом с EXE
-            GetExecutableDirectory() + L"..\\" + filename,  // На уровень выше
-            GetExecutableDirectory() + L"..\\..\\" + filename,  // На два уровня выше
-        };
-
-        // Также пробуем разные расширения
-        std::vector<std::wstring> extensions = { L"", L".png", L".bmp", L".obj", L".jpg", L".jpeg", L".mtl", L".fbx" };
-
-        for (const auto& path : searchPaths) {
-            for (const auto& ext : extensions) {
-                std::wstring fullPath = path + ext;
-                if (FileExists(fullPath)) {
-                    DEBUG_LOG_W(L"Найден файл: " + fullPath);
-                    return fullPath;
-                }
-            }
-        }
-
-        DEBUG_LOG_W(L"Файл не найден: " + filename);
-        return L"";
+    // Поиск файла в папках ассетов с типичными расширениями (см. AssetIndex)
+    static std::wstring FindFile(const std::wstring& filename);
+
+    // То же для изображений: сначала без расширения, затем jpg/png/bmp/dds/tga/gif,
+    // дополнительно в textures/assets/images рядом с EXE; регистр не важен
+    static std::wstring FindImageFile(const std::wstring& baseName);
+
+    // std::filesystem::path из wstring и обратно. На POSIX пути - байты UTF-8,
+    // переводим сами: преобразование через локаль бросает исключение на "C"
+    static std::filesystem::path ToPath(const std::wstring& path) {
+#ifdef _WIN32
+        return std::filesystem::path(path);
+#else
+        return std::filesystem::path(WideToUtf8(path));
+#endif
     }
 
-    static std::wstring FindImageFile(const std::wstring& baseName) {
-        std::vector<std::wstring> imageExtensions = {
-            L".jpg", L".jpeg", L".png", L".bmp", L".dds", L".tga", L".gif"
-        };
-
-        std::vector<std::wstring> searchPaths = {
-            baseName,  // Прямой путь
-            GetExecutableDirectory() + baseName,
-            GetExecutableDirectory() + L"textures\\" + baseName,
-            GetExecutableDirectory() + L"assets\\" + baseName,
-            GetExecutableDirectory() + L"images\\" + baseName,
-        };
-
-        // Также пробуем различные регистры
-        std::wstring lowerName = baseName;
-        std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
-        std::wstring upperName = baseName;
-        std::transform(upperName.begin(), upperName.end(), upperName.begin(), ::toupper);
+    static std::wstring FromPath(const std::filesystem::path& path) {
+#ifdef _WIN32
+        return path.wstring();
+#else
+        return Utf8ToWide(path.string());
+#endif
+    }
 
-        searchPaths.push_back(GetExecutableDirectory() + lowerName);
-        searchPaths.push_back(GetExecutableDirectory() + upperName);
+    static std::string ToUtf8(const std::wstring& path) {
+#ifdef _WIN32
+        return std::filesystem::path(path).u8string();
+#else
+        return WideToUtf8(path);
+#endif
+    }
 
-        for (const auto& path : searchPaths) {
-            for (const auto& ext : imageExtensions) {
-                std::wstring fullPath = path + ext;
-                if (FileExists(fullPath)) {
-                    DEBUG_LOG_W(L"Найден файл изображения: " + fullPath);
-                    return fullPath;
-                }
-            }
-        }
+    static std::wstring FromUtf8(const std::string& path) {
+#ifdef _WIN32
+        return std::filesystem::u8path(path).wstring();
+#else
+        return Utf8ToWide(path);
+#endif
+    }
 
-        DEBUG_LOG_W(L"Файл изображения не найден: " + baseName);
-        return L"";
+    // Расширение с точкой в нижнем регистре: L".obj"
+    static std::wstring GetLowerExtension(const std::wstring& path) {
+        std::wstring extension = FromPath(ToPath(path).extension());
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::towlower);
+        return extension;
     }
 
     static bool FileExists(const std::wstring& path) {
+#ifdef _WIN32
         DWORD attrs = GetFileAttributesW(path.c_str());
         return (attrs != INVALID_FILE_ATTRIBUTES && !(attrs & FILE_ATTRIBUTE_DIRECTORY));
+#else
+        std::error_code ec;
+        return std::filesystem::is_regular_file(ToPath(path), ec);
+#endif
     }
 
     static void ListFilesInDirectory(const std::wstring& directory) {
         DEBUG_LOG_W(L"Содержимое директории: " + directory);
 
+#ifdef _WIN32
         WIN32_FIND_DATAW findData;
         HANDLE hFind = FindFirstFileW((directory + L"*").c_str(), &findData);
 
@@ -226,617 +451,10043 @@ public:
             } while (FindNextFileW(hFind, &findData));
             FindClose(hFind);
         }
+#else
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(ToPath(directory), ec)) {
+            if (entry.is_regular_file(ec)) {
+                DEBUG_LOG_W(L"  " + FromPath(entry.path().filename()));
+            }
+        }
+#endif
     }
 };
 
-// ==================== СТРУКТУРЫ ДАННЫХ ====================
-struct Vertex {
-    XMFLOAT3 position;
-    XMFLOAT3 normal;
-    XMFLOAT2 texcoord;
-    XMFLOAT3 color;
+// ==================== КАТАЛОГ АССЕТОВ ====================
+// Поиск файлов в корнях ассетов по спискам папок: корни читаются при построении (Rebuild),
+// вложенные папки - целиком при первом обращении к ним, без обхода вглубь. Дальше каждая
+// комбинация "корень x расширение" - поиск в хэш-таблице, а не системный вызов. Ключ -
+// путь в нижнем регистре с '/'. Результаты поиска запоминаются, промахи тоже. Прочитанные
+// папки отслеживает FileWatcher: Update раз в кадр перечитывает изменившиеся и сбрасывает
+// запомненное, поэтому файлы, появившиеся во время работы (новые картинки, перезагрузка),
+// находятся без обращений к диску на каждый промах.
+class FileWatcher;
+
+class AssetIndex {
+public:
+    enum RootKind : uint8_t {
+        ROOT_GENERAL = 0, // Рабочая папка, папка EXE и две папки выше
+        ROOT_IMAGES = 1   // textures/assets/images рядом с EXE - только для изображений
+    };
 
-    Vertex() : position(0, 0, 0), normal(0, 1, 0), texcoord(0, 0), color(1, 1, 1) {}
-    Vertex(float px, float py, float pz, float nx, float ny, float nz, float u, float v, float r, float g, float b)
-        : position(px, py, pz), normal(nx, ny, nz), texcoord(u, v), color(r, g, b) {
+    // Папка с большим числом записей в память не берётся - в ней ищем прямыми проверками
+    static constexpr size_t MAX_DIRECTORY_ENTRIES = 200000;
+
+    // Первый найденный файл name + ext (расширения по порядку, корни по приоритету)
+    static std::wstring Find(const std::wstring& name, const std::vector<std::wstring>& extensions,
+        bool includeImageRoots) {
+
+        std::lock_guard<std::mutex> lock(GetMutex());
+        State& state = GetState();
+        if (!state.built) BuildLocked(state);
+
+        std::wstring key = NormalizeKey(name);
+        std::wstring lookupKey = (includeImageRoots ? L"i:" : L"g:") + key;
+        for (const auto& ext : extensions) lookupKey += L"|" + ext;
+        auto cached = state.lookups.find(lookupKey);
+        if (cached != state.lookups.end()) return cached->second;
+
+        std::wstring result;
+        bool indexable = IsIndexable(key);
+        if (indexable) {
+            result = FindInRoots(state, name, key, extensions, includeImageRoots);
+        }
+        else {
+            // Абсолютный путь или выход из корня через ".." - проверяем напрямую
+            for (const auto& ext : extensions) {
+                if (FileSystemHelper::FileExists(name + ext)) {
+                    result = name + ext;
+                    break;
+                }
+            }
+        }
+
+        // Промахи в корнях снимают Update и Invalidate. Папки вне корней не отслеживаются -
+        // для них запоминаются только найденные файлы
+        if (indexable || !result.empty()) state.lookups.emplace(lookupKey, result);
+        return result;
     }
-};
 
-struct Texture2D {
-    ID3D11Texture2D* texture = nullptr;
-    ID3D11ShaderResourceView* srv = nullptr;
-    ID3D11SamplerState* samplerState = nullptr;
-    std::wstring filename;
-    int width = 0;
-    int height = 0;
+    // Строит каталог заново: корни перечитываются сразу, вложенные папки - при поиске,
+    // запомненные результаты сбрасываются
+    static void Rebuild() {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        BuildLocked(GetState());
+    }
 
-    bool LoadFromFile(ID3D11Device* device, const wchar_t* filename);
-    bool CreateDebugTexture(ID3D11Device* device, const wchar_t* name);
-    bool CreateColorTexture(ID3D11Device* device, const wchar_t* name, float r, float g, float b);
-    void Cleanup();
-};
+    // Файл или папка path появились, исчезли или переименованы: списки папки, её родителя
+    // и вложенных папок перечитаются при следующем поиске
+    static void Invalidate(const std::wstring& path) {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        InvalidateLocked(GetState(), path);
+    }
 
-struct Mesh {
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
-    std::string materialName;  // Изменено с textureName на materialName
-    int textureIndex = -1;
-};
+    // Раз в кадр: изменения в прочитанных папках от FileWatcher (см. после FileWatcher)
+    static void Update();
 
-// Структура для материала из MTL
-struct Material {
-    std::string name;
-    XMFLOAT3 ambient;
-    XMFLOAT3 diffuse;
-    XMFLOAT3 specular;
-    float shininess;
-    float alpha;
-    std::string textureFilename;
+    // Запомненные результаты поиска, вместе с промахами
+    static size_t GetLookupCount() {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        return GetState().lookups.size();
+    }
 
-    Material() : ambient(0.2f, 0.2f, 0.2f), diffuse(0.8f, 0.8f, 0.8f),
-        specular(1.0f, 1.0f, 1.0f), shininess(20.0f), alpha(1.0f) {
+    // Файлы, которых нет на диске (записи пакета): directory - папка пакета
+    // с разделителем в конце, names - пути относительно неё через '/'
+    static void AddVirtualFiles(const std::wstring& directory, const std::vector<std::wstring>& names) {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        State& state = GetState();
+        state.virtualDirectories.push_back({ directory, AbsoluteKey(directory), names });
+        state.built = false;
     }
-};
 
-// ==================== КЛАСС ЗАГРУЗКИ OBJ И MTL ====================
-class OBJLoader {
-public:
-    static bool Load(const std::wstring& filename, std::vector<Mesh>& meshes, std::map<std::string, Material>& materials) {
-        DEBUG_LOG_W(L"Загрузка OBJ файла: " + filename);
+    static void ClearVirtualFiles() {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        State& state = GetState();
+        state.virtualDirectories.clear();
+        state.built = false;
+    }
 
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            DEBUG_LOG_W(L"Не удалось открыть файл: " + filename);
+private:
+    struct Directory {
+        std::wstring path;     // С разделителем в конце; пусто - рабочая папка
+        std::wstring key;      // Абсолютный путь в виде ключа (см. AbsoluteKey)
+        bool exists = false;
+        bool complete = false; // false - записей больше MAX_DIRECTORY_ENTRIES, списков нет
+        std::unordered_map<std::wstring, std::wstring> files;       // Имя в нижнем регистре -> полный путь
+        std::unordered_map<std::wstring, std::wstring> directories; // Имя -> путь с разделителем
+    };
 
-            // Создаем простую кубическую модель как запасной вариант
-            CreateSimpleCubeModel(meshes);
-            return true;
-        }
+    struct Root {
+        std::wstring path; // С разделителем в конце; пусто - рабочая папка
+        RootKind kind = ROOT_GENERAL;
+        std::unordered_map<std::wstring, std::wstring> virtualFiles; // Ключ -> путь в пакете
+        std::unordered_map<std::wstring, Directory> directories;     // "" или "a/b/" -> список
+    };
 
-        std::vector<XMFLOAT3> positions;
-        std::vector<XMFLOAT3> normals;
-        std::vector<XMFLOAT2> texcoords;
-        std::vector<std::string> mtlFiles;
+    struct VirtualDirectory {
+        std::wstring path;
+        std::wstring key;                // Абсолютный путь в виде ключа, без '/' в конце
+        std::vector<std::wstring> names;
+    };
 
-        Mesh currentMesh;
-        std::string currentMaterial;
-        std::string currentMtlFile;
+    struct State {
+        bool built = false;
+        std::vector<Root> roots;
+        std::vector<VirtualDirectory> virtualDirectories;
+        std::unordered_map<std::wstring, std::wstring> lookups; // Запрос -> найденный путь
+    };
 
-        std::string line;
-        int lineNum = 0;
-        while (std::getline(file, line)) {
-            lineNum++;
-            std::istringstream iss(line);
-            std::string prefix;
-            iss >> prefix;
+#ifdef _WIN32
+    static constexpr const wchar_t* SEPARATOR = L"\\";
+#else
+    static constexpr const wchar_t* SEPARATOR = L"/";
+#endif
 
-            if (prefix == "v") { // Вершина
-                XMFLOAT3 pos;
-                iss >> pos.x >> pos.y >> pos.z;
-                positions.push_back(pos);
-            }
-            else if (prefix == "vn") { // Нормаль
-                XMFLOAT3 norm;
-                iss >> norm.x >> norm.y >> norm.z;
-                normals.push_back(norm);
-            }
-            else if (prefix == "vt") { // Текстурные координаты
-                XMFLOAT2 tex;
-                iss >> tex.x >> tex.y;
-                tex.y = 1.0f - tex.y; // Flip Y для DirectX
-                texcoords.push_back(tex);
-            }
-            else if (prefix == "f") { // Грань (поддержка треугольников, квадов и n-угольников)
-                std::vector<std::string> faceVerts;
-                std::string vert;
+    static std::mutex& GetMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
 
-                // Считываем ВСЕ вершины грани
-                while (iss >> vert) {
-                    faceVerts.push_back(vert);
-                }
+    static State& GetState() {
+        static State state;
+        return state;
+    }
 
-                // Минимум 3 вершины — иначе это не грань
-                if (faceVerts.size() < 3)
-                    continue;
+    // Слежение за прочитанными папками через FileWatcher (см. после него)
+    static FileWatcher& GetWatcher();
+    static bool WatchFolder(const std::wstring& path);
+    static void ClearWatches();
 
-                // Fan triangulation:
-                // (0, i, i+1)
-                for (size_t i = 1; i + 1 < faceVerts.size(); ++i) {
-                    ProcessFace(
-                        faceVerts[0],
-                        positions,
-                        normals,
-                        texcoords,
-                        currentMesh,
-                        currentMaterial,
-                        materials
-                    );
-
-                    ProcessFace(
-                        faceVerts[i],
-                        positions,
-                        normals,
-                        texcoords,
-                        currentMesh,
-                        currentMaterial,
-                        materials
-                    );
-
-                    ProcessFace(
-                        faceVerts[i + 1],
-                        positions,
-                        normals,
-                        texcoords,
-                        currentMesh,
-                        currentMaterial,
-                        materials
-                    );
-                }
-            }
-
-            else if (prefix == "usemtl") { // Материал
-                if (!currentMesh.vertices.empty()) {
-                    currentMesh.materialName = currentMaterial;
-                    meshes.push_back(currentMesh);
-                    currentMesh = Mesh();
-                }
-                iss >> currentMaterial;
+    static std::wstring NormalizeKey(const std::wstring& name) {
+        std::wstring key = name;
+        for (auto& c : key) {
+            c = (c == L'\\') ? L'/' : (wchar_t)towlower(c);
+        }
+        while (key.size() >= 2 && key[0] == L'.' && key[1] == L'/') key.erase(0, 2);
+        return key;
+    }
 
-                char buffer[256];
-                sprintf_s(buffer, "Строка %d: Используется материал: %s", lineNum, currentMaterial.c_str());
-                DEBUG_LOG(buffer);
-            }
-            else if (prefix == "mtllib") { // Файл материалов
-                std::string mtlFile;
-                iss >> mtlFile;
-                mtlFiles.push_back(mtlFile);
+    static bool IsIndexable(const std::wstring& key) {
+        if (key.empty() || key[0] == L'/') return false;
+        if (key.size() >= 2 && key[1] == L':') return false; // C:/...
+        return key != L".." && key.compare(0, 3, L"../") != 0 && key.find(L"/../") == std::wstring::npos;
+    }
+
+    static std::wstring AbsoluteKey(const std::wstring& path) {
+        std::error_code ec;
+        std::filesystem::path absolute = std::filesystem::absolute(
+            FileSystemHelper::ToPath(path.empty() ? L"." : path), ec);
+        std::wstring key = NormalizeKey(FileSystemHelper::FromPath(absolute.lexically_normal()));
+        while (!key.empty() && key.back() == L'/') key.pop_back();
+        return key;
+    }
 
-                // Получаем путь к MTL файлу
-                std::wstring objPath = filename;
-                size_t lastSlash = objPath.find_last_of(L"\\/");
-                std::wstring basePath = (lastSlash != std::wstring::npos) ?
-                    objPath.substr(0, lastSlash + 1) : L"";
+    static std::wstring FindInRoots(State& state, const std::wstring& name, const std::wstring& key,
+        const std::vector<std::wstring>& extensions, bool includeImageRoots) {
 
-                std::wstring mtlPath = basePath + std::wstring(mtlFile.begin(), mtlFile.end());
+        size_t slash = key.rfind(L'/');
+        std::wstring directoryKey = (slash == std::wstring::npos) ? L"" : key.substr(0, slash + 1);
+        std::wstring fileKey = key.substr(directoryKey.size());
 
-                // Загружаем материалы из MTL файла
-                if (LoadMTL(mtlPath, materials)) {
-                    DEBUG_LOG("MTL файл успешно загружен");
+        for (Root& root : state.roots) {
+            if (root.kind == ROOT_IMAGES && !includeImageRoots) continue;
+            const Directory* directory = GetDirectory(root, directoryKey);
+            for (const auto& ext : extensions) {
+                std::wstring extKey = NormalizeKey(ext);
+                auto packed = root.virtualFiles.find(key + extKey);
+                if (packed != root.virtualFiles.end()) return packed->second;
+                if (!directory) continue;
+
+                if (directory->complete) {
+                    auto it = directory->files.find(fileKey + extKey);
+                    if (it != directory->files.end()) return it->second;
                 }
-                else {
-                    DEBUG_WARNING("Не удалось загрузить MTL файл");
+                else if (FileSystemHelper::FileExists(root.path + name + ext)) {
+                    return root.path + name + ext;
                 }
             }
         }
+        return L"";
+    }
 
-        // Добавляем последний меш
-        if (!currentMesh.vertices.empty()) {
-            currentMesh.materialName = currentMaterial;
-            meshes.push_back(currentMesh);
+    // Список папки directoryKey внутри корня; nullptr - папки нет. Если папка на пути
+    // не уместилась в список, возвращается она (complete = false) - дальше только
+    // прямые проверки.
+    static const Directory* GetDirectory(Root& root, const std::wstring& directoryKey) {
+        std::wstring path = root.path;
+        if (!directoryKey.empty()) {
+            // Настоящее имя папки (с регистром) - из списка родительской
+            size_t slash = directoryKey.rfind(L'/', directoryKey.size() - 2);
+            std::wstring parentKey = (slash == std::wstring::npos) ? L"" : directoryKey.substr(0, slash + 1);
+            const Directory* parent = GetDirectory(root, parentKey);
+            if (!parent || !parent->complete) return parent;
+
+            std::wstring childName = directoryKey.substr(parentKey.size(), directoryKey.size() - parentKey.size() - 1);
+            auto child = parent->directories.find(childName);
+            if (child == parent->directories.end()) return nullptr;
+            path = child->second;
         }
 
-        file.close();
-
-        if (meshes.empty()) {
-            CreateSimpleCubeModel(meshes);
+        auto it = root.directories.find(directoryKey);
+        if (it == root.directories.end()) {
+            Directory& directory = root.directories[directoryKey];
+            ListDirectory(path, directory);
+            return directory.exists ? &directory : nullptr;
         }
-
-        char buffer[256];
-        sprintf_s(buffer, "OBJ загружен: %zu мешей, %zu вершин в первом меше, %zu материалов",
-            meshes.size(), meshes.empty() ? (size_t)0 : meshes[0].vertices.size(),
-            materials.size());
-        DEBUG_LOG(buffer);
-
-        return !meshes.empty();
+        return it->second.exists ? &it->second : nullptr;
     }
 
-    static bool LoadMTL(const std::wstring& filename, std::map<std::string, Material>& materials) {
-        DEBUG_LOG_W(L"Загрузка MTL файла: " + filename);
+    static void ListDirectory(const std::wstring& path, Directory& directory) {
+        directory.path = path;
+        directory.key = AbsoluteKey(path);
+        directory.files.clear();
+        directory.directories.clear();
+        directory.complete = true;
+
+        // Слежение - до чтения: изменения во время чтения сообщит следующий Update
+        directory.exists = WatchFolder(path);
+        if (!directory.exists) return;
+
+        size_t entryCount = 0;
+        auto addEntry = [&](const std::wstring& name, bool isDirectory) {
+            if (name.empty() || name[0] == L'.') return; // ".", "..", .git, .vs
+            if (++entryCount > MAX_DIRECTORY_ENTRIES) {
+                directory.complete = false;
+                return;
+            }
+            // Первое вхождение выигрывает, как и при переборе путей
+            if (isDirectory) {
+                directory.directories.emplace(NormalizeKey(name), path + name + SEPARATOR);
+            }
+            else {
+                directory.files.emplace(NormalizeKey(name), path + name);
+            }
+        };
 
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            DEBUG_LOG_W(L"Не удалось открыть MTL файл: " + filename);
-            return false;
+#ifdef _WIN32
+        WIN32_FIND_DATAW findData;
+        HANDLE find = FindFirstFileExW((path + L"*").c_str(), FindExInfoBasic, &findData,
+            FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+        if (find == INVALID_HANDLE_VALUE) {
+            directory.exists = false;
+            return;
         }
-
-        Material currentMaterial;
-        std::string line;
-
-        while (std::getline(file, line)) {
-            std::istringstream iss(line);
-            std::string prefix;
-            iss >> prefix;
-
-            if (prefix == "newmtl") { // Новый материал
-                if (!currentMaterial.name.empty()) {
-                    materials[currentMaterial.name] = currentMaterial;
-                }
-                iss >> currentMaterial.name;
-                currentMaterial = Material(); // Сброс значений по умолчанию
-                currentMaterial.name = currentMaterial.name;
-
-                DEBUG_LOG("Найден материал: " + currentMaterial.name);
+        do {
+            addEntry(findData.cFileName, (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+        } while (directory.complete && FindNextFileW(find, &findData));
+        FindClose(find);
+#else
+        DIR* dir = opendir(path.empty() ? "." : WideToUtf8(path).c_str());
+        if (!dir) {
+            directory.exists = false;
+            return;
+        }
+        while (directory.complete) {
+            dirent* entry = readdir(dir);
+            if (!entry) break;
+            bool isDirectory = entry->d_type == DT_DIR;
+            bool isFile = entry->d_type == DT_REG;
+            if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                struct stat entryStat;
+                if (fstatat(dirfd(dir), entry->d_name, &entryStat, 0) != 0) continue;
+                isDirectory = S_ISDIR(entryStat.st_mode);
+                isFile = S_ISREG(entryStat.st_mode);
             }
-            else if (prefix == "Ka") { // Ambient color
-                iss >> currentMaterial.ambient.x >> currentMaterial.ambient.y >> currentMaterial.ambient.z;
+            if (isDirectory || isFile) {
+                addEntry(Utf8ToWide(entry->d_name), isDirectory);
             }
-            else if (prefix == "Kd") { // Diffuse color
-                iss >> currentMaterial.diffuse.x >> currentMaterial.diffuse.y >> currentMaterial.diffuse.z;
+        }
+        closedir(dir);
+#endif
 
-                char buffer[256];
-                sprintf_s(buffer, "  Цвет материала %s: (%.3f, %.3f, %.3f)",
-                    currentMaterial.name.c_str(),
-                    currentMaterial.diffuse.x,
-                    currentMaterial.diffuse.y,
-                    currentMaterial.diffuse.z);
-                DEBUG_LOG(buffer);
+        if (!directory.complete) {
+            directory.files.clear();
+            directory.directories.clear();
+            char buffer[256];
+            sprintf_s(buffer, "Каталог ассетов: в папке больше %zu записей, поиск в ней - прямыми проверками",
+                MAX_DIRECTORY_ENTRIES);
+            DEBUG_ERROR(buffer);
+            DEBUG_ERROR_W(L"  " + (path.empty() ? std::wstring(L".") : path));
+        }
+    }
+
+    // Виртуальные файлы, попадающие в корень: папка пакета внутри корня или корень
+    // внутри папки пакета. Проверяются раньше файлов на диске.
+    static void AddVirtualEntries(const State& state, Root& root) {
+        if (state.virtualDirectories.empty()) return;
+
+        std::wstring rootKey = AbsoluteKey(root.path);
+        for (auto it = state.virtualDirectories.rbegin(); it != state.virtualDirectories.rend(); ++it) {
+            const VirtualDirectory& directory = *it;
+            std::wstring prefix; // Папка пакета относительно корня
+            std::wstring strip;  // Корень относительно папки пакета
+            if (directory.key == rootKey) {
             }
-            else if (prefix == "Ks") { // Specular color
-                iss >> currentMaterial.specular.x >> currentMaterial.specular.y >> currentMaterial.specular.z;
+            else if (directory.key.compare(0, rootKey.size() + 1, rootKey + L"/") == 0) {
+                prefix = directory.key.substr(rootKey.size() + 1) + L"/";
             }
-            else if (prefix == "Ns") { // Shininess
-                iss >> currentMaterial.shininess;
+            else if (rootKey.compare(0, directory.key.size() + 1, directory.key + L"/") == 0) {
+                strip = rootKey.substr(directory.key.size() + 1) + L"/";
             }
-            else if (prefix == "d" || prefix == "Tr") { // Alpha (transparency)
-                iss >> currentMaterial.alpha;
+            else {
+                continue;
             }
-            else if (prefix == "map_Kd") { // Texture
-                iss >> currentMaterial.textureFilename;
+
+            for (const auto& name : directory.names) {
+                std::wstring key = NormalizeKey(name);
+                if (key.compare(0, strip.size(), strip) != 0) continue;
+
+                std::wstring path = directory.path + name;
+                std::replace(path.begin() + directory.path.size(), path.end(), L'/', SEPARATOR[0]);
+                root.virtualFiles.emplace(prefix + key.substr(strip.size()), path);
             }
         }
+    }
 
-        // Добавляем последний материал
-        if (!currentMaterial.name.empty()) {
-            materials[currentMaterial.name] = currentMaterial;
+    static void InvalidateLocked(State& state, const std::wstring& path) {
+        std::wstring key = AbsoluteKey(path);
+        size_t slash = key.rfind(L'/');
+        std::wstring parentKey = (slash == std::wstring::npos) ? L"" : key.substr(0, slash);
+        for (Root& root : state.roots) {
+            for (auto it = root.directories.begin(); it != root.directories.end();) {
+                const std::wstring& listed = it->second.key;
+                bool stale = listed == key || listed == parentKey || listed.compare(0, key.size() + 1, key + L"/") == 0;
+                it = stale ? root.directories.erase(it) : std::next(it);
+            }
         }
+        state.lookups.clear();
+    }
+
+    // Корни и файлы пакетов; вложенные папки на диске читаются по мере поиска
+    static void BuildLocked(State& state) {
+        std::wstring exeDir = FileSystemHelper::GetExecutableDirectory();
+        std::wstring up = std::wstring(L"..") + SEPARATOR;
+        std::vector<std::pair<std::wstring, RootKind>> rootPaths = {
+            { L"", ROOT_GENERAL },
+            { exeDir, ROOT_GENERAL },
+            { exeDir + L"textures" + SEPARATOR, ROOT_IMAGES },
+            { exeDir + L"assets" + SEPARATOR, ROOT_IMAGES },
+            { exeDir + L"images" + SEPARATOR, ROOT_IMAGES },
+            { exeDir + up, ROOT_GENERAL },
+            { exeDir + up + up, ROOT_GENERAL },
+        };
 
-        file.close();
+        state.roots.clear();
+        state.lookups.clear();
+        ClearWatches();
+        size_t virtualCount = 0;
+        size_t fileCount = 0;
+        for (const auto& rootPath : rootPaths) {
+            Root root;
+            root.path = rootPath.first;
+            root.kind = rootPath.second;
+            AddVirtualEntries(state, root);
+            virtualCount += root.virtualFiles.size();
+            state.roots.push_back(std::move(root));
+
+            const Directory* directory = GetDirectory(state.roots.back(), L"");
+            if (directory) fileCount += directory->files.size();
+        }
+        state.built = true;
 
         char buffer[256];
-        sprintf_s(buffer, "Загружено материалов: %zu", materials.size());
+        sprintf_s(buffer, "Каталог ассетов: %zu корней, файлов в корнях %zu, из пакетов %zu",
+            state.roots.size(), fileCount, virtualCount);
         DEBUG_LOG(buffer);
-
-        return !materials.empty();
     }
+};
 
-private:
-    static void ProcessFace(const std::string& faceStr,
-        const std::vector<XMFLOAT3>& positions,
-        const std::vector<XMFLOAT3>& normals,
-        const std::vector<XMFLOAT2>& texcoords,
-        Mesh& mesh,
-        const std::string& currentMaterial,
-        const std::map<std::string, Material>& materials) {
-
-        std::istringstream fss(faceStr);
-        std::string token;
-        int indices[3] = { -1, -1, -1 };
-        int idx = 0;
+// Поиск через каталог ассетов: одна проверка по хэшу на корень вместо обращений к диску
+inline std::wstring FileSystemHelper::FindFile(const std::wstring& filename) {
+    static const std::vector<std::wstring> extensions = {
+        L"", L".png", L".bmp", L".obj", L".jpg", L".jpeg", L".mtl", L".fbx"
+    };
 
-        while (std::getline(fss, token, '/') && idx < 3) {
-            if (!token.empty()) {
-                indices[idx] = std::stoi(token) - 1; // OBJ индексы начинаются с 1
-            }
-            idx++;
-        }
+    std::wstring fullPath = AssetIndex::Find(filename, extensions, false);
+    if (!fullPath.empty()) {
+        DEBUG_LOG_W(L"Найден файл: " + fullPath);
+    }
+    else {
+        DEBUG_LOG_W(L"Файл не найден: " + filename);
+    }
+    return fullPath;
+}
 
-        Vertex vertex;
+inline std::wstring FileSystemHelper::FindImageFile(const std::wstring& baseName) {
+    static const std::vector<std::wstring> imageExtensions = {
+        L"", L".jpg", L".jpeg", L".png", L".bmp", L".dds", L".tga", L".gif"
+    };
 
-        // Позиция
-        if (indices[0] >= 0 && indices[0] < (int)positions.size()) {
-            vertex.position = positions[indices[0]];
-        }
-        else {
-            vertex.position = XMFLOAT3(0, 0, 0);
-        }
+    std::wstring fullPath = AssetIndex::Find(baseName, imageExtensions, true);
+    if (!fullPath.empty()) {
+        DEBUG_LOG_W(L"Найден файл изображения: " + fullPath);
+    }
+    else {
+        DEBUG_LOG_W(L"Файл изображения не найден: " + baseName);
+    }
+    return fullPath;
+}
 
-        // Текстурные координаты
-        if (indices[1] >= 0 && indices[1] < (int)texcoords.size()) {
-            vertex.texcoord = texcoords[indices[1]];
+// ==================== ОТОБРАЖЕНИЕ ФАЙЛОВ В ПАМЯТЬ ====================
+// Файл, отображённый в адресное пространство только для чтения.
+// Содержимое читается напрямую из страничного кэша ОС, без копирования.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::wstring& path) {
+        Close();
+
+#ifdef _WIN32
+        fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            return false;
         }
-        else {
-            vertex.texcoord = XMFLOAT2(0, 0);
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize)) {
+            Close();
+            return false;
         }
+        size = (size_t)fileSize.QuadPart;
 
-        // Нормаль
-        if (indices[2] >= 0 && indices[2] < (int)normals.size()) {
-            vertex.normal = normals[indices[2]];
+        // Пустой файл нельзя отобразить - считаем его открытым, но без данных
+        if (size > 0) {
+            mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!mappingHandle) {
+                Close();
+                return false;
+            }
+
+            data = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+            if (!data) {
+                Close();
+                return false;
+            }
         }
-        else {
-            // Вычисляем нормаль по умолчанию
-            vertex.normal = XMFLOAT3(0, 1, 0);
+#else
+        fileDescriptor = open(WideToUtf8(path).c_str(), O_RDONLY);
+        if (fileDescriptor < 0) {
+            return false;
         }
 
-        // Цвет из материала
-        if (!currentMaterial.empty() && materials.find(currentMaterial) != materials.end()) {
-            const Material& mat = materials.at(currentMaterial);
-            vertex.color = mat.diffuse; // Используем диффузный цвет
+        struct stat fileStat;
+        if (fstat(fileDescriptor, &fileStat) != 0) {
+            Close();
+            return false;
+        }
+        size = (size_t)fileStat.st_size;
 
-            // Отладочный вывод для первых вершин
-            static int debugVertexCount = 0;
-            if (debugVertexCount < 10) {
-                char buffer[256];
-                sprintf_s(buffer, "Вершина %d: материал '%s', цвет (%.3f, %.3f, %.3f)",
-                    debugVertexCount, currentMaterial.c_str(),
-                    vertex.color.x, vertex.color.y, vertex.color.z);
-                DEBUG_LOG(buffer);
-                debugVertexCount++;
+        if (size > 0) {
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+            if (mapped == MAP_FAILED) {
+                Close();
+                return false;
             }
+            madvise(mapped, size, MADV_SEQUENTIAL);
+            data = (const char*)mapped;
         }
-        else {
-            // Дефолтный цвет (белый)
-            vertex.color = XMFLOAT3(1, 1, 1);
-        }
+#endif
 
-        mesh.vertices.push_back(vertex);
-        mesh.indices.push_back((uint32_t)mesh.indices.size());
+        isOpen = true;
+        return true;
     }
 
-    static void CreateSimpleCubeModel(std::vector<Mesh>& meshes) {
-        DEBUG_LOG("Создание простой кубической модели...");
+    void Close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap((void*)data, size);
+        if (fileDescriptor >= 0) close(fileDescriptor);
+        fileDescriptor = -1;
+#endif
+        data = nullptr;
+        size = 0;
+        isOpen = false;
+    }
 
-        Mesh cubeMesh;
+    const char* Data() const { return data; }
+    size_t Size() const { return size; }
+    bool IsOpen() const { return isOpen; }
+
+    // Просит ОС заранее подкачать диапазон - чтение идёт крупными запросами,
+    // а не по странице на каждый промах
+    void Prefetch(size_t offset, size_t length) const {
+        if (!data || offset >= size || length == 0) return;
+        length = std::min(length, size - offset);
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY range;
+        range.VirtualAddress = (PVOID)(data + offset);
+        range.NumberOfBytes = length;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t alignedOffset = offset / pageSize * pageSize;
+        madvise((void*)(data + alignedOffset), length + (offset - alignedOffset), MADV_WILLNEED);
+#endif
+    }
 
-        // Вершины куба (8 вершин)
-        Vertex vertices[] = {
-            // Передняя грань
-            Vertex(-1.0f, -1.0f, -1.0f, 0, 0, -1, 0, 1, 1, 0, 0),
-            Vertex(1.0f, -1.0f, -1.0f, 0, 0, -1, 1, 1, 0, 1, 0),
-            Vertex(1.0f,  1.0f, -1.0f, 0, 0, -1, 1, 0, 0, 0, 1),
-            Vertex(-1.0f,  1.0f, -1.0f, 0, 0, -1, 0, 0, 1, 1, 0),
+private:
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+    const char* data = nullptr;
+    size_t size = 0;
+    bool isOpen = false;
+};
 
-            // Задняя грань
-            Vertex(-1.0f, -1.0f,  1.0f, 0, 0, 1, 1, 1, 1, 0, 0),
-            Vertex(1.0f, -1.0f,  1.0f, 0, 0, 1, 0, 1, 0, 1, 0),
-            Vertex(1.0f,  1.0f,  1.0f, 0, 0, 1, 0, 0, 0, 0, 1),
-            Vertex(-1.0f,  1.0f,  1.0f, 0, 0, 1, 1, 0, 1, 1, 0),
-        };
+// Построчный разбор текста на месте: строки и токены - это string_view
+// внутри исходного буфера, числа разбираются через std::from_chars.
+class TextScanner {
+public:
+    TextScanner(const char* data, size_t size)
+        : current(data), end(data + size) {
+    }
 
-        // Индексы куба (12 треугольников)
-        uint32_t indices[] = {
-            // Передняя грань
-            0, 1, 2, 2, 3, 0,
-            // Задняя грань
-            4, 5, 6, 6, 7, 4,
-            // Верхняя грань
-            3, 2, 6, 6, 7, 3,
-            // Нижняя грань
-            0, 1, 5, 5, 4, 0,
-            // Левая грань
-            0, 3, 7, 7, 4, 0,
-            // Правая грань
-            1, 2, 6, 6, 5, 1
-        };
+    // Возвращает следующую строку без символов перевода строки
+    bool NextLine(std::string_view& line) {
+        if (current >= end) return false;
 
-        cubeMesh.vertices.assign(vertices, vertices + 8);
-        cubeMesh.indices.assign(indices, indices + 36);
-        cubeMesh.materialName = "default";
+        const char* lineEnd = (const char*)memchr(current, '\n', end - current);
+        if (!lineEnd) lineEnd = end;
 
-        meshes.push_back(cubeMesh);
-        DEBUG_LOG("Простая кубическая модель создана");
+        line = std::string_view(current, lineEnd - current);
+        current = (lineEnd < end) ? lineEnd + 1 : end;
+        return true;
     }
-};
-
-// ==================== ТЕКСТУРНЫЙ МЕНЕДЖЕР ====================
-class TextureManager {
-private:
-    std::map<std::wstring, Texture2D> textures;
-    ID3D11Device* device = nullptr;
 
-public:
-    void Initialize(ID3D11Device* dev) {
-        device = dev;
+    static bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
     }
 
-    int LoadTexture(const std::wstring& filename) {
-        // Ищем файл
-        std::wstring foundPath = FileSystemHelper::FindFile(filename);
-        if (foundPath.empty()) {
-            DEBUG_WARNING("Не удалось найти текстуру, создаю дебажную");
-            return CreateDebugTexture(filename);
-        }
+    // Отрезает от строки следующий токен, разделённый пробелами
+    static std::string_view NextToken(std::string_view& text) {
+        size_t pos = 0;
+        while (pos < text.size() && IsSpace(text[pos])) pos++;
 
-        // Проверяем, не загружена ли уже эта текстура
-        auto it = textures.find(foundPath);
-        if (it != textures.end()) {
-            return (int)std::distance(textures.begin(), it);
-        }
+        size_t start = pos;
+        while (pos < text.size() && !IsSpace(text[pos])) pos++;
 
-        // Загружаем новую текстуру
-        Texture2D texture;
-        if (texture.LoadFromFile(device, foundPath.c_str())) {
-            textures[foundPath] = texture;
-            DEBUG_LOG_W(L"Текстура загружена: " + foundPath);
-            return (int)textures.size() - 1;
-        }
-        else {
-            return CreateDebugTexture(filename);
-        }
+        std::string_view token = text.substr(start, pos - start);
+        text.remove_prefix(pos);
+        return token;
     }
 
-    int CreateDebugTexture(const std::wstring& name) {
-        Texture2D texture;
-        if (texture.CreateDebugTexture(device, name.c_str())) {
-            std::wstring debugName = L"[DEBUG]" + name;
-            textures[debugName] = texture;
-            DEBUG_LOG_W(L"Создана дебажная текстура: " + name);
-            return (int)textures.size() - 1;
+    // Как operator>> у потока: при ошибке значение обнуляется
+    static bool ParseFloat(std::string_view& text, float& value) {
+        std::string_view token = NextToken(text);
+        if (token.size() > 1 && token[0] == '+' && token[1] != '-') token.remove_prefix(1);
+
+        auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+        if (token.empty() || result.ec != std::errc()) {
+            value = 0.0f;
+            return false;
         }
-        return -1;
+        return true;
     }
 
-    int CreateColorTexture(const std::wstring& name, float r, float g, float b) {
-        Texture2D texture;
-        if (texture.CreateColorTexture(device, name.c_str(), r, g, b)) {
-            std::wstring colorName = L"[COLOR]" + name;
-            textures[colorName] = texture;
-
-            char buffer[256];
-            sprintf_s(buffer, "Создана цветная текстура %s: (%.3f, %.3f, %.3f)",
-                std::string(name.begin(), name.end()).c_str(), r, g, b);
-            DEBUG_LOG(buffer);
+    static bool ParseInt(std::string_view token, int& value) {
+        if (token.size() > 1 && token[0] == '+' && token[1] != '-') token.remove_prefix(1);
 
-            return (int)textures.size() - 1;
-        }
-        return -1;
+        auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+        return !token.empty() && result.ec == std::errc();
     }
 
-    Texture2D* GetTexture(int index) {
-        if (index < 0 || index >= (int)textures.size()) return nullptr;
+private:
+    const char* current;
+    const char* end;
+};
+
+// ==================== ПАРАЛЛЕЛЬНЫЕ ЗАДАЧИ ====================
+// Число рабочих потоков: 0 - по числу ядер
+inline unsigned GetWorkerThreadCount(unsigned requested) {
+    if (requested > 0) return requested;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
 
-        auto it = textures.begin();
-        std::advance(it, index);
-        return &it->second;
+// Выполняет func(i) для всех i из [0, count), раздавая индексы потокам по одному
+template <typename Func>
+void ParallelFor(size_t count, unsigned threadCount, Func&& func) {
+    size_t workerCount = std::min<size_t>(std::max(1u, threadCount), count);
+    if (workerCount <= 1) {
+        for (size_t i = 0; i < count; i++) func(i);
+        return;
     }
 
-    void Cleanup() {
-        for (auto& pair : textures) {
-            pair.second.Cleanup();
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) func(i);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workerCount - 1);
+    for (size_t t = 1; t < workerCount; t++) {
+        try {
+            threads.emplace_back(worker);
+        }
+        catch (const std::system_error&) {
+            // Поток не создался - оставшуюся работу заберут уже запущенные
+            break;
         }
-        textures.clear();
     }
+    worker();
+    for (auto& thread : threads) thread.join();
+}
+
+// ==================== АРХИВ АССЕТОВ ====================
+// Пакет .pack - один файл вместо россыпи ассетов: одно открытие и отображение в память
+// на весь пакет, данные лежат подряд. Формат 'STPK':
+//   PackHeader | данные записей | таблица размеров блоков | PackEntry[] | имена
+// Записи отсортированы по имени (путь относительно папки пакета, нижний регистр, '/'),
+// поиск - двоичный. Сжатые записи разбиты на блоки по PACK_BLOCK_SIZE в формате блока
+// LZ4 и распаковываются параллельно; несжатые выровнены на 4 КиБ и отдаются прямо
+// из отображения без копирования. Собирает пакеты кукер: thames-cook --pack.
+const uint32_t PACK_MAGIC = 0x4B505453; // 'STPK'
+const uint32_t PACK_VERSION = 1;
+const uint32_t PACK_BLOCK_SIZE = 64 * 1024;
+const uint64_t PACK_ALIGNMENT = 4096;
+const uint32_t PACK_NO_BLOCKS = 0xFFFFFFFF;
+
+struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t blockCount;
+    uint64_t entriesOffset;
+    uint64_t blocksOffset;   // uint32_t на блок: размер в файле
+    uint64_t namesOffset;
+    uint64_t namesSize;
+    uint64_t fileSize;
 };
 
-// ==================== ЗАГРУЗКА ТЕКСТУР ====================
-bool Texture2D::LoadFromFile(ID3D11Device* device, const wchar_t* filename) {
-    this->filename = filename;
+struct PackEntry {
+    uint64_t offset;         // Начало данных в файле
+    uint64_t size;           // Размер после распаковки
+    uint64_t storedSize;     // Размер в файле
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t firstBlock;     // PACK_NO_BLOCKS - данные не сжаты
+    uint32_t blockCount;
+};
 
-    // Проверяем существование файла
-    if (!FileSystemHelper::FileExists(filename)) {
-        DEBUG_LOG_W(L"Файл не существует: " + std::wstring(filename));
-        return false;
+// Сжатие в формате блока LZ4: токен (длины литералов и совпадения по 4 бита),
+// литералы, 16-битное смещение. Жадный поиск по хэшу 4 байт - быстро, без окон
+// и цепочек; распаковка - одно копирование на последовательность.
+class Lz4Block {
+public:
+    static size_t CompressBound(size_t size) {
+        return size + size / 255 + 16;
     }
 
-    DEBUG_LOG_W(L"Загрузка текстуры: " + std::wstring(filename));
+    // Возвращает размер сжатых данных; 0 - не поместилось в capacity
+    static size_t Compress(const uint8_t* source, size_t size, uint8_t* destination, size_t capacity) {
+        const uint8_t* end = source + size;
+        const uint8_t* anchor = source;
+        uint8_t* out = destination;
+        uint8_t* outEnd = destination + capacity;
+
+        // Совпадение начинается не ближе 12 байт к концу, последние 5 байт - литералы
+        if (size >= MIN_INPUT) {
+            std::vector<uint32_t> table(HASH_SIZE, 0);
+            const uint8_t* matchLimit = end - LAST_MATCH_DISTANCE;
+            const uint8_t* ip = source + 1;
+            unsigned misses = 0;
+
+            while (ip < matchLimit) {
+                uint32_t sequence = Read32(ip);
+                uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+                const uint8_t* ref = source + table[hash];
+                table[hash] = (uint32_t)(ip - source);
+
+                if (ref >= ip || ip - ref > MAX_OFFSET || Read32(ref) != sequence) {
+                    // Несжимаемые данные проходим всё более крупным шагом
+                    ip += 1 + (misses++ >> 6);
+                    continue;
+                }
+                misses = 0;
 
-    // Инициализируем COM для WIC
-    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-    if (FAILED(hr) && hr != RPC_E_CHANGED_MODE) {
-        DEBUG_ERROR("Ошибка инициализации COM");
-        return false;
+                while (ip > anchor && ref > source && ip[-1] == ref[-1]) {
+                    ip--;
+                    ref--;
+                }
+
+                size_t matchLength = MIN_MATCH;
+                const uint8_t* matchEnd = end - LAST_LITERALS;
+                while (ip + matchLength < matchEnd && ip[matchLength] == ref[matchLength]) matchLength++;
+
+                if (!WriteSequence(out, outEnd, anchor, (size_t)(ip - anchor), (uint32_t)(ip - ref), matchLength)) {
+                    return 0;
+                }
+                ip += matchLength;
+                anchor = ip;
+            }
+        }
+
+        if (!WriteSequence(out, outEnd, anchor, (size_t)(end - anchor), 0, 0)) return 0;
+        return (size_t)(out - destination);
     }
 
-    IWICImagingFactory* wicFactory = nullptr;
-    hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr,
-        CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&wicFactory));
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания WIC фабрики");
-        CoUninitialize();
-        return false;
+    // Распаковывает ровно size байт; false - данные повреждены
+    static bool Decompress(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t size) {
+        const uint8_t* ip = source;
+        const uint8_t* ipEnd = source + sourceSize;
+        uint8_t* op = destination;
+        uint8_t* opEnd = destination + size;
+
+        while (ip < ipEnd) {
+            uint8_t token = *ip++;
+
+            size_t literalLength = token >> 4;
+            if (literalLength == 15 && !ReadLength(ip, ipEnd, literalLength)) return false;
+            if ((size_t)(ipEnd - ip) < literalLength || (size_t)(opEnd - op) < literalLength) return false;
+            memcpy(op, ip, literalLength);
+            ip += literalLength;
+            op += literalLength;
+
+            if (ip == ipEnd) break; // Последние литералы без совпадения
+
+            if (ipEnd - ip < 2) return false;
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if (offset == 0 || offset > (size_t)(op - destination)) return false;
+
+            size_t matchLength = token & 15;
+            if (matchLength == 15 && !ReadLength(ip, ipEnd, matchLength)) return false;
+            matchLength += MIN_MATCH;
+            if ((size_t)(opEnd - op) < matchLength) return false;
+
+            const uint8_t* match = op - offset;
+            if (offset >= matchLength) {
+                memcpy(op, match, matchLength);
+                op += matchLength;
+            }
+            else {
+                // Перекрытие: повтор короткого фрагмента, копируем по байту
+                for (size_t i = 0; i < matchLength; i++) *op++ = match[i];
+            }
+        }
+        return op == opEnd;
     }
 
-    IWICBitmapDecoder* decoder = nullptr;
-    hr = wicFactory->CreateDecoderFromFilename(filename, nullptr,
-        GENERIC_READ,
-        WICDecodeMetadataCacheOnLoad,
-        &decoder);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания декодера");
-        wicFactory->Release();
-        CoUninitialize();
-        return false;
+private:
+    static constexpr int HASH_BITS = 12;
+    static constexpr size_t HASH_SIZE = (size_t)1 << HASH_BITS;
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr size_t LAST_LITERALS = 5;
+    static constexpr size_t LAST_MATCH_DISTANCE = 12;
+    static constexpr size_t MIN_INPUT = 13;
+    static constexpr ptrdiff_t MAX_OFFSET = 65535;
+
+    static uint32_t Read32(const uint8_t* p) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
     }
 
-    IWICBitmapFrameDecode* frame = nullptr;
-    hr = decoder->GetFrame(0, &frame);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка получения фрейма");
-        decoder->Release();
-        wicFactory->Release();
-        CoUninitialize();
-        return false;
+    static bool ReadLength(const uint8_t*& ip, const uint8_t* ipEnd, size_t& length) {
+        uint8_t byte;
+        do {
+            if (ip >= ipEnd) return false;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
     }
 
-    // Получаем размеры
-    UINT w, h;
-    frame->GetSize(&w, &h);
-    width = (int)w;
-    height = (int)h;
+    static bool WriteLength(uint8_t*& out, uint8_t* outEnd, size_t length) {
+        for (; length >= 255; length -= 255) {
+            if (out >= outEnd) return false;
+            *out++ = 255;
+        }
+        if (out >= outEnd) return false;
+        *out++ = (uint8_t)length;
+        return true;
+    }
 
-    // Конвертируем в RGBA
-    IWICFormatConverter* converter = nullptr;
-    hr = wicFactory->CreateFormatConverter(&converter);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания конвертера");
-        frame->Release();
-        decoder->Release();
-        wicFactory->Release();
-        CoUninitialize();
-        return false;
+    // offset == 0 - завершающие литералы без совпадения
+    static bool WriteSequence(uint8_t*& out, uint8_t* outEnd, const uint8_t* literals, size_t literalLength,
+        uint32_t offset, size_t matchLength) {
+
+        if (out >= outEnd) return false;
+        size_t matchCode = offset ? matchLength - MIN_MATCH : 0;
+        uint8_t* token = out++;
+        *token = (uint8_t)((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15));
+
+        if (literalLength >= 15 && !WriteLength(out, outEnd, literalLength - 15)) return false;
+        if ((size_t)(outEnd - out) < literalLength) return false;
+        memcpy(out, literals, literalLength);
+        out += literalLength;
+
+        if (offset) {
+            if (outEnd - out < 2) return false;
+            *out++ = (uint8_t)(offset & 0xFF);
+            *out++ = (uint8_t)(offset >> 8);
+            if (matchCode >= 15 && !WriteLength(out, outEnd, matchCode - 15)) return false;
+        }
+        return true;
     }
+};
 
-    hr = converter->Initialize(frame, GUID_WICPixelFormat32bppRGBA,
-        WICBitmapDitherTypeNone, nullptr, 0.0,
-        WICBitmapPaletteTypeCustom);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка инициализации конвертера");
-        converter->Release();
-        frame->Release();
-        decoder->Release();
-        wicFactory->Release();
-        CoUninitialize();
-        return false;
+// Ключ записи: путь с '/' в нижнем регистре (ASCII), как его пишет кукер
+inline std::string MakePackKey(std::string path) {
+    for (auto& c : path) {
+        if (c == '\\') c = '/';
+        else if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
     }
+    while (path.size() >= 2 && path[0] == '.' && path[1] == '/') path.erase(0, 2);
+    return path;
+}
 
-    // Копируем пиксели
-    std::vector<BYTE> pixels(width * height * 4);
-    hr = converter->CopyPixels(nullptr, width * 4,
-        (UINT)pixels.size(), pixels.data());
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка копирования пикселей");
-        converter->Release();
-        frame->Release();
-        decoder->Release();
-        wicFactory->Release();
-        CoUninitialize();
-        return false;
+// Открытый пакет: оглавление проверяется при открытии, данные читаются по запросу
+class AssetPack {
+public:
+    bool Open(const std::wstring& path) {
+        file.Close();
+        header = nullptr;
+
+        if (!file.Open(path) || !Validate()) {
+            file.Close();
+            header = nullptr;
+            return false;
+        }
+        this->path = path;
+        return true;
     }
 
-    // Создаем текстуру DirectX
-    D3D11_TEXTURE2D_DESC texDesc = {};
-    texDesc.Width = width;
-    texDesc.Height = height;
-    texDesc.MipLevels = 1;
-    texDesc.ArraySize = 1;
-    texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    texDesc.SampleDesc.Count = 1;
-    texDesc.SampleDesc.Quality = 0;
-    texDesc.Usage = D3D11_USAGE_DEFAULT;
-    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-    texDesc.CPUAccessFlags = 0;
+    const std::wstring& GetPath() const { return path; }
+    uint32_t GetEntryCount() const { return header ? header->entryCount : 0; }
+    const PackEntry& GetEntry(uint32_t index) const { return entries[index]; }
 
-    D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = pixels.data();
-    initData.SysMemPitch = width * 4;
-    initData.SysMemSlicePitch = 0;
+    std::string_view GetName(const PackEntry& entry) const {
+        return std::string_view(names + entry.nameOffset, entry.nameLength);
+    }
 
-    hr = device->CreateTexture2D(&texDesc, &initData, &texture);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания текстуры DirectX");
-        converter->Release();
-        frame->Release();
-        decoder->Release();
-        wicFactory->Release();
-        CoUninitialize();
-        return false;
+    // key - результат MakePackKey
+    const PackEntry* Find(std::string_view key) const {
+        const PackEntry* end = entries + GetEntryCount();
+        const PackEntry* it = std::lower_bound(entries, end, key,
+            [this](const PackEntry& entry, std::string_view value) { return GetName(entry) < value; });
+        return (it != end && GetName(*it) == key) ? it : nullptr;
     }
 
-    // Создаем шейдерный ресурс
-    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-    srvDesc.Format = texDesc.Format;
-    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-    srvDesc.Texture2D.MostDetailedMip = 0;
-    srvDesc.Texture2D.MipLevels = 1;
+    // Несжатая запись - указатель прямо в отображение, иначе nullptr
+    const char* GetDirectData(const PackEntry& entry) const {
+        return (entry.firstBlock == PACK_NO_BLOCKS) ? file.Data() + entry.offset : nullptr;
+    }
+
+    // Распаковка в output. Блоки независимы и делятся между потоками: каждый поток
+    // сам подкачивает свои страницы, так что к диску идёт несколько запросов сразу.
+    bool Read(const PackEntry& entry, std::vector<char>& output, unsigned threadCount) const {
+        const char* stored = file.Data() + entry.offset;
+        file.Prefetch(entry.offset, (size_t)entry.storedSize);
+
+        output.resize((size_t)entry.size);
+        if (entry.firstBlock == PACK_NO_BLOCKS) {
+            memcpy(output.data(), stored, (size_t)entry.size);
+            return true;
+        }
+
+        std::vector<uint64_t> blockOffsets(entry.blockCount + 1, 0);
+        for (uint32_t b = 0; b < entry.blockCount; b++) {
+            blockOffsets[b + 1] = blockOffsets[b] + blockSizes[entry.firstBlock + b];
+        }
+        if (blockOffsets[entry.blockCount] != entry.storedSize) return false;
+
+        // Запуск потока дороже распаковки одного блока - не меньше 4 блоков на поток
+        unsigned workers = std::min<unsigned>(GetWorkerThreadCount(threadCount), (entry.blockCount + 3) / 4);
+        std::atomic<bool> valid = true;
+        ParallelFor(entry.blockCount, workers, [&](size_t b) {
+            size_t rawSize = (size_t)std::min<uint64_t>(PACK_BLOCK_SIZE, entry.size - (uint64_t)b * PACK_BLOCK_SIZE);
+            size_t storedSize = (size_t)(blockOffsets[b + 1] - blockOffsets[b]);
+            const uint8_t* source = (const uint8_t*)stored + blockOffsets[b];
+            uint8_t* destination = (uint8_t*)output.data() + b * (size_t)PACK_BLOCK_SIZE;
+
+            // Блок, который не сжался, хранится как есть
+            if (storedSize == rawSize) {
+                memcpy(destination, source, rawSize);
+            }
+            else if (!Lz4Block::Decompress(source, storedSize, destination, rawSize)) {
+                valid = false;
+            }
+        });
+        return valid;
+    }
+
+private:
+    static bool InRange(uint64_t offset, uint64_t size, uint64_t limit) {
+        return offset <= limit && size <= limit - offset;
+    }
+
+    bool Validate() {
+        if (file.Size() < sizeof(PackHeader)) return false;
+        header = (const PackHeader*)file.Data();
+        uint64_t fileSize = file.Size();
+        if (header->magic != PACK_MAGIC || header->version != PACK_VERSION || header->fileSize != fileSize) {
+            return false;
+        }
+        if (!InRange(header->entriesOffset, (uint64_t)header->entryCount * sizeof(PackEntry), fileSize) ||
+            !InRange(header->blocksOffset, (uint64_t)header->blockCount * sizeof(uint32_t), fileSize) ||
+            !InRange(header->namesOffset, header->namesSize, fileSize) ||
+            header->entriesOffset % alignof(PackEntry) != 0 || header->blocksOffset % alignof(uint32_t) != 0) {
+            return false;
+        }
+
+        entries = (const PackEntry*)(file.Data() + header->entriesOffset);
+        blockSizes = (const uint32_t*)(file.Data() + header->blocksOffset);
+        names = file.Data() + header->namesOffset;
+
+        for (uint32_t i = 0; i < header->entryCount; i++) {
+            const PackEntry& entry = entries[i];
+            if (!InRange(entry.offset, entry.storedSize, fileSize) ||
+                !InRange(entry.nameOffset, entry.nameLength, header->namesSize)) {
+                return false;
+            }
+            if (entry.firstBlock == PACK_NO_BLOCKS) {
+                if (entry.storedSize != entry.size) return false;
+            }
+            else if (!InRange(entry.firstBlock, entry.blockCount, header->blockCount) ||
+                (uint64_t)entry.blockCount != (entry.size + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    MappedFile file;
+    std::wstring path;
+    const PackHeader* header = nullptr;
+    const PackEntry* entries = nullptr;
+    const uint32_t* blockSizes = nullptr;
+    const char* names = nullptr;
+};
+
+// Сборка пакета (кукер). Файлы сжимаются параллельно; запись, которая сжалась
+// меньше чем на 1/8 (JPEG, PNG), хранится как есть и читается без копирования.
+class AssetPackWriter {
+public:
+    struct Input {
+        std::string name;        // Путь относительно папки пакета
+        std::wstring sourcePath;
+    };
+
+    static bool Write(const std::wstring& packPath, std::vector<Input> inputs, unsigned threadCount) {
+        for (auto& input : inputs) input.name = MakePackKey(input.name);
+        std::sort(inputs.begin(), inputs.end(),
+            [](const Input& a, const Input& b) { return a.name < b.name; });
+        for (size_t i = 1; i < inputs.size(); i++) {
+            if (inputs[i].name == inputs[i - 1].name) {
+                DEBUG_ERROR_W(L"Два файла с одним именем в пакете: " + inputs[i].sourcePath);
+                return false;
+            }
+        }
+
+        std::vector<Packed> packed(inputs.size());
+        std::atomic<bool> readOk = true;
+        ParallelFor(inputs.size(), GetWorkerThreadCount(threadCount), [&](size_t i) {
+            if (!Compress(inputs[i].sourcePath, packed[i])) {
+                DEBUG_ERROR_W(L"Не удалось прочитать: " + inputs[i].sourcePath);
+                readOk = false;
+            }
+        });
+        if (!readOk) return false;
+
+        // Раскладка: заголовок, данные (несжатые - с выравниванием), блоки, оглавление, имена
+        std::vector<PackEntry> entries(inputs.size());
+        std::vector<uint32_t> blockSizes;
+        std::string names;
+        uint64_t offset = sizeof(PackHeader);
+        for (size_t i = 0; i < inputs.size(); i++) {
+            PackEntry& entry = entries[i];
+            const Packed& data = packed[i];
+            bool compressed = !data.blockSizes.empty();
+
+            offset = AlignUp(offset, compressed ? 16 : PACK_ALIGNMENT);
+            entry.offset = offset;
+            entry.size = data.size;
+            entry.storedSize = data.bytes.size();
+            entry.nameOffset = (uint32_t)names.size();
+            entry.nameLength = (uint32_t)inputs[i].name.size();
+            entry.firstBlock = compressed ? (uint32_t)blockSizes.size() : PACK_NO_BLOCKS;
+            entry.blockCount = (uint32_t)data.blockSizes.size();
+
+            names += inputs[i].name;
+            blockSizes.insert(blockSizes.end(), data.blockSizes.begin(), data.blockSizes.end());
+            offset += entry.storedSize;
+        }
+
+        PackHeader header = {};
+        header.magic = PACK_MAGIC;
+        header.version = PACK_VERSION;
+        header.entryCount = (uint32_t)entries.size();
+        header.blockCount = (uint32_t)blockSizes.size();
+        header.blocksOffset = AlignUp(offset, 16);
+        header.entriesOffset = AlignUp(header.blocksOffset + blockSizes.size() * sizeof(uint32_t), 16);
+        header.namesOffset = header.entriesOffset + entries.size() * sizeof(PackEntry);
+        header.namesSize = names.size();
+        header.fileSize = header.namesOffset + header.namesSize;
+
+        std::wstring tempPath = packPath + L".tmp";
+        {
+            std::ofstream out(FileSystemHelper::ToPath(tempPath), std::ios::binary | std::ios::trunc);
+            if (!out) {
+                DEBUG_ERROR_W(L"Не удалось создать пакет: " + tempPath);
+                return false;
+            }
+
+            uint64_t position = 0;
+            auto writeAt = [&](uint64_t target, const void* data, size_t size) {
+                static const char zeros[PACK_ALIGNMENT] = {};
+                for (; position < target; ) {
+                    size_t padding = (size_t)std::min<uint64_t>(target - position, PACK_ALIGNMENT);
+                    out.write(zeros, padding);
+                    position += padding;
+                }
+                out.write((const char*)data, size);
+                position += size;
+            };
+
+            writeAt(0, &header, sizeof(header));
+            for (size_t i = 0; i < entries.size(); i++) {
+                writeAt(entries[i].offset, packed[i].bytes.data(), packed[i].bytes.size());
+            }
+            writeAt(header.blocksOffset, blockSizes.data(), blockSizes.size() * sizeof(uint32_t));
+            writeAt(header.entriesOffset, entries.data(), entries.size() * sizeof(PackEntry));
+            writeAt(header.namesOffset, names.data(), names.size());
+            if (!out) {
+                DEBUG_ERROR_W(L"Ошибка записи пакета: " + tempPath);
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(FileSystemHelper::ToPath(tempPath), FileSystemHelper::ToPath(packPath), ec);
+        if (ec) {
+            std::filesystem::remove(FileSystemHelper::ToPath(tempPath), ec);
+            DEBUG_ERROR_W(L"Не удалось переименовать пакет: " + packPath);
+            return false;
+        }
+
+        uint64_t rawTotal = 0;
+        for (const auto& entry : entries) rawTotal += entry.size;
+        char buffer[256];
+        sprintf_s(buffer, "Пакет: %zu файлов, %.1f МБ -> %.1f МБ",
+            entries.size(), rawTotal / (1024.0 * 1024.0), header.fileSize / (1024.0 * 1024.0));
+        DEBUG_LOG(buffer);
+        return true;
+    }
+
+private:
+    struct Packed {
+        uint64_t size = 0;
+        std::vector<char> bytes;           // Данные в том виде, как лягут в файл
+        std::vector<uint32_t> blockSizes;  // Пусто - запись не сжата
+    };
+
+    static uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static bool Compress(const std::wstring& sourcePath, Packed& packed) {
+        MappedFile file;
+        if (!file.Open(sourcePath)) return false;
+        packed.size = file.Size();
+
+        const uint8_t* source = (const uint8_t*)file.Data();
+        std::vector<uint8_t> scratch(Lz4Block::CompressBound(PACK_BLOCK_SIZE));
+        for (uint64_t start = 0; start < packed.size; start += PACK_BLOCK_SIZE) {
+            size_t rawSize = (size_t)std::min<uint64_t>(PACK_BLOCK_SIZE, packed.size - start);
+            size_t storedSize = Lz4Block::Compress(source + start, rawSize, scratch.data(), scratch.size());
+            if (storedSize == 0 || storedSize >= rawSize) {
+                packed.bytes.insert(packed.bytes.end(), source + start, source + start + rawSize);
+                storedSize = rawSize;
+            }
+            else {
+                packed.bytes.insert(packed.bytes.end(), scratch.begin(), scratch.begin() + storedSize);
+            }
+            packed.blockSizes.push_back((uint32_t)storedSize);
+        }
+
+        if (packed.bytes.size() > packed.size - packed.size / 8) {
+            packed.bytes.assign(file.Data(), file.Data() + packed.size);
+            packed.blockSizes.clear();
+        }
+        return true;
+    }
+};
+
+// Подключённые пакеты. Запись пакета видна по пути "папка пакета/имя записи": такой
+// путь возвращает FileSystemHelper::FindFile, а AssetFile читает его из пакета.
+// Пакеты важнее файлов на диске; из двух пакетов важнее подключённый позже.
+class AssetPacks {
+public:
+    static bool Mount(const std::wstring& packPath) {
+        auto pack = std::make_shared<AssetPack>();
+        if (!pack->Open(packPath)) {
+            DEBUG_WARNING_W(L"Не удалось открыть пакет: " + packPath);
+            return false;
+        }
+
+        size_t pos = packPath.find_last_of(L"\\/");
+        std::wstring directory = (pos != std::wstring::npos) ? packPath.substr(0, pos + 1) : L"";
+
+        std::vector<std::wstring> names;
+        names.reserve(pack->GetEntryCount());
+        for (uint32_t i = 0; i < pack->GetEntryCount(); i++) {
+            names.push_back(FileSystemHelper::FromUtf8(std::string(pack->GetName(pack->GetEntry(i)))));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(GetMutex());
+            GetMounted().push_back({ pack, AbsoluteKey(directory) });
+        }
+        AssetIndex::AddVirtualFiles(directory, names);
+
+        char buffer[256];
+        sprintf_s(buffer, "Подключён пакет: %u файлов", pack->GetEntryCount());
+        DEBUG_SUCCESS(buffer);
+        return true;
+    }
+
+    // Все *.pack в папке (directory - с разделителем в конце), по имени
+    static size_t MountDirectory(const std::wstring& directory) {
+        std::vector<std::wstring> packs;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(FileSystemHelper::ToPath(directory), ec)) {
+            std::wstring name = FileSystemHelper::FromPath(entry.path().filename());
+            std::wstring extension = (name.size() > 5) ? name.substr(name.size() - 5) : L"";
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::towlower);
+            if (extension == L".pack" && entry.is_regular_file(ec)) packs.push_back(directory + name);
+        }
+        std::sort(packs.begin(), packs.end());
+
+        size_t mounted = 0;
+        for (const auto& pack : packs) {
+            if (Mount(pack)) mounted++;
+        }
+        return mounted;
+    }
+
+    static void UnmountAll() {
+        {
+            std::lock_guard<std::mutex> lock(GetMutex());
+            GetMounted().clear();
+        }
+        AssetIndex::ClearVirtualFiles();
+    }
+
+    // Запись пакета по пути файла; пакет держится живым, пока жив результат
+    static bool Resolve(const std::wstring& path, std::shared_ptr<const AssetPack>& pack, const PackEntry*& entry) {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        auto& mounted = GetMounted();
+        if (mounted.empty()) return false;
+
+        std::string key = AbsoluteKey(path);
+        for (auto it = mounted.rbegin(); it != mounted.rend(); ++it) {
+            const std::string& directory = it->directoryKey;
+            if (key.size() <= directory.size() + 1 || key.compare(0, directory.size(), directory) != 0 ||
+                key[directory.size()] != '/') {
+                continue;
+            }
+            entry = it->pack->Find(std::string_view(key).substr(directory.size() + 1));
+            if (entry) {
+                pack = it->pack;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Mounted {
+        std::shared_ptr<const AssetPack> pack;
+        std::string directoryKey; // Абсолютный путь папки пакета в виде MakePackKey
+    };
+
+    static std::mutex& GetMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<Mounted>& GetMounted() {
+        static std::vector<Mounted> mounted;
+        return mounted;
+    }
+
+    static std::string AbsoluteKey(const std::wstring& path) {
+        std::error_code ec;
+        std::filesystem::path absolute = std::filesystem::absolute(
+            FileSystemHelper::ToPath(path.empty() ? L"." : path), ec);
+        std::string key = MakePackKey(FileSystemHelper::ToUtf8(FileSystemHelper::FromPath(absolute.lexically_normal())));
+        while (!key.empty() && key.back() == '/') key.pop_back();
+        return key;
+    }
+};
+
+// Содержимое ассета: запись пакета или файл на диске, отображённый в память.
+// Несжатая запись и файл на диске не копируются; сжатая распаковывается в буфер.
+class AssetFile {
+public:
+    AssetFile() = default;
+    AssetFile(const AssetFile&) = delete;
+    AssetFile& operator=(const AssetFile&) = delete;
+
+    bool Open(const std::wstring& path, unsigned threadCount = 0) {
+        Close();
+
+        std::shared_ptr<const AssetPack> pack;
+        const PackEntry* entry = nullptr;
+        if (AssetPacks::Resolve(path, pack, entry)) {
+            data = pack->GetDirectData(*entry);
+            if (data) {
+                this->pack = pack;
+            }
+            else {
+                if (!pack->Read(*entry, buffer, threadCount)) {
+                    DEBUG_ERROR_W(L"Повреждённая запись пакета: " + path);
+                    Close();
+                    return false;
+                }
+                data = buffer.data();
+            }
+            size = (size_t)entry->size;
+            isOpen = true;
+            return true;
+        }
+
+        if (!file.Open(path)) return false;
+        data = file.Data();
+        size = file.Size();
+        isOpen = true;
+        return true;
+    }
+
+    void Close() {
+        file.Close();
+        pack.reset();
+        std::vector<char>().swap(buffer);
+        data = nullptr;
+        size = 0;
+        isOpen = false;
+    }
+
+    const char* Data() const { return data; }
+    size_t Size() const { return size; }
+    bool IsOpen() const { return isOpen; }
+
+private:
+    MappedFile file;
+    std::shared_ptr<const AssetPack> pack;
+    std::vector<char> buffer;
+    const char* data = nullptr;
+    size_t size = 0;
+    bool isOpen = false;
+};
+
+// ==================== ИМЕНА И ИДЕНТИФИКАТОРЫ ====================
+// Имена материалов и ассетов хранятся как 32-битный FNV-1a хэш.
+// Функция constexpr, поэтому имена, известные при сборке, хэшируются компилятором:
+// "default"_name - это просто константа.
+using NameId = uint32_t;
+
+constexpr NameId HashName(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash ^= (uint8_t)c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr NameId operator""_name(const char* text, size_t length) {
+    return HashName(std::string_view(text, length));
+}
+
+// Реестр строк для отладочного вывода и проверки коллизий хэша
+class NameRegistry {
+public:
+    static NameId Intern(std::string_view name) {
+        NameId id = HashName(name);
+
+        std::lock_guard<std::mutex> lock(GetMutex());
+        auto& names = GetNames();
+        auto it = names.find(id);
+        if (it == names.end()) {
+            names.emplace(id, std::string(name));
+        }
+        else if (it->second != name) {
+            DEBUG_ERROR("Коллизия хэша имён: '" + it->second + "' и '" + std::string(name) + "'");
+        }
+        return id;
+    }
+
+    static std::string GetName(NameId id) {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        auto& names = GetNames();
+        auto it = names.find(id);
+        if (it != names.end()) return it->second;
+
+        char buffer[16];
+        sprintf_s(buffer, "#%08X", id);
+        return buffer;
+    }
+
+private:
+    static std::mutex& GetMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::unordered_map<NameId, std::string>& GetNames() {
+        static std::unordered_map<NameId, std::string> names;
+        return names;
+    }
+};
+
+// ==================== МИП-УРОВНИ ТЕКСТУР ====================
+// Полная цепочка мип-уровней RGBA8 на CPU фильтром 2x2 (box). Цвет хранится в sRGB,
+// поэтому усредняется в линейном пространстве: первый уровень строится из исходника
+// через таблицу sRGB -> линейный (16 бит), дальше уровни считаются в линейных
+// 16-битных значениях (SSE2 - по два пикселя за шаг) и лишь для выгрузки кодируются
+// обратно в sRGB. Альфа усредняется как есть.
+class MipGenerator {
+public:
+    // Число уровней полной цепочки, включая исходный
+    static int CountLevels(int width, int height) {
+        int levels = 1;
+        while (width > 1 || height > 1) {
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            levels++;
+        }
+        return levels;
+    }
+
+    // levels[i] - уровень i + 1 (исходный уровень не копируется); useSimd = false - скалярный путь
+    static void Build(const uint8_t* pixels, int width, int height,
+        std::vector<std::vector<uint8_t>>& levels, bool useSimd = true) {
+
+        levels.clear();
+        if (!pixels || width <= 0 || height <= 0 || (width == 1 && height == 1)) return;
+        levels.reserve(CountLevels(width, height) - 1);
+
+        // Уровень 1 - прямо из sRGB, линейная копия исходника не нужна
+        int levelWidth = std::max(1, width / 2);
+        int levelHeight = std::max(1, height / 2);
+        std::vector<uint16_t> linear((size_t)levelWidth * levelHeight * 4);
+        DownsampleFromSrgb(pixels, width, height, linear.data(), levelWidth, levelHeight);
+        levels.emplace_back();
+        EncodeSrgb(linear.data(), (size_t)levelWidth * levelHeight, levels.back());
+
+        std::vector<uint16_t> next;
+        while (levelWidth > 1 || levelHeight > 1) {
+            int nextWidth = std::max(1, levelWidth / 2);
+            int nextHeight = std::max(1, levelHeight / 2);
+            next.resize((size_t)nextWidth * nextHeight * 4);
+            DownsampleLinear(linear.data(), levelWidth, levelHeight, next.data(), nextWidth, nextHeight, useSimd);
+            levels.emplace_back();
+            EncodeSrgb(next.data(), (size_t)nextWidth * nextHeight, levels.back());
+
+            linear.swap(next);
+            levelWidth = nextWidth;
+            levelHeight = nextHeight;
+        }
+    }
+
+    // Замер на синтетической картинке size x size: SSE2 против скалярного пути
+    static bool Benchmark(int size, int runs) {
+        std::vector<uint8_t> pixels((size_t)size * size * 4);
+        uint32_t seed = 12345;
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                seed = seed * 1664525u + 1013904223u;
+                uint8_t* p = &pixels[((size_t)y * size + x) * 4];
+                p[0] = (uint8_t)((x * 255) / size);
+                p[1] = (uint8_t)((y * 255) / size);
+                p[2] = (uint8_t)(seed >> 24);
+                p[3] = 255;
+            }
+        }
+
+        std::vector<std::vector<uint8_t>> simdLevels;
+        std::vector<std::vector<uint8_t>> scalarLevels;
+        double simdMs = TimeBuild(pixels, size, runs, simdLevels, true);
+        double scalarMs = TimeBuild(pixels, size, runs, scalarLevels, false);
+
+        double megapixels = (double)size * size / 1e6;
+        char buffer[256];
+        sprintf_s(buffer, "Мипы %dx%d (%d уровней), лучшее из %d: SSE2 %.1f мс (%.0f Мпикс/с), скалярно %.1f мс (%.0f Мпикс/с)",
+            size, size, CountLevels(size, size), runs,
+            simdMs, megapixels / (simdMs / 1000.0), scalarMs, megapixels / (scalarMs / 1000.0));
+        DEBUG_LOG(buffer);
+        if (!MIPS_USE_SSE2) DEBUG_WARNING("SSE2 недоступен - оба замера скалярные");
+
+        if (simdLevels != scalarLevels) {
+            DEBUG_ERROR("Мипы SSE2 и скалярного пути различаются");
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // sRGB (0..255) -> линейный 0..65535
+    static const uint16_t* GetToLinear() {
+        static const std::vector<uint16_t> table = []() {
+            std::vector<uint16_t> values(256);
+            for (int i = 0; i < 256; i++) {
+                double c = i / 255.0;
+                double l = (c <= 0.04045) ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+                values[i] = (uint16_t)std::lround(l * 65535.0);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    // Линейный 0..65535 -> sRGB (0..255), точная таблица на все 16 бит
+    static const uint8_t* GetToSrgb() {
+        static const std::vector<uint8_t> table = []() {
+            std::vector<uint8_t> values(65536);
+            for (int i = 0; i < 65536; i++) {
+                double l = i / 65535.0;
+                double c = (l <= 0.0031308) ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+                values[i] = (uint8_t)std::clamp(std::lround(c * 255.0), 0L, 255L);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    // Усреднение с округлением вверх - как _mm_avg_epu16, чтобы пути совпадали побитно
+    static uint16_t Average(uint32_t a, uint32_t b) {
+        return (uint16_t)((a + b + 1) >> 1);
+    }
+
+    static void DownsampleFromSrgb(const uint8_t* src, int srcWidth, int srcHeight,
+        uint16_t* dst, int dstWidth, int dstHeight) {
+
+        const uint16_t* toLinear = GetToLinear();
+        for (int y = 0; y < dstHeight; y++) {
+            const uint8_t* row0 = src + (size_t)std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+            const uint8_t* row1 = src + (size_t)std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+            uint16_t* out = dst + (size_t)y * dstWidth * 4;
+            for (int x = 0; x < dstWidth; x++) {
+                const uint8_t* a0 = row0 + (size_t)std::min(x * 2, srcWidth - 1) * 4;
+                const uint8_t* a1 = row0 + (size_t)std::min(x * 2 + 1, srcWidth - 1) * 4;
+                const uint8_t* b0 = row1 + (a0 - row0);
+                const uint8_t* b1 = row1 + (a1 - row0);
+                uint16_t* o = out + x * 4;
+                o[0] = (uint16_t)(((uint32_t)toLinear[a0[0]] + toLinear[a1[0]] + toLinear[b0[0]] + toLinear[b1[0]] + 2) >> 2);
+                o[1] = (uint16_t)(((uint32_t)toLinear[a0[1]] + toLinear[a1[1]] + toLinear[b0[1]] + toLinear[b1[1]] + 2) >> 2);
+                o[2] = (uint16_t)(((uint32_t)toLinear[a0[2]] + toLinear[a1[2]] + toLinear[b0[2]] + toLinear[b1[2]] + 2) >> 2);
+                o[3] = (uint16_t)((((uint32_t)a0[3] + a1[3] + b0[3] + b1[3]) * 257 + 2) >> 2);
+            }
+        }
+    }
+
+    static void DownsampleLinear(const uint16_t* src, int srcWidth, int srcHeight,
+        uint16_t* dst, int dstWidth, int dstHeight, bool useSimd) {
+
+        for (int y = 0; y < dstHeight; y++) {
+            const uint16_t* row0 = src + (size_t)std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+            const uint16_t* row1 = src + (size_t)std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+            uint16_t* out = dst + (size_t)y * dstWidth * 4;
+
+            int x = 0;
+#if MIPS_USE_SSE2
+            // Два выходных пикселя за шаг: 4 пикселя из каждой строки, по вертикали, затем пары
+            if (useSimd && srcWidth >= 2) {
+                for (; x + 2 <= dstWidth; x += 2) {
+                    const __m128i* a = (const __m128i*)(row0 + x * 8);
+                    const __m128i* b = (const __m128i*)(row1 + x * 8);
+                    __m128i left = _mm_avg_epu16(_mm_loadu_si128(a), _mm_loadu_si128(b));
+                    __m128i right = _mm_avg_epu16(_mm_loadu_si128(a + 1), _mm_loadu_si128(b + 1));
+                    __m128i even = _mm_unpacklo_epi64(left, right);
+                    __m128i odd = _mm_unpackhi_epi64(left, right);
+                    _mm_storeu_si128((__m128i*)(out + x * 4), _mm_avg_epu16(even, odd));
+                }
+            }
+#else
+            (void)useSimd;
+#endif
+            for (; x < dstWidth; x++) {
+                size_t x0 = (size_t)std::min(x * 2, srcWidth - 1) * 4;
+                size_t x1 = (size_t)std::min(x * 2 + 1, srcWidth - 1) * 4;
+                for (int c = 0; c < 4; c++) {
+                    out[x * 4 + c] = Average(Average(row0[x0 + c], row1[x0 + c]), Average(row0[x1 + c], row1[x1 + c]));
+                }
+            }
+        }
+    }
+
+    static void EncodeSrgb(const uint16_t* linear, size_t pixelCount, std::vector<uint8_t>& out) {
+        const uint8_t* toSrgb = GetToSrgb();
+        out.resize(pixelCount * 4);
+        for (size_t i = 0; i < pixelCount; i++) {
+            out[i * 4 + 0] = toSrgb[linear[i * 4 + 0]];
+            out[i * 4 + 1] = toSrgb[linear[i * 4 + 1]];
+            out[i * 4 + 2] = toSrgb[linear[i * 4 + 2]];
+            out[i * 4 + 3] = (uint8_t)std::min(255, (linear[i * 4 + 3] + 128) / 257);
+        }
+    }
+
+    static double TimeBuild(const std::vector<uint8_t>& pixels, int size, int runs,
+        std::vector<std::vector<uint8_t>>& levels, bool useSimd) {
+        double best = DBL_MAX;
+        for (int run = 0; run < std::max(1, runs); run++) {
+            auto start = std::chrono::steady_clock::now();
+            Build(pixels.data(), size, size, levels, useSimd);
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    }
+};
+
+// ==================== ДЕКОДИРОВАНИЕ ИЗОБРАЖЕНИЙ ====================
+// Свой декодер PNG, JPEG (baseline и progressive), BMP и TGA в RGBA8 - без WIC и COM,
+// одинаково на Windows и Linux. Читает только из памяти и состояния между вызовами не
+// держит, так что картинки декодируются в любых потоках, в том числе пачкой (DecodeBatch).
+// Каналы сразу пишутся в порядке RGBA: BGR(A) из BMP/TGA и YCbCr из JPEG переставляются
+// и переводятся при копировании строки (SSE2 - по 4-16 пикселей, побитно как скалярно).
+// Чего декодер не знает (CMYK и арифметический JPEG, RLE в BMP, GIF...), игра отдаёт WIC.
+const bool USE_IMAGE_DECODER = true;
+const int MAX_IMAGE_DIMENSION = 16384;
+
+enum ImageFileType {
+    IMAGE_UNKNOWN = 0,
+    IMAGE_PNG,
+    IMAGE_JPEG,
+    IMAGE_BMP,
+    IMAGE_TGA
+};
+
+// Одна картинка пачки: данные в памяти на входе, RGBA8 на выходе
+struct ImageDecodeJob {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> pixels;
+    bool decoded = false;
+};
+
+class ImageDecoder {
+public:
+    // Формат по сигнатуре; у TGA её нет - проверяется правдоподобность заголовка
+    static ImageFileType DetectType(const uint8_t* data, size_t size) {
+        if (!data) return IMAGE_UNKNOWN;
+        static const uint8_t pngSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+        if (size >= 8 && memcmp(data, pngSignature, 8) == 0) return IMAGE_PNG;
+        if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) return IMAGE_JPEG;
+        if (size >= 26 && data[0] == 'B' && data[1] == 'M') return IMAGE_BMP;
+
+        if (size >= 18) {
+            uint8_t colorMapType = data[1];
+            uint8_t imageType = data[2];
+            uint8_t depth = data[16];
+            bool colorMapped = (imageType == 1 || imageType == 9);
+            bool trueColor = (imageType == 2 || imageType == 10);
+            bool gray = (imageType == 3 || imageType == 11);
+            bool validDepth = colorMapped ? (depth == 8 && colorMapType == 1) :
+                trueColor ? (depth == 15 || depth == 16 || depth == 24 || depth == 32) :
+                gray ? depth == 8 : false;
+            if (colorMapType <= 1 && validDepth && ReadLe16(data + 12) > 0 && ReadLe16(data + 14) > 0) {
+                return IMAGE_TGA;
+            }
+        }
+        return IMAGE_UNKNOWN;
+    }
+
+    // pixels == nullptr - только размеры из заголовка; useSimd = false - скалярный путь
+    static bool Decode(const uint8_t* data, size_t size, int& width, int& height,
+        std::vector<uint8_t>* pixels, bool useSimd = true) {
+        switch (DetectType(data, size)) {
+        case IMAGE_PNG: return DecodePng(data, size, width, height, pixels, useSimd);
+        case IMAGE_JPEG: return DecodeJpeg(data, size, width, height, pixels, useSimd);
+        case IMAGE_BMP: return DecodeBmp(data, size, width, height, pixels, useSimd);
+        case IMAGE_TGA: return DecodeTga(data, size, width, height, pixels, useSimd);
+        default: return false;
+        }
+    }
+
+    // Все картинки пачки, по одной на поток
+    static void DecodeBatch(std::vector<ImageDecodeJob>& jobs, unsigned threadCount, bool useSimd = true) {
+        ParallelFor(jobs.size(), GetWorkerThreadCount(threadCount), [&](size_t i) {
+            ImageDecodeJob& job = jobs[i];
+            job.decoded = Decode(job.data, job.size, job.width, job.height, &job.pixels, useSimd);
+        });
+    }
+
+    static bool IsImageExtension(const std::wstring& extension) {
+        return extension == L".png" || extension == L".jpg" || extension == L".jpeg" ||
+            extension == L".bmp" || extension == L".tga";
+    }
+
+    // Замер на файлах (папки - рекурсивно по расширениям): один поток, пачка на threadCount
+    // потоках и скалярный путь; картинки всех трёх прогонов должны совпасть побитно
+    static bool Benchmark(const std::vector<std::wstring>& inputs, int runs, unsigned threadCount) {
+        std::vector<std::wstring> files;
+        for (const auto& input : inputs) {
+            std::error_code ec;
+            std::filesystem::path inputPath = FileSystemHelper::ToPath(input);
+            if (!std::filesystem::is_directory(inputPath, ec)) {
+                files.push_back(input);
+                continue;
+            }
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(inputPath, ec)) {
+                std::wstring path = FileSystemHelper::FromPath(entry.path());
+                if (entry.is_regular_file(ec) && IsImageExtension(FileSystemHelper::GetLowerExtension(path))) {
+                    files.push_back(path);
+                }
+            }
+        }
+
+        std::vector<std::unique_ptr<AssetFile>> sources;
+        std::vector<ImageDecodeJob> jobs;
+        for (const auto& path : files) {
+            auto source = std::make_unique<AssetFile>();
+            if (!source->Open(path)) {
+                DEBUG_WARNING_W(L"Не удалось открыть картинку: " + path);
+                continue;
+            }
+            ImageDecodeJob job;
+            job.data = (const uint8_t*)source->Data();
+            job.size = source->Size();
+            jobs.push_back(std::move(job));
+            sources.push_back(std::move(source));
+        }
+        if (jobs.empty()) {
+            DEBUG_ERROR("Нет картинок для замера декодера");
+            return false;
+        }
+
+        unsigned threads = GetWorkerThreadCount(threadCount);
+        std::vector<ImageDecodeJob> serialJobs = jobs;
+        std::vector<ImageDecodeJob> scalarJobs = jobs;
+        double serialMs = TimeBatch(serialJobs, runs, 1, true);
+        double parallelMs = TimeBatch(jobs, runs, threads, true);
+        double scalarMs = TimeBatch(scalarJobs, runs, 1, false);
+
+        double megapixels = 0.0;
+        size_t failed = 0;
+        bool identical = true;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (!jobs[i].decoded) {
+                failed++;
+                continue;
+            }
+            megapixels += (double)jobs[i].width * jobs[i].height / 1e6;
+            if (jobs[i].pixels != serialJobs[i].pixels || jobs[i].pixels != scalarJobs[i].pixels) {
+                DEBUG_ERROR_W(L"Результаты прогонов различаются: " + files[i]);
+                identical = false;
+            }
+        }
+
+        char buffer[256];
+        sprintf_s(buffer, "Декодирование %zu картинок (%.1f Мпикс), лучшее из %d: 1 поток %.1f мс (%.0f Мпикс/с), "
+            "%u потоков %.1f мс (%.0f Мпикс/с)", jobs.size(), megapixels, runs,
+            serialMs, megapixels / (serialMs / 1000.0), threads, parallelMs, megapixels / (parallelMs / 1000.0));
+        DEBUG_LOG(buffer);
+        sprintf_s(buffer, "Скалярный путь: %.1f мс (%.0f Мпикс/с)", scalarMs, megapixels / (scalarMs / 1000.0));
+        DEBUG_LOG(buffer);
+        if (!MIPS_USE_SSE2) DEBUG_WARNING("SSE2 недоступен - все замеры скалярные");
+        if (failed > 0) {
+            sprintf_s(buffer, "Не декодировано картинок: %zu", failed);
+            DEBUG_WARNING(buffer);
+        }
+        return identical;
+    }
+
+private:
+    static uint16_t ReadLe16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+    static uint32_t ReadLe32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+    static uint16_t ReadBe16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+    static uint32_t ReadBe32(const uint8_t* p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+    static bool Fail(const char* reason) {
+        DEBUG_WARNING(std::string("Декодер картинок: ") + reason);
+        return false;
+    }
+
+    static bool IsValidSize(int width, int height) {
+        return width > 0 && height > 0 && width <= MAX_IMAGE_DIMENSION && height <= MAX_IMAGE_DIMENSION;
+    }
+
+    static double TimeBatch(std::vector<ImageDecodeJob>& jobs, int runs, unsigned threadCount, bool useSimd) {
+        double best = DBL_MAX;
+        for (int run = 0; run < std::max(1, runs); run++) {
+            auto start = std::chrono::steady_clock::now();
+            DecodeBatch(jobs, threadCount, useSimd);
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    }
+
+    // ---------- Перестановка и перевод каналов ----------
+
+    // BGRA -> RGBA; opaque - альфа не задана (BGRX), пишется 255. Можно на месте.
+    static void SwizzleBgra(const uint8_t* src, uint8_t* dst, int count, bool opaque, bool useSimd) {
+        int i = 0;
+#if MIPS_USE_SSE2
+        if (useSimd) {
+            const __m128i redBlue = _mm_set1_epi32(0x00FF00FF);
+            const __m128i greenAlpha = _mm_set1_epi32(opaque ? 0x0000FF00 : (int)0xFF00FF00);
+            const __m128i alpha = _mm_set1_epi32(opaque ? (int)0xFF000000 : 0);
+            for (; i + 4 <= count; i += 4) {
+                __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+                // B и R - младшие байты 16-битных половинок: меняем половинки местами
+                __m128i rb = _mm_and_si128(p, redBlue);
+                rb = _mm_shufflehi_epi16(_mm_shufflelo_epi16(rb, 0xB1), 0xB1);
+                __m128i out = _mm_or_si128(_mm_or_si128(_mm_and_si128(p, greenAlpha), rb), alpha);
+                _mm_storeu_si128((__m128i*)(dst + i * 4), out);
+            }
+        }
+#else
+        (void)useSimd;
+#endif
+        for (; i < count; i++) {
+            const uint8_t* s = src + i * 4;
+            uint8_t* d = dst + i * 4;
+            uint8_t blue = s[0];
+            d[0] = s[2];
+            d[1] = s[1];
+            d[2] = blue;
+            d[3] = opaque ? 255 : s[3];
+        }
+    }
+
+    // RGB или BGR (3 байта) -> RGBA
+    static void ExpandRgb(const uint8_t* src, uint8_t* dst, int count, bool bgr) {
+        int red = bgr ? 2 : 0;
+        int blue = bgr ? 0 : 2;
+        for (int i = 0; i < count; i++) {
+            dst[i * 4 + 0] = src[i * 3 + red];
+            dst[i * 4 + 1] = src[i * 3 + 1];
+            dst[i * 4 + 2] = src[i * 3 + blue];
+            dst[i * 4 + 3] = 255;
+        }
+    }
+
+    // Оттенки серого -> RGBA
+    static void ExpandGray(const uint8_t* src, uint8_t* dst, int count, bool useSimd) {
+        int i = 0;
+#if MIPS_USE_SSE2
+        if (useSimd) {
+            const __m128i alpha = _mm_set1_epi8((char)0xFF);
+            for (; i + 16 <= count; i += 16) {
+                __m128i gray = _mm_loadu_si128((const __m128i*)(src + i));
+                __m128i grayLo = _mm_unpacklo_epi8(gray, gray);
+                __m128i grayHi = _mm_unpackhi_epi8(gray, gray);
+                __m128i alphaLo = _mm_unpacklo_epi8(gray, alpha);
+                __m128i alphaHi = _mm_unpackhi_epi8(gray, alpha);
+                __m128i* out = (__m128i*)(dst + i * 4);
+                _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(grayLo, alphaLo));
+                _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(grayLo, alphaLo));
+                _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(grayHi, alphaHi));
+                _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(grayHi, alphaHi));
+            }
+        }
+#else
+        (void)useSimd;
+#endif
+        for (; i < count; i++) {
+            dst[i * 4 + 0] = dst[i * 4 + 1] = dst[i * 4 + 2] = src[i];
+            dst[i * 4 + 3] = 255;
+        }
+    }
+
+    // YCbCr (JFIF, BT.601) -> RGBA в 14-битной фиксированной точке. SSE2 считает те же
+    // суммы через _mm_madd_epi16 парами (Cr, 1) x (коэффициент, половина) - без расхождений.
+    static const int YCC_SHIFT = 14;
+    static const int YCC_HALF = 1 << (YCC_SHIFT - 1);
+    static const int YCC_CR_R = 22970;  // 1.40200
+    static const int YCC_CB_G = -5638;  // -0.34414
+    static const int YCC_CR_G = -11700; // -0.71414
+    static const int YCC_CB_B = 29032;  // 1.77200
+
+    static uint8_t ClampByte(int value) {
+        return (uint8_t)std::min(255, std::max(0, value));
+    }
+
+    static void YCbCrToRgba(const uint8_t* yRow, const uint8_t* cbRow, const uint8_t* crRow,
+        uint8_t* dst, int count, bool useSimd) {
+        int i = 0;
+#if MIPS_USE_SSE2
+        if (useSimd) {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i center = _mm_set1_epi16(128);
+            const __m128i one = _mm_set1_epi16(1);
+            const __m128i half = _mm_set1_epi32(YCC_HALF);
+            const __m128i alpha = _mm_set1_epi8((char)0xFF);
+            const __m128i red = _mm_set1_epi32((YCC_HALF << 16) | (uint16_t)YCC_CR_R);
+            const __m128i green = _mm_set1_epi32((int)(((uint32_t)(uint16_t)YCC_CR_G << 16) | (uint16_t)YCC_CB_G));
+            const __m128i blue = _mm_set1_epi32((YCC_HALF << 16) | (uint16_t)YCC_CB_B);
+            for (; i + 8 <= count; i += 8) {
+                __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(yRow + i)), zero);
+                __m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(cbRow + i)), zero), center);
+                __m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(crRow + i)), zero), center);
+
+                __m128i rLo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cr, one), red), YCC_SHIFT);
+                __m128i rHi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cr, one), red), YCC_SHIFT);
+                __m128i gLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cb, cr), green), half), YCC_SHIFT);
+                __m128i gHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cb, cr), green), half), YCC_SHIFT);
+                __m128i bLo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cb, one), blue), YCC_SHIFT);
+                __m128i bHi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cb, one), blue), YCC_SHIFT);
+
+                __m128i r = _mm_add_epi16(_mm_packs_epi32(rLo, rHi), y);
+                __m128i g = _mm_add_epi16(_mm_packs_epi32(gLo, gHi), y);
+                __m128i b = _mm_add_epi16(_mm_packs_epi32(bLo, bHi), y);
+                __m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+                __m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), alpha);
+                _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi16(rg, ba));
+                _mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+            }
+        }
+#else
+        (void)useSimd;
+#endif
+        for (; i < count; i++) {
+            int y = yRow[i];
+            int cb = cbRow[i] - 128;
+            int cr = crRow[i] - 128;
+            dst[i * 4 + 0] = ClampByte(y + ((cr * YCC_CR_R + YCC_HALF) >> YCC_SHIFT));
+            dst[i * 4 + 1] = ClampByte(y + ((cb * YCC_CB_G + cr * YCC_CR_G + YCC_HALF) >> YCC_SHIFT));
+            dst[i * 4 + 2] = ClampByte(y + ((cb * YCC_CB_B + YCC_HALF) >> YCC_SHIFT));
+            dst[i * 4 + 3] = 255;
+        }
+    }
+
+    // ---------- DEFLATE (zlib) для PNG ----------
+
+    // Префиксный код: таблица на INFLATE_FAST_BITS бит, длинные коды - канонический разбор
+    static const int INFLATE_FAST_BITS = 10;
+
+    struct InflateHuffman {
+        uint16_t fast[1 << INFLATE_FAST_BITS]; // (длина << 9) | символ; 0 - код длиннее
+        uint16_t counts[16];
+        uint16_t symbols[288];
+
+        bool Build(const uint8_t* lengths, int count) {
+            memset(fast, 0, sizeof(fast));
+            memset(counts, 0, sizeof(counts));
+            for (int i = 0; i < count; i++) counts[lengths[i]]++;
+            counts[0] = 0;
+
+            int left = 1;
+            for (int len = 1; len < 16; len++) {
+                left = (left << 1) - counts[len];
+                if (left < 0) return false; // Кодов больше, чем помещается
+            }
+
+            uint16_t offsets[16] = {};
+            for (int len = 1; len < 15; len++) offsets[len + 1] = offsets[len] + counts[len];
+            for (int i = 0; i < count; i++) {
+                if (lengths[i]) symbols[offsets[lengths[i]]++] = (uint16_t)i;
+            }
+
+            // Коды в потоке идут старшим битом вперёд, а биты читаются с младшего - разворачиваем
+            int code = 0;
+            int index = 0;
+            for (int len = 1; len <= INFLATE_FAST_BITS; len++) {
+                for (int k = 0; k < counts[len]; k++, code++, index++) {
+                    int reversed = 0;
+                    for (int bit = 0; bit < len; bit++) reversed |= ((code >> bit) & 1) << (len - 1 - bit);
+                    for (int j = reversed; j < (1 << INFLATE_FAST_BITS); j += 1 << len) {
+                        fast[j] = (uint16_t)((len << 9) | symbols[index]);
+                    }
+                }
+                code <<= 1;
+            }
+            return true;
+        }
+    };
+
+    class InflateStream {
+    public:
+        InflateStream(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+        uint32_t GetBits(int n) {
+            if (n == 0) return 0;
+            if (count < n) Refill();
+            uint32_t value = (uint32_t)(bits & ((1ull << n) - 1));
+            bits >>= n;
+            count -= n;
+            return value;
+        }
+
+        int Decode(const InflateHuffman& h) {
+            if (count < 16) Refill();
+            uint16_t entry = h.fast[bits & ((1 << INFLATE_FAST_BITS) - 1)];
+            if (entry) {
+                int len = entry >> 9;
+                bits >>= len;
+                count -= len;
+                return entry & 511;
+            }
+
+            int code = 0, first = 0, index = 0;
+            for (int len = 1; len < 16; len++) {
+                code |= (int)(bits & 1);
+                bits >>= 1;
+                count--;
+                int c = h.counts[len];
+                if (code - c < first) return h.symbols[index + (code - first)];
+                index += c;
+                first = (first + c) << 1;
+                code <<= 1;
+            }
+            return -1;
+        }
+
+        void AlignToByte() {
+            int drop = count & 7;
+            bits >>= drop;
+            count -= drop;
+        }
+
+        // Прочитано больше, чем есть данных (за концом подставляются нули)
+        bool Overrun() const { return (uint64_t)pos * 8 - count > (uint64_t)size * 8; }
+
+    private:
+        const uint8_t* data;
+        size_t size;
+        size_t pos = 0;
+        uint64_t bits = 0;
+        int count = 0;
+
+        void Refill() {
+            while (count <= 56) {
+                uint64_t byte = (pos < size) ? data[pos] : 0;
+                pos++;
+                bits |= byte << count;
+                count += 8;
+            }
+        }
+    };
+
+    static bool InflateBlock(InflateStream& stream, const InflateHuffman& literals, const InflateHuffman& distances,
+        uint8_t* out, size_t limit, size_t& written) {
+        static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        size_t pos = written;
+        for (;;) {
+            int symbol = stream.Decode(literals);
+            if (symbol < 0 || stream.Overrun()) return false;
+            if (symbol < 256) {
+                if (pos >= limit) return false;
+                out[pos++] = (uint8_t)symbol;
+                continue;
+            }
+            if (symbol == 256) break;
+
+            symbol -= 257;
+            if (symbol >= 29) return false;
+            size_t length = lengthBase[symbol] + stream.GetBits(lengthExtra[symbol]);
+            int distanceCode = stream.Decode(distances);
+            if (distanceCode < 0 || distanceCode >= 30) return false;
+            size_t distance = distanceBase[distanceCode] + stream.GetBits(distanceExtra[distanceCode]);
+            if (distance > pos || length > limit - pos) return false;
+
+            // Источник может перекрываться с приёмником - копируем побайтно
+            const uint8_t* from = out + pos - distance;
+            uint8_t* to = out + pos;
+            for (size_t i = 0; i < length; i++) to[i] = from[i];
+            pos += length;
+        }
+        written = pos;
+        return true;
+    }
+
+    // Поток zlib целиком в out (размер известен заранее - лишнее считается ошибкой)
+    static bool Inflate(const uint8_t* data, size_t size, uint8_t* out, size_t outSize) {
+        if (size < 2) return false;
+        uint8_t method = data[0];
+        uint8_t flags = data[1];
+        if ((method & 15) != 8 || ((method << 8) | flags) % 31 != 0 || (flags & 0x20)) return false;
+
+        static const uint8_t lengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+        static const std::pair<InflateHuffman, InflateHuffman> fixedTables = []() {
+            std::pair<InflateHuffman, InflateHuffman> tables;
+            uint8_t lengths[288];
+            for (int i = 0; i < 288; i++) lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+            tables.first.Build(lengths, 288);
+            for (int i = 0; i < 30; i++) lengths[i] = 5;
+            tables.second.Build(lengths, 30);
+            return tables;
+        }();
+
+        InflateStream stream(data + 2, size - 2);
+        InflateHuffman literals;
+        InflateHuffman distances;
+        size_t written = 0;
+        bool last = false;
+        while (!last) {
+            last = stream.GetBits(1) != 0;
+            uint32_t type = stream.GetBits(2);
+            if (type == 0) {
+                // Несжатый блок
+                stream.AlignToByte();
+                uint32_t length = stream.GetBits(16);
+                uint32_t inverted = stream.GetBits(16);
+                if (length != (~inverted & 0xFFFF) || length > outSize - written) return false;
+                for (uint32_t i = 0; i < length; i++) out[written++] = (uint8_t)stream.GetBits(8);
+                if (stream.Overrun()) return false;
+                continue;
+            }
+            if (type == 1) {
+                if (!InflateBlock(stream, fixedTables.first, fixedTables.second, out, outSize, written)) return false;
+                continue;
+            }
+            if (type != 2) return false;
+
+            int literalCount = (int)stream.GetBits(5) + 257;
+            int distanceCount = (int)stream.GetBits(5) + 1;
+            int lengthCodeCount = (int)stream.GetBits(4) + 4;
+            uint8_t codeLengths[19] = {};
+            for (int i = 0; i < lengthCodeCount; i++) codeLengths[lengthOrder[i]] = (uint8_t)stream.GetBits(3);
+            InflateHuffman lengthCodes;
+            if (!lengthCodes.Build(codeLengths, 19)) return false;
+
+            uint8_t lengths[288 + 32] = {};
+            int total = literalCount + distanceCount;
+            for (int n = 0; n < total;) {
+                int symbol = stream.Decode(lengthCodes);
+                if (symbol < 0 || stream.Overrun()) return false;
+                if (symbol < 16) {
+                    lengths[n++] = (uint8_t)symbol;
+                    continue;
+                }
+                uint8_t value = 0;
+                int repeat;
+                if (symbol == 16) {
+                    if (n == 0) return false;
+                    value = lengths[n - 1];
+                    repeat = 3 + (int)stream.GetBits(2);
+                }
+                else if (symbol == 17) {
+                    repeat = 3 + (int)stream.GetBits(3);
+                }
+                else {
+                    repeat = 11 + (int)stream.GetBits(7);
+                }
+                if (n + repeat > total) return false;
+                memset(lengths + n, value, repeat);
+                n += repeat;
+            }
+            if (lengths[256] == 0) return false;
+            if (!literals.Build(lengths, literalCount) || !distances.Build(lengths + literalCount, distanceCount)) {
+                return false;
+            }
+            if (!InflateBlock(stream, literals, distances, out, outSize, written)) return false;
+        }
+        return written == outSize;
+    }
+
+    // ---------- PNG ----------
+
+    struct PngInfo {
+        int colorType = 0;
+        int depth = 0;
+        int channels = 0;
+        uint32_t palette[256];   // RGBA в памяти
+        bool hasKey = false;     // tRNS для серого и RGB: этот цвет прозрачный
+        uint16_t key[3] = {};
+    };
+
+    static uint8_t Paeth(int a, int b, int c) {
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        if (pa <= pb && pa <= pc) return (uint8_t)a;
+        return (uint8_t)((pb <= pc) ? b : c);
+    }
+
+    static bool UnfilterRow(uint8_t* row, const uint8_t* prev, size_t rowBytes, size_t stride, int type) {
+        switch (type) {
+        case 0:
+            break;
+        case 1:
+            for (size_t i = stride; i < rowBytes; i++) row[i] += row[i - stride];
+            break;
+        case 2:
+            for (size_t i = 0; i < rowBytes; i++) row[i] += prev[i];
+            break;
+        case 3:
+            for (size_t i = 0; i < stride; i++) row[i] += prev[i] >> 1;
+            for (size_t i = stride; i < rowBytes; i++) row[i] += (uint8_t)((row[i - stride] + prev[i]) >> 1);
+            break;
+        case 4:
+            for (size_t i = 0; i < stride; i++) row[i] += prev[i];
+            for (size_t i = stride; i < rowBytes; i++) row[i] += Paeth(row[i - stride], prev[i], prev[i - stride]);
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+    // Строка после фильтров -> count пикселей RGBA
+    static void ConvertPngRow(const PngInfo& info, const uint8_t* row, int count, uint8_t* dst, bool useSimd) {
+        if (info.depth == 8 && !info.hasKey) {
+            switch (info.colorType) {
+            case 6: memcpy(dst, row, (size_t)count * 4); return;
+            case 2: ExpandRgb(row, dst, count, false); return;
+            case 0: ExpandGray(row, dst, count, useSimd); return;
+            default: break;
+            }
+        }
+
+        for (int x = 0; x < count; x++) {
+            uint8_t* d = dst + (size_t)x * 4;
+            uint16_t samples[4] = {};
+            if (info.depth < 8) {
+                int bitOffset = x * info.depth;
+                samples[0] = (row[bitOffset >> 3] >> (8 - info.depth - (bitOffset & 7))) & ((1 << info.depth) - 1);
+            }
+            else if (info.depth == 8) {
+                for (int c = 0; c < info.channels; c++) samples[c] = row[x * info.channels + c];
+            }
+            else {
+                for (int c = 0; c < info.channels; c++) samples[c] = ReadBe16(row + (size_t)(x * info.channels + c) * 2);
+            }
+
+            if (info.colorType == 3) {
+                memcpy(d, &info.palette[samples[0]], 4);
+                continue;
+            }
+
+            // 16 бит - старший байт; 1/2/4 бита (только серый) - растягиваем до 0..255
+            auto toByte = [&](uint16_t value) -> uint8_t {
+                if (info.depth == 16) return (uint8_t)(value >> 8);
+                if (info.depth < 8) return (uint8_t)(value * (255 / ((1 << info.depth) - 1)));
+                return (uint8_t)value;
+            };
+            bool gray = (info.colorType == 0 || info.colorType == 4);
+            d[0] = toByte(samples[0]);
+            d[1] = gray ? d[0] : toByte(samples[1]);
+            d[2] = gray ? d[0] : toByte(samples[2]);
+            if (info.colorType == 4) d[3] = toByte(samples[1]);
+            else if (info.colorType == 6) d[3] = toByte(samples[3]);
+            else {
+                bool transparent = info.hasKey && samples[0] == info.key[0] &&
+                    (gray || (samples[1] == info.key[1] && samples[2] == info.key[2]));
+                d[3] = transparent ? 0 : 255;
+            }
+        }
+    }
+
+    static bool DecodePng(const uint8_t* data, size_t size, int& width, int& height,
+        std::vector<uint8_t>* pixels, bool useSimd) {
+
+        PngInfo info;
+        for (int i = 0; i < 256; i++) {
+            uint8_t black[4] = { 0, 0, 0, 255 };
+            memcpy(&info.palette[i], black, 4);
+        }
+        int interlace = 0;
+        bool headerFound = false;
+
+        // IDAT обычно несколько - склеиваем, одиночный читаем на месте
+        const uint8_t* compressed = nullptr;
+        size_t compressedSize = 0;
+        std::vector<uint8_t> joined;
+
+        size_t pos = 8;
+        while (pos + 12 <= size) {
+            uint32_t length = ReadBe32(data + pos);
+            const uint8_t* type = data + pos + 4;
+            const uint8_t* chunk = data + pos + 8;
+            if (length > size - pos - 12) return Fail("PNG: обрезанный блок");
+
+            if (memcmp(type, "IHDR", 4) == 0) {
+                if (length < 13) return Fail("PNG: неверный IHDR");
+                width = (int)std::min<uint32_t>(ReadBe32(chunk), INT_MAX);
+                height = (int)std::min<uint32_t>(ReadBe32(chunk + 4), INT_MAX);
+                info.depth = chunk[8];
+                info.colorType = chunk[9];
+                interlace = chunk[12];
+                static const int channelCounts[7] = { 1, 0, 3, 1, 2, 0, 4 };
+                info.channels = (info.colorType <= 6) ? channelCounts[info.colorType] : 0;
+                bool validDepth = (info.depth == 8) || (info.depth == 16 && info.colorType != 3) ||
+                    ((info.depth == 1 || info.depth == 2 || info.depth == 4) && (info.colorType == 0 || info.colorType == 3));
+                if (info.channels == 0 || !validDepth || chunk[10] != 0 || chunk[11] != 0 || interlace > 1) {
+                    return Fail("PNG: неподдерживаемый формат пикселей");
+                }
+                if (!IsValidSize(width, height)) return Fail("PNG: недопустимый размер");
+                headerFound = true;
+                if (!pixels) return true;
+            }
+            else if (!headerFound) {
+                return Fail("PNG: нет IHDR");
+            }
+            else if (memcmp(type, "PLTE", 4) == 0) {
+                for (uint32_t i = 0; i < std::min<uint32_t>(length / 3, 256); i++) {
+                    uint8_t entry[4] = { chunk[i * 3], chunk[i * 3 + 1], chunk[i * 3 + 2], 255 };
+                    memcpy(&info.palette[i], entry, 4);
+                }
+            }
+            else if (memcmp(type, "tRNS", 4) == 0) {
+                if (info.colorType == 3) {
+                    for (uint32_t i = 0; i < std::min<uint32_t>(length, 256); i++) {
+                        ((uint8_t*)&info.palette[i])[3] = chunk[i];
+                    }
+                }
+                else if (info.colorType == 0 && length >= 2) {
+                    info.hasKey = true;
+                    info.key[0] = ReadBe16(chunk);
+                }
+                else if (info.colorType == 2 && length >= 6) {
+                    info.hasKey = true;
+                    for (int c = 0; c < 3; c++) info.key[c] = ReadBe16(chunk + c * 2);
+                }
+            }
+            else if (memcmp(type, "IDAT", 4) == 0) {
+                if (!compressed) {
+                    compressed = chunk;
+                    compressedSize = length;
+                }
+                else {
+                    if (joined.empty()) joined.assign(compressed, compressed + compressedSize);
+                    joined.insert(joined.end(), chunk, chunk + length);
+                    compressed = joined.data();
+                    compressedSize = joined.size();
+                }
+            }
+            else if (memcmp(type, "IEND", 4) == 0) {
+                break;
+            }
+            pos += 12 + (size_t)length;
+        }
+        if (!headerFound) return Fail("PNG: нет IHDR");
+        if (!compressed) return Fail("PNG: нет данных изображения");
+
+        // Проходы Adam7; без чересстрочности - один проход на всю картинку
+        static const int adam7[7][4] = { // x0, y0, шаг x, шаг y
+            { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+            { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+        static const int single[1][4] = { { 0, 0, 1, 1 } };
+        const int (*passes)[4] = interlace ? adam7 : single;
+        int passCount = interlace ? 7 : 1;
+
+        size_t bitsPerPixel = (size_t)info.channels * info.depth;
+        size_t stride = std::max<size_t>(1, bitsPerPixel / 8);
+        size_t rawSize = 0;
+        for (int p = 0; p < passCount; p++) {
+            size_t passWidth = (width - passes[p][0] + passes[p][2] - 1) / passes[p][2];
+            size_t passHeight = (height - passes[p][1] + passes[p][3] - 1) / passes[p][3];
+            if (passWidth && passHeight) rawSize += passHeight * (1 + (passWidth * bitsPerPixel + 7) / 8);
+        }
+
+        std::vector<uint8_t> raw(rawSize);
+        if (!Inflate(compressed, compressedSize, raw.data(), raw.size())) return Fail("PNG: повреждённые данные");
+
+        pixels->resize((size_t)width * height * 4);
+        std::vector<uint8_t> zeroRow;
+        std::vector<uint8_t> line;
+        size_t offset = 0;
+        for (int p = 0; p < passCount; p++) {
+            int x0 = passes[p][0], y0 = passes[p][1], stepX = passes[p][2], stepY = passes[p][3];
+            int passWidth = (width - x0 + stepX - 1) / stepX;
+            int passHeight = (height - y0 + stepY - 1) / stepY;
+            if (passWidth <= 0 || passHeight <= 0) continue;
+            size_t rowBytes = ((size_t)passWidth * bitsPerPixel + 7) / 8;
+            zeroRow.assign(rowBytes, 0);
+            if (interlace) line.resize((size_t)passWidth * 4);
+
+            const uint8_t* prev = zeroRow.data();
+            for (int y = 0; y < passHeight; y++) {
+                uint8_t* row = raw.data() + offset + 1;
+                if (!UnfilterRow(row, prev, rowBytes, stride, raw[offset])) return Fail("PNG: неизвестный фильтр строки");
+                offset += 1 + rowBytes;
+                prev = row;
+
+                uint8_t* dst = pixels->data() + ((size_t)(y0 + y * stepY) * width) * 4;
+                if (!interlace) {
+                    ConvertPngRow(info, row, passWidth, dst, useSimd);
+                    continue;
+                }
+                ConvertPngRow(info, row, passWidth, line.data(), useSimd);
+                for (int x = 0; x < passWidth; x++) {
+                    memcpy(dst + (size_t)(x0 + x * stepX) * 4, line.data() + (size_t)x * 4, 4);
+                }
+            }
+        }
+        return true;
+    }
+
+    // ---------- JPEG ----------
+
+    // Порядок зигзага -> естественный порядок коэффициентов блока 8x8
+    static const uint8_t* GetZigzag() {
+        static const uint8_t zigzag[64] = {
+            0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+            12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+            35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+            58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+        return zigzag;
+    }
+
+    static const int JPEG_FAST_BITS = 9;
+
+    struct JpegHuffman {
+        uint16_t fast[1 << JPEG_FAST_BITS]; // (длина << 8) | значение; 0 - код длиннее
+        uint8_t values[256];
+        int32_t maxCode[17];                // Наибольший код длины l; -1 - таких нет
+        int32_t delta[17];                  // Индекс значения = код + delta[l]
+        bool defined = false;
+
+        bool Build(const uint8_t* counts, const uint8_t* symbols, int total) {
+            memset(fast, 0, sizeof(fast));
+            memcpy(values, symbols, total);
+            int code = 0;
+            int index = 0;
+            for (int len = 1; len <= 16; len++) {
+                delta[len] = index - code;
+                for (int k = 0; k < counts[len - 1]; k++, code++, index++) {
+                    if (len > JPEG_FAST_BITS) continue;
+                    int first = code << (JPEG_FAST_BITS - len);
+                    for (int j = 0; j < (1 << (JPEG_FAST_BITS - len)); j++) {
+                        fast[first + j] = (uint16_t)((len << 8) | values[index]);
+                    }
+                }
+                maxCode[len] = counts[len - 1] ? code - 1 : -1;
+                if (code > (1 << len)) return false;
+                code <<= 1;
+            }
+            defined = true;
+            return true;
+        }
+    };
+
+    // Биты энтропийного сегмента (старшим вперёд, буфер 64 бита): FF 00 -> FF,
+    // на маркере дальше подставляются нули
+    class JpegBitReader {
+    public:
+        JpegBitReader(const uint8_t* data, size_t size, size_t pos) : data(data), size(size), pos(pos) {}
+
+        uint32_t GetBits(int n) {
+            if (n == 0) return 0;
+            if (count < n) Refill();
+            uint32_t value = (uint32_t)(bits >> (64 - n));
+            bits <<= n;
+            count -= n;
+            return value;
+        }
+
+        int Decode(const JpegHuffman& h) {
+            if (count < 16) Refill();
+            uint16_t entry = h.fast[bits >> (64 - JPEG_FAST_BITS)];
+            if (entry) {
+                int len = entry >> 8;
+                bits <<= len;
+                count -= len;
+                return entry & 255;
+            }
+            for (int len = JPEG_FAST_BITS + 1; len <= 16; len++) {
+                int32_t code = (int32_t)(bits >> (64 - len));
+                if (code <= h.maxCode[len]) {
+                    bits <<= len;
+                    count -= len;
+                    return h.values[(code + h.delta[len]) & 255];
+                }
+            }
+            return -1;
+        }
+
+        // Маркер RSTn после интервала: остаток байта отбрасывается, чтение с нуля
+        void Restart() {
+            if (!marker) {
+                while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7)) pos++;
+            }
+            if (pos + 1 < size && data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7) pos += 2;
+            bits = 0;
+            count = 0;
+            marker = false;
+        }
+
+        // Начало следующего маркера (не RSTn) после сегмента
+        size_t FindNextMarker() const {
+            size_t p = pos;
+            while (p + 1 < size) {
+                if (data[p] == 0xFF && data[p + 1] != 0 && data[p + 1] != 0xFF &&
+                    !(data[p + 1] >= 0xD0 && data[p + 1] <= 0xD7)) {
+                    return p;
+                }
+                p++;
+            }
+            return size;
+        }
+
+    private:
+        const uint8_t* data;
+        size_t size;
+        size_t pos;
+        uint64_t bits = 0;
+        int count = 0;
+        bool marker = false;
+
+        void Refill() {
+            while (count <= 56) {
+                uint64_t byte = 0;
+                if (!marker && pos < size) {
+                    byte = data[pos];
+                    if (byte == 0xFF) {
+                        uint8_t next = (pos + 1 < size) ? data[pos + 1] : 0xD9;
+                        if (next == 0) pos += 2;
+                        else if (next == 0xFF) pos++; // Байт-заполнитель перед маркером
+                        else {
+                            marker = true;
+                            byte = 0;
+                        }
+                    }
+                    else {
+                        pos++;
+                    }
+                }
+                bits |= byte << (56 - count);
+                count += 8;
+            }
+        }
+    };
+
+    struct JpegComponent {
+        int id = 0;
+        int h = 1;               // Доля выборки по горизонтали и вертикали
+        int v = 1;
+        int quantTable = 0;
+        int dcTable = 0;
+        int acTable = 0;
+        int dcPrediction = 0;
+        int blocksX = 0;         // Сетка блоков с добивкой до целых MCU
+        int blocksY = 0;
+        int usedBlocksX = 0;     // Блоки, покрывающие картинку (неперемежающийся скан)
+        int usedBlocksY = 0;
+        int width = 0;           // Размер плоскости до добивки
+        int height = 0;
+        std::vector<int16_t> coefficients; // 64 на блок, естественный порядок, без деквантования
+        std::vector<uint8_t> plane;        // После IDCT: blocksX * 8 на blocksY * 8
+    };
+
+    struct JpegState {
+        uint16_t quant[4][64] = {};
+        JpegHuffman dc[4];
+        JpegHuffman ac[4];
+        std::vector<JpegComponent> components;
+        bool progressive = false;
+        int restartInterval = 0;
+        int adobeTransform = -1; // Из APP14: 0 - RGB без преобразования
+        int maxH = 1;
+        int maxV = 1;
+        int mcusX = 0;
+        int mcusY = 0;
+        int eobRun = 0;
+    };
+
+    static int Extend(int value, int bits) {
+        return (bits && value < (1 << (bits - 1))) ? value - (1 << bits) + 1 : value;
+    }
+
+    static bool DecodeBlockBaseline(JpegState& st, JpegBitReader& reader, JpegComponent& comp, int16_t* block) {
+        const uint8_t* zigzag = GetZigzag();
+        int size = reader.Decode(st.dc[comp.dcTable]);
+        if (size < 0 || size > 15) return false;
+        comp.dcPrediction = (int16_t)(comp.dcPrediction + Extend((int)reader.GetBits(size), size));
+        block[0] = (int16_t)comp.dcPrediction;
+
+        for (int k = 1; k < 64;) {
+            int rs = reader.Decode(st.ac[comp.acTable]);
+            if (rs < 0) return false;
+            int run = rs >> 4;
+            int bits = rs & 15;
+            if (bits == 0) {
+                if (run != 15) break; // Конец блока
+                k += 16;
+                continue;
+            }
+            k += run;
+            if (k > 63) return false;
+            block[zigzag[k++]] = (int16_t)Extend((int)reader.GetBits(bits), bits);
+        }
+        return true;
+    }
+
+    static bool DecodeBlockDc(JpegState& st, JpegBitReader& reader, JpegComponent& comp, int16_t* block,
+        int approxHigh, int approxLow) {
+        if (approxHigh == 0) {
+            int size = reader.Decode(st.dc[comp.dcTable]);
+            if (size < 0 || size > 15) return false;
+            comp.dcPrediction = (int16_t)(comp.dcPrediction + Extend((int)reader.GetBits(size), size));
+            block[0] = (int16_t)(comp.dcPrediction * (1 << approxLow));
+        }
+        else if (reader.GetBits(1)) {
+            block[0] |= (int16_t)(1 << approxLow);
+        }
+        return true;
+    }
+
+    static bool DecodeBlockAcFirst(JpegState& st, JpegBitReader& reader, JpegComponent& comp, int16_t* block,
+        int start, int end, int approxLow) {
+        if (st.eobRun > 0) {
+            st.eobRun--;
+            return true;
+        }
+        const uint8_t* zigzag = GetZigzag();
+        for (int k = start; k <= end;) {
+            int rs = reader.Decode(st.ac[comp.acTable]);
+            if (rs < 0) return false;
+            int run = rs >> 4;
+            int bits = rs & 15;
+            if (bits == 0) {
+                if (run < 15) {
+                    st.eobRun = (1 << run) - 1 + (int)reader.GetBits(run);
+                    break;
+                }
+                k += 16;
+                continue;
+            }
+            k += run;
+            if (k > 63) return false;
+            block[zigzag[k++]] = (int16_t)(Extend((int)reader.GetBits(bits), bits) * (1 << approxLow));
+        }
+        return true;
+    }
+
+    // Уточнение AC: новые коэффициенты +-1 и по биту каждому уже ненулевому на пути
+    static bool DecodeBlockAcRefine(JpegState& st, JpegBitReader& reader, JpegComponent& comp, int16_t* block,
+        int start, int end, int approxLow) {
+        const uint8_t* zigzag = GetZigzag();
+        int plus = 1 << approxLow;
+        int minus = -1 * (1 << approxLow);
+        auto refine = [&](int16_t& coef) {
+            if (reader.GetBits(1) && (coef & plus) == 0) coef = (int16_t)(coef + (coef >= 0 ? plus : minus));
+        };
+
+        int k = start;
+        if (st.eobRun == 0) {
+            for (; k <= end; k++) {
+                int rs = reader.Decode(st.ac[comp.acTable]);
+                if (rs < 0) return false;
+                int run = rs >> 4;
+                int value = 0;
+                if ((rs & 15) != 0) {
+                    if ((rs & 15) != 1) return false;
+                    value = reader.GetBits(1) ? plus : minus;
+                }
+                else if (run != 15) {
+                    st.eobRun = (1 << run) + (int)reader.GetBits(run);
+                    break;
+                }
+
+                for (; k <= end; k++) {
+                    int16_t& coef = block[zigzag[k]];
+                    if (coef != 0) refine(coef);
+                    else if (run-- == 0) break;
+                }
+                if (value != 0 && k <= end) block[zigzag[k]] = (int16_t)value;
+            }
+        }
+        if (st.eobRun > 0) {
+            for (; k <= end; k++) {
+                int16_t& coef = block[zigzag[k]];
+                if (coef != 0) refine(coef);
+            }
+            st.eobRun--;
+        }
+        return true;
+    }
+
+    // Скан: все блоки его компонентов (перемежающийся - по MCU), с перезапусками
+    static bool DecodeJpegScan(JpegState& st, const uint8_t* segment, size_t length,
+        const uint8_t* data, size_t size, size_t& pos) {
+        int count = segment[0];
+        if (count < 1 || count > 4 || length < (size_t)(4 + count * 2)) return Fail("JPEG: неверный заголовок скана");
+
+        JpegComponent* scan[4] = {};
+        for (int i = 0; i < count; i++) {
+            for (auto& comp : st.components) {
+                if (comp.id == segment[1 + i * 2]) scan[i] = &comp;
+            }
+            if (!scan[i]) return Fail("JPEG: скан ссылается на неизвестный компонент");
+            scan[i]->dcTable = segment[2 + i * 2] >> 4;
+            scan[i]->acTable = segment[2 + i * 2] & 15;
+            if (scan[i]->dcTable > 3 || scan[i]->acTable > 3) return Fail("JPEG: неверная таблица Хаффмана");
+        }
+        int start = segment[1 + count * 2];
+        int end = segment[2 + count * 2];
+        int approxHigh = segment[3 + count * 2] >> 4;
+        int approxLow = segment[3 + count * 2] & 15;
+        if (!st.progressive) {
+            start = 0;
+            end = 63;
+            approxHigh = approxLow = 0;
+        }
+        else if (start > end || end > 63 || approxLow > 13 || (start == 0 && end != 0) || (start > 0 && count != 1)) {
+            return Fail("JPEG: неверные параметры прогрессивного скана");
+        }
+
+        bool dcScan = st.progressive && start == 0;
+        for (int i = 0; i < count; i++) {
+            bool needDc = !st.progressive || (dcScan && approxHigh == 0);
+            bool needAc = !st.progressive || !dcScan;
+            if ((needDc && !st.dc[scan[i]->dcTable].defined) || (needAc && !st.ac[scan[i]->acTable].defined)) {
+                return Fail("JPEG: не задана таблица Хаффмана");
+            }
+            scan[i]->dcPrediction = 0;
+        }
+        st.eobRun = 0;
+
+        JpegBitReader reader(data, size, pos);
+        auto decode = [&](JpegComponent& comp, int bx, int by) {
+            int16_t* block = comp.coefficients.data() + ((size_t)by * comp.blocksX + bx) * 64;
+            if (!st.progressive) return DecodeBlockBaseline(st, reader, comp, block);
+            if (dcScan) return DecodeBlockDc(st, reader, comp, block, approxHigh, approxLow);
+            if (approxHigh == 0) return DecodeBlockAcFirst(st, reader, comp, block, start, end, approxLow);
+            return DecodeBlockAcRefine(st, reader, comp, block, start, end, approxLow);
+        };
+        auto restart = [&](int unit) {
+            if (st.restartInterval == 0 || unit == 0 || unit % st.restartInterval != 0) return;
+            reader.Restart();
+            for (int i = 0; i < count; i++) scan[i]->dcPrediction = 0;
+            st.eobRun = 0;
+        };
+
+        if (count == 1) {
+            // Неперемежающийся скан: MCU - один блок, только блоки внутри картинки
+            JpegComponent& comp = *scan[0];
+            int unit = 0;
+            for (int by = 0; by < comp.usedBlocksY; by++) {
+                for (int bx = 0; bx < comp.usedBlocksX; bx++, unit++) {
+                    restart(unit);
+                    if (!decode(comp, bx, by)) return Fail("JPEG: повреждённые данные скана");
+                }
+            }
+        }
+        else {
+            int unit = 0;
+            for (int my = 0; my < st.mcusY; my++) {
+                for (int mx = 0; mx < st.mcusX; mx++, unit++) {
+                    restart(unit);
+                    for (int i = 0; i < count; i++) {
+                        JpegComponent& comp = *scan[i];
+                        for (int v = 0; v < comp.v; v++) {
+                            for (int h = 0; h < comp.h; h++) {
+                                if (!decode(comp, mx * comp.h + h, my * comp.v + v)) return Fail("JPEG: повреждённые данные скана");
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        pos = reader.FindNextMarker();
+        return true;
+    }
+
+    // Целочисленное обратное DCT (как jidctint в libjpeg): 13 бит дробной части, 2 - запас между
+    // проходами. 64 бита - чтобы испорченные коэффициенты не переполняли промежуточные суммы.
+    static void Idct8(int64_t s0, int64_t s1, int64_t s2, int64_t s3, int64_t s4, int64_t s5, int64_t s6, int64_t s7,
+        int64_t out[8]) {
+        int64_t z1 = (s2 + s6) * 4433;
+        int64_t tmp2 = z1 - s6 * 15137;
+        int64_t tmp3 = z1 + s2 * 6270;
+        int64_t tmp0 = (s0 + s4) * 8192;
+        int64_t tmp1 = (s0 - s4) * 8192;
+        int64_t tmp10 = tmp0 + tmp3;
+        int64_t tmp13 = tmp0 - tmp3;
+        int64_t tmp11 = tmp1 + tmp2;
+        int64_t tmp12 = tmp1 - tmp2;
+
+        tmp0 = s7;
+        tmp1 = s5;
+        tmp2 = s3;
+        tmp3 = s1;
+        z1 = tmp0 + tmp3;
+        int64_t z2 = tmp1 + tmp2;
+        int64_t z3 = tmp0 + tmp2;
+        int64_t z4 = tmp1 + tmp3;
+        int64_t z5 = (z3 + z4) * 9633;
+        tmp0 *= 2446;
+        tmp1 *= 16819;
+        tmp2 *= 25172;
+        tmp3 *= 12299;
+        z1 *= -7373;
+        z2 *= -20995;
+        z3 = z3 * -16069 + z5;
+        z4 = z4 * -3196 + z5;
+        tmp0 += z1 + z3;
+        tmp1 += z2 + z4;
+        tmp2 += z2 + z3;
+        tmp3 += z1 + z4;
+
+        out[0] = tmp10 + tmp3;
+        out[7] = tmp10 - tmp3;
+        out[1] = tmp11 + tmp2;
+        out[6] = tmp11 - tmp2;
+        out[2] = tmp12 + tmp1;
+        out[5] = tmp12 - tmp1;
+        out[3] = tmp13 + tmp0;
+        out[4] = tmp13 - tmp0;
+    }
+
+    static void IdctBlock(const int16_t* in, const uint16_t* quant, uint8_t* out, size_t stride) {
+        int64_t workspace[64];
+        for (int c = 0; c < 8; c++) {
+            bool acZero = true;
+            for (int r = 1; r < 8; r++) acZero = acZero && in[r * 8 + c] == 0;
+            if (acZero) {
+                // Частый случай: в столбце только DC
+                int64_t dc = (int64_t)in[c] * quant[c] * 4;
+                for (int r = 0; r < 8; r++) workspace[r * 8 + c] = dc;
+                continue;
+            }
+            int64_t s[8];
+            for (int r = 0; r < 8; r++) s[r] = (int64_t)in[r * 8 + c] * quant[r * 8 + c];
+            int64_t column[8];
+            Idct8(s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], column);
+            for (int r = 0; r < 8; r++) workspace[r * 8 + c] = (column[r] + (1 << 10)) >> 11;
+        }
+        for (int r = 0; r < 8; r++) {
+            const int64_t* w = workspace + r * 8;
+            int64_t row[8];
+            Idct8(w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], row);
+            uint8_t* dst = out + r * stride;
+            for (int c = 0; c < 8; c++) {
+                dst[c] = (uint8_t)std::min<int64_t>(255, std::max<int64_t>(0, ((row[c] + (1 << 17)) >> 18) + 128));
+            }
+        }
+    }
+
+    // Строка компонента в полном разрешении; 2x по горизонтали, вертикали и 2x2 - треугольным
+    // фильтром (как fancy upsampling в libjpeg), остальные доли - повтором отсчётов
+    static const uint8_t* UpsampleRow(const JpegState& st, const JpegComponent& comp, int y, int width, uint8_t* temp) {
+        int scaleX = st.maxH / comp.h;
+        int scaleY = st.maxV / comp.v;
+        size_t stride = (size_t)comp.blocksX * 8;
+        int n = comp.width;
+        if (scaleX == 1 && scaleY == 1) return comp.plane.data() + (size_t)y * stride;
+
+        if (scaleX == 2 && scaleY == 1) {
+            const uint8_t* in = comp.plane.data() + (size_t)y * stride;
+            if (n == 1) {
+                temp[0] = temp[1] = in[0];
+                return temp;
+            }
+            temp[0] = in[0];
+            temp[1] = (uint8_t)((in[0] * 3 + in[1] + 2) >> 2);
+            for (int i = 1; i < n - 1; i++) {
+                temp[i * 2] = (uint8_t)((in[i] * 3 + in[i - 1] + 1) >> 2);
+                temp[i * 2 + 1] = (uint8_t)((in[i] * 3 + in[i + 1] + 2) >> 2);
+            }
+            temp[n * 2 - 2] = (uint8_t)((in[n - 1] * 3 + in[n - 2] + 1) >> 2);
+            temp[n * 2 - 1] = in[n - 1];
+            return temp;
+        }
+
+        if (scaleX == 1 && scaleY == 2) {
+            int nearY = y / 2;
+            int farY = (y & 1) ? std::min(nearY + 1, comp.height - 1) : std::max(nearY - 1, 0);
+            const uint8_t* nearRow = comp.plane.data() + (size_t)nearY * stride;
+            const uint8_t* farRow = comp.plane.data() + (size_t)farY * stride;
+            int bias = (y & 1) ? 2 : 1;
+            for (int i = 0; i < n; i++) temp[i] = (uint8_t)((nearRow[i] * 3 + farRow[i] + bias) >> 2);
+            return temp;
+        }
+
+        if (scaleX == 2 && scaleY == 2) {
+            int nearY = y / 2;
+            int farY = (y & 1) ? std::min(nearY + 1, comp.height - 1) : std::max(nearY - 1, 0);
+            const uint8_t* nearRow = comp.plane.data() + (size_t)nearY * stride;
+            const uint8_t* farRow = comp.plane.data() + (size_t)farY * stride;
+            auto sum = [&](int i) { return nearRow[i] * 3 + farRow[i]; };
+            if (n == 1) {
+                temp[0] = temp[1] = (uint8_t)((sum(0) * 4 + 8) >> 4);
+                return temp;
+            }
+            temp[0] = (uint8_t)((sum(0) * 4 + 8) >> 4);
+            temp[1] = (uint8_t)((sum(0) * 3 + sum(1) + 7) >> 4);
+            for (int i = 1; i < n - 1; i++) {
+                int current = sum(i);
+                temp[i * 2] = (uint8_t)((current * 3 + sum(i - 1) + 8) >> 4);
+                temp[i * 2 + 1] = (uint8_t)((current * 3 + sum(i + 1) + 7) >> 4);
+            }
+            temp[n * 2 - 2] = (uint8_t)((sum(n - 1) * 3 + sum(n - 2) + 8) >> 4);
+            temp[n * 2 - 1] = (uint8_t)((sum(n - 1) * 4 + 7) >> 4);
+            return temp;
+        }
+
+        const uint8_t* in = comp.plane.data() + (size_t)(y / scaleY) * stride;
+        for (int x = 0; x < width; x++) temp[x] = in[x / scaleX];
+        return temp;
+    }
+
+    static bool DecodeJpeg(const uint8_t* data, size_t size, int& width, int& height,
+        std::vector<uint8_t>* pixels, bool useSimd) {
+
+        JpegState st;
+        bool frameFound = false;
+        bool scanFound = false;
+        size_t pos = 2;
+        while (pos + 4 <= size) {
+            if (data[pos] != 0xFF) {
+                pos++; // Мусор между сегментами
+                continue;
+            }
+            uint8_t marker = data[pos + 1];
+            if (marker == 0xFF) {
+                pos++;
+                continue;
+            }
+            pos += 2;
+            if (marker == 0xD9) break;
+            if ((marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) continue;
+
+            size_t length = ReadBe16(data + pos);
+            if (length < 2 || pos + length > size) return Fail("JPEG: обрезанный сегмент");
+            const uint8_t* segment = data + pos + 2;
+            size_t segmentLength = length - 2;
+
+            if (marker == 0xDB) {
+                const uint8_t* zigzag = GetZigzag();
+                for (size_t p = 0; p < segmentLength;) {
+                    int precision = segment[p] >> 4;
+                    int table = segment[p] & 15;
+                    size_t tableSize = 1 + 64 * (precision ? 2 : 1);
+                    if (table > 3 || precision > 1 || p + tableSize > segmentLength) return Fail("JPEG: неверная таблица квантования");
+                    for (int i = 0; i < 64; i++) {
+                        st.quant[table][zigzag[i]] = precision ? ReadBe16(segment + p + 1 + i * 2) : segment[p + 1 + i];
+                    }
+                    p += tableSize;
+                }
+            }
+            else if (marker == 0xC4) {
+                for (size_t p = 0; p < segmentLength;) {
+                    int tableClass = segment[p] >> 4;
+                    int table = segment[p] & 15;
+                    if (tableClass > 1 || table > 3 || p + 17 > segmentLength) return Fail("JPEG: неверная таблица Хаффмана");
+                    int total = 0;
+                    for (int i = 0; i < 16; i++) total += segment[p + 1 + i];
+                    if (total > 256 || p + 17 + total > segmentLength) return Fail("JPEG: неверная таблица Хаффмана");
+                    JpegHuffman& huffman = tableClass ? st.ac[table] : st.dc[table];
+                    if (!huffman.Build(segment + p + 1, segment + p + 17, total)) return Fail("JPEG: неверная таблица Хаффмана");
+                    p += 17 + total;
+                }
+            }
+            else if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2) {
+                if (frameFound) return Fail("JPEG: второй кадр");
+                if (segmentLength < 6 || segment[0] != 8) return Fail("JPEG: поддерживается только 8 бит на канал");
+                height = ReadBe16(segment + 1);
+                width = ReadBe16(segment + 3);
+                int count = segment[5];
+                if (!IsValidSize(width, height)) return Fail("JPEG: недопустимый размер");
+                if ((count != 1 && count != 3) || segmentLength < (size_t)(6 + count * 3)) {
+                    return Fail("JPEG: поддерживаются только серый и цветной (3 компонента)");
+                }
+                st.progressive = (marker == 0xC2);
+                st.components.resize(count);
+                for (int i = 0; i < count; i++) {
+                    JpegComponent& comp = st.components[i];
+                    comp.id = segment[6 + i * 3];
+                    comp.h = segment[7 + i * 3] >> 4;
+                    comp.v = segment[7 + i * 3] & 15;
+                    comp.quantTable = segment[8 + i * 3];
+                    if (comp.h < 1 || comp.h > 4 || comp.v < 1 || comp.v > 4 || comp.quantTable > 3) {
+                        return Fail("JPEG: неверные параметры компонента");
+                    }
+                    st.maxH = std::max(st.maxH, comp.h);
+                    st.maxV = std::max(st.maxV, comp.v);
+                }
+                frameFound = true;
+                if (!pixels) return true;
+
+                st.mcusX = (width + st.maxH * 8 - 1) / (st.maxH * 8);
+                st.mcusY = (height + st.maxV * 8 - 1) / (st.maxV * 8);
+                for (auto& comp : st.components) {
+                    if (st.maxH % comp.h != 0 || st.maxV % comp.v != 0) return Fail("JPEG: неподдерживаемые доли выборки");
+                    comp.width = (width * comp.h + st.maxH - 1) / st.maxH;
+                    comp.height = (height * comp.v + st.maxV - 1) / st.maxV;
+                    comp.blocksX = st.mcusX * comp.h;
+                    comp.blocksY = st.mcusY * comp.v;
+                    comp.usedBlocksX = (comp.width + 7) / 8;
+                    comp.usedBlocksY = (comp.height + 7) / 8;
+                    comp.coefficients.assign((size_t)comp.blocksX * comp.blocksY * 64, 0);
+                }
+            }
+            else if ((marker >= 0xC3 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+                return Fail("JPEG: lossless, иерархический и арифметический не поддерживаются");
+            }
+            else if (marker == 0xDD) {
+                if (segmentLength < 2) return Fail("JPEG: неверный DRI");
+                st.restartInterval = ReadBe16(segment);
+            }
+            else if (marker == 0xEE && segmentLength >= 12 && memcmp(segment, "Adobe", 5) == 0) {
+                st.adobeTransform = segment[11];
+            }
+            else if (marker == 0xDA) {
+                if (!frameFound) return Fail("JPEG: скан до заголовка кадра");
+                size_t scanPos = pos + length;
+                if (!DecodeJpegScan(st, segment, segmentLength, data, size, scanPos)) return false;
+                scanFound = true;
+                pos = scanPos;
+                continue;
+            }
+            pos += length;
+        }
+        if (!frameFound) return Fail("JPEG: нет заголовка кадра");
+        if (!scanFound) return Fail("JPEG: нет данных изображения");
+
+        for (auto& comp : st.components) {
+            size_t stride = (size_t)comp.blocksX * 8;
+            comp.plane.resize(stride * comp.blocksY * 8);
+            const uint16_t* quant = st.quant[comp.quantTable];
+            for (int by = 0; by < comp.usedBlocksY; by++) {
+                for (int bx = 0; bx < comp.usedBlocksX; bx++) {
+                    const int16_t* block = comp.coefficients.data() + ((size_t)by * comp.blocksX + bx) * 64;
+                    IdctBlock(block, quant, comp.plane.data() + (size_t)by * 8 * stride + bx * 8, stride);
+                }
+            }
+            std::vector<int16_t>().swap(comp.coefficients);
+        }
+
+        // Три компонента - YCbCr, если APP14 или идентификаторы R, G, B не говорят об RGB
+        bool rgb = st.components.size() == 3 && (st.adobeTransform == 0 ||
+            (st.components[0].id == 'R' && st.components[1].id == 'G' && st.components[2].id == 'B'));
+        pixels->resize((size_t)width * height * 4);
+        std::vector<uint8_t> temp[3];
+        for (auto& row : temp) row.resize((size_t)width + 16);
+        for (int y = 0; y < height; y++) {
+            uint8_t* dst = pixels->data() + (size_t)y * width * 4;
+            const uint8_t* rows[3] = {};
+            for (size_t c = 0; c < st.components.size(); c++) rows[c] = UpsampleRow(st, st.components[c], y, width, temp[c].data());
+
+            if (st.components.size() == 1) {
+                ExpandGray(rows[0], dst, width, useSimd);
+            }
+            else if (rgb) {
+                for (int x = 0; x < width; x++) {
+                    dst[x * 4 + 0] = rows[0][x];
+                    dst[x * 4 + 1] = rows[1][x];
+                    dst[x * 4 + 2] = rows[2][x];
+                    dst[x * 4 + 3] = 255;
+                }
+            }
+            else {
+                YCbCrToRgba(rows[0], rows[1], rows[2], dst, width, useSimd);
+            }
+        }
+        return true;
+    }
+
+    // ---------- BMP ----------
+
+    // Канал по маске битов: сдвиг и растяжение до 8 бит
+    struct BmpChannel {
+        uint32_t mask = 0;
+        int shift = 0;
+        int bits = 0;
+
+        void Init(uint32_t channelMask) {
+            mask = channelMask;
+            shift = 0;
+            bits = 0;
+            if (!mask) return;
+            while (!((mask >> shift) & 1)) shift++;
+            while (shift + bits < 32 && ((mask >> (shift + bits)) & 1)) bits++;
+        }
+
+        uint8_t Extract(uint32_t value, uint8_t fallback) const {
+            if (!mask) return fallback;
+            uint32_t v = (value & mask) >> shift;
+            if (bits >= 8) return (uint8_t)(v >> (bits - 8));
+            return (uint8_t)(v * 255 / ((1u << bits) - 1));
+        }
+    };
+
+    static bool DecodeBmp(const uint8_t* data, size_t size, int& width, int& height,
+        std::vector<uint8_t>* pixels, bool useSimd) {
+
+        uint32_t offset = ReadLe32(data + 10);
+        uint32_t headerSize = ReadLe32(data + 14);
+        int64_t rawHeight;
+        int bitCount;
+        uint32_t compression = 0;
+        uint32_t colorsUsed = 0;
+        if (headerSize == 12) {
+            width = ReadLe16(data + 18);
+            rawHeight = (int16_t)ReadLe16(data + 20);
+            bitCount = ReadLe16(data + 24);
+        }
+        else if (headerSize >= 40 && size >= 14 + (size_t)headerSize) {
+            width = (int)ReadLe32(data + 18);
+            rawHeight = (int32_t)ReadLe32(data + 22);
+            bitCount = ReadLe16(data + 28);
+            compression = ReadLe32(data + 30);
+            colorsUsed = ReadLe32(data + 46);
+        }
+        else {
+            return Fail("BMP: неизвестный заголовок");
+        }
+        bool topDown = rawHeight < 0;
+        height = (int)std::min<int64_t>(topDown ? -rawHeight : rawHeight, INT_MAX);
+        if (!IsValidSize(width, height)) return Fail("BMP: недопустимый размер");
+        if (!pixels) return true;
+
+        // Маски каналов: из заголовка V2+ или сразу за BITMAPINFOHEADER; без них - стандартные
+        uint32_t masks[4] = {};
+        if (compression == 3 || compression == 6) {
+            size_t maskOffset = 14 + 40;
+            int maskCount = (headerSize >= 56 || compression == 6) ? 4 : 3;
+            if (maskOffset + maskCount * 4 > size) return Fail("BMP: обрезанные маски");
+            for (int i = 0; i < maskCount; i++) masks[i] = ReadLe32(data + maskOffset + i * 4);
+        }
+        else if (compression == 0) {
+            // 32 бита - BGRX (альфа в BI_RGB не учитывается, как у WIC), 16 бит - 5-5-5
+            if (bitCount == 32) {
+                masks[0] = 0xFF0000;
+                masks[1] = 0xFF00;
+                masks[2] = 0xFF;
+            }
+            else if (bitCount == 16) {
+                masks[0] = 0x7C00;
+                masks[1] = 0x3E0;
+                masks[2] = 0x1F;
+            }
+        }
+        else {
+            return Fail("BMP: сжатие RLE не поддерживается");
+        }
+        if (bitCount != 1 && bitCount != 4 && bitCount != 8 && bitCount != 16 && bitCount != 24 && bitCount != 32) {
+            return Fail("BMP: неподдерживаемая глубина цвета");
+        }
+
+        // Палитра BGR(X) сразу за заголовком
+        uint32_t palette[256];
+        if (bitCount <= 8) {
+            size_t entrySize = (headerSize == 12) ? 3 : 4;
+            size_t paletteOffset = 14 + headerSize;
+            uint32_t entries = colorsUsed ? std::min<uint32_t>(colorsUsed, 256) : (1u << bitCount);
+            for (uint32_t i = 0; i < 256; i++) {
+                uint8_t rgba[4] = { 0, 0, 0, 255 };
+                const uint8_t* entry = data + paletteOffset + i * entrySize;
+                if (i < entries && paletteOffset + (i + 1) * entrySize <= size) {
+                    rgba[0] = entry[2];
+                    rgba[1] = entry[1];
+                    rgba[2] = entry[0];
+                }
+                memcpy(&palette[i], rgba, 4);
+            }
+        }
+
+        size_t rowStride = (((size_t)width * bitCount + 31) / 32) * 4;
+        if (offset > size || rowStride * height > size - offset) return Fail("BMP: обрезанные пиксели");
+
+        BmpChannel channels[4];
+        for (int c = 0; c < 4; c++) channels[c].Init(masks[c]);
+        bool standardBgra = bitCount == 32 && masks[0] == 0xFF0000 && masks[1] == 0xFF00 && masks[2] == 0xFF &&
+            (masks[3] == 0 || masks[3] == 0xFF000000);
+
+        pixels->resize((size_t)width * height * 4);
+        for (int y = 0; y < height; y++) {
+            const uint8_t* src = data + offset + (size_t)(topDown ? y : height - 1 - y) * rowStride;
+            uint8_t* dst = pixels->data() + (size_t)y * width * 4;
+            if (standardBgra) {
+                SwizzleBgra(src, dst, width, masks[3] == 0, useSimd);
+            }
+            else if (bitCount == 24) {
+                ExpandRgb(src, dst, width, true);
+            }
+            else if (bitCount >= 16) {
+                for (int x = 0; x < width; x++) {
+                    uint32_t value = (bitCount == 16) ? ReadLe16(src + x * 2) : ReadLe32(src + x * 4);
+                    uint8_t* d = dst + (size_t)x * 4;
+                    d[0] = channels[0].Extract(value, 0);
+                    d[1] = channels[1].Extract(value, 0);
+                    d[2] = channels[2].Extract(value, 0);
+                    d[3] = channels[3].Extract(value, 255);
+                }
+            }
+            else {
+                for (int x = 0; x < width; x++) {
+                    int bitOffset = x * bitCount;
+                    int index = (src[bitOffset >> 3] >> (8 - bitCount - (bitOffset & 7))) & ((1 << bitCount) - 1);
+                    memcpy(dst + (size_t)x * 4, &palette[index], 4);
+                }
+            }
+        }
+        return true;
+    }
+
+    // ---------- TGA ----------
+
+    // Пиксель 15/16/24/32 бит (BGR(A) и 5-5-5) -> RGBA
+    static void ConvertTgaPixel(const uint8_t* src, int depth, bool alpha, uint8_t* dst) {
+        if (depth <= 16) {
+            uint16_t value = ReadLe16(src);
+            dst[0] = (uint8_t)(((value >> 10) & 31) * 255 / 31);
+            dst[1] = (uint8_t)(((value >> 5) & 31) * 255 / 31);
+            dst[2] = (uint8_t)((value & 31) * 255 / 31);
+            dst[3] = 255;
+            return;
+        }
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = (depth == 32 && alpha) ? src[3] : 255;
+    }
+
+    static bool DecodeTga(const uint8_t* data, size_t size, int& width, int& height,
+        std::vector<uint8_t>* pixels, bool useSimd) {
+
+        int idLength = data[0];
+        int colorMapType = data[1];
+        int imageType = data[2];
+        int mapFirst = ReadLe16(data + 3);
+        int mapLength = ReadLe16(data + 5);
+        int mapDepth = data[7];
+        width = ReadLe16(data + 12);
+        height = ReadLe16(data + 14);
+        int depth = data[16];
+        int descriptor = data[17];
+        if (!IsValidSize(width, height)) return Fail("TGA: недопустимый размер");
+        if (!pixels) return true;
+
+        bool colorMapped = (imageType == 1 || imageType == 9);
+        bool rle = imageType >= 9;
+        bool hasAlpha = (descriptor & 15) != 0; // Биты альфы; 0 - альфа не задана
+        int pixelBytes = (depth + 7) / 8;
+        int mapBytes = (mapDepth + 7) / 8;
+        size_t pos = 18 + (size_t)idLength;
+
+        uint32_t palette[256];
+        if (colorMapped) {
+            if (mapDepth != 15 && mapDepth != 16 && mapDepth != 24 && mapDepth != 32) return Fail("TGA: неверная палитра");
+            if (pos + (size_t)mapLength * mapBytes > size) return Fail("TGA: обрезанная палитра");
+            for (int i = 0; i < 256; i++) {
+                uint8_t rgba[4] = { 0, 0, 0, 255 };
+                int entry = i - mapFirst;
+                if (entry >= 0 && entry < mapLength) ConvertTgaPixel(data + pos + (size_t)entry * mapBytes, mapDepth, hasAlpha, rgba);
+                memcpy(&palette[i], rgba, 4);
+            }
+        }
+        if (colorMapType) pos += (size_t)mapLength * mapBytes;
+
+        // RLE раскрываем в несжатые пиксели, дальше путь общий
+        size_t total = (size_t)width * height * pixelBytes;
+        const uint8_t* source = data + pos;
+        std::vector<uint8_t> unpacked;
+        if (rle) {
+            unpacked.resize(total);
+            size_t written = 0;
+            while (written < total) {
+                if (pos >= size) return Fail("TGA: обрезанные данные RLE");
+                uint8_t header = data[pos++];
+                size_t count = (size_t)(header & 0x7F) + 1;
+                if (header & 0x80) {
+                    if (pos + pixelBytes > size) return Fail("TGA: обрезанные данные RLE");
+                    for (size_t i = 0; i < count && written < total; i++, written += pixelBytes) {
+                        memcpy(unpacked.data() + written, data + pos, pixelBytes);
+                    }
+                    pos += pixelBytes;
+                }
+                else {
+                    size_t bytes = count * pixelBytes;
+                    if (pos + bytes > size) return Fail("TGA: обрезанные данные RLE");
+                    memcpy(unpacked.data() + written, data + pos, std::min(bytes, total - written));
+                    written += std::min(bytes, total - written);
+                    pos += bytes;
+                }
+            }
+            source = unpacked.data();
+        }
+        else if (pos > size || total > size - pos) {
+            return Fail("TGA: обрезанные пиксели");
+        }
+
+        bool topOrigin = (descriptor & 0x20) != 0;
+        bool rightToLeft = (descriptor & 0x10) != 0;
+        size_t rowBytes = (size_t)width * pixelBytes;
+        pixels->resize((size_t)width * height * 4);
+        for (int y = 0; y < height; y++) {
+            const uint8_t* src = source + (size_t)(topOrigin ? y : height - 1 - y) * rowBytes;
+            uint8_t* dst = pixels->data() + (size_t)y * width * 4;
+            if (colorMapped) {
+                for (int x = 0; x < width; x++) memcpy(dst + (size_t)x * 4, &palette[src[x]], 4);
+            }
+            else if (depth == 8) {
+                ExpandGray(src, dst, width, useSimd);
+            }
+            else if (depth == 32) {
+                SwizzleBgra(src, dst, width, !hasAlpha, useSimd);
+            }
+            else if (depth == 24) {
+                ExpandRgb(src, dst, width, true);
+            }
+            else {
+                for (int x = 0; x < width; x++) ConvertTgaPixel(src + (size_t)x * pixelBytes, depth, hasAlpha, dst + (size_t)x * 4);
+            }
+            if (rightToLeft) {
+                uint32_t* row = (uint32_t*)dst;
+                std::reverse(row, row + width);
+            }
+        }
+        return true;
+    }
+};
+
+// ==================== СТРУКТУРЫ ДАННЫХ ====================
+struct Vertex {
+    XMFLOAT3 position;
+    XMFLOAT3 normal;
+    XMFLOAT2 texcoord;
+    XMFLOAT3 color;
+
+    Vertex() : position(0, 0, 0), normal(0, 1, 0), texcoord(0, 0), color(1, 1, 1) {}
+    Vertex(float px, float py, float pz, float nx, float ny, float nz, float u, float v, float r, float g, float b)
+        : position(px, py, pz), normal(nx, ny, nz), texcoord(u, v), color(r, g, b) {
+    }
+};
+
+// Формат уровней текстуры на диске и в видеопамяти (см. BlockCompressor)
+enum TextureFormat : uint32_t {
+    TEXTURE_RGBA8 = 0,
+    TEXTURE_BC1 = 1,
+    TEXTURE_BC3 = 2,
+    TEXTURE_BC7 = 3
+};
+
+#ifndef ASSET_COOKER
+// Изображение для выгрузки - результат фоновой загрузки до создания текстуры:
+// уровни в памяти (RGBA8 после декодирования или уже сжатые) либо прямо из кэша
+const bool GENERATE_TEXTURE_MIPS = true; // Полная цепочка мипов при декодировании (см. MipGenerator)
+const bool USE_TEXTURE_CACHE = true;     // Читать и писать <картинка>.texcache (см. TextureCache)
+
+class TextureCache;
+
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    TextureFormat format = TEXTURE_RGBA8;
+    std::vector<BYTE> pixels;            // Верхний уровень в формате format
+    std::vector<std::vector<BYTE>> mips; // Уровни 1..N; пусто - только исходный
+    std::shared_ptr<TextureCache> cache; // Задан - уровни берутся из отображённого кэша
+};
+
+struct Texture2D {
+    ID3D11Texture2D* texture = nullptr;
+    ID3D11ShaderResourceView* srv = nullptr;
+    ID3D11SamplerState* samplerState = nullptr;
+    std::wstring filename;
+    int width = 0;
+    int height = 0;
+
+    static bool DecodeFile(const wchar_t* filename, DecodedImage& image);
+    bool CreateFromImage(ID3D11Device* device, const DecodedImage& image, uint32_t firstLevel = 0);
+    static uint32_t GetLevelCount(const DecodedImage& image);
+    static bool DecodeSource(const wchar_t* filename, DecodedImage& image, bool sizeOnly = false);
+    static void CompressImage(const std::wstring& sourcePath, DecodedImage& image);
+    static DXGI_FORMAT GetDxgiFormat(TextureFormat format);
+    bool CreateDebugTexture(ID3D11Device* device, const wchar_t* name);
+    void Cleanup();
+};
+#endif
+
+// Уровень детализации: диапазон в общем индексном буфере меша
+const uint32_t MAX_MESH_LODS = 4;
+
+struct MeshLod {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    float error = 0.0f;        // Геометрическая ошибка уровня в единицах модели
+    uint32_t firstMeshlet = 0; // Кластеры уровня в Mesh::meshlets
+    uint32_t meshletCount = 0;
+};
+
+// Кластер треугольников: непрерывный диапазон индексов со сферой и конусом нормалей
+struct Meshlet {
+    XMFLOAT3 center = { 0, 0, 0 };   // Ограничивающая сфера
+    float radius = 0.0f;
+    XMFLOAT3 coneAxis = { 0, 0, 0 }; // Средняя внешняя нормаль
+    float coneCutoff = 2.0f;         // sin раствора конуса; > 1 - не отсекается по нормалям
+    uint32_t firstIndex = 0;         // Относительно начала индексов меша
+    uint32_t triangleCount = 0;
+    uint32_t vertexCount = 0;
+    uint32_t padding = 0;
+};
+
+struct Mesh {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    NameId materialId = 0;     // Хэш имени материала (см. NameRegistry)
+    int textureIndex = -1;
+    std::vector<MeshLod> lods; // Пусто - единственный уровень на все индексы
+    std::vector<Meshlet> meshlets;
+    std::vector<VertexSkin> skin; // Пусто - меш без скелета, иначе по элементу на вершину
+};
+
+// Структура для материала из MTL
+struct Material {
+    std::string name;
+    NameId id = 0;
+    XMFLOAT3 ambient;
+    XMFLOAT3 diffuse;
+    XMFLOAT3 specular;
+    float shininess;
+    float alpha;
+    std::string textureFilename;
+
+    Material() : ambient(0.2f, 0.2f, 0.2f), diffuse(0.8f, 0.8f, 0.8f),
+        specular(1.0f, 1.0f, 1.0f), shininess(20.0f), alpha(1.0f) {
+    }
+};
+
+// Плоская таблица материалов: материал ищется по NameId один раз на usemtl,
+// дальше везде используется компактный индекс в таблице.
+class MaterialTable {
+public:
+    static constexpr uint32_t INVALID_INDEX = 0xFFFFFFFF;
+
+    // Добавляет материал или заменяет одноимённый (как повторный newmtl)
+    uint32_t Add(const Material& material) {
+        auto it = lookup.find(material.id);
+        if (it != lookup.end()) {
+            items[it->second] = material;
+            return it->second;
+        }
+
+        uint32_t index = (uint32_t)items.size();
+        items.push_back(material);
+        lookup.emplace(material.id, index);
+        return index;
+    }
+
+    uint32_t Find(NameId id) const {
+        auto it = lookup.find(id);
+        return (it != lookup.end()) ? it->second : INVALID_INDEX;
+    }
+
+    const Material* Get(uint32_t index) const {
+        return (index < items.size()) ? &items[index] : nullptr;
+    }
+
+    size_t Size() const { return items.size(); }
+    bool Empty() const { return items.empty(); }
+    void Clear() {
+        items.clear();
+        lookup.clear();
+    }
+
+    std::vector<Material>::const_iterator begin() const { return items.begin(); }
+    std::vector<Material>::const_iterator end() const { return items.end(); }
+
+private:
+    std::vector<Material> items;
+    std::unordered_map<NameId, uint32_t> lookup;
+};
+
+// Настройки загрузки OBJ
+struct OBJLoadOptions {
+    unsigned threadCount = 0;            // 0 - по числу ядер, 1 - без потоков
+    size_t minChunkBytes = 4 * 1024 * 1024; // Меньшие куски не стоят запуска потока
+};
+
+// ==================== КЛАСС ЗАГРУЗКИ OBJ И MTL ====================
+class OBJLoader {
+public:
+    static bool Load(const std::wstring& filename, std::vector<Mesh>& meshes, MaterialTable& materials,
+        const OBJLoadOptions& options = OBJLoadOptions(), std::vector<std::wstring>* mtlPaths = nullptr) {
+        DEBUG_LOG_W(L"Загрузка OBJ файла: " + filename);
+
+        AssetFile file;
+        if (!file.Open(filename, options.threadCount)) {
+            DEBUG_LOG_W(L"Не удалось открыть файл: " + filename);
+
+            // Создаем простую кубическую модель как запасной вариант
+            CreateSimpleCubeModel(meshes);
+            return true;
+        }
+
+        // 1. Делим файл на куски по границам строк и разбираем их параллельно
+        unsigned threadCount = GetWorkerThreadCount(options.threadCount);
+        size_t maxChunks = std::max<size_t>(1, file.Size() / std::max<size_t>(options.minChunkBytes, 1));
+        size_t chunkCount = std::min<size_t>(threadCount, maxChunks);
+
+        std::vector<const char*> bounds(chunkCount + 1);
+        const char* fileBegin = file.Data();
+        const char* fileEnd = file.Data() + file.Size();
+        bounds[0] = fileBegin;
+        bounds[chunkCount] = fileEnd;
+        for (size_t i = 1; i < chunkCount; i++) {
+            const char* split = std::max(bounds[i - 1], fileBegin + file.Size() / chunkCount * i);
+            const char* newline = (const char*)memchr(split, '\n', fileEnd - split);
+            bounds[i] = newline ? newline + 1 : fileEnd;
+        }
+
+        std::vector<ObjChunk> chunks(chunkCount);
+        ParallelFor(chunkCount, threadCount, [&](size_t i) {
+            ParseChunk(bounds[i], bounds[i + 1], chunks[i]);
+        });
+
+        // 2. Склеиваем атрибуты и переводим индексы OBJ в глобальные 0-based
+        std::vector<XMFLOAT3> positions;
+        std::vector<XMFLOAT3> normals;
+        std::vector<XMFLOAT2> texcoords;
+
+        std::vector<ChunkBase> bases(chunkCount);
+        for (size_t i = 0; i < chunkCount; i++) {
+            bases[i].position = (int)positions.size();
+            bases[i].texcoord = (int)texcoords.size();
+            bases[i].normal = (int)normals.size();
+            bases[i].line = (i == 0) ? 0 : bases[i - 1].line + chunks[i - 1].lineCount;
+
+            positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+            texcoords.insert(texcoords.end(), chunks[i].texcoords.begin(), chunks[i].texcoords.end());
+            normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+        }
+
+        ParallelFor(chunkCount, threadCount, [&](size_t i) {
+            ResolveChunkIndices(chunks[i], bases[i]);
+        });
+
+        // 3. Проходим события в порядке файла: mtllib, usemtl и группировка граней.
+        // Повторный usemtl того же материала продолжает его группу, поэтому на
+        // каждый материал получается ровно один меш.
+        std::vector<std::string> mtlFiles;
+        std::vector<ObjGroup> groups(1);
+        std::unordered_map<NameId, size_t> groupByMaterial = { { groups[0].materialId, 0 } };
+        size_t currentGroup = 0;
+        size_t cornerCount = 0;
+
+        for (size_t c = 0; c < chunkCount; c++) {
+            const ObjChunk& chunk = chunks[c];
+            for (const ObjEvent& event : chunk.events) {
+                if (event.type == ObjEvent::Face) {
+                    groups[currentGroup].faces.push_back({ (uint32_t)c, event.first, event.count });
+                    cornerCount += (event.count - 2) * 3;
+                }
+                else if (event.type == ObjEvent::UseMaterial) { // Материал
+                    NameId materialId = groups[currentGroup].materialId;
+                    const std::string& name = chunk.names[event.first];
+                    if (!name.empty()) {
+                        materialId = NameRegistry::Intern(name);
+                    }
+
+                    auto found = groupByMaterial.find(materialId);
+                    if (found == groupByMaterial.end()) {
+                        groups.emplace_back();
+                        groups.back().materialId = materialId;
+                        found = groupByMaterial.emplace(materialId, groups.size() - 1).first;
+                    }
+                    currentGroup = found->second;
+
+                    char buffer[256];
+                    sprintf_s(buffer, "Строка %d: Используется материал: %s",
+                        bases[c].line + event.line, NameRegistry::GetName(materialId).c_str());
+                    DEBUG_LOG(buffer);
+                }
+                else if (event.type == ObjEvent::MaterialLibrary) { // Файл материалов
+                    const std::string& mtlFile = chunk.names[event.first];
+                    mtlFiles.push_back(mtlFile);
+
+                    // Получаем путь к MTL файлу
+                    std::wstring objPath = filename;
+                    size_t lastSlash = objPath.find_last_of(L"\\/");
+                    std::wstring basePath = (lastSlash != std::wstring::npos) ?
+                        objPath.substr(0, lastSlash + 1) : L"";
+
+                    std::wstring mtlPath = basePath + std::wstring(mtlFile.begin(), mtlFile.end());
+                    if (mtlPaths) {
+                        mtlPaths->push_back(mtlPath);
+                    }
+
+                    // Загружаем материалы из MTL файла
+                    if (LoadMTL(mtlPath, materials)) {
+                        DEBUG_LOG("MTL файл успешно загружен");
+                    }
+                    else {
+                        DEBUG_WARNING("Не удалось загрузить MTL файл");
+                    }
+                }
+            }
+        }
+
+        // 4. Собираем меши групп независимо друг от друга
+        std::vector<Mesh> groupMeshes(groups.size());
+        ParallelFor(groups.size(), threadCount, [&](size_t g) {
+            BuildGroupMesh(groups[g], chunks, positions, normals, texcoords, groupMeshes[g]);
+        });
+
+        for (auto& mesh : groupMeshes) {
+            if (!mesh.vertices.empty()) {
+                meshes.push_back(std::move(mesh));
+            }
+        }
+
+        file.Close();
+
+        if (meshes.empty()) {
+            CreateSimpleCubeModel(meshes);
+        }
+
+        size_t uniqueVertexCount = 0;
+        for (const auto& mesh : meshes) {
+            uniqueVertexCount += mesh.vertices.size();
+        }
+
+        char buffer[256];
+        sprintf_s(buffer, "OBJ загружен: %zu мешей, %zu вершин в первом меше, %zu материалов (кусков: %zu, потоков: %u)",
+            meshes.size(), meshes.empty() ? (size_t)0 : meshes[0].vertices.size(),
+            materials.Size(), chunkCount, threadCount);
+        DEBUG_LOG(buffer);
+        if (cornerCount > 0) {
+            sprintf_s(buffer, "Дедупликация вершин: %zu -> %zu (в %.2f раза меньше)",
+                cornerCount, uniqueVertexCount, (double)cornerCount / std::max<size_t>(uniqueVertexCount, 1));
+            DEBUG_LOG(buffer);
+        }
+
+        return !meshes.empty();
+    }
+
+    static bool LoadMTL(const std::wstring& filename, MaterialTable& materials) {
+        DEBUG_LOG_W(L"Загрузка MTL файла: " + filename);
+
+        AssetFile file;
+        if (!file.Open(filename)) {
+            DEBUG_LOG_W(L"Не удалось открыть MTL файл: " + filename);
+            return false;
+        }
+
+        Material currentMaterial;
+        TextScanner scanner(file.Data(), file.Size());
+        std::string_view line;
+
+        while (scanner.NextLine(line)) {
+            std::string_view prefix = TextScanner::NextToken(line);
+
+            if (prefix == "newmtl") { // Новый материал
+                if (!currentMaterial.name.empty()) {
+                    materials.Add(currentMaterial);
+                }
+                currentMaterial = Material(); // Сброс значений по умолчанию
+                currentMaterial.name = std::string(TextScanner::NextToken(line));
+                currentMaterial.id = NameRegistry::Intern(currentMaterial.name);
+
+                DEBUG_LOG("Найден материал: " + currentMaterial.name);
+            }
+            else if (prefix == "Ka") { // Ambient color
+                TextScanner::ParseFloat(line, currentMaterial.ambient.x);
+                TextScanner::ParseFloat(line, currentMaterial.ambient.y);
+                TextScanner::ParseFloat(line, currentMaterial.ambient.z);
+            }
+            else if (prefix == "Kd") { // Diffuse color
+                TextScanner::ParseFloat(line, currentMaterial.diffuse.x);
+                TextScanner::ParseFloat(line, currentMaterial.diffuse.y);
+                TextScanner::ParseFloat(line, currentMaterial.diffuse.z);
+
+                char buffer[256];
+                sprintf_s(buffer, "  Цвет материала %s: (%.3f, %.3f, %.3f)",
+                    currentMaterial.name.c_str(),
+                    currentMaterial.diffuse.x,
+                    currentMaterial.diffuse.y,
+                    currentMaterial.diffuse.z);
+                DEBUG_LOG(buffer);
+            }
+            else if (prefix == "Ks") { // Specular color
+                TextScanner::ParseFloat(line, currentMaterial.specular.x);
+                TextScanner::ParseFloat(line, currentMaterial.specular.y);
+                TextScanner::ParseFloat(line, currentMaterial.specular.z);
+            }
+            else if (prefix == "Ns") { // Shininess
+                TextScanner::ParseFloat(line, currentMaterial.shininess);
+            }
+            else if (prefix == "d" || prefix == "Tr") { // Alpha (transparency)
+                TextScanner::ParseFloat(line, currentMaterial.alpha);
+            }
+            else if (prefix == "map_Kd") { // Texture
+                std::string_view texture = TextScanner::NextToken(line);
+                if (!texture.empty()) {
+                    currentMaterial.textureFilename.assign(texture.data(), texture.size());
+                }
+            }
+        }
+
+        // Добавляем последний материал
+        if (!currentMaterial.name.empty()) {
+            materials.Add(currentMaterial);
+        }
+
+        file.Close();
+
+        char buffer[256];
+        sprintf_s(buffer, "Загружено материалов: %zu", materials.Size());
+        DEBUG_LOG(buffer);
+
+        return !materials.Empty();
+    }
+
+private:
+    // Ключ вершины - тройка индексов OBJ (позиция/UV/нормаль)
+    struct VertexKey {
+        int position;
+        int texcoord;
+        int normal;
+
+        bool operator==(const VertexKey& other) const {
+            return position == other.position && texcoord == other.texcoord && normal == other.normal;
+        }
+    };
+
+    struct VertexKeyHash {
+        size_t operator()(const VertexKey& key) const {
+            uint64_t h = (uint64_t)(uint32_t)key.position * 0x9E3779B97F4A7C15ull;
+            h ^= (uint64_t)(uint32_t)key.texcoord * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+            h ^= (uint64_t)(uint32_t)key.normal * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+            return (size_t)h;
+        }
+    };
+
+    using VertexCache = std::unordered_map<VertexKey, uint32_t, VertexKeyHash>;
+
+    // Событие внутри куска файла, порядок которого важен при склейке
+    struct ObjEvent {
+        enum Type { Face, UseMaterial, MaterialLibrary };
+        Type type;
+        uint32_t first;   // Face: первый угол в corners, иначе индекс в names
+        uint32_t count;   // Face: число углов
+        int line;         // Номер строки внутри куска
+        int positionCount; // Сколько v/vt/vn было в куске до этой грани (для отрицательных индексов)
+        int texcoordCount;
+        int normalCount;
+    };
+
+    // Результат разбора одного куска файла
+    struct ObjChunk {
+        std::vector<XMFLOAT3> positions;
+        std::vector<XMFLOAT3> normals;
+        std::vector<XMFLOAT2> texcoords;
+        std::vector<VertexKey> corners; // Сырые индексы OBJ: 1-based, отрицательные - относительные
+        std::vector<ObjEvent> events;
+        std::vector<std::string> names;
+        int lineCount = 0;
+    };
+
+    // Сколько атрибутов и строк было в файле до начала куска
+    struct ChunkBase {
+        int position = 0;
+        int texcoord = 0;
+        int normal = 0;
+        int line = 0;
+    };
+
+    struct ObjFaceRef {
+        uint32_t chunk;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    // Непрерывная группа граней с одним материалом (будущий Mesh)
+    struct ObjGroup {
+        NameId materialId = 0;
+        std::vector<ObjFaceRef> faces;
+    };
+
+    static void ParseChunk(const char* begin, const char* end, ObjChunk& chunk) {
+        TextScanner scanner(begin, end - begin);
+        std::string_view line;
+        while (scanner.NextLine(line)) {
+            chunk.lineCount++;
+            std::string_view prefix = TextScanner::NextToken(line);
+
+            if (ParseAttribute(prefix, line, chunk.positions, chunk.normals, chunk.texcoords)) {
+                continue;
+            }
+            else if (prefix == "f") { // Грань (поддержка треугольников, квадов и n-угольников)
+                size_t first = chunk.corners.size();
+
+                // Считываем ВСЕ вершины грани
+                for (std::string_view vert = TextScanner::NextToken(line); !vert.empty();
+                    vert = TextScanner::NextToken(line)) {
+                    chunk.corners.push_back(ParseFaceVertex(vert));
+                }
+
+                // Минимум 3 вершины — иначе это не грань
+                size_t count = chunk.corners.size() - first;
+                if (count < 3) {
+                    chunk.corners.resize(first);
+                    continue;
+                }
+
+                chunk.events.push_back({ ObjEvent::Face, (uint32_t)first, (uint32_t)count, chunk.lineCount,
+                    (int)chunk.positions.size(), (int)chunk.texcoords.size(), (int)chunk.normals.size() });
+            }
+            else if (prefix == "usemtl" || prefix == "mtllib") {
+                ObjEvent::Type type = (prefix == "usemtl") ? ObjEvent::UseMaterial : ObjEvent::MaterialLibrary;
+                chunk.events.push_back({ type, (uint32_t)chunk.names.size(), 0, chunk.lineCount, 0, 0, 0 });
+                chunk.names.emplace_back(TextScanner::NextToken(line));
+            }
+        }
+    }
+
+    // Разбирает строки v/vn/vt; возвращает false для остальных префиксов
+    static bool ParseAttribute(std::string_view prefix, std::string_view& line,
+        std::vector<XMFLOAT3>& positions,
+        std::vector<XMFLOAT3>& normals,
+        std::vector<XMFLOAT2>& texcoords) {
+        if (prefix == "v") { // Вершина
+            XMFLOAT3 pos;
+            TextScanner::ParseFloat(line, pos.x);
+            TextScanner::ParseFloat(line, pos.y);
+            TextScanner::ParseFloat(line, pos.z);
+            positions.push_back(pos);
+            return true;
+        }
+        if (prefix == "vn") { // Нормаль
+            XMFLOAT3 norm;
+            TextScanner::ParseFloat(line, norm.x);
+            TextScanner::ParseFloat(line, norm.y);
+            TextScanner::ParseFloat(line, norm.z);
+            normals.push_back(norm);
+            return true;
+        }
+        if (prefix == "vt") { // Текстурные координаты
+            XMFLOAT2 tex;
+            TextScanner::ParseFloat(line, tex.x);
+            TextScanner::ParseFloat(line, tex.y);
+            tex.y = 1.0f - tex.y; // Flip Y для DirectX
+            texcoords.push_back(tex);
+            return true;
+        }
+        return false;
+    }
+
+    // 1-based индекс -> 0-based, отрицательный - относительно уже прочитанных атрибутов
+    static int ResolveIndex(int index, int base, int countBefore) {
+        if (index > 0) return index - 1;
+        if (index < 0) return base + countBefore + index;
+        return -1;
+    }
+
+    static void ResolveChunkIndices(ObjChunk& chunk, const ChunkBase& base) {
+        for (const ObjEvent& event : chunk.events) {
+            if (event.type != ObjEvent::Face) continue;
+
+            for (uint32_t i = event.first; i < event.first + event.count; i++) {
+                VertexKey& key = chunk.corners[i];
+                key.position = ResolveIndex(key.position, base.position, event.positionCount);
+                key.texcoord = ResolveIndex(key.texcoord, base.texcoord, event.texcoordCount);
+                key.normal = ResolveIndex(key.normal, base.normal, event.normalCount);
+            }
+        }
+    }
+
+    static void BuildGroupMesh(const ObjGroup& group,
+        const std::vector<ObjChunk>& chunks,
+        const std::vector<XMFLOAT3>& positions,
+        const std::vector<XMFLOAT3>& normals,
+        const std::vector<XMFLOAT2>& texcoords,
+        Mesh& mesh) {
+
+        // Кэш уникальных комбинаций (позиция, UV, нормаль) этого меша
+        VertexCache vertexCache;
+        mesh.materialId = group.materialId;
+
+        for (const ObjFaceRef& face : group.faces) {
+            const VertexKey* corners = chunks[face.chunk].corners.data() + face.first;
+
+            // Fan triangulation:
+            // (0, i, i+1)
+            for (uint32_t i = 1; i + 1 < face.count; ++i) {
+                ProcessFace(corners[0], positions, normals, texcoords, mesh, vertexCache);
+                ProcessFace(corners[i], positions, normals, texcoords, mesh, vertexCache);
+                ProcessFace(corners[i + 1], positions, normals, texcoords, mesh, vertexCache);
+            }
+        }
+    }
+
+    // Разбирает "p/t/n", "p//n", "p/t" или "p" в сырые индексы OBJ (0 = нет)
+    static VertexKey ParseFaceVertex(std::string_view vert) {
+        int indices[3] = { 0, 0, 0 };
+        int idx = 0;
+
+        size_t start = 0;
+        while (start <= vert.size() && idx < 3) {
+            size_t slash = vert.find('/', start);
+            std::string_view token = vert.substr(start, slash == std::string_view::npos ? std::string_view::npos : slash - start);
+            int value = 0;
+            if (!token.empty() && TextScanner::ParseInt(token, value)) {
+                indices[idx] = value;
+            }
+            idx++;
+            if (slash == std::string_view::npos) break;
+            start = slash + 1;
+        }
+
+        return { indices[0], indices[1], indices[2] };
+    }
+
+    static void ProcessFace(const VertexKey& key,
+        const std::vector<XMFLOAT3>& positions,
+        const std::vector<XMFLOAT3>& normals,
+        const std::vector<XMFLOAT2>& texcoords,
+        Mesh& mesh,
+        VertexCache& vertexCache) {
+
+        // Вершина с такой же тройкой индексов уже есть в меше - переиспользуем её
+        auto cached = vertexCache.find(key);
+        if (cached != vertexCache.end()) {
+            mesh.indices.push_back(cached->second);
+            return;
+        }
+
+        Vertex vertex;
+
+        // Позиция
+        if (key.position >= 0 && key.position < (int)positions.size()) {
+            vertex.position = positions[key.position];
+        }
+        else {
+            vertex.position = XMFLOAT3(0, 0, 0);
+        }
+
+        // Текстурные координаты
+        if (key.texcoord >= 0 && key.texcoord < (int)texcoords.size()) {
+            vertex.texcoord = texcoords[key.texcoord];
+        }
+        else {
+            vertex.texcoord = XMFLOAT2(0, 0);
+        }
+
+        // Нормаль
+        if (key.normal >= 0 && key.normal < (int)normals.size()) {
+            vertex.normal = normals[key.normal];
+        }
+        else {
+            // Вычисляем нормаль по умолчанию
+            vertex.normal = XMFLOAT3(0, 1, 0);
+        }
+
+        // Цвет материала шейдер берёт из таблицы материалов - вершина остаётся белой
+        vertex.color = XMFLOAT3(1, 1, 1);
+
+        uint32_t newIndex = (uint32_t)mesh.vertices.size();
+        mesh.vertices.push_back(vertex);
+        mesh.indices.push_back(newIndex);
+        vertexCache.emplace(key, newIndex);
+    }
+
+    static void CreateSimpleCubeModel(std::vector<Mesh>& meshes) {
+        DEBUG_LOG("Создание простой кубической модели...");
+
+        Mesh cubeMesh;
+
+        // Вершины куба (8 вершин)
+        Vertex vertices[] = {
+            // Передняя грань
+            Vertex(-1.0f, -1.0f, -1.0f, 0, 0, -1, 0, 1, 1, 0, 0),
+            Vertex(1.0f, -1.0f, -1.0f, 0, 0, -1, 1, 1, 0, 1, 0),
+            Vertex(1.0f,  1.0f, -1.0f, 0, 0, -1, 1, 0, 0, 0, 1),
+            Vertex(-1.0f,  1.0f, -1.0f, 0, 0, -1, 0, 0, 1, 1, 0),
+
+            // Задняя грань
+            Vertex(-1.0f, -1.0f,  1.0f, 0, 0, 1, 1, 1, 1, 0, 0),
+            Vertex(1.0f, -1.0f,  1.0f, 0, 0, 1, 0, 1, 0, 1, 0),
+            Vertex(1.0f,  1.0f,  1.0f, 0, 0, 1, 0, 0, 0, 0, 1),
+            Vertex(-1.0f,  1.0f,  1.0f, 0, 0, 1, 1, 0, 1, 1, 0),
+        };
+
+        // Индексы куба (12 треугольников)
+        uint32_t indices[] = {
+            // Передняя грань
+            0, 1, 2, 2, 3, 0,
+            // Задняя грань
+            4, 5, 6, 6, 7, 4,
+            // Верхняя грань
+            3, 2, 6, 6, 7, 3,
+            // Нижняя грань
+            0, 1, 5, 5, 4, 0,
+            // Левая грань
+            0, 3, 7, 7, 4, 0,
+            // Правая грань
+            1, 2, 6, 6, 5, 1
+        };
+
+        cubeMesh.vertices.assign(vertices, vertices + 8);
+        cubeMesh.indices.assign(indices, indices + 36);
+        cubeMesh.materialId = "default"_name;
+
+        meshes.push_back(cubeMesh);
+        DEBUG_LOG("Простая кубическая модель создана");
+    }
+};
+
+// ==================== ОПТИМИЗАЦИЯ МЕШЕЙ ====================
+// Порядок треугольников после OBJLoader повторяет файл (веер на каждую грань),
+// что плохо для кэша вершин после трансформации. Проход после загрузки:
+// 1) порядок треугольников под кэш вершин (алгоритм Форсайта),
+// 2) перестановка кластеров треугольников для уменьшения overdraw (как в Tipsify),
+// 3) порядок вершин по первому использованию для локальности выборки.
+// Работает только на CPU, поэтому применяется и при загрузке, и офлайн.
+const bool OPTIMIZE_MESHES_ON_LOAD = true;
+
+// Статистика FIFO-кэша вершин
+struct VertexCacheStats {
+    float acmr = 0.0f; // Промахи на треугольник (0.5 - идеал, 3.0 - худший случай)
+    float atvr = 0.0f; // Промахи на уникальную вершину (1.0 - идеал)
+};
+
+class MeshOptimizer {
+public:
+    static constexpr uint32_t ANALYZE_CACHE_SIZE = 16;  // Типичный FIFO-кэш post-transform
+    static constexpr float OVERDRAW_THRESHOLD = 1.05f; // Допустимое ухудшение ACMR ради overdraw
+
+    static VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount,
+        uint32_t cacheSize = ANALYZE_CACHE_SIZE) {
+
+        VertexCacheStats stats;
+        if (indices.size() < 3 || vertexCount == 0) return stats;
+
+        // Время попадания вершины в кэш: вершина в кэше, если с тех пор было < cacheSize промахов
+        std::vector<uint32_t> cachedAt(vertexCount, 0);
+        std::vector<uint8_t> used(vertexCount, 0);
+        uint32_t misses = 0;
+        size_t uniqueVertices = 0;
+
+        for (uint32_t index : indices) {
+            if (index >= vertexCount) continue;
+            if (!used[index]) {
+                used[index] = 1;
+                uniqueVertices++;
+            }
+            else if (misses - cachedAt[index] < cacheSize) {
+                continue;
+            }
+            cachedAt[index] = misses;
+            misses++;
+        }
+
+        stats.acmr = (float)misses / (float)(indices.size() / 3);
+        stats.atvr = uniqueVertices ? (float)misses / (float)uniqueVertices : 0.0f;
+        return stats;
+    }
+
+    // Полный проход с логом ACMR/ATVR до и после
+    static void Optimize(Mesh& mesh) {
+        if (mesh.indices.size() < 3 || mesh.vertices.empty()) return;
+
+        VertexCacheStats before = AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+
+        OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+        OptimizeOverdraw(mesh.indices, mesh.vertices, OVERDRAW_THRESHOLD);
+        OptimizeVertexFetch(mesh.vertices, mesh.indices, mesh.skin.empty() ? nullptr : &mesh.skin);
+
+        VertexCacheStats after = AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+
+        char buffer[256];
+        sprintf_s(buffer, "Оптимизация меша %s (%zu треугольников): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+            NameRegistry::GetName(mesh.materialId).c_str(), mesh.indices.size() / 3,
+            before.acmr, after.acmr, before.atvr, after.atvr);
+        DEBUG_LOG(buffer);
+    }
+
+    // Алгоритм Форсайта (Linear-Speed Vertex Cache Optimisation):
+    // жадно выбирает треугольник с лучшей суммой очков вершин, где очки зависят
+    // от позиции вершины в моделируемом LRU-кэше и числа оставшихся у неё треугольников.
+    static void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount) {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 2 || vertexCount == 0) return;
+
+        // Треугольники каждой вершины (CSR-раскладка)
+        std::vector<uint32_t> trianglesLeft(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            if (indices[i] >= vertexCount) return; // Битые индексы не трогаем
+            trianglesLeft[indices[i]]++;
+        }
+
+        std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffset[v + 1] = adjacencyOffset[v] + trianglesLeft[v];
+        }
+        std::vector<uint32_t> adjacency(adjacencyOffset[vertexCount]);
+        {
+            std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+            for (size_t t = 0; t < triangleCount; t++) {
+                for (int k = 0; k < 3; k++) {
+                    uint32_t v = indices[t * 3 + k];
+                    adjacency[fill[v]++] = (uint32_t)t;
+                }
+            }
+        }
+
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> vertexScore(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            vertexScore[v] = VertexScore(-1, trianglesLeft[v]);
+        }
+
+        std::vector<float> triangleScore(triangleCount);
+        std::vector<uint8_t> emitted(triangleCount, 0);
+        for (size_t t = 0; t < triangleCount; t++) {
+            triangleScore[t] = vertexScore[indices[t * 3]] +
+                vertexScore[indices[t * 3 + 1]] +
+                vertexScore[indices[t * 3 + 2]];
+        }
+
+        std::vector<uint32_t> result;
+        result.reserve(triangleCount * 3);
+
+        // LRU-кэш с запасом на 3 новые вершины треугольника
+        uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+        uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+        uint32_t cacheCount = 0;
+
+        size_t scanCursor = 0;
+        int64_t bestTriangle = -1;
+
+        for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+            if (bestTriangle < 0) {
+                // Кэш не дал кандидатов - берём лучший из оставшихся линейным проходом
+                float bestScore = -1.0f;
+                for (size_t t = scanCursor; t < triangleCount; t++) {
+                    if (!emitted[t] && triangleScore[t] > bestScore) {
+                        bestScore = triangleScore[t];
+                        bestTriangle = (int64_t)t;
+                    }
+                }
+            }
+
+            uint32_t t = (uint32_t)bestTriangle;
+            emitted[t] = 1;
+            while (scanCursor < triangleCount && emitted[scanCursor]) scanCursor++;
+
+            const uint32_t* tri = &indices[t * 3];
+            result.insert(result.end(), tri, tri + 3);
+
+            // Убираем треугольник из списков его вершин
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = tri[k];
+                uint32_t* begin = &adjacency[adjacencyOffset[v]];
+                uint32_t* end = begin + trianglesLeft[v];
+                uint32_t* found = std::find(begin, end, t);
+                if (found != end) {
+                    std::swap(*found, *(end - 1));
+                    trianglesLeft[v]--;
+                }
+            }
+
+            // Вершины треугольника встают в начало кэша, остальные сдвигаются
+            uint32_t newCount = 0;
+            for (int k = 0; k < 3; k++) newCache[newCount++] = tri[k];
+            for (uint32_t i = 0; i < cacheCount; i++) {
+                uint32_t v = cache[i];
+                if (v != tri[0] && v != tri[1] && v != tri[2]) newCache[newCount++] = v;
+            }
+
+            // Вытесненные вершины выпадают из кэша
+            for (uint32_t i = FORSYTH_CACHE_SIZE; i < newCount; i++) {
+                uint32_t v = newCache[i];
+                cachePosition[v] = -1;
+                vertexScore[v] = VertexScore(-1, trianglesLeft[v]);
+                UpdateTriangleScores(v, indices, adjacency, adjacencyOffset, trianglesLeft, vertexScore, triangleScore);
+            }
+
+            cacheCount = std::min(newCount, FORSYTH_CACHE_SIZE);
+            std::copy(newCache, newCache + cacheCount, cache);
+
+            // Пересчёт очков и выбор следующего кандидата среди треугольников вершин в кэше
+            for (uint32_t i = 0; i < cacheCount; i++) {
+                uint32_t v = cache[i];
+                cachePosition[v] = (int)i;
+                vertexScore[v] = VertexScore((int)i, trianglesLeft[v]);
+            }
+
+            bestTriangle = -1;
+            float bestScore = -1.0f;
+            for (uint32_t i = 0; i < cacheCount; i++) {
+                uint32_t v = cache[i];
+                for (uint32_t a = 0; a < trianglesLeft[v]; a++) {
+                    uint32_t adjacent = adjacency[adjacencyOffset[v] + a];
+                    float score = vertexScore[indices[adjacent * 3]] +
+                        vertexScore[indices[adjacent * 3 + 1]] +
+                        vertexScore[indices[adjacent * 3 + 2]];
+                    triangleScore[adjacent] = score;
+                    if (score > bestScore) {
+                        bestScore = score;
+                        bestTriangle = adjacent;
+                    }
+                }
+            }
+        }
+
+        indices.swap(result);
+    }
+
+    // Перестановка кластеров для overdraw: порядок под кэш режется на кластеры
+    // в точках сброса кэша, затем кластеры сортируются так, чтобы внешние,
+    // смотрящие наружу части шли первыми и закрывали внутренние по depth test.
+    static void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold) {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 2) return;
+
+        std::vector<uint32_t> clusters = BuildClusters(indices, vertices.size(), threshold);
+        if (clusters.size() < 2) return;
+
+        // Центр меша, взвешенный по площади
+        XMVECTOR meshCentroid = XMVectorZero();
+        float meshArea = 0.0f;
+
+        struct ClusterInfo {
+            uint32_t first;
+            uint32_t count;
+            float sortKey;
+        };
+        std::vector<ClusterInfo> infos(clusters.size());
+        std::vector<XMFLOAT3> centroids(clusters.size());
+        std::vector<XMFLOAT3> normals(clusters.size());
+
+        for (size_t c = 0; c < clusters.size(); c++) {
+            uint32_t first = clusters[c];
+            uint32_t last = (c + 1 < clusters.size()) ? clusters[c + 1] : (uint32_t)triangleCount;
+
+            XMVECTOR centroid = XMVectorZero();
+            XMVECTOR normal = XMVectorZero();
+            float area = 0.0f;
+
+            for (uint32_t t = first; t < last; t++) {
+                XMVECTOR p0 = XMLoadFloat3(&vertices[indices[t * 3]].position);
+                XMVECTOR p1 = XMLoadFloat3(&vertices[indices[t * 3 + 1]].position);
+                XMVECTOR p2 = XMLoadFloat3(&vertices[indices[t * 3 + 2]].position);
+
+                XMVECTOR cross = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+                float doubleArea = XMVectorGetX(XMVector3Length(cross));
+                XMVECTOR center = XMVectorScale(XMVectorAdd(XMVectorAdd(p0, p1), p2), 1.0f / 3.0f);
+
+                centroid = XMVectorAdd(centroid, XMVectorScale(center, doubleArea));
+                normal = XMVectorAdd(normal, cross); // Длина креста уже пропорциональна площади
+                area += doubleArea;
+            }
+
+            if (area > 0.0f) {
+                centroid = XMVectorScale(centroid, 1.0f / area);
+            }
+            meshCentroid = XMVectorAdd(meshCentroid, XMVectorScale(centroid, area));
+            meshArea += area;
+
+            XMStoreFloat3(&centroids[c], centroid);
+            XMStoreFloat3(&normals[c], XMVector3Normalize(normal));
+            infos[c] = { first, last - first, 0.0f };
+        }
+
+        if (meshArea > 0.0f) {
+            meshCentroid = XMVectorScale(meshCentroid, 1.0f / meshArea);
+        }
+
+        for (size_t c = 0; c < clusters.size(); c++) {
+            XMVECTOR offset = XMVectorSubtract(XMLoadFloat3(&centroids[c]), meshCentroid);
+            infos[c].sortKey = XMVectorGetX(XMVector3Dot(offset, XMLoadFloat3(&normals[c])));
+        }
+
+        std::stable_sort(infos.begin(), infos.end(), [](const ClusterInfo& a, const ClusterInfo& b) {
+            return a.sortKey > b.sortKey;
+        });
+
+        std::vector<uint32_t> result;
+        result.reserve(indices.size());
+        for (const auto& info : infos) {
+            result.insert(result.end(),
+                indices.begin() + info.first * 3,
+                indices.begin() + (info.first + info.count) * 3);
+        }
+
+        // Перестановка не должна ухудшить кэш сильнее допустимого
+        float acmrBefore = AnalyzeVertexCache(indices, vertices.size()).acmr;
+        float acmrAfter = AnalyzeVertexCache(result, vertices.size()).acmr;
+        if (acmrAfter <= acmrBefore * threshold) {
+            indices.swap(result);
+        }
+    }
+
+    // Вершины переставляются в порядке первого обращения из индексов,
+    // неиспользуемые вершины отбрасываются. Поток скиннинга (если есть) - вместе с ними.
+    static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+        std::vector<VertexSkin>* skin = nullptr) {
+        const uint32_t UNUSED = 0xFFFFFFFF;
+        std::vector<uint32_t> remap(vertices.size(), UNUSED);
+        std::vector<Vertex> result;
+        std::vector<VertexSkin> skinResult;
+        result.reserve(vertices.size());
+        if (skin) skinResult.reserve(skin->size());
+
+        for (auto& index : indices) {
+            if (index >= vertices.size()) continue;
+            if (remap[index] == UNUSED) {
+                remap[index] = (uint32_t)result.size();
+                result.push_back(vertices[index]);
+                if (skin) skinResult.push_back((*skin)[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(result);
+        if (skin) skin->swap(skinResult);
+    }
+
+private:
+    static constexpr uint32_t FORSYTH_CACHE_SIZE = 32;
+
+    static float VertexScore(int cachePosition, uint32_t trianglesLeft) {
+        const float CACHE_DECAY_POWER = 1.5f;
+        const float LAST_TRIANGLE_SCORE = 0.75f;
+        const float VALENCE_BOOST_SCALE = 2.0f;
+        const float VALENCE_BOOST_POWER = 0.5f;
+
+        if (trianglesLeft == 0) return -1.0f; // Вершина больше не нужна
+
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            if (cachePosition < 3) {
+                // Вершины последнего треугольника получают фиксированный вес,
+                // чтобы не поощрять длинные полосы
+                score = LAST_TRIANGLE_SCORE;
+            }
+            else {
+                const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = powf(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+            }
+        }
+
+        // Бонус вершинам с малым числом оставшихся треугольников - закрываем "хвосты"
+        score += VALENCE_BOOST_SCALE * powf((float)trianglesLeft, -VALENCE_BOOST_POWER);
+        return score;
+    }
+
+    static void UpdateTriangleScores(uint32_t v,
+        const std::vector<uint32_t>& indices,
+        const std::vector<uint32_t>& adjacency,
+        const std::vector<uint32_t>& adjacencyOffset,
+        const std::vector<uint32_t>& trianglesLeft,
+        const std::vector<float>& vertexScore,
+        std::vector<float>& triangleScore) {
+
+        for (uint32_t a = 0; a < trianglesLeft[v]; a++) {
+            uint32_t t = adjacency[adjacencyOffset[v] + a];
+            triangleScore[t] = vertexScore[indices[t * 3]] +
+                vertexScore[indices[t * 3 + 1]] +
+                vertexScore[indices[t * 3 + 2]];
+        }
+    }
+
+    // Границы кластеров (индексы первых треугольников). Жёсткие границы - там, где
+    // моделируемый кэш сбрасывается (все три вершины промахнулись); внутри жёсткого
+    // кластера добавляются мягкие границы, пока ACMR части не хуже threshold * ACMR кластера.
+    static std::vector<uint32_t> BuildClusters(const std::vector<uint32_t>& indices, size_t vertexCount, float threshold) {
+        size_t triangleCount = indices.size() / 3;
+        std::vector<uint32_t> cachedAt(vertexCount, 0);
+        std::vector<uint8_t> used(vertexCount, 0);
+        uint32_t misses = 0;
+
+        auto simulate = [&](uint32_t t) {
+            int triangleMisses = 0;
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[t * 3 + k];
+                if (used[v] && misses - cachedAt[v] < ANALYZE_CACHE_SIZE) continue;
+                used[v] = 1;
+                cachedAt[v] = misses++;
+                triangleMisses++;
+            }
+            return triangleMisses;
+        };
+
+        std::vector<uint32_t> hard;
+        std::vector<uint8_t> triangleMisses(triangleCount);
+        for (uint32_t t = 0; t < triangleCount; t++) {
+            int m = simulate(t);
+            triangleMisses[t] = (uint8_t)m;
+            if (t == 0 || m == 3) hard.push_back(t);
+        }
+
+        std::vector<uint32_t> clusters;
+        for (size_t h = 0; h < hard.size(); h++) {
+            uint32_t first = hard[h];
+            uint32_t last = (h + 1 < hard.size()) ? hard[h + 1] : (uint32_t)triangleCount;
+
+            uint32_t clusterMisses = 0;
+            for (uint32_t t = first; t < last; t++) clusterMisses += triangleMisses[t];
+            float clusterAcmr = (float)clusterMisses / (float)(last - first);
+
+            clusters.push_back(first);
+            uint32_t partMisses = 0;
+            uint32_t partStart = first;
+            for (uint32_t t = first; t < last; t++) {
+                partMisses += triangleMisses[t];
+                uint32_t partCount = t - partStart + 1;
+                // Мягкая граница: часть достаточно велика и её ACMR не хуже допустимого
+                if (t + 1 < last && partCount >= MIN_CLUSTER_TRIANGLES &&
+                    (float)partMisses / (float)partCount <= clusterAcmr * threshold) {
+                    clusters.push_back(t + 1);
+                    partStart = t + 1;
+                    partMisses = 0;
+                }
+            }
+        }
+        return clusters;
+    }
+
+    static constexpr uint32_t MIN_CLUSTER_TRIANGLES = 256;
+};
+
+// ==================== УПРОЩЕНИЕ МЕШЕЙ (LOD) ====================
+// Цепочка LOD строится упрощением по квадрикам ошибки (QEM, Гарланд-Хекберт)
+// со схлопыванием полурёбер: вершина переезжает в позицию соседа, поэтому новые
+// вершины не нужны и все уровни делят один вершинный буфер, а индексы уровней
+// дописываются в конец индексного. Границы и швы атрибутов (UV/нормали) сохраняются.
+const bool GENERATE_MESH_LODS = true;
+
+class MeshSimplifier {
+public:
+    static constexpr float LOD_TRIANGLE_RATIO = 0.5f;  // Каждый уровень вдвое легче предыдущего
+    static constexpr float LOD_MIN_REDUCTION = 0.85f;  // Уровень, упростившийся меньше чем на 15%, не нужен
+    static constexpr float LOD_MAX_ERROR = 0.05f;      // Предел ошибки относительно размера меша
+    static constexpr uint32_t LOD_MIN_TRIANGLES = 64;  // Мелкие меши не упрощаем
+
+    // Дописывает уровни 1..MAX_MESH_LODS-1 в mesh.indices и заполняет mesh.lods
+    static void BuildLods(Mesh& mesh) {
+        if (!mesh.lods.empty() || mesh.indices.size() < 3) return;
+
+        MeshLod base;
+        base.firstIndex = 0;
+        base.indexCount = (uint32_t)mesh.indices.size();
+        mesh.lods.push_back(base);
+        if (base.indexCount / 3 < LOD_MIN_TRIANGLES) return;
+
+        float extent = ComputeExtent(mesh.vertices);
+        if (extent <= 0.0f) return;
+
+        std::vector<uint32_t> previous(mesh.indices);
+        while (mesh.lods.size() < MAX_MESH_LODS) {
+            const MeshLod& prev = mesh.lods.back();
+            size_t target = (size_t)(prev.indexCount / 3 * LOD_TRIANGLE_RATIO) * 3;
+
+            float error = 0.0f;
+            std::vector<uint32_t> lodIndices = Simplify(mesh.vertices, previous, target,
+                extent * LOD_MAX_ERROR, &error);
+            if (lodIndices.empty() || lodIndices.size() > prev.indexCount * LOD_MIN_REDUCTION) break;
+
+            MeshOptimizer::OptimizeVertexCache(lodIndices, mesh.vertices.size());
+
+            MeshLod lod;
+            lod.firstIndex = (uint32_t)mesh.indices.size();
+            lod.indexCount = (uint32_t)lodIndices.size();
+            lod.error = prev.error + error; // Уровни строятся цепочкой, ошибки складываются
+            mesh.indices.insert(mesh.indices.end(), lodIndices.begin(), lodIndices.end());
+            mesh.lods.push_back(lod);
+            previous.swap(lodIndices);
+        }
+
+        char buffer[256];
+        int length = sprintf_s(buffer, "LOD меша %s:", NameRegistry::GetName(mesh.materialId).c_str());
+        for (size_t i = 0; i < mesh.lods.size() && length < 200; i++) {
+            length += sprintf_s(buffer + length, sizeof(buffer) - length, " %u (%.4f)",
+                mesh.lods[i].indexCount / 3, mesh.lods[i].error);
+        }
+        DEBUG_LOG(buffer);
+    }
+
+    // Упрощает треугольники до targetIndexCount индексов или до ошибки maxError (в единицах модели).
+    // resultError - достигнутая ошибка (оценка сверху расстояния до исходных плоскостей).
+    static std::vector<uint32_t> Simplify(const std::vector<Vertex>& vertices,
+        const std::vector<uint32_t>& indices,
+        size_t targetIndexCount, float maxError, float* resultError) {
+
+        std::vector<uint32_t> triangles(indices.begin(), indices.begin() + indices.size() / 3 * 3);
+        if (resultError) *resultError = 0.0f;
+        if (triangles.empty() || vertices.empty()) return triangles;
+
+        // Склейка вершин по позиции: узел - точка, вершины узла - его "клинья" с разными атрибутами
+        std::vector<uint32_t> vertexNode(vertices.size());
+        std::vector<XMFLOAT3> nodePosition;
+        {
+            std::unordered_map<PositionKey, uint32_t, PositionKeyHash> nodes;
+            nodes.reserve(vertices.size());
+            for (size_t v = 0; v < vertices.size(); v++) {
+                auto inserted = nodes.emplace(PositionKey::Of(vertices[v].position), (uint32_t)nodePosition.size());
+                if (inserted.second) nodePosition.push_back(vertices[v].position);
+                vertexNode[v] = inserted.first->second;
+            }
+        }
+        size_t nodeCount = nodePosition.size();
+
+        // Квадрики плоскостей исходных треугольников
+        std::vector<Quadric> quadrics(nodeCount);
+        for (size_t t = 0; t < triangles.size(); t += 3) {
+            Quadric q = Quadric::FromTriangle(
+                vertices[triangles[t]].position,
+                vertices[triangles[t + 1]].position,
+                vertices[triangles[t + 2]].position);
+            for (int k = 0; k < 3; k++) {
+                quadrics[vertexNode[triangles[t + k]]].Add(q);
+            }
+        }
+
+        const double maxCost = (double)maxError * maxError;
+        float achievedError = 0.0f;
+
+        std::vector<uint32_t> vertexRemap(vertices.size());
+        std::vector<uint8_t> touched(nodeCount);
+        std::vector<uint32_t> nodeTriangleOffset(nodeCount + 1);
+        std::vector<uint32_t> nodeTriangles;
+        std::unordered_map<uint64_t, uint32_t> edgeUse;
+        std::vector<uint8_t> nodeKind(nodeCount);
+
+        while (triangles.size() > targetIndexCount) {
+            size_t triangleCount = triangles.size() / 3;
+
+            // Треугольники каждого узла (CSR)
+            std::fill(nodeTriangleOffset.begin(), nodeTriangleOffset.end(), 0);
+            for (uint32_t index : triangles) nodeTriangleOffset[vertexNode[index] + 1]++;
+            for (size_t n = 0; n < nodeCount; n++) nodeTriangleOffset[n + 1] += nodeTriangleOffset[n];
+            nodeTriangles.resize(triangles.size());
+            {
+                std::vector<uint32_t> fill(nodeTriangleOffset.begin(), nodeTriangleOffset.end() - 1);
+                for (size_t t = 0; t < triangleCount; t++) {
+                    for (int k = 0; k < 3; k++) {
+                        nodeTriangles[fill[vertexNode[triangles[t * 3 + k]]]++] = (uint32_t)t;
+                    }
+                }
+            }
+
+            // Рёбра в пространстве узлов: 1 треугольник - граница, больше 2 - неманифолд
+            edgeUse.clear();
+            for (size_t t = 0; t < triangleCount; t++) {
+                for (int k = 0; k < 3; k++) {
+                    uint32_t a = vertexNode[triangles[t * 3 + k]];
+                    uint32_t b = vertexNode[triangles[t * 3 + (k + 1) % 3]];
+                    edgeUse[EdgeKey(a, b)]++;
+                }
+            }
+            std::fill(nodeKind.begin(), nodeKind.end(), NODE_MANIFOLD);
+            for (const auto& edge : edgeUse) {
+                uint32_t a = (uint32_t)(edge.first >> 32);
+                uint32_t b = (uint32_t)edge.first;
+                uint8_t kind = (edge.second == 1) ? NODE_BORDER : (edge.second > 2 ? NODE_LOCKED : NODE_MANIFOLD);
+                nodeKind[a] = std::max(nodeKind[a], kind);
+                nodeKind[b] = std::max(nodeKind[b], kind);
+            }
+
+            // Кандидаты: оба направления каждого ребра
+            struct Collapse {
+                uint32_t from;
+                uint32_t to;
+                double cost;
+            };
+            std::vector<Collapse> candidates;
+            candidates.reserve(edgeUse.size() * 2);
+            for (const auto& edge : edgeUse) {
+                uint32_t a = (uint32_t)(edge.first >> 32);
+                uint32_t b = (uint32_t)edge.first;
+                bool borderEdge = edge.second == 1;
+                for (int dir = 0; dir < 2; dir++) {
+                    uint32_t from = dir ? b : a;
+                    uint32_t to = dir ? a : b;
+                    if (nodeKind[from] == NODE_LOCKED) continue;
+                    // Граничный узел может ехать только вдоль границы, иначе контур "съёживается"
+                    if (nodeKind[from] == NODE_BORDER && (!borderEdge || nodeKind[to] == NODE_MANIFOLD)) continue;
+                    candidates.push_back({ from, to, quadrics[from].Evaluate(nodePosition[to]) });
+                }
+            }
+            if (candidates.empty()) break;
+
+            std::sort(candidates.begin(), candidates.end(), [](const Collapse& x, const Collapse& y) {
+                return x.cost < y.cost;
+            });
+
+            for (size_t v = 0; v < vertices.size(); v++) vertexRemap[v] = (uint32_t)v;
+            std::fill(touched.begin(), touched.end(), 0);
+
+            size_t collapses = 0;
+            size_t remainingTriangles = triangleCount;
+            for (const Collapse& collapse : candidates) {
+                if (remainingTriangles * 3 <= targetIndexCount) break;
+                if (collapse.cost > maxCost) break;
+                if (touched[collapse.from] || touched[collapse.to]) continue;
+
+                uint32_t firstTri = nodeTriangleOffset[collapse.from];
+                uint32_t lastTri = nodeTriangleOffset[collapse.from + 1];
+
+                if (!MapWedges(collapse.from, collapse.to, triangles, vertexNode,
+                    &nodeTriangles[firstTri], lastTri - firstTri, vertexRemap)) {
+                    continue;
+                }
+                if (FlipsTriangle(collapse.from, collapse.to, triangles, vertexNode, nodePosition,
+                    &nodeTriangles[firstTri], lastTri - firstTri)) {
+                    // Откатываем назначенные клинья
+                    for (uint32_t i = firstTri; i < lastTri; i++) {
+                        const uint32_t* tri = &triangles[nodeTriangles[i] * 3];
+                        for (int k = 0; k < 3; k++) vertexRemap[tri[k]] = tri[k];
+                    }
+                    continue;
+                }
+
+                // Соседи тоже замораживаются до следующего прохода: их треугольники меняются
+                for (uint32_t i = firstTri; i < lastTri; i++) {
+                    const uint32_t* tri = &triangles[nodeTriangles[i] * 3];
+                    uint32_t nodes[3] = { vertexNode[tri[0]], vertexNode[tri[1]], vertexNode[tri[2]] };
+                    for (int k = 0; k < 3; k++) touched[nodes[k]] = 1;
+                    if (nodes[0] == collapse.to || nodes[1] == collapse.to || nodes[2] == collapse.to) {
+                        remainingTriangles--;
+                    }
+                }
+
+                quadrics[collapse.to].Add(quadrics[collapse.from]);
+                achievedError = std::max(achievedError, (float)sqrt(std::max(collapse.cost, 0.0)));
+                collapses++;
+            }
+
+            if (collapses == 0) break;
+
+            // Переписываем треугольники, выбрасывая выродившиеся
+            size_t write = 0;
+            for (size_t t = 0; t < triangleCount; t++) {
+                uint32_t a = vertexRemap[triangles[t * 3]];
+                uint32_t b = vertexRemap[triangles[t * 3 + 1]];
+                uint32_t c = vertexRemap[triangles[t * 3 + 2]];
+                uint32_t na = vertexNode[a], nb = vertexNode[b], nc = vertexNode[c];
+                if (na == nb || nb == nc || na == nc) continue;
+                triangles[write++] = a;
+                triangles[write++] = b;
+                triangles[write++] = c;
+            }
+            triangles.resize(write);
+        }
+
+        if (resultError) *resultError = achievedError;
+        return triangles;
+    }
+
+    // Ключ точного совпадения позиции (склейка вершин по швам атрибутов)
+    struct PositionKey {
+        uint32_t x, y, z;
+
+        static PositionKey Of(const XMFLOAT3& p) {
+            PositionKey key;
+            memcpy(&key.x, &p.x, sizeof(float));
+            memcpy(&key.y, &p.y, sizeof(float));
+            memcpy(&key.z, &p.z, sizeof(float));
+            return key;
+        }
+
+        bool operator==(const PositionKey& other) const {
+            return x == other.x && y == other.y && z == other.z;
+        }
+    };
+
+    struct PositionKeyHash {
+        size_t operator()(const PositionKey& key) const {
+            return (size_t)(key.x * 73856093u ^ key.y * 19349663u ^ key.z * 83492791u);
+        }
+    };
+
+private:
+    enum : uint8_t {
+        NODE_MANIFOLD = 0,
+        NODE_BORDER = 1,
+        NODE_LOCKED = 2
+    };
+
+    // Симметричная 4x4 квадрика плоскостей, храним верхний треугольник
+    struct Quadric {
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        double a11 = 0, a12 = 0, a13 = 0;
+        double a22 = 0, a23 = 0;
+        double a33 = 0;
+
+        static Quadric FromTriangle(const XMFLOAT3& p0, const XMFLOAT3& p1, const XMFLOAT3& p2) {
+            double ux = p1.x - p0.x, uy = p1.y - p0.y, uz = p1.z - p0.z;
+            double vx = p2.x - p0.x, vy = p2.y - p0.y, vz = p2.z - p0.z;
+            double nx = uy * vz - uz * vy;
+            double ny = uz * vx - ux * vz;
+            double nz = ux * vy - uy * vx;
+            double length = sqrt(nx * nx + ny * ny + nz * nz);
+
+            Quadric q;
+            if (length <= 0.0) return q;
+            nx /= length; ny /= length; nz /= length;
+            double d = -(nx * p0.x + ny * p0.y + nz * p0.z);
+
+            q.a00 = nx * nx; q.a01 = nx * ny; q.a02 = nx * nz; q.a03 = nx * d;
+            q.a11 = ny * ny; q.a12 = ny * nz; q.a13 = ny * d;
+            q.a22 = nz * nz; q.a23 = nz * d;
+            q.a33 = d * d;
+            return q;
+        }
+
+        void Add(const Quadric& q) {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+            a11 += q.a11; a12 += q.a12; a13 += q.a13;
+            a22 += q.a22; a23 += q.a23;
+            a33 += q.a33;
+        }
+
+        // Сумма квадратов расстояний от точки до плоскостей квадрики
+        double Evaluate(const XMFLOAT3& p) const {
+            double x = p.x, y = p.y, z = p.z;
+            return x * x * a00 + 2 * x * y * a01 + 2 * x * z * a02 + 2 * x * a03 +
+                y * y * a11 + 2 * y * z * a12 + 2 * y * a13 +
+                z * z * a22 + 2 * z * a23 +
+                a33;
+        }
+    };
+
+    static uint64_t EdgeKey(uint32_t a, uint32_t b) {
+        if (a > b) std::swap(a, b);
+        return ((uint64_t)a << 32) | b;
+    }
+
+    static float ComputeExtent(const std::vector<Vertex>& vertices) {
+        XMFLOAT3 minPos(FLT_MAX, FLT_MAX, FLT_MAX);
+        XMFLOAT3 maxPos(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (const auto& v : vertices) {
+            minPos.x = std::min(minPos.x, v.position.x); maxPos.x = std::max(maxPos.x, v.position.x);
+            minPos.y = std::min(minPos.y, v.position.y); maxPos.y = std::max(maxPos.y, v.position.y);
+            minPos.z = std::min(minPos.z, v.position.z); maxPos.z = std::max(maxPos.z, v.position.z);
+        }
+        float dx = maxPos.x - minPos.x, dy = maxPos.y - minPos.y, dz = maxPos.z - minPos.z;
+        return sqrtf(dx * dx + dy * dy + dz * dz);
+    }
+
+    // Каждый клин узла from должен лежать на ребре с клином узла to - туда он и переезжает.
+    // Для узла-шва это значит, что ребро идёт вдоль шва и обе стороны шва схлопываются согласованно.
+    static bool MapWedges(uint32_t from, uint32_t to,
+        const std::vector<uint32_t>& triangles,
+        const std::vector<uint32_t>& vertexNode,
+        const uint32_t* nodeTris, uint32_t nodeTriCount,
+        std::vector<uint32_t>& vertexRemap) {
+
+        bool valid = true;
+        for (uint32_t i = 0; i < nodeTriCount && valid; i++) {
+            const uint32_t* tri = &triangles[nodeTris[i] * 3];
+            for (int k = 0; k < 3; k++) {
+                uint32_t wedge = tri[k];
+                if (vertexNode[wedge] != from || vertexRemap[wedge] != wedge) continue;
+
+                // Ищем ребро клина к узлу to в любом треугольнике узла
+                uint32_t partner = wedge;
+                for (uint32_t j = 0; j < nodeTriCount && partner == wedge; j++) {
+                    const uint32_t* other = &triangles[nodeTris[j] * 3];
+                    if (other[0] != wedge && other[1] != wedge && other[2] != wedge) continue;
+                    for (int m = 0; m < 3; m++) {
+                        if (vertexNode[other[m]] == to) {
+                            partner = other[m];
+                            break;
+                        }
+                    }
+                }
+
+                if (partner == wedge) {
+                    valid = false;
+                    break;
+                }
+                vertexRemap[wedge] = partner;
+            }
+        }
+
+        if (!valid) {
+            for (uint32_t i = 0; i < nodeTriCount; i++) {
+                const uint32_t* tri = &triangles[nodeTris[i] * 3];
+                for (int k = 0; k < 3; k++) vertexRemap[tri[k]] = tri[k];
+            }
+        }
+        return valid;
+    }
+
+    // Схлопывание не должно разворачивать оставшиеся треугольники узла
+    static bool FlipsTriangle(uint32_t from, uint32_t to,
+        const std::vector<uint32_t>& triangles,
+        const std::vector<uint32_t>& vertexNode,
+        const std::vector<XMFLOAT3>& nodePosition,
+        const uint32_t* nodeTris, uint32_t nodeTriCount) {
+
+        for (uint32_t i = 0; i < nodeTriCount; i++) {
+            const uint32_t* tri = &triangles[nodeTris[i] * 3];
+            uint32_t nodes[3] = { vertexNode[tri[0]], vertexNode[tri[1]], vertexNode[tri[2]] };
+            if (nodes[0] == to || nodes[1] == to || nodes[2] == to) continue; // Этот треугольник исчезнет
+
+            XMFLOAT3 before[3], after[3];
+            for (int k = 0; k < 3; k++) {
+                before[k] = nodePosition[nodes[k]];
+                after[k] = (nodes[k] == from) ? nodePosition[to] : before[k];
+            }
+
+            XMFLOAT3 n0 = TriangleNormal(before[0], before[1], before[2]);
+            XMFLOAT3 n1 = TriangleNormal(after[0], after[1], after[2]);
+            float dot = n0.x * n1.x + n0.y * n1.y + n0.z * n1.z;
+            float len0 = n0.x * n0.x + n0.y * n0.y + n0.z * n0.z;
+            float len1 = n1.x * n1.x + n1.y * n1.y + n1.z * n1.z;
+            // Разворот или вырождение в иглу (угол между нормалями больше ~75°)
+            if (len1 <= 0.0f || dot <= 0.25f * sqrtf(len0 * len1)) return true;
+        }
+        return false;
+    }
+
+    static XMFLOAT3 TriangleNormal(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c) {
+        float ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+        float vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+        return XMFLOAT3(uy * vz - uz * vy, uz * vx - ux * vz, ux * vy - uy * vx);
+    }
+};
+
+// ==================== КЛАСТЕРЫ ТРЕУГОЛЬНИКОВ (MESHLETS) ====================
+// Каждый уровень LOD режется на кластеры до 64 вершин / 124 треугольников,
+// треугольники кластера лежат в индексном буфере подряд. У кластера есть
+// ограничивающая сфера и конус нормалей: Model3D::Render отбрасывает кластеры
+// вне пирамиды видимости и целиком обращённые от камеры, а соседние видимые
+// кластеры рисует одним DrawIndexed.
+const bool BUILD_MESHLETS = true;
+
+class MeshletBuilder {
+public:
+    static constexpr uint32_t MAX_VERTICES = 64;
+    static constexpr uint32_t MAX_TRIANGLES = 124;
+    static constexpr uint32_t MIN_TRIANGLES = 32;       // Меньшие кластеры добираются несвязными кусками
+    static constexpr float MAX_OPEN_EDGE_RATIO = 0.01f; // Больше граничных рёбер - меш двусторонний
+
+    // Режет все уровни LOD меша на кластеры (переставляя треугольники внутри уровня)
+    static void Build(Mesh& mesh) {
+        if (!mesh.meshlets.empty() || mesh.indices.size() < 3) return;
+
+        if (mesh.lods.empty()) {
+            MeshLod base;
+            base.indexCount = (uint32_t)mesh.indices.size();
+            mesh.lods.push_back(base);
+        }
+
+        // Внешняя сторона определяется знаком объёма, а не соглашением о порядке обхода;
+        // у незамкнутых мешей (плащи, листья) видны обе стороны - конусы отключаются
+        const MeshLod& base = mesh.lods[0];
+        bool closed = IsClosed(mesh.vertices, &mesh.indices[base.firstIndex], base.indexCount);
+        float orientation = (SignedVolume(mesh.vertices, &mesh.indices[base.firstIndex], base.indexCount) >= 0.0) ? 1.0f : -1.0f;
+
+        size_t culledMeshlets = 0;
+        for (MeshLod& lod : mesh.lods) {
+            lod.firstMeshlet = (uint32_t)mesh.meshlets.size();
+            BuildRange(mesh.vertices, mesh.indices, lod.firstIndex, lod.indexCount,
+                closed ? orientation : 0.0f, mesh.meshlets);
+            lod.meshletCount = (uint32_t)mesh.meshlets.size() - lod.firstMeshlet;
+        }
+        for (const Meshlet& meshlet : mesh.meshlets) {
+            if (meshlet.coneCutoff <= 1.0f) culledMeshlets++;
+        }
+
+        char buffer[256];
+        sprintf_s(buffer, "Кластеры меша %s: %zu (LOD 0: %u), с конусом нормалей: %zu%s",
+            NameRegistry::GetName(mesh.materialId).c_str(), mesh.meshlets.size(),
+            mesh.lods[0].meshletCount, culledMeshlets, closed ? "" : " (меш незамкнут)");
+        DEBUG_LOG(buffer);
+    }
+
+    // Кластер целиком вне пирамиды видимости (плоскости в пространстве модели, нормали внутрь)
+    static bool IsOutsideFrustum(const Meshlet& meshlet, const XMFLOAT4 planes[6]) {
+        for (int p = 0; p < 6; p++) {
+            const XMFLOAT4& plane = planes[p];
+            float distance = plane.x * meshlet.center.x + plane.y * meshlet.center.y +
+                plane.z * meshlet.center.z + plane.w;
+            if (distance < -meshlet.radius) return true;
+        }
+        return false;
+    }
+
+    // Все треугольники кластера смотрят от камеры (ортогональная проекция:
+    // viewDirection - направление взгляда в пространстве модели, нормализованное)
+    static bool IsBackfacing(const Meshlet& meshlet, const XMFLOAT3& viewDirection) {
+        float dot = meshlet.coneAxis.x * viewDirection.x +
+            meshlet.coneAxis.y * viewDirection.y +
+            meshlet.coneAxis.z * viewDirection.z;
+        return dot >= meshlet.coneCutoff;
+    }
+
+private:
+    static void BuildRange(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+        uint32_t firstIndex, uint32_t indexCount, float orientation, std::vector<Meshlet>& meshlets) {
+
+        uint32_t triangleCount = indexCount / 3;
+        if (triangleCount == 0) return;
+        const uint32_t* tris = &indices[firstIndex];
+
+        // Внешние нормали треугольников
+        std::vector<XMFLOAT3> normals(triangleCount);
+        for (uint32_t t = 0; t < triangleCount; t++) {
+            XMFLOAT3 n = TriangleNormal(vertices, &tris[t * 3]);
+            normals[t] = XMFLOAT3(n.x * orientation, n.y * orientation, n.z * orientation);
+        }
+
+        // Треугольники каждой вершины (CSR)
+        std::vector<uint32_t> offsets(vertices.size() + 1, 0);
+        for (uint32_t i = 0; i < triangleCount * 3; i++) offsets[tris[i] + 1]++;
+        for (size_t v = 0; v < vertices.size(); v++) offsets[v + 1] += offsets[v];
+        std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+        {
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (uint32_t t = 0; t < triangleCount; t++) {
+                for (int k = 0; k < 3; k++) vertexTriangles[fill[tris[t * 3 + k]]++] = t;
+            }
+        }
+
+        std::vector<uint8_t> emitted(triangleCount, 0);
+        std::vector<uint32_t> vertexMark(vertices.size(), UINT32_MAX); // Номер кластера, где вершина уже есть
+        std::vector<uint32_t> result;
+        result.reserve(indexCount);
+
+        uint32_t seedCursor = 0;
+        uint32_t meshletId = 0;
+        std::vector<uint32_t> meshletVertices;
+        std::vector<uint32_t> meshletTriangles;
+
+        while (result.size() < triangleCount * 3) {
+            meshletVertices.clear();
+            meshletTriangles.clear();
+            XMFLOAT3 axis(0, 0, 0);
+
+            while (seedCursor < triangleCount && emitted[seedCursor]) seedCursor++;
+            uint32_t next = seedCursor;
+
+            // Жадный рост: следующий треугольник - сосед по вершинам, добавляющий меньше всего
+            // новых вершин; при равенстве - ближе по нормали к текущей оси кластера
+            while (next != UINT32_MAX) {
+                const uint32_t* tri = &tris[next * 3];
+                for (int k = 0; k < 3; k++) {
+                    if (vertexMark[tri[k]] != meshletId) {
+                        vertexMark[tri[k]] = meshletId;
+                        meshletVertices.push_back(tri[k]);
+                    }
+                }
+                emitted[next] = 1;
+                meshletTriangles.push_back(next);
+                result.insert(result.end(), tri, tri + 3);
+                axis.x += normals[next].x;
+                axis.y += normals[next].y;
+                axis.z += normals[next].z;
+
+                if (meshletTriangles.size() >= MAX_TRIANGLES) break;
+
+                next = UINT32_MAX;
+                int bestNew = 4;
+                float bestDot = -FLT_MAX;
+                for (uint32_t v : meshletVertices) {
+                    for (uint32_t a = offsets[v]; a < offsets[v + 1]; a++) {
+                        uint32_t candidate = vertexTriangles[a];
+                        if (emitted[candidate]) continue;
+
+                        const uint32_t* ctri = &tris[candidate * 3];
+                        int newVertices = (vertexMark[ctri[0]] != meshletId) +
+                            (vertexMark[ctri[1]] != meshletId) +
+                            (vertexMark[ctri[2]] != meshletId);
+                        if (meshletVertices.size() + newVertices > MAX_VERTICES) continue;
+
+                        float dot = normals[candidate].x * axis.x + normals[candidate].y * axis.y +
+                            normals[candidate].z * axis.z;
+                        if (newVertices < bestNew || (newVertices == bestNew && dot > bestDot)) {
+                            bestNew = newVertices;
+                            bestDot = dot;
+                            next = candidate;
+                        }
+                    }
+                }
+
+                // Соседей нет (мелкие несвязные детали) - не плодим крошечные кластеры
+                if (next == UINT32_MAX && meshletTriangles.size() < MIN_TRIANGLES) {
+                    while (seedCursor < triangleCount && emitted[seedCursor]) seedCursor++;
+                    if (seedCursor < triangleCount && meshletVertices.size() + 3 <= MAX_VERTICES) {
+                        next = seedCursor;
+                    }
+                }
+            }
+
+            Meshlet meshlet;
+            meshlet.firstIndex = firstIndex + (uint32_t)result.size() - (uint32_t)meshletTriangles.size() * 3;
+            meshlet.triangleCount = (uint32_t)meshletTriangles.size();
+            meshlet.vertexCount = (uint32_t)meshletVertices.size();
+            ComputeBounds(vertices, meshletVertices, meshlet);
+            ComputeCone(normals, meshletTriangles, orientation != 0.0f, meshlet);
+            meshlets.push_back(meshlet);
+            meshletId++;
+        }
+
+        std::copy(result.begin(), result.end(), indices.begin() + firstIndex);
+    }
+
+    static void ComputeBounds(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& meshletVertices,
+        Meshlet& meshlet) {
+
+        XMFLOAT3 minPos(FLT_MAX, FLT_MAX, FLT_MAX);
+        XMFLOAT3 maxPos(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (uint32_t v : meshletVertices) {
+            const XMFLOAT3& p = vertices[v].position;
+            minPos.x = std::min(minPos.x, p.x); maxPos.x = std::max(maxPos.x, p.x);
+            minPos.y = std::min(minPos.y, p.y); maxPos.y = std::max(maxPos.y, p.y);
+            minPos.z = std::min(minPos.z, p.z); maxPos.z = std::max(maxPos.z, p.z);
+        }
+
+        meshlet.center = XMFLOAT3((minPos.x + maxPos.x) * 0.5f, (minPos.y + maxPos.y) * 0.5f, (minPos.z + maxPos.z) * 0.5f);
+        float radiusSq = 0.0f;
+        for (uint32_t v : meshletVertices) {
+            const XMFLOAT3& p = vertices[v].position;
+            float dx = p.x - meshlet.center.x, dy = p.y - meshlet.center.y, dz = p.z - meshlet.center.z;
+            radiusSq = std::max(radiusSq, dx * dx + dy * dy + dz * dz);
+        }
+        meshlet.radius = sqrtf(radiusSq);
+    }
+
+    // Конус: ось - средняя нормаль, cutoff = sin(угла раствора). Кластер обращён от камеры,
+    // если dot(ось, взгляд) >= sin(раствора); при растворе >= 90° отсекать нельзя.
+    static void ComputeCone(const std::vector<XMFLOAT3>& normals, const std::vector<uint32_t>& triangles,
+        bool cullable, Meshlet& meshlet) {
+
+        meshlet.coneAxis = XMFLOAT3(0, 0, 0);
+        meshlet.coneCutoff = NO_CONE;
+        if (!cullable) return;
+
+        XMFLOAT3 axis(0, 0, 0);
+        for (uint32_t t : triangles) {
+            axis.x += normals[t].x;
+            axis.y += normals[t].y;
+            axis.z += normals[t].z;
+        }
+        float length = sqrtf(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+        if (length <= 0.0f) return;
+        axis = XMFLOAT3(axis.x / length, axis.y / length, axis.z / length);
+
+        float minDot = 1.0f;
+        for (uint32_t t : triangles) {
+            const XMFLOAT3& n = normals[t];
+            float nLength = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+            if (nLength <= 0.0f) continue; // Вырожденный треугольник не виден
+            minDot = std::min(minDot, (n.x * axis.x + n.y * axis.y + n.z * axis.z) / nLength);
+        }
+
+        meshlet.coneAxis = axis;
+        if (minDot > 0.0f) {
+            meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+        }
+    }
+
+    static XMFLOAT3 TriangleNormal(const std::vector<Vertex>& vertices, const uint32_t* tri) {
+        const XMFLOAT3& a = vertices[tri[0]].position;
+        const XMFLOAT3& b = vertices[tri[1]].position;
+        const XMFLOAT3& c = vertices[tri[2]].position;
+        float ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+        float vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+        XMFLOAT3 n(uy * vz - uz * vy, uz * vx - ux * vz, ux * vy - uy * vx);
+        float length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+        if (length <= 0.0f) return XMFLOAT3(0, 0, 0);
+        return XMFLOAT3(n.x / length, n.y / length, n.z / length);
+    }
+
+    static double SignedVolume(const std::vector<Vertex>& vertices, const uint32_t* tris, uint32_t indexCount) {
+        double volume = 0.0;
+        for (uint32_t i = 0; i + 2 < indexCount; i += 3) {
+            const XMFLOAT3& a = vertices[tris[i]].position;
+            const XMFLOAT3& b = vertices[tris[i + 1]].position;
+            const XMFLOAT3& c = vertices[tris[i + 2]].position;
+            volume += (double)a.x * ((double)b.y * c.z - (double)b.z * c.y) +
+                (double)a.y * ((double)b.z * c.x - (double)b.x * c.z) +
+                (double)a.z * ((double)b.x * c.y - (double)b.y * c.x);
+        }
+        return volume;
+    }
+
+    // Доля рёбер (по позициям, без учёта швов UV/нормалей) с одним треугольником
+    static bool IsClosed(const std::vector<Vertex>& vertices, const uint32_t* tris, uint32_t indexCount) {
+        std::unordered_map<MeshSimplifier::PositionKey, uint32_t, MeshSimplifier::PositionKeyHash> nodes;
+        std::vector<uint32_t> vertexNode(vertices.size());
+        for (size_t v = 0; v < vertices.size(); v++) {
+            vertexNode[v] = nodes.emplace(MeshSimplifier::PositionKey::Of(vertices[v].position),
+                (uint32_t)nodes.size()).first->second;
+        }
+
+        std::unordered_map<uint64_t, uint32_t> edges;
+        for (uint32_t i = 0; i + 2 < indexCount; i += 3) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t a = vertexNode[tris[i + k]];
+                uint32_t b = vertexNode[tris[i + (k + 1) % 3]];
+                if (a > b) std::swap(a, b);
+                edges[((uint64_t)a << 32) | b]++;
+            }
+        }
+
+        size_t openEdges = 0;
+        for (const auto& edge : edges) {
+            if (edge.second == 1) openEdges++;
+        }
+        return !edges.empty() && openEdges <= edges.size() * MAX_OPEN_EDGE_RATIO;
+    }
+
+    static constexpr float NO_CONE = 2.0f;
+};
+
+// ==================== УПАКОВАННЫЕ ВЕРШИНЫ ====================
+// Компактный формат вершины для GPU (20 байт вместо 44):
+// позиция - UNORM16 относительно AABB меша, нормаль - октаэдрическая SNORM16,
+// UV - half float, цвет - UNORM8. Параметры деквантования лежат в
+// неизменяемом константном буфере меша (регистр b1).
+const bool USE_PACKED_VERTICES = true;
+
+struct PackedVertex {
+    uint16_t position[4]; // UNORM16, w не используется
+    int16_t normal[2];    // SNORM16, октаэдрическая развёртка
+    uint16_t texcoord[2]; // half float
+    uint8_t color[4];     // UNORM8 RGBA
+};
+static_assert(sizeof(PackedVertex) == 20, "PackedVertex должен занимать 20 байт");
+
+// Раскладка совпадает с cbuffer PackedMeshBuffer в шейдере
+struct PackedMeshParams {
+    XMFLOAT4 positionOffset; // Минимум AABB
+    XMFLOAT4 positionScale;  // Размер AABB
+};
+
+// Ошибка квантования: максимум по вершинам меша
+struct QuantizationError {
+    float position = 0.0f;      // Отклонение по оси, в единицах модели
+    float normalDegrees = 0.0f; // Угол между исходной и восстановленной нормалью
+    float texcoord = 0.0f;      // Отклонение UV по компоненте
+    float color = 0.0f;         // Отклонение цвета по каналу (цвет в [0, 1])
+};
+
+class VertexQuantizer {
+public:
+    static PackedMeshParams ComputeParams(const Vertex* vertices, uint32_t count) {
+        XMFLOAT3 minPos(FLT_MAX, FLT_MAX, FLT_MAX);
+        XMFLOAT3 maxPos(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (uint32_t i = 0; i < count; i++) {
+            const XMFLOAT3& p = vertices[i].position;
+            minPos.x = std::min(minPos.x, p.x); maxPos.x = std::max(maxPos.x, p.x);
+            minPos.y = std::min(minPos.y, p.y); maxPos.y = std::max(maxPos.y, p.y);
+            minPos.z = std::min(minPos.z, p.z); maxPos.z = std::max(maxPos.z, p.z);
+        }
+        if (count == 0) {
+            minPos = maxPos = XMFLOAT3(0, 0, 0);
+        }
+
+        PackedMeshParams params;
+        params.positionOffset = XMFLOAT4(minPos.x, minPos.y, minPos.z, 0.0f);
+        params.positionScale = XMFLOAT4(maxPos.x - minPos.x, maxPos.y - minPos.y, maxPos.z - minPos.z, 0.0f);
+        return params;
+    }
+
+    static PackedVertex Encode(const Vertex& vertex, const PackedMeshParams& params) {
+        PackedVertex packed = {};
+        packed.position[0] = QuantizeUnorm16(vertex.position.x, params.positionOffset.x, params.positionScale.x);
+        packed.position[1] = QuantizeUnorm16(vertex.position.y, params.positionOffset.y, params.positionScale.y);
+        packed.position[2] = QuantizeUnorm16(vertex.position.z, params.positionOffset.z, params.positionScale.z);
+        packed.position[3] = 0;
+
+        EncodeOctahedral(vertex.normal, packed.normal);
+
+        packed.texcoord[0] = FloatToHalf(vertex.texcoord.x);
+        packed.texcoord[1] = FloatToHalf(vertex.texcoord.y);
+
+        packed.color[0] = QuantizeUnorm8(vertex.color.x);
+        packed.color[1] = QuantizeUnorm8(vertex.color.y);
+        packed.color[2] = QuantizeUnorm8(vertex.color.z);
+        packed.color[3] = 255;
+        return packed;
+    }
+
+    // То же, что делает входной ассемблер и вершинный шейдер
+    static Vertex Decode(const PackedVertex& packed, const PackedMeshParams& params) {
+        Vertex vertex;
+        vertex.position.x = params.positionOffset.x + packed.position[0] / 65535.0f * params.positionScale.x;
+        vertex.position.y = params.positionOffset.y + packed.position[1] / 65535.0f * params.positionScale.y;
+        vertex.position.z = params.positionOffset.z + packed.position[2] / 65535.0f * params.positionScale.z;
+
+        vertex.normal = DecodeOctahedral(
+            std::max(packed.normal[0] / 32767.0f, -1.0f),
+            std::max(packed.normal[1] / 32767.0f, -1.0f));
+
+        vertex.texcoord.x = HalfToFloat(packed.texcoord[0]);
+        vertex.texcoord.y = HalfToFloat(packed.texcoord[1]);
+
+        vertex.color.x = packed.color[0] / 255.0f;
+        vertex.color.y = packed.color[1] / 255.0f;
+        vertex.color.z = packed.color[2] / 255.0f;
+        return vertex;
+    }
+
+    static void EncodeMesh(const Vertex* vertices, uint32_t count, const PackedMeshParams& params,
+        std::vector<PackedVertex>& packed) {
+        packed.resize(count);
+        for (uint32_t i = 0; i < count; i++) {
+            packed[i] = Encode(vertices[i], params);
+        }
+    }
+
+    // Фактическая ошибка после кодирования и декодирования
+    static QuantizationError MeasureError(const Vertex* vertices, uint32_t count, const PackedMeshParams& params) {
+        QuantizationError error;
+        for (uint32_t i = 0; i < count; i++) {
+            const Vertex& source = vertices[i];
+            Vertex decoded = Decode(Encode(source, params), params);
+
+            error.position = std::max(error.position, fabsf(decoded.position.x - source.position.x));
+            error.position = std::max(error.position, fabsf(decoded.position.y - source.position.y));
+            error.position = std::max(error.position, fabsf(decoded.position.z - source.position.z));
+
+            XMFLOAT3 n = Normalize(source.normal);
+            if (n.x != 0.0f || n.y != 0.0f || n.z != 0.0f) {
+                // atan2 вместо acos: acos около 1 теряет точность float
+                const XMFLOAT3& d = decoded.normal;
+                float cx = n.y * d.z - n.z * d.y;
+                float cy = n.z * d.x - n.x * d.z;
+                float cz = n.x * d.y - n.y * d.x;
+                float cosAngle = n.x * d.x + n.y * d.y + n.z * d.z;
+                float angle = atan2f(sqrtf(cx * cx + cy * cy + cz * cz), cosAngle) * 180.0f / XM_PI;
+                error.normalDegrees = std::max(error.normalDegrees, angle);
+            }
+
+            error.texcoord = std::max(error.texcoord, fabsf(decoded.texcoord.x - source.texcoord.x));
+            error.texcoord = std::max(error.texcoord, fabsf(decoded.texcoord.y - source.texcoord.y));
+
+            error.color = std::max(error.color, fabsf(decoded.color.x - Saturate(source.color.x)));
+            error.color = std::max(error.color, fabsf(decoded.color.y - Saturate(source.color.y)));
+            error.color = std::max(error.color, fabsf(decoded.color.z - Saturate(source.color.z)));
+        }
+        return error;
+    }
+
+    // Теоретическая граница ошибки для данного меша
+    static QuantizationError GetErrorBound(const Vertex* vertices, uint32_t count, const PackedMeshParams& params) {
+        float maxExtent = std::max(params.positionScale.x, std::max(params.positionScale.y, params.positionScale.z));
+        float maxCoord = 0.0f;
+        float maxTexcoord = 0.0f;
+        for (uint32_t i = 0; i < count; i++) {
+            const Vertex& v = vertices[i];
+            maxCoord = std::max(maxCoord, std::max(fabsf(v.position.x), std::max(fabsf(v.position.y), fabsf(v.position.z))));
+            maxTexcoord = std::max(maxTexcoord, std::max(fabsf(v.texcoord.x), fabsf(v.texcoord.y)));
+        }
+
+        QuantizationError bound;
+        // Полшага решётки плюс погрешность float при восстановлении
+        bound.position = maxExtent / (2.0f * 65535.0f) + maxCoord * 4.0f * FLT_EPSILON;
+        bound.normalDegrees = OCTAHEDRAL_ERROR_DEGREES;
+        // Half хранит 11 значащих бит: полшага относительно значения, либо шаг денормалей
+        bound.texcoord = std::max(maxTexcoord * (1.0f / 2048.0f), 1.0f / 33554432.0f);
+        bound.color = 0.5f / 255.0f + FLT_EPSILON;
+        return bound;
+    }
+
+    static bool IsWithinBound(const QuantizationError& error, const QuantizationError& bound) {
+        return error.position <= bound.position &&
+            error.normalDegrees <= bound.normalDegrees &&
+            error.texcoord <= bound.texcoord &&
+            error.color <= bound.color;
+    }
+
+    static uint16_t FloatToHalf(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t magnitude = bits & 0x7FFFFFFF;
+
+        if (magnitude > 0x7F800000) return (uint16_t)(sign | 0x7E00); // NaN
+        if (magnitude >= 0x477FF000) return (uint16_t)(sign | 0x7BFF); // Насыщаем до 65504, без бесконечностей
+        if (magnitude < 0x38800000) {
+            // Денормаль half: шаг 2^-24
+            float scaled = fabsf(value) * 16777216.0f;
+            return (uint16_t)(sign | (uint32_t)lrintf(scaled));
+        }
+
+        // Смена смещения экспоненты (127 -> 15) и округление мантиссы к ближайшему чётному
+        uint32_t half = (magnitude - 0x38000000) >> 13;
+        uint32_t rest = magnitude & 0x1FFF;
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+        return (uint16_t)(sign | half);
+    }
+
+    static float HalfToFloat(uint16_t half) {
+        uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+        uint32_t exponent = (half >> 10) & 0x1F;
+        uint32_t mantissa = half & 0x3FF;
+
+        if (exponent == 0) {
+            float value = mantissa / 16777216.0f;
+            return sign ? -value : value;
+        }
+
+        uint32_t bits = (exponent == 31)
+            ? (sign | 0x7F800000 | (mantissa << 13))
+            : (sign | ((exponent + 112) << 23) | (mantissa << 13));
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+private:
+    // Измеренный максимум для SNORM16 с выбором лучшего из соседних узлов решётки - около 0.007°
+    static constexpr float OCTAHEDRAL_ERROR_DEGREES = 0.01f;
+
+    static float Saturate(float value) {
+        return std::min(std::max(value, 0.0f), 1.0f);
+    }
+
+    static float SignNotZero(float value) {
+        return (value >= 0.0f) ? 1.0f : -1.0f;
+    }
+
+    static XMFLOAT3 Normalize(const XMFLOAT3& v) {
+        float length = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+        if (length <= 0.0f) return XMFLOAT3(0, 0, 0);
+        return XMFLOAT3(v.x / length, v.y / length, v.z / length);
+    }
+
+    static uint16_t QuantizeUnorm16(float value, float offset, float scale) {
+        if (scale <= 0.0f) return 0;
+        float t = Saturate((value - offset) / scale);
+        return (uint16_t)lrintf(t * 65535.0f);
+    }
+
+    static uint8_t QuantizeUnorm8(float value) {
+        return (uint8_t)lrintf(Saturate(value) * 255.0f);
+    }
+
+    static XMFLOAT3 DecodeOctahedral(float ex, float ey) {
+        XMFLOAT3 n(ex, ey, 1.0f - fabsf(ex) - fabsf(ey));
+        float t = Saturate(-n.z);
+        n.x += (n.x >= 0.0f) ? -t : t;
+        n.y += (n.y >= 0.0f) ? -t : t;
+        return Normalize(n);
+    }
+
+    static void EncodeOctahedral(const XMFLOAT3& normal, int16_t out[2]) {
+        XMFLOAT3 n = Normalize(normal);
+        float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+        if (l1 <= 0.0f) {
+            out[0] = out[1] = 0;
+            return;
+        }
+
+        float ox = n.x / l1;
+        float oy = n.y / l1;
+        if (n.z < 0.0f) {
+            float fx = (1.0f - fabsf(oy)) * SignNotZero(ox);
+            float fy = (1.0f - fabsf(ox)) * SignNotZero(oy);
+            ox = fx;
+            oy = fy;
+        }
+
+        // Простое округление даёт ошибку до ~2x; проверяем 4 соседних узла и берём лучший
+        float baseX = floorf(ox * 32767.0f);
+        float baseY = floorf(oy * 32767.0f);
+        float bestDot = -2.0f;
+        for (int dy = 0; dy <= 1; dy++) {
+            for (int dx = 0; dx <= 1; dx++) {
+                float qx = std::min(std::max(baseX + dx, -32767.0f), 32767.0f);
+                float qy = std::min(std::max(baseY + dy, -32767.0f), 32767.0f);
+                XMFLOAT3 decoded = DecodeOctahedral(qx / 32767.0f, qy / 32767.0f);
+                float dot = decoded.x * n.x + decoded.y * n.y + decoded.z * n.z;
+                if (dot > bestDot) {
+                    bestDot = dot;
+                    out[0] = (int16_t)qx;
+                    out[1] = (int16_t)qy;
+                }
+            }
+        }
+    }
+};
+
+// ==================== БИНАРНЫЙ КЭШ МЕШЕЙ ====================
+// Готовые массивы вершин/индексов, таблица материалов и диапазоны сабмешей,
+// сохранённые после первой загрузки OBJ. При следующих запусках файл
+// отображается в память и передаётся в CreateBuffer без разбора.
+const uint32_t MESH_CACHE_MAGIC = 0x434D5453; // 'STMC'
+const uint32_t MESH_CACHE_VERSION = 8;
+
+// Размер и время изменения исходного файла - по ним кэш признаётся устаревшим
+struct SourceStamp {
+    uint64_t size = 0;
+    int64_t modifiedTime = 0;
+
+    static SourceStamp Of(const std::wstring& path) {
+        SourceStamp stamp;
+        std::error_code ec;
+        uintmax_t fileSize = std::filesystem::file_size(FileSystemHelper::ToPath(path), ec);
+        if (ec) return stamp;
+        auto writeTime = std::filesystem::last_write_time(FileSystemHelper::ToPath(path), ec);
+        if (ec) return stamp;
+
+        stamp.size = (uint64_t)fileSize;
+        stamp.modifiedTime = (int64_t)writeTime.time_since_epoch().count();
+        return stamp;
+    }
+
+    bool operator==(const SourceStamp& other) const {
+        return size == other.size && modifiedTime == other.modifiedTime;
+    }
+
+    // FNV-1a 64 по содержимому: время изменения меняется при checkout/копировании,
+    // содержимое - нет. 0 - файл не прочитан.
+    static uint64_t ContentHash(const std::wstring& path) {
+        MappedFile file;
+        if (!file.Open(path)) return 0;
+
+        uint64_t hash = 14695981039346656037ull;
+        const unsigned char* data = (const unsigned char*)file.Data();
+        for (size_t i = 0; i < file.Size(); i++) {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+};
+
+class MeshCache {
+public:
+    // Сабмеш, указывающий прямо в данные кэша (или в загруженный Mesh)
+    struct Submesh {
+        const Vertex* vertices = nullptr;
+        uint32_t vertexCount = 0;
+        const uint32_t* indices = nullptr;
+        uint32_t indexCount = 0;
+        NameId materialId = 0;
+        MeshLod lods[MAX_MESH_LODS];
+        uint32_t lodCount = 0; // 0 - единственный уровень на все индексы
+        const Meshlet* meshlets = nullptr; // Диапазоны уровней - в lods[l].firstMeshlet
+        uint32_t meshletCount = 0;
+        const VertexSkin* skin = nullptr;  // По элементу на вершину или nullptr
+    };
+
+    static std::wstring GetCachePath(const std::wstring& objPath) {
+        return objPath + L".meshcache";
+    }
+
+    static bool Write(const std::wstring& cachePath,
+        const std::vector<std::wstring>& sources,
+        const std::vector<Mesh>& meshes,
+        const MaterialTable& materials,
+        const std::vector<Bone>& bones = std::vector<Bone>()) {
+
+        std::vector<char> strings;
+        auto addString = [&strings](const std::string& text, uint32_t& offset, uint32_t& length) {
+            offset = (uint32_t)strings.size();
+            length = (uint32_t)text.size();
+            strings.insert(strings.end(), text.begin(), text.end());
+        };
+
+        std::vector<CacheSource> sourceRecords;
+        for (const auto& source : sources) {
+            CacheSource record = {};
+            SourceStamp stamp = SourceStamp::Of(source);
+            record.size = stamp.size;
+            record.modifiedTime = stamp.modifiedTime;
+            record.contentHash = SourceStamp::ContentHash(source);
+            addString(FileSystemHelper::ToUtf8(source), record.pathOffset, record.pathLength);
+            sourceRecords.push_back(record);
+        }
+
+        std::vector<CacheMaterial> materialRecords;
+        for (const Material& mat : materials) {
+            CacheMaterial record = {};
+            addString(mat.name, record.nameOffset, record.nameLength);
+            addString(mat.textureFilename, record.textureOffset, record.textureLength);
+            record.ambient = mat.ambient;
+            record.diffuse = mat.diffuse;
+            record.specular = mat.specular;
+            record.shininess = mat.shininess;
+            record.alpha = mat.alpha;
+            materialRecords.push_back(record);
+        }
+
+        std::vector<CacheBone> boneRecords;
+        for (const Bone& bone : bones) {
+            CacheBone record = {};
+            addString(bone.name, record.nameOffset, record.nameLength);
+            record.offset = bone.offset;
+            boneRecords.push_back(record);
+        }
+
+        std::vector<CacheSubmesh> submeshRecords;
+        uint64_t vertexCount = 0;
+        uint64_t indexCount = 0;
+        uint64_t meshletCount = 0;
+        uint64_t skinCount = 0;
+        for (const auto& mesh : meshes) {
+            CacheSubmesh record = {};
+            // На диске храним строку: хэш восстанавливается при открытии
+            addString(NameRegistry::GetName(mesh.materialId), record.materialOffset, record.materialLength);
+            record.firstVertex = (uint32_t)vertexCount;
+            record.vertexCount = (uint32_t)mesh.vertices.size();
+            record.firstIndex = (uint32_t)indexCount;
+            record.indexCount = (uint32_t)mesh.indices.size();
+            record.firstMeshlet = (uint32_t)meshletCount;
+            record.meshletCount = (uint32_t)mesh.meshlets.size();
+            record.firstSkin = mesh.skin.empty() ? NO_SKIN : (uint32_t)skinCount;
+            record.lodCount = (uint32_t)std::min<size_t>(mesh.lods.size(), MAX_MESH_LODS);
+            for (uint32_t l = 0; l < record.lodCount; l++) {
+                record.lods[l].firstIndex = mesh.lods[l].firstIndex;
+                record.lods[l].indexCount = mesh.lods[l].indexCount;
+                record.lods[l].error = mesh.lods[l].error;
+                record.lods[l].firstMeshlet = mesh.lods[l].firstMeshlet;
+                record.lods[l].meshletCount = mesh.lods[l].meshletCount;
+            }
+            submeshRecords.push_back(record);
+
+            vertexCount += mesh.vertices.size();
+            indexCount += mesh.indices.size();
+            meshletCount += mesh.meshlets.size();
+            skinCount += mesh.skin.size();
+        }
+
+        // Раскладка файла: заголовок, таблицы, строки, кластеры, вершины, индексы (выровнены)
+        CacheHeader header = {};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.vertexStride = sizeof(Vertex);
+        header.sourceCount = (uint32_t)sourceRecords.size();
+        header.materialCount = (uint32_t)materialRecords.size();
+        header.submeshCount = (uint32_t)submeshRecords.size();
+        header.boneCount = (uint32_t)boneRecords.size();
+
+        uint64_t offset = sizeof(CacheHeader);
+        header.sourcesOffset = offset;
+        offset += sizeof(CacheSource) * sourceRecords.size();
+        header.materialsOffset = offset;
+        offset += sizeof(CacheMaterial) * materialRecords.size();
+        header.submeshesOffset = offset;
+        offset += sizeof(CacheSubmesh) * submeshRecords.size();
+        header.bonesOffset = offset;
+        offset += sizeof(CacheBone) * boneRecords.size();
+        header.stringsOffset = offset;
+        header.stringsSize = strings.size();
+        offset += strings.size();
+        offset = AlignUp(offset, 16);
+        header.meshletsOffset = offset;
+        header.meshletCount = meshletCount;
+        offset += sizeof(Meshlet) * meshletCount;
+        offset = AlignUp(offset, 16);
+        header.skinOffset = offset;
+        header.skinCount = skinCount;
+        offset += sizeof(VertexSkin) * skinCount;
+        offset = AlignUp(offset, 16);
+        header.verticesOffset = offset;
+        header.vertexCount = vertexCount;
+        offset += sizeof(Vertex) * vertexCount;
+        offset = AlignUp(offset, 16);
+        header.indicesOffset = offset;
+        header.indexCount = indexCount;
+        offset += sizeof(uint32_t) * indexCount;
+        header.fileSize = offset;
+
+        std::vector<char> blob((size_t)header.fileSize, 0);
+        memcpy(blob.data(), &header, sizeof(header));
+        if (!sourceRecords.empty())
+            memcpy(blob.data() + header.sourcesOffset, sourceRecords.data(), sizeof(CacheSource) * sourceRecords.size());
+        if (!materialRecords.empty())
+            memcpy(blob.data() + header.materialsOffset, materialRecords.data(), sizeof(CacheMaterial) * materialRecords.size());
+        if (!submeshRecords.empty())
+            memcpy(blob.data() + header.submeshesOffset, submeshRecords.data(), sizeof(CacheSubmesh) * submeshRecords.size());
+        if (!boneRecords.empty())
+            memcpy(blob.data() + header.bonesOffset, boneRecords.data(), sizeof(CacheBone) * boneRecords.size());
+        if (!strings.empty())
+            memcpy(blob.data() + header.stringsOffset, strings.data(), strings.size());
+
+        char* meshletDst = blob.data() + header.meshletsOffset;
+        char* skinDst = blob.data() + header.skinOffset;
+        char* vertexDst = blob.data() + header.verticesOffset;
+        char* indexDst = blob.data() + header.indicesOffset;
+        for (const auto& mesh : meshes) {
+            if (!mesh.meshlets.empty())
+                memcpy(meshletDst, mesh.meshlets.data(), sizeof(Meshlet) * mesh.meshlets.size());
+            memcpy(vertexDst, mesh.vertices.data(), sizeof(Vertex) * mesh.vertices.size());
+            memcpy(indexDst, mesh.indices.data(), sizeof(uint32_t) * mesh.indices.size());
+            if (!mesh.skin.empty())
+                memcpy(skinDst, mesh.skin.data(), sizeof(VertexSkin) * mesh.skin.size());
+            meshletDst += sizeof(Meshlet) * mesh.meshlets.size();
+            skinDst += sizeof(VertexSkin) * mesh.skin.size();
+            vertexDst += sizeof(Vertex) * mesh.vertices.size();
+            indexDst += sizeof(uint32_t) * mesh.indices.size();
+        }
+
+        // Пишем во временный файл и переименовываем, чтобы не оставить обрезанный кэш
+        std::wstring tempPath = cachePath + L".tmp";
+        {
+            std::ofstream out(FileSystemHelper::ToPath(tempPath), std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) {
+                DEBUG_WARNING("Не удалось создать файл кэша меша");
+                return false;
+            }
+            out.write(blob.data(), (std::streamsize)blob.size());
+            if (!out.good()) {
+                DEBUG_WARNING("Ошибка записи кэша меша");
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(FileSystemHelper::ToPath(tempPath), FileSystemHelper::ToPath(cachePath), ec);
+        if (ec) {
+            std::filesystem::remove(FileSystemHelper::ToPath(tempPath), ec);
+            DEBUG_WARNING("Не удалось переименовать файл кэша меша");
+            return false;
+        }
+
+        char buffer[256];
+        sprintf_s(buffer, "Кэш меша записан: %zu байт, %llu вершин, %llu индексов",
+            blob.size(), (unsigned long long)vertexCount, (unsigned long long)indexCount);
+        DEBUG_LOG(buffer);
+        return true;
+    }
+
+    // Открывает кэш и проверяет, что он целый и исходники не менялись
+    bool Open(const std::wstring& cachePath) {
+        submeshes.clear();
+        materials.Clear();
+        bones.clear();
+        sources.clear();
+
+        if (!file.Open(cachePath)) {
+            return false;
+        }
+
+        std::vector<StampRefresh> refreshes;
+        if (!Validate(refreshes)) {
+            Close();
+            return false;
+        }
+
+        // Время изменения исходника сдвинулось, а содержимое то же (checkout, копирование):
+        // записываем новое время, чтобы следующие запуски не хэшировали исходник заново.
+        // Отображённый файл на Windows не открыть на запись - закрываем и открываем снова.
+        if (!refreshes.empty()) {
+            Close();
+            WriteStamps(cachePath, refreshes);
+            std::vector<StampRefresh> unused;
+            if (!file.Open(cachePath) || !Validate(unused)) {
+                Close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Close() {
+        file.Close();
+        submeshes.clear();
+        materials.Clear();
+        bones.clear();
+        sources.clear();
+    }
+
+    const std::vector<Submesh>& GetSubmeshes() const { return submeshes; }
+    const MaterialTable& GetMaterials() const { return materials; }
+    const std::vector<Bone>& GetBones() const { return bones; }
+    // Исходники, из которых приготовлен кэш (включая отсутствующие на диске)
+    const std::vector<std::wstring>& GetSources() const { return sources; }
+
+private:
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vertexStride;
+        uint32_t sourceCount;
+        uint32_t materialCount;
+        uint32_t submeshCount;
+        uint32_t boneCount;
+        uint64_t sourcesOffset;
+        uint64_t materialsOffset;
+        uint64_t submeshesOffset;
+        uint64_t bonesOffset;
+        uint64_t stringsOffset;
+        uint64_t stringsSize;
+        uint64_t meshletsOffset;
+        uint64_t meshletCount;
+        uint64_t skinOffset;
+        uint64_t skinCount;
+        uint64_t verticesOffset;
+        uint64_t vertexCount;
+        uint64_t indicesOffset;
+        uint64_t indexCount;
+        uint64_t fileSize;
+    };
+
+    struct CacheSource {
+        uint32_t pathOffset;
+        uint32_t pathLength;
+        uint64_t size;
+        int64_t modifiedTime;
+        uint64_t contentHash;
+    };
+
+    struct CacheMaterial {
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        uint32_t textureOffset;
+        uint32_t textureLength;
+        XMFLOAT3 ambient;
+        XMFLOAT3 diffuse;
+        XMFLOAT3 specular;
+        float shininess;
+        float alpha;
+    };
+
+    struct CacheBone {
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        XMFLOAT4X4 offset;
+    };
+
+    struct CacheLod {
+        uint32_t firstIndex; // Относительно firstIndex сабмеша
+        uint32_t indexCount;
+        float error;
+        uint32_t firstMeshlet; // Относительно firstMeshlet сабмеша
+        uint32_t meshletCount;
+    };
+
+    struct CacheSubmesh {
+        uint32_t materialOffset;
+        uint32_t materialLength;
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        uint32_t firstMeshlet;
+        uint32_t meshletCount;
+        uint32_t firstSkin; // NO_SKIN - без скелета, иначе vertexCount элементов
+        uint32_t lodCount;
+        CacheLod lods[MAX_MESH_LODS];
+    };
+
+    static constexpr uint32_t NO_SKIN = 0xFFFFFFFF;
+
+    static uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Новое время изменения исходника - по смещению поля modifiedTime его записи
+    struct StampRefresh {
+        uint64_t offset;
+        int64_t modifiedTime;
+    };
+
+    static bool InRange(uint64_t offset, uint64_t size, uint64_t total) {
+        return offset <= total && size <= total - offset;
+    }
+
+    // count элементов по elementSize байт от offset: без умножения, которое переполнится
+    // на испорченном счётчике
+    static bool InRange(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t total) {
+        return offset <= total && count <= (total - offset) / elementSize;
+    }
+
+    static void WriteStamps(const std::wstring& cachePath, const std::vector<StampRefresh>& refreshes) {
+        std::fstream out(FileSystemHelper::ToPath(cachePath), std::ios::binary | std::ios::in | std::ios::out);
+        if (!out.is_open()) {
+            DEBUG_WARNING("Не удалось обновить отметки исходников в кэше меша");
+            return;
+        }
+        for (const StampRefresh& refresh : refreshes) {
+            out.seekp((std::streamoff)refresh.offset);
+            out.write((const char*)&refresh.modifiedTime, sizeof(refresh.modifiedTime));
+        }
+        if (!out.good()) DEBUG_WARNING("Ошибка записи отметок исходников в кэш меша");
+    }
+
+    bool Validate(std::vector<StampRefresh>& refreshes) {
+        const char* data = file.Data();
+        uint64_t total = file.Size();
+        if (total < sizeof(CacheHeader)) return false;
+
+        CacheHeader header;
+        memcpy(&header, data, sizeof(header));
+        if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION ||
+            header.vertexStride != sizeof(Vertex) || header.fileSize != total) {
+            DEBUG_LOG("Кэш меша другой версии или повреждён");
+            return false;
+        }
+
+        if (!InRange(header.sourcesOffset, header.sourceCount, sizeof(CacheSource), total) ||
+            !InRange(header.materialsOffset, header.materialCount, sizeof(CacheMaterial), total) ||
+            !InRange(header.submeshesOffset, header.submeshCount, sizeof(CacheSubmesh), total) ||
+            !InRange(header.bonesOffset, header.boneCount, sizeof(CacheBone), total) ||
+            !InRange(header.stringsOffset, header.stringsSize, total) ||
+            !InRange(header.meshletsOffset, header.meshletCount, sizeof(Meshlet), total) ||
+            !InRange(header.skinOffset, header.skinCount, sizeof(VertexSkin), total) ||
+            !InRange(header.verticesOffset, header.vertexCount, sizeof(Vertex), total) ||
+            !InRange(header.indicesOffset, header.indexCount, sizeof(uint32_t), total)) {
+            DEBUG_LOG("Кэш меша повреждён: таблицы выходят за пределы файла");
+            return false;
+        }
+
+        const char* strings = data + header.stringsOffset;
+        auto getString = [&](uint32_t offset, uint32_t length, std::string& out) {
+            if (!InRange(offset, length, header.stringsSize)) return false;
+            out.assign(strings + offset, length);
+            return true;
+        };
+
+        // Исходники: если хоть один изменился по содержимому, кэш устарел.
+        // Отсутствующий исходник - приготовленные данные поставлены без исходников.
+        const CacheSource* sourceRecords = (const CacheSource*)(data + header.sourcesOffset);
+        for (uint32_t i = 0; i < header.sourceCount; i++) {
+            const CacheSource& source = sourceRecords[i];
+            std::string path;
+            if (!getString(source.pathOffset, source.pathLength, path)) return false;
+
+            std::wstring sourcePath = FileSystemHelper::FromUtf8(path);
+            sources.push_back(sourcePath);
+            std::error_code ec;
+            if (!std::filesystem::exists(FileSystemHelper::ToPath(sourcePath), ec)) continue;
+
+            SourceStamp stamp = SourceStamp::Of(sourcePath);
+            if (stamp.size == source.size && stamp.modifiedTime == source.modifiedTime) continue;
+            if (stamp.size != source.size || SourceStamp::ContentHash(sourcePath) != source.contentHash) {
+                DEBUG_LOG("Кэш меша устарел: изменился " + path);
+                return false;
+            }
+            refreshes.push_back({ header.sourcesOffset + sizeof(CacheSource) * i + offsetof(CacheSource, modifiedTime),
+                stamp.modifiedTime });
+        }
+
+        const CacheMaterial* materialRecords = (const CacheMaterial*)(data + header.materialsOffset);
+        for (uint32_t i = 0; i < header.materialCount; i++) {
+            Material mat;
+            if (!getString(materialRecords[i].nameOffset, materialRecords[i].nameLength, mat.name) ||
+                !getString(materialRecords[i].textureOffset, materialRecords[i].textureLength, mat.textureFilename)) {
+                return false;
+            }
+            mat.ambient = materialRecords[i].ambient;
+            mat.diffuse = materialRecords[i].diffuse;
+            mat.specular = materialRecords[i].specular;
+            mat.shininess = materialRecords[i].shininess;
+            mat.alpha = materialRecords[i].alpha;
+            mat.id = NameRegistry::Intern(mat.name);
+            materials.Add(mat);
+        }
+
+        const CacheBone* boneRecords = (const CacheBone*)(data + header.bonesOffset);
+        for (uint32_t i = 0; i < header.boneCount; i++) {
+            Bone bone;
+            if (!getString(boneRecords[i].nameOffset, boneRecords[i].nameLength, bone.name)) return false;
+            bone.offset = boneRecords[i].offset;
+            bones.push_back(bone);
+        }
+
+        const Meshlet* meshlets = (const Meshlet*)(data + header.meshletsOffset);
+        const VertexSkin* skin = (const VertexSkin*)(data + header.skinOffset);
+        const Vertex* vertices = (const Vertex*)(data + header.verticesOffset);
+        const uint32_t* indices = (const uint32_t*)(data + header.indicesOffset);
+        const CacheSubmesh* submeshRecords = (const CacheSubmesh*)(data + header.submeshesOffset);
+        for (uint32_t i = 0; i < header.submeshCount; i++) {
+            const CacheSubmesh& record = submeshRecords[i];
+            if (!InRange(record.firstVertex, record.vertexCount, header.vertexCount) ||
+                !InRange(record.firstIndex, record.indexCount, header.indexCount) ||
+                !InRange(record.firstMeshlet, record.meshletCount, header.meshletCount) ||
+                (record.firstSkin != NO_SKIN && !InRange(record.firstSkin, record.vertexCount, header.skinCount))) {
+                return false;
+            }
+
+            Submesh submesh;
+            std::string materialName;
+            if (!getString(record.materialOffset, record.materialLength, materialName)) return false;
+            submesh.materialId = NameRegistry::Intern(materialName);
+            submesh.vertices = vertices + record.firstVertex;
+            submesh.vertexCount = record.vertexCount;
+            submesh.indices = indices + record.firstIndex;
+            submesh.indexCount = record.indexCount;
+            submesh.meshlets = meshlets + record.firstMeshlet;
+            submesh.meshletCount = record.meshletCount;
+            submesh.skin = (record.firstSkin != NO_SKIN) ? skin + record.firstSkin : nullptr;
+
+            // Индексы локальные: за пределами сабмеша они ушли бы в чужие вершины
+            // (а при сужении до 16 бит в CreateModelBuffers - обрезались бы молча)
+            uint32_t maxIndex = 0;
+            for (uint32_t k = 0; k < record.indexCount; k++) {
+                maxIndex = std::max(maxIndex, submesh.indices[k]);
+            }
+            if (record.indexCount > 0 && maxIndex >= record.vertexCount) {
+                DEBUG_LOG("Кэш меша повреждён: индекс за пределами вершин сабмеша");
+                return false;
+            }
+
+            for (uint32_t m = 0; m < record.meshletCount; m++) {
+                const Meshlet& meshlet = submesh.meshlets[m];
+                if (!InRange(meshlet.firstIndex, (uint64_t)meshlet.triangleCount * 3, record.indexCount)) return false;
+            }
+
+            if (record.lodCount > MAX_MESH_LODS) return false;
+            submesh.lodCount = record.lodCount;
+            for (uint32_t l = 0; l < record.lodCount; l++) {
+                if (!InRange(record.lods[l].firstIndex, record.lods[l].indexCount, record.indexCount) ||
+                    !InRange(record.lods[l].firstMeshlet, record.lods[l].meshletCount, record.meshletCount)) {
+                    return false;
+                }
+                submesh.lods[l].firstIndex = record.lods[l].firstIndex;
+                submesh.lods[l].indexCount = record.lods[l].indexCount;
+                submesh.lods[l].error = record.lods[l].error;
+                submesh.lods[l].firstMeshlet = record.lods[l].firstMeshlet;
+                submesh.lods[l].meshletCount = record.lods[l].meshletCount;
+            }
+            submeshes.push_back(submesh);
+        }
+
+        return !submeshes.empty();
+    }
+
+    AssetFile file;
+    std::vector<Submesh> submeshes;
+    MaterialTable materials;
+    std::vector<Bone> bones;
+    std::vector<std::wstring> sources;
+};
+
+// ==================== СЖАТИЕ ТЕКСТУР ====================
+// Блочное сжатие на CPU: каждый блок 4x4 кодируется независимо, уровень делится между
+// потоками по строкам блоков. BC1 - 8 байт на блок (непрозрачные, в 8 раз меньше RGBA8),
+// BC3 - 16 байт (блок альфы + BC1), BC7 - 16 байт (режим 6: пара концов RGBA и
+// 16 градаций на блок - заметно чище BC1/BC3 на плавных переходах).
+const bool TEXTURE_CACHE_USE_BC7 = false; // BC7 вместо BC1/BC3: качество выше, непрозрачные 4x вместо 8x
+
+class BlockCompressor {
+public:
+    static uint32_t GetBlockBytes(TextureFormat format) {
+        switch (format) {
+        case TEXTURE_BC1: return 8;
+        case TEXTURE_BC3:
+        case TEXTURE_BC7: return 16;
+        default: return 0;
+        }
+    }
+
+    static const char* GetFormatName(TextureFormat format) {
+        switch (format) {
+        case TEXTURE_BC1: return "BC1";
+        case TEXTURE_BC3: return "BC3";
+        case TEXTURE_BC7: return "BC7";
+        default: return "RGBA8";
+        }
+    }
+
+    // Байт на строку уровня: для BC - строка блоков
+    static uint32_t GetRowPitch(TextureFormat format, int width) {
+        if (format == TEXTURE_RGBA8) return (uint32_t)width * 4;
+        return (uint32_t)std::max(1, (width + 3) / 4) * GetBlockBytes(format);
+    }
+
+    static uint32_t GetRowCount(TextureFormat format, int height) {
+        if (format == TEXTURE_RGBA8) return (uint32_t)height;
+        return (uint32_t)std::max(1, (height + 3) / 4);
+    }
+
+    static uint64_t GetLevelSize(TextureFormat format, int width, int height) {
+        return (uint64_t)GetRowPitch(format, width) * GetRowCount(format, height);
+    }
+
+    // BC требует кратных 4 размеров верхнего уровня - иначе остаётся RGBA8
+    static TextureFormat ChooseFormat(const uint8_t* rgba, int width, int height) {
+        if (width % 4 != 0 || height % 4 != 0) return TEXTURE_RGBA8;
+        if (TEXTURE_CACHE_USE_BC7) return TEXTURE_BC7;
+
+        size_t count = (size_t)width * height;
+        for (size_t i = 0; i < count; i++) {
+            if (rgba[i * 4 + 3] != 255) return TEXTURE_BC3;
+        }
+        return TEXTURE_BC1;
+    }
+
+    static void CompressLevel(const uint8_t* rgba, int width, int height, TextureFormat format,
+        std::vector<uint8_t>& out, unsigned threadCount = 0) {
+
+        if (format == TEXTURE_RGBA8) {
+            out.assign(rgba, rgba + (size_t)width * height * 4);
+            return;
+        }
+
+        uint32_t blockBytes = GetBlockBytes(format);
+        int blocksWide = std::max(1, (width + 3) / 4);
+        int blocksHigh = std::max(1, (height + 3) / 4);
+        out.resize((size_t)blocksWide * blocksHigh * blockBytes);
+
+        // Мелкие уровни не стоят запуска потоков
+        unsigned threads = ((size_t)blocksWide * blocksHigh >= 1024) ? GetWorkerThreadCount(threadCount) : 1;
+        ParallelFor((size_t)blocksHigh, threads, [&](size_t by) {
+            uint8_t block[64];
+            for (int bx = 0; bx < blocksWide; bx++) {
+                // Блок на краю уровня меньше 4x4 дополняется повтором крайних пикселей
+                for (int y = 0; y < 4; y++) {
+                    int sy = std::min((int)by * 4 + y, height - 1);
+                    for (int x = 0; x < 4; x++) {
+                        int sx = std::min(bx * 4 + x, width - 1);
+                        memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+                    }
+                }
+
+                uint8_t* dst = out.data() + ((size_t)by * blocksWide + bx) * blockBytes;
+                switch (format) {
+                case TEXTURE_BC1:
+                    EncodeColorBlock(block, dst);
+                    break;
+                case TEXTURE_BC3:
+                    EncodeAlphaBlock(block, dst);
+                    EncodeColorBlock(block, dst + 8);
+                    break;
+                case TEXTURE_BC7:
+                    EncodeBc7Block(block, dst);
+                    break;
+                default:
+                    break;
+                }
+            }
+        });
+    }
+
+private:
+    // ---- BC1: два конца RGB565 и 2-битные индексы ----
+    static uint16_t Pack565(const float color[3]) {
+        int r = (int)std::clamp(color[0] * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f);
+        int g = (int)std::clamp(color[1] * 63.0f / 255.0f + 0.5f, 0.0f, 63.0f);
+        int b = (int)std::clamp(color[2] * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f);
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    }
+
+    static void Unpack565(uint16_t value, int color[3]) {
+        int r = (value >> 11) & 31;
+        int g = (value >> 5) & 63;
+        int b = value & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // Главная ось разброса точек (power iteration по ковариации), размерность 3 или 4
+    template <int N>
+    static void PrincipalAxis(const uint8_t* block, float mean[N], float axis[N]) {
+        for (int c = 0; c < N; c++) mean[c] = 0.0f;
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < N; c++) mean[c] += block[i * 4 + c];
+        for (int c = 0; c < N; c++) mean[c] /= 16.0f;
+
+        float cov[N][N] = {};
+        for (int i = 0; i < 16; i++) {
+            float d[N];
+            for (int c = 0; c < N; c++) d[c] = block[i * 4 + c] - mean[c];
+            for (int a = 0; a < N; a++)
+                for (int b = a; b < N; b++) cov[a][b] += d[a] * d[b];
+        }
+        for (int a = 0; a < N; a++)
+            for (int b = 0; b < a; b++) cov[a][b] = cov[b][a];
+
+        for (int c = 0; c < N; c++) axis[c] = 1.0f;
+        for (int iteration = 0; iteration < 4; iteration++) {
+            float next[N] = {};
+            float length = 0.0f;
+            for (int a = 0; a < N; a++) {
+                for (int b = 0; b < N; b++) next[a] += cov[a][b] * axis[b];
+                length = std::max(length, std::fabs(next[a]));
+            }
+            if (length < 1e-6f) break;
+            for (int c = 0; c < N; c++) axis[c] = next[c] / length;
+        }
+    }
+
+    static uint32_t ColorError(const uint8_t* pixel, const int color[3]) {
+        int dr = pixel[0] - color[0];
+        int dg = pixel[1] - color[1];
+        int db = pixel[2] - color[2];
+        return (uint32_t)(dr * dr + dg * dg + db * db);
+    }
+
+    // Индексы для пары концов; возвращает суммарную ошибку блока
+    static uint32_t FitColorIndices(const uint8_t* block, uint16_t c0, uint16_t c1, uint8_t indices[16]) {
+        int palette[4][3];
+        Unpack565(c0, palette[0]);
+        Unpack565(c1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        uint32_t total = 0;
+        for (int i = 0; i < 16; i++) {
+            uint32_t best = UINT32_MAX;
+            for (int p = 0; p < 4; p++) {
+                uint32_t error = ColorError(block + i * 4, palette[p]);
+                if (error < best) {
+                    best = error;
+                    indices[i] = (uint8_t)p;
+                }
+            }
+            total += best;
+        }
+        return total;
+    }
+
+    // Концы по методу наименьших квадратов для уже выбранных индексов
+    static bool SolveColorEndpoints(const uint8_t* block, const uint8_t indices[16], float end0[3], float end1[3]) {
+        static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[3] = {}, bx[3] = {};
+        for (int i = 0; i < 16; i++) {
+            float a = weights[indices[i]];
+            float b = 1.0f - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < 3; c++) {
+                ax[c] += a * block[i * 4 + c];
+                bx[c] += b * block[i * 4 + c];
+            }
+        }
+
+        float det = aa * bb - ab * ab;
+        if (std::fabs(det) < 1e-4f) return false;
+        for (int c = 0; c < 3; c++) {
+            end0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.0f, 255.0f);
+            end1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.0f, 255.0f);
+        }
+        return true;
+    }
+
+    // Для однотонного блока: пара концов канала (5 или 6 бит), чья точка 2/3 ближе всего к значению
+    static const uint8_t* GetSingleColorTable(int bits) {
+        static const std::vector<uint8_t> tables = []() {
+            std::vector<uint8_t> values(2 * 256 * 2);
+            for (int t = 0; t < 2; t++) {
+                int levels = t ? 64 : 32;
+                int shift = t ? 4 : 2;
+                int expandShift = t ? 2 : 3;
+                for (int value = 0; value < 256; value++) {
+                    int bestError = INT32_MAX;
+                    for (int e0 = 0; e0 < levels; e0++) {
+                        for (int e1 = 0; e1 < levels; e1++) {
+                            int v0 = (e0 << expandShift) | (e0 >> shift);
+                            int v1 = (e1 << expandShift) | (e1 >> shift);
+                            int error = std::abs((2 * v0 + v1) / 3 - value);
+                            if (error < bestError) {
+                                bestError = error;
+                                values[(t * 256 + value) * 2] = (uint8_t)e0;
+                                values[(t * 256 + value) * 2 + 1] = (uint8_t)e1;
+                            }
+                        }
+                    }
+                }
+            }
+            return values;
+        }();
+        return tables.data() + (bits == 6 ? 256 * 2 : 0);
+    }
+
+    static void EncodeColorBlock(const uint8_t* block, uint8_t* out) {
+        bool solid = true;
+        for (int i = 1; i < 16 && solid; i++) {
+            solid = block[i * 4] == block[0] && block[i * 4 + 1] == block[1] && block[i * 4 + 2] == block[2];
+        }
+        if (solid) {
+            const uint8_t* table5 = GetSingleColorTable(5);
+            const uint8_t* table6 = GetSingleColorTable(6);
+            uint16_t c0 = (uint16_t)((table5[block[0] * 2] << 11) | (table6[block[1] * 2] << 5) | table5[block[2] * 2]);
+            uint16_t c1 = (uint16_t)((table5[block[0] * 2 + 1] << 11) | (table6[block[1] * 2 + 1] << 5) | table5[block[2] * 2 + 1]);
+            uint8_t indices[16];
+            memset(indices, 2, sizeof(indices));
+            WriteColorBlock(c0, c1, indices, out);
+            return;
+        }
+
+        float mean[3], axis[3];
+        PrincipalAxis<3>(block, mean, axis);
+
+        // Крайние точки вдоль оси - начальные концы
+        float minDot = FLT_MAX, maxDot = -FLT_MAX;
+        int minIndex = 0, maxIndex = 0;
+        for (int i = 0; i < 16; i++) {
+            float dot = 0.0f;
+            for (int c = 0; c < 3; c++) dot += (block[i * 4 + c] - mean[c]) * axis[c];
+            if (dot < minDot) { minDot = dot; minIndex = i; }
+            if (dot > maxDot) { maxDot = dot; maxIndex = i; }
+        }
+
+        float end0[3], end1[3];
+        for (int c = 0; c < 3; c++) {
+            end0[c] = block[maxIndex * 4 + c];
+            end1[c] = block[minIndex * 4 + c];
+        }
+
+        uint16_t c0 = Pack565(end0);
+        uint16_t c1 = Pack565(end1);
+        uint8_t indices[16];
+        uint32_t error = FitColorIndices(block, c0, c1, indices);
+
+        for (int iteration = 0; iteration < 2 && error > 0; iteration++) {
+            if (!SolveColorEndpoints(block, indices, end0, end1)) break;
+            uint16_t n0 = Pack565(end0);
+            uint16_t n1 = Pack565(end1);
+            uint8_t candidate[16];
+            uint32_t candidateError = FitColorIndices(block, n0, n1, candidate);
+            if (candidateError >= error) break;
+            c0 = n0;
+            c1 = n1;
+            error = candidateError;
+            memcpy(indices, candidate, sizeof(indices));
+        }
+
+        WriteColorBlock(c0, c1, indices, out);
+    }
+
+    static void WriteColorBlock(uint16_t c0, uint16_t c1, uint8_t indices[16], uint8_t* out) {
+        // Режим 4 цветов требует c0 > c1; при равных концах все индексы 0
+        if (c0 < c1) {
+            std::swap(c0, c1);
+            static const uint8_t swapped[4] = { 1, 0, 3, 2 };
+            for (int i = 0; i < 16; i++) indices[i] = swapped[indices[i]];
+        }
+        else if (c0 == c1) {
+            memset(indices, 0, 16);
+        }
+
+        uint32_t bits = 0;
+        for (int i = 0; i < 16; i++) bits |= (uint32_t)indices[i] << (i * 2);
+        out[0] = (uint8_t)(c0 & 0xFF);
+        out[1] = (uint8_t)(c0 >> 8);
+        out[2] = (uint8_t)(c1 & 0xFF);
+        out[3] = (uint8_t)(c1 >> 8);
+        memcpy(out + 4, &bits, 4);
+    }
+
+    // ---- Альфа BC3: два конца и 3-битные индексы по 8 градациям ----
+    static void EncodeAlphaBlock(const uint8_t* block, uint8_t* out) {
+        int minAlpha = 255, maxAlpha = 0;
+        for (int i = 0; i < 16; i++) {
+            minAlpha = std::min(minAlpha, (int)block[i * 4 + 3]);
+            maxAlpha = std::max(maxAlpha, (int)block[i * 4 + 3]);
+        }
+
+        out[0] = (uint8_t)maxAlpha;
+        out[1] = (uint8_t)minAlpha;
+        uint64_t bits = 0;
+        if (maxAlpha > minAlpha) {
+            // Индекс 0 - max, 1 - min, 2..7 - промежуточные от max к min
+            int palette[8] = { maxAlpha, minAlpha };
+            for (int k = 1; k < 7; k++) palette[k + 1] = ((7 - k) * maxAlpha + k * minAlpha) / 7;
+            for (int i = 0; i < 16; i++) {
+                int alpha = block[i * 4 + 3];
+                int bestIndex = 0;
+                int bestError = INT32_MAX;
+                for (int p = 0; p < 8; p++) {
+                    int error = std::abs(alpha - palette[p]);
+                    if (error < bestError) {
+                        bestError = error;
+                        bestIndex = p;
+                    }
+                }
+                bits |= (uint64_t)bestIndex << (i * 3);
+            }
+        }
+        for (int b = 0; b < 6; b++) out[2 + b] = (uint8_t)(bits >> (b * 8));
+    }
+
+    // ---- BC7 режим 6: концы RGBA 7 бит + общий младший бит, 4-битные индексы ----
+    static const int* Bc7Weights() {
+        static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+        return weights;
+    }
+
+    // Квантует конец в 7 бит + p-бит, выбирая p с меньшей ошибкой
+    static void QuantizeBc7Endpoint(const float color[4], int quantized[4], int& pBit) {
+        float bestError = FLT_MAX;
+        for (int p = 0; p < 2; p++) {
+            int candidate[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; c++) {
+                candidate[c] = (int)std::clamp(std::floor((color[c] - p) / 2.0f + 0.5f), 0.0f, 127.0f);
+                float d = (float)(candidate[c] * 2 + p) - color[c];
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                pBit = p;
+                memcpy(quantized, candidate, sizeof(candidate));
+            }
+        }
+    }
+
+    static uint32_t FitBc7Indices(const uint8_t* block, const int end0[4], const int end1[4], uint8_t indices[16]) {
+        const int* weights = Bc7Weights();
+        int palette[16][4];
+        for (int p = 0; p < 16; p++)
+            for (int c = 0; c < 4; c++)
+                palette[p][c] = ((64 - weights[p]) * end0[c] + weights[p] * end1[c] + 32) >> 6;
+
+        // Проекция на отрезок даёт ближайшую градацию; проверяются она и соседние
+        int direction[4];
+        int lengthSq = 0;
+        for (int c = 0; c < 4; c++) {
+            direction[c] = end1[c] - end0[c];
+            lengthSq += direction[c] * direction[c];
+        }
+
+        uint32_t total = 0;
+        for (int i = 0; i < 16; i++) {
+            int guess = 0;
+            if (lengthSq > 0) {
+                int dot = 0;
+                for (int c = 0; c < 4; c++) dot += (block[i * 4 + c] - end0[c]) * direction[c];
+                int t = std::clamp((dot * 64 + lengthSq / 2) / lengthSq, 0, 64);
+                while (guess < 15 && weights[guess + 1] <= t) guess++;
+            }
+
+            uint32_t best = UINT32_MAX;
+            for (int p = std::max(0, guess - 1); p <= std::min(15, guess + 1); p++) {
+                uint32_t error = 0;
+                for (int c = 0; c < 4; c++) {
+                    int d = block[i * 4 + c] - palette[p][c];
+                    error += (uint32_t)(d * d);
+                }
+                if (error < best) {
+                    best = error;
+                    indices[i] = (uint8_t)p;
+                }
+            }
+            total += best;
+        }
+        return total;
+    }
+
+    static uint32_t TryBc7Endpoints(const uint8_t* block, const float end0[4], const float end1[4],
+        int q0[4], int q1[4], int& p0, int& p1, uint8_t indices[16]) {
+        QuantizeBc7Endpoint(end0, q0, p0);
+        QuantizeBc7Endpoint(end1, q1, p1);
+        int e0[4], e1[4];
+        for (int c = 0; c < 4; c++) {
+            e0[c] = q0[c] * 2 + p0;
+            e1[c] = q1[c] * 2 + p1;
+        }
+        return FitBc7Indices(block, e0, e1, indices);
+    }
+
+    static void EncodeBc7Block(const uint8_t* block, uint8_t* out) {
+        float mean[4], axis[4];
+        PrincipalAxis<4>(block, mean, axis);
+
+        float minDot = FLT_MAX, maxDot = -FLT_MAX;
+        int minIndex = 0, maxIndex = 0;
+        for (int i = 0; i < 16; i++) {
+            float dot = 0.0f;
+            for (int c = 0; c < 4; c++) dot += (block[i * 4 + c] - mean[c]) * axis[c];
+            if (dot < minDot) { minDot = dot; minIndex = i; }
+            if (dot > maxDot) { maxDot = dot; maxIndex = i; }
+        }
+
+        float end0[4], end1[4];
+        for (int c = 0; c < 4; c++) {
+            end0[c] = block[minIndex * 4 + c];
+            end1[c] = block[maxIndex * 4 + c];
+        }
+
+        int q0[4], q1[4], p0 = 0, p1 = 0;
+        uint8_t indices[16];
+        uint32_t error = TryBc7Endpoints(block, end0, end1, q0, q1, p0, p1, indices);
+
+        // Уточнение концов наименьшими квадратами по весам индексов
+        const int* weights = Bc7Weights();
+        for (int iteration = 0; iteration < 2 && error > 0; iteration++) {
+            float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+            float ax[4] = {}, bx[4] = {};
+            for (int i = 0; i < 16; i++) {
+                float b = weights[indices[i]] / 64.0f;
+                float a = 1.0f - b;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int c = 0; c < 4; c++) {
+                    ax[c] += a * block[i * 4 + c];
+                    bx[c] += b * block[i * 4 + c];
+                }
+            }
+            float det = aa * bb - ab * ab;
+            if (std::fabs(det) < 1e-4f) break;
+            for (int c = 0; c < 4; c++) {
+                end0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.0f, 255.0f);
+                end1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.0f, 255.0f);
+            }
+
+            int n0[4], n1[4], np0 = 0, np1 = 0;
+            uint8_t candidate[16];
+            uint32_t candidateError = TryBc7Endpoints(block, end0, end1, n0, n1, np0, np1, candidate);
+            if (candidateError >= error) break;
+            error = candidateError;
+            memcpy(q0, n0, sizeof(n0));
+            memcpy(q1, n1, sizeof(n1));
+            p0 = np0;
+            p1 = np1;
+            memcpy(indices, candidate, sizeof(indices));
+        }
+
+        // Старший бит индекса первого пикселя не хранится - он должен быть 0
+        if (indices[0] & 8) {
+            std::swap(q0, q1);
+            std::swap(p0, p1);
+            for (int i = 0; i < 16; i++) indices[i] = (uint8_t)(15 - indices[i]);
+        }
+
+        uint64_t bits[2] = {};
+        int position = 0;
+        auto put = [&](uint32_t value, int count) {
+            for (int b = 0; b < count; b++, position++) {
+                if ((value >> b) & 1) bits[position >> 6] |= 1ull << (position & 63);
+            }
+        };
+        put(1u << 6, 7); // Режим 6
+        for (int c = 0; c < 4; c++) {
+            put((uint32_t)q0[c], 7);
+            put((uint32_t)q1[c], 7);
+        }
+        put((uint32_t)p0, 1);
+        put((uint32_t)p1, 1);
+        put(indices[0], 3);
+        for (int i = 1; i < 16; i++) put(indices[i], 4);
+
+        for (int b = 0; b < 8; b++) {
+            out[b] = (uint8_t)(bits[0] >> (b * 8));
+            out[8 + b] = (uint8_t)(bits[1] >> (b * 8));
+        }
+    }
+};
+
+// ==================== КЭШ ТЕКСТУР ====================
+// Готовые к выгрузке уровни текстуры (BC1/BC3/BC7 или RGBA8 при некратных 4 размерах)
+// рядом с исходной картинкой: <картинка>.texcache. Раскладка как у DDS - уровни подряд,
+// строки блоков без выравнивания, - плюс отметка исходника для проверки свежести.
+// Файл отображается в память, и уровни уходят в CreateTexture2D без декодирования.
+const uint32_t TEXTURE_CACHE_MAGIC = 0x43545453; // 'STTC'
+const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+class TextureCache {
+public:
+    struct Level {
+        const uint8_t* data = nullptr;
+        uint64_t size = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t rowPitch = 0;
+    };
+
+    static std::wstring GetCachePath(const std::wstring& imagePath) {
+        return imagePath + L".texcache";
+    }
+
+    // levels[0] - верхний уровень, каждый уже в формате format
+    static bool Write(const std::wstring& cachePath, const std::wstring& sourcePath,
+        TextureFormat format, int width, int height,
+        const std::vector<std::vector<uint8_t>>& levels) {
+
+        CacheHeader header = {};
+        header.magic = TEXTURE_CACHE_MAGIC;
+        header.version = TEXTURE_CACHE_VERSION;
+        header.format = format;
+        header.width = (uint32_t)width;
+        header.height = (uint32_t)height;
+        header.levelCount = (uint32_t)levels.size();
+        SourceStamp stamp = SourceStamp::Of(sourcePath);
+        header.sourceSize = stamp.size;
+        header.sourceModifiedTime = stamp.modifiedTime;
+        header.sourceContentHash = SourceStamp::ContentHash(sourcePath);
+
+        std::vector<CacheLevel> levelRecords(levels.size());
+        uint64_t offset = sizeof(CacheHeader);
+        header.levelsOffset = offset;
+        offset += sizeof(CacheLevel) * levelRecords.size();
+        for (size_t i = 0; i < levels.size(); i++) {
+            CacheLevel& record = levelRecords[i];
+            record.width = (uint32_t)std::max(1, width >> i);
+            record.height = (uint32_t)std::max(1, height >> i);
+            record.rowPitch = BlockCompressor::GetRowPitch(format, (int)record.width);
+            record.size = levels[i].size();
+            offset = AlignUp(offset, 16);
+            record.offset = offset;
+            offset += record.size;
+        }
+        header.fileSize = offset;
+
+        std::vector<char> blob((size_t)header.fileSize, 0);
+        memcpy(blob.data(), &header, sizeof(header));
+        if (!levelRecords.empty())
+            memcpy(blob.data() + header.levelsOffset, levelRecords.data(), sizeof(CacheLevel) * levelRecords.size());
+        for (size_t i = 0; i < levels.size(); i++) {
+            if (!levels[i].empty())
+                memcpy(blob.data() + levelRecords[i].offset, levels[i].data(), levels[i].size());
+        }
+
+        // Пишем во временный файл и переименовываем, чтобы не оставить обрезанный кэш
+        std::wstring tempPath = cachePath + L".tmp";
+        {
+            std::ofstream out(FileSystemHelper::ToPath(tempPath), std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) {
+                DEBUG_WARNING("Не удалось создать файл кэша текстуры");
+                return false;
+            }
+            out.write(blob.data(), (std::streamsize)blob.size());
+            if (!out.good()) {
+                DEBUG_WARNING("Ошибка записи кэша текстуры");
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(FileSystemHelper::ToPath(tempPath), FileSystemHelper::ToPath(cachePath), ec);
+        if (ec) {
+            std::filesystem::remove(FileSystemHelper::ToPath(tempPath), ec);
+            DEBUG_WARNING("Не удалось переименовать файл кэша текстуры");
+            return false;
+        }
+
+        char buffer[256];
+        sprintf_s(buffer, "Кэш текстуры записан: %dx%d %s, %zu уровней, %zu байт",
+            width, height, BlockCompressor::GetFormatName(format), levels.size(), blob.size());
+        DEBUG_LOG(buffer);
+        return true;
+    }
+
+    // Открывает кэш и проверяет, что он целый и картинка не менялась
+    bool Open(const std::wstring& cachePath, const std::wstring& sourcePath) {
+        Close();
+        if (!file.Open(cachePath)) {
+            return false;
+        }
+        if (!Validate(sourcePath)) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close() {
+        file.Close();
+        levels.clear();
+        format = TEXTURE_RGBA8;
+        width = 0;
+        height = 0;
+    }
+
+    TextureFormat GetFormat() const { return format; }
+    int GetWidth() const { return width; }
+    int GetHeight() const { return height; }
+    const std::vector<Level>& GetLevels() const { return levels; }
+
+private:
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+        uint64_t sourceSize;
+        int64_t sourceModifiedTime;
+        uint64_t sourceContentHash;
+        uint64_t levelsOffset;
+        uint64_t fileSize;
+    };
+
+    struct CacheLevel {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t width;
+        uint32_t height;
+        uint32_t rowPitch;
+        uint32_t padding;
+    };
+
+    static uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static bool InRange(uint64_t offset, uint64_t size, uint64_t total) {
+        return offset <= total && size <= total - offset;
+    }
+
+    bool Validate(const std::wstring& sourcePath) {
+        const char* data = file.Data();
+        uint64_t total = file.Size();
+        if (total < sizeof(CacheHeader)) return false;
+
+        CacheHeader header;
+        memcpy(&header, data, sizeof(header));
+        if (header.magic != TEXTURE_CACHE_MAGIC || header.version != TEXTURE_CACHE_VERSION ||
+            header.format > TEXTURE_BC7 || header.fileSize != total) {
+            DEBUG_LOG("Кэш текстуры другой версии или повреждён");
+            return false;
+        }
+
+        TextureFormat cacheFormat = (TextureFormat)header.format;
+        if (header.width == 0 || header.height == 0 || header.width > 16384 || header.height > 16384 ||
+            header.levelCount == 0 || header.levelCount > (uint32_t)MipGenerator::CountLevels(header.width, header.height) ||
+            (cacheFormat != TEXTURE_RGBA8 && (header.width % 4 != 0 || header.height % 4 != 0)) ||
+            !InRange(header.levelsOffset, sizeof(CacheLevel) * (uint64_t)header.levelCount, total)) {
+            DEBUG_LOG("Кэш текстуры повреждён: неверный заголовок");
+            return false;
+        }
+
+        // Картинки нет на диске - кэш поставлен без исходника (например, в пакете)
+        std::error_code ec;
+        if (std::filesystem::exists(FileSystemHelper::ToPath(sourcePath), ec)) {
+            SourceStamp stamp = SourceStamp::Of(sourcePath);
+            if (stamp.size != header.sourceSize ||
+                (stamp.modifiedTime != header.sourceModifiedTime &&
+                    SourceStamp::ContentHash(sourcePath) != header.sourceContentHash)) {
+                DEBUG_LOG_W(L"Кэш текстуры устарел: изменился " + sourcePath);
+                return false;
+            }
+        }
+
+        const CacheLevel* levelRecords = (const CacheLevel*)(data + header.levelsOffset);
+        for (uint32_t i = 0; i < header.levelCount; i++) {
+            const CacheLevel& record = levelRecords[i];
+            uint32_t levelWidth = std::max(1u, header.width >> i);
+            uint32_t levelHeight = std::max(1u, header.height >> i);
+            if (record.width != levelWidth || record.height != levelHeight ||
+                record.rowPitch != BlockCompressor::GetRowPitch(cacheFormat, (int)levelWidth) ||
+                record.size != BlockCompressor::GetLevelSize(cacheFormat, (int)levelWidth, (int)levelHeight) ||
+                !InRange(record.offset, record.size, total)) {
+                DEBUG_LOG("Кэш текстуры повреждён: уровни выходят за пределы файла");
+                return false;
+            }
+
+            Level level;
+            level.data = (const uint8_t*)(data + record.offset);
+            level.size = record.size;
+            level.width = record.width;
+            level.height = record.height;
+            level.rowPitch = record.rowPitch;
+            levels.push_back(level);
+        }
+
+        format = cacheFormat;
+        width = (int)header.width;
+        height = (int)header.height;
+        return true;
+    }
+
+    AssetFile file;
+    std::vector<Level> levels;
+    TextureFormat format = TEXTURE_RGBA8;
+    int width = 0;
+    int height = 0;
+};
+
+// ==================== ОТСЛЕЖИВАНИЕ ИЗМЕНЕНИЙ ФАЙЛОВ ====================
+// Следит за отдельными файлами и за составом папок на диске. На Linux - inotify по папкам
+// (сохранение через переименование тоже видно), иначе - опрос размера и времени
+// изменения раз в POLL_INTERVAL_MS. Изменение файла подтверждается сменой SourceStamp,
+// папки - сменой её времени изменения; удалённый файл не сообщается, пока не появится снова.
+class FileWatcher {
+public:
+    static constexpr int POLL_INTERVAL_MS = 250;
+
+    FileWatcher() = default;
+    ~FileWatcher() { Clear(); }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Начинает следить за файлом или, если уже следит, запоминает его текущее
+    // состояние. false - файла нет на диске (например, запись пакета).
+    bool Watch(const std::wstring& path) {
+        std::wstring key = MakeKey(path);
+        SourceStamp stamp = SourceStamp::Of(key);
+        if (!FileSystemHelper::FileExists(key)) return false;
+
+        auto it = files.find(key);
+        if (it != files.end()) {
+            it->second.stamp = stamp;
+            return true;
+        }
+        files[key] = { path, stamp };
+#ifdef __linux__
+        size_t pos = key.find_last_of(L'/');
+        WatchDirectory((pos != std::wstring::npos) ? key.substr(0, pos + 1) : L"./");
+#endif
+        return true;
+    }
+
+    // Начинает следить за составом папки: запись в ней появилась, исчезла или
+    // переименована. Poll сообщает саму папку (путь - как передан сюда; пусто -
+    // рабочая папка). false - папки нет на диске.
+    bool WatchFolder(const std::wstring& path) {
+        std::wstring key = MakeKey(path.empty() ? L"." : path);
+        while (key.size() > 1 && (key.back() == L'/' || key.back() == L'\\')) key.pop_back();
+
+        std::error_code ec;
+        if (!std::filesystem::is_directory(FileSystemHelper::ToPath(key), ec)) return false;
+        auto modifiedTime = std::filesystem::last_write_time(FileSystemHelper::ToPath(key), ec);
+        if (ec) return false;
+
+        auto it = folders.find(key);
+        if (it != folders.end()) {
+            it->second.modifiedTime = modifiedTime;
+            return true;
+        }
+        folders[key] = { path, modifiedTime };
+#ifdef __linux__
+        WatchDirectory(key + L"/");
+#endif
+        return true;
+    }
+
+    // Файлы и папки, изменившиеся с прошлого вызова (пути - как в Watch и WatchFolder);
+    // дёшево, можно каждый кадр
+    std::vector<std::wstring> Poll() {
+        std::vector<std::wstring> candidates;
+        bool checkAll = false;
+#ifdef __linux__
+        if (inotifyFd >= 0) {
+            checkAll = ReadEvents(candidates);
+        }
+        else
+#endif
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastPoll >= std::chrono::milliseconds(POLL_INTERVAL_MS)) {
+                lastPoll = now;
+                checkAll = true;
+            }
+        }
+        if (checkAll) {
+            for (const auto& pair : files) candidates.push_back(pair.first);
+            for (const auto& pair : folders) candidates.push_back(pair.first);
+        }
+
+        std::vector<std::wstring> changed;
+        auto report = [&changed](const std::wstring& path) {
+            if (std::find(changed.begin(), changed.end(), path) == changed.end()) {
+                changed.push_back(path);
+            }
+        };
+        for (const auto& key : candidates) {
+            auto it = files.find(key);
+            if (it != files.end()) {
+                SourceStamp stamp = SourceStamp::Of(key);
+                if (stamp == it->second.stamp || !FileSystemHelper::FileExists(key)) continue;
+                it->second.stamp = stamp;
+                report(it->second.path);
+                continue;
+            }
+
+            auto folder = folders.find(key);
+            if (folder == folders.end()) continue;
+            std::error_code ec;
+            auto modifiedTime = std::filesystem::last_write_time(FileSystemHelper::ToPath(key), ec);
+            if (ec || modifiedTime == folder->second.modifiedTime) continue;
+            folder->second.modifiedTime = modifiedTime;
+            report(folder->second.path);
+        }
+        return changed;
+    }
+
+    void Clear() {
+        files.clear();
+        folders.clear();
+#ifdef __linux__
+        if (inotifyFd >= 0) close(inotifyFd);
+        inotifyFd = -1;
+        inotifyFailed = false;
+        directories.clear();
+#endif
+    }
+
+private:
+    struct WatchedFile {
+        std::wstring path;  // Как передан в Watch
+        SourceStamp stamp;
+    };
+
+    struct WatchedFolder {
+        std::wstring path;  // Как передан в WatchFolder
+        std::filesystem::file_time_type modifiedTime;
+    };
+
+    // Абсолютный путь - один файл под разными относительными путями совпадает
+    static std::wstring MakeKey(const std::wstring& path) {
+        std::error_code ec;
+        std::filesystem::path absolute = std::filesystem::absolute(FileSystemHelper::ToPath(path), ec);
+        return ec ? path : FileSystemHelper::FromPath(absolute.lexically_normal());
+    }
+
+    std::unordered_map<std::wstring, WatchedFile> files;
+    std::unordered_map<std::wstring, WatchedFolder> folders; // Ключ - абсолютный путь без '/' в конце
+    std::chrono::steady_clock::time_point lastPoll;
+
+#ifdef __linux__
+    // Одна маска на папку: повторный inotify_add_watch заменяет прежнюю
+    static constexpr uint32_t FILE_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB;
+    static constexpr uint32_t FOLDER_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+    // directory - с '/' в конце
+    void WatchDirectory(const std::wstring& directory) {
+        if (inotifyFd < 0 && !inotifyFailed) {
+            inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (inotifyFd < 0) {
+                inotifyFailed = true;
+                DEBUG_WARNING("inotify недоступен, изменения файлов ищутся опросом");
+            }
+        }
+        if (inotifyFd < 0) return;
+
+        int descriptor = inotify_add_watch(inotifyFd, WideToUtf8(directory).c_str(), FILE_EVENTS | FOLDER_EVENTS);
+        if (descriptor < 0) {
+            // Папку не удалось поставить на слежение - дальше опрос для всех файлов
+            DEBUG_WARNING_W(L"inotify не следит за папкой, изменения ищутся опросом: " + directory);
+            close(inotifyFd);
+            inotifyFd = -1;
+            inotifyFailed = true;
+            directories.clear();
+            return;
+        }
+        directories[descriptor] = directory;
+    }
+
+    // Файлы и папки из событий - в candidates; true - очередь событий переполнилась, проверить всё
+    bool ReadEvents(std::vector<std::wstring>& candidates) {
+        alignas(inotify_event) char buffer[4096];
+        bool overflow = false;
+        for (;;) {
+            ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+            if (length <= 0) break;
+
+            for (char* p = buffer; p < buffer + length;) {
+                const inotify_event* event = (const inotify_event*)p;
+                p += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) overflow = true;
+                if (event->len == 0) continue;
+                auto directory = directories.find(event->wd);
+                if (directory != directories.end()) {
+                    candidates.push_back(directory->second + Utf8ToWide(event->name));
+                    if (event->mask & FOLDER_EVENTS) {
+                        candidates.push_back(directory->second.substr(0, std::max<size_t>(directory->second.size() - 1, 1)));
+                    }
+                }
+            }
+        }
+        return overflow;
+    }
+
+    int inotifyFd = -1;
+    bool inotifyFailed = false;
+    std::unordered_map<int, std::wstring> directories; // Дескриптор -> папка с '/' в конце
+#endif
+};
+
+inline FileWatcher& AssetIndex::GetWatcher() {
+    static FileWatcher watcher;
+    return watcher;
+}
+
+inline bool AssetIndex::WatchFolder(const std::wstring& path) {
+    return GetWatcher().WatchFolder(path);
+}
+
+inline void AssetIndex::ClearWatches() {
+    GetWatcher().Clear();
+}
+
+// Папки, в которых что-то появилось или исчезло, перечитываются при следующем поиске
+inline void AssetIndex::Update() {
+    std::lock_guard<std::mutex> lock(GetMutex());
+    State& state = GetState();
+    for (const auto& path : GetWatcher().Poll()) {
+        InvalidateLocked(state, path);
+    }
+}
+
+// ==================== КЭШ СОСТОЯНИЙ КОНВЕЙЕРА ====================
+// Одинаковые описания сэмплеров, растеризатора и смешивания дают один общий объект.
+// Вызывающий получает свою ссылку (AddRef) и отпускает её через Release как обычно;
+// кэш держит ещё одну до Clear. Описания сравниваются побайтно - их нужно создавать
+// через = {}, как везде в этом файле, чтобы байты выравнивания были нулевыми.
+class PipelineStateCache {
+public:
+    static HRESULT GetSamplerState(ID3D11Device* device, const D3D11_SAMPLER_DESC& desc,
+        ID3D11SamplerState** state) {
+        return Acquire(GetSamplers(), device, desc, state, [&](ID3D11SamplerState** created) {
+            return device->CreateSamplerState(&desc, created);
+        });
+    }
+
+    static HRESULT GetRasterizerState(ID3D11Device* device, const D3D11_RASTERIZER_DESC& desc,
+        ID3D11RasterizerState** state) {
+        return Acquire(GetRasterizers(), device, desc, state, [&](ID3D11RasterizerState** created) {
+            return device->CreateRasterizerState(&desc, created);
+        });
+    }
+
+    static HRESULT GetBlendState(ID3D11Device* device, const D3D11_BLEND_DESC& desc,
+        ID3D11BlendState** state) {
+        return Acquire(GetBlends(), device, desc, state, [&](ID3D11BlendState** created) {
+            return device->CreateBlendState(&desc, created);
+        });
+    }
+
+    // FNV-1a по байтам описания; устройство входит в ключ
+    template<class Desc>
+    static uint64_t HashDesc(ID3D11Device* device, const Desc& desc) {
+        uint64_t hash = 1469598103934665603ULL;
+        auto mix = [&hash](const void* data, size_t size) {
+            const BYTE* bytes = (const BYTE*)data;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
+            }
+        };
+        mix(&device, sizeof(device));
+        mix(&desc, sizeof(desc));
+        return hash;
+    }
+
+    static size_t GetCount() {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        return GetSamplers().entries.size() + GetRasterizers().entries.size() + GetBlends().entries.size();
+    }
+
+    // Перед освобождением устройства: отдаёт ссылки кэша
+    static void Clear() {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        Stats& stats = GetStats();
+        char buffer[256];
+        sprintf_s(buffer, "Кэш состояний: создано %zu объектов, повторных запросов %zu",
+            stats.created, stats.reused);
+        DEBUG_LOG(buffer);
+
+        GetSamplers().Clear();
+        GetRasterizers().Clear();
+        GetBlends().Clear();
+        stats = Stats();
+    }
+
+private:
+    template<class State, class Desc>
+    struct StateTable {
+        struct Entry {
+            ID3D11Device* device;
+            Desc desc;
+            State* state;
+        };
+        std::unordered_multimap<uint64_t, Entry> entries;
+
+        void Clear() {
+            for (auto& pair : entries) pair.second.state->Release();
+            entries.clear();
+        }
+    };
+
+    struct Stats {
+        size_t created = 0;
+        size_t reused = 0;
+    };
+
+    template<class State, class Desc, class CreateFunc>
+    static HRESULT Acquire(StateTable<State, Desc>& table, ID3D11Device* device, const Desc& desc,
+        State** state, CreateFunc&& create) {
+        *state = nullptr;
+        uint64_t hash = HashDesc(device, desc);
+
+        std::lock_guard<std::mutex> lock(GetMutex());
+        auto range = table.entries.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second.device == device && memcmp(&it->second.desc, &desc, sizeof(Desc)) == 0) {
+                it->second.state->AddRef();
+                *state = it->second.state;
+                GetStats().reused++;
+                return S_OK;
+            }
+        }
+
+        State* created = nullptr;
+        HRESULT hr = create(&created);
+        if (FAILED(hr)) return hr;
+
+        table.entries.emplace(hash, typename StateTable<State, Desc>::Entry{ device, desc, created });
+        created->AddRef();
+        *state = created;
+        GetStats().created++;
+        return S_OK;
+    }
+
+    static std::mutex& GetMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static StateTable<ID3D11SamplerState, D3D11_SAMPLER_DESC>& GetSamplers() {
+        static StateTable<ID3D11SamplerState, D3D11_SAMPLER_DESC> table;
+        return table;
+    }
+
+    static StateTable<ID3D11RasterizerState, D3D11_RASTERIZER_DESC>& GetRasterizers() {
+        static StateTable<ID3D11RasterizerState, D3D11_RASTERIZER_DESC> table;
+        return table;
+    }
+
+    static StateTable<ID3D11BlendState, D3D11_BLEND_DESC>& GetBlends() {
+        static StateTable<ID3D11BlendState, D3D11_BLEND_DESC> table;
+        return table;
+    }
+
+    static Stats& GetStats() {
+        static Stats stats;
+        return stats;
+    }
+};
+
+// ==================== ПОТОКОВАЯ ЗАГРУЗКА ТЕКСТУР ====================
+// Текстуры из файлов живут в видеопамяти не целиком, а начиная с некоторого мипа.
+// Модели каждый кадр сообщают экранный размер своих текстур; раз в кадр стример решает,
+// какие текстуры поднять до более мелких мипов (загрузка в фоне) и какие уровни выбросить,
+// чтобы уложиться в бюджет. Первыми выбрасываются уровни давно не использованных текстур.
+// Сами ресурсы стример не трогает - решения уходят в TextureResidencyTarget.
+const bool STREAM_TEXTURES = true;
+const uint64_t TEXTURE_STREAMING_BUDGET = 256ull * 1024 * 1024;
+const int STREAM_MIN_RESIDENT_SIZE = 64; // Уровни не больше этого по стороне всегда в памяти
+const uint32_t MAX_STREAM_MIPS = 16;
+
+// Исполнитель решений стримера: выгрузка на GPU в игре или заглушка в проверках
+class TextureResidencyTarget {
+public:
+    virtual ~TextureResidencyTarget() = default;
+
+    // Загрузить уровни начиная с topMip; по готовности - TextureStreamer::OnMipsLoaded
+    // (можно прямо из вызова), при ошибке - OnLoadFailed
+    virtual void LoadMips(uint32_t streamId, uint32_t topMip) = 0;
+
+    // Оставить уровни начиная с topMip, более мелкие освободить сразу
+    virtual void EvictMips(uint32_t streamId, uint32_t topMip) = 0;
+};
+
+struct TextureStreamStats {
+    uint64_t budgetBytes = 0;
+    uint64_t residentBytes = 0;  // Уровни в памяти после решений кадра
+    uint64_t pendingBytes = 0;   // Загружаются
+    uint64_t requestedBytes = 0; // Запрошено за кадр
+    uint32_t requests = 0;
+    uint32_t evictions = 0;      // Выброшено уровней за кадр
+    uint32_t streamedTextures = 0;
+};
+
+class TextureStreamer {
+public:
+    static constexpr uint32_t INVALID_ID = 0xFFFFFFFF;
+
+    void Initialize(TextureResidencyTarget* residencyTarget, uint64_t budget) {
+        target = residencyTarget;
+        stats.budgetBytes = budget;
+    }
+
+    // Новая текстура с уровнями 0..levelCount-1; в памяти сначала только хвост мипов
+    // (GetResidentMip). Для BC верхний уровень должен быть кратен 4 - глубже не опускаемся.
+    uint32_t Register(int width, int height, TextureFormat format, uint32_t levelCount) {
+        levelCount = std::max(1u, std::min(levelCount, MAX_STREAM_MIPS));
+
+        Entry entry;
+        entry.active = true;
+        entry.width = width;
+        entry.height = height;
+        entry.levelCount = levelCount;
+        entry.tailMip = 0;
+        bool blockCompressed = format != TEXTURE_RGBA8;
+        bool tailFound = false;
+        for (uint32_t level = 0; level < levelCount; level++) {
+            int levelWidth = std::max(1, width >> level);
+            int levelHeight = std::max(1, height >> level);
+            entry.levelBytes[level] = BlockCompressor::GetLevelSize(format, levelWidth, levelHeight);
+
+            // Размеры нужны и уровням под хвостом - они тоже в памяти и в бюджете
+            bool canBeTop = !blockCompressed || (levelWidth % 4 == 0 && levelHeight % 4 == 0);
+            if (tailFound || !canBeTop) continue;
+            entry.tailMip = level;
+            tailFound = std::max(levelWidth, levelHeight) <= STREAM_MIN_RESIDENT_SIZE;
+        }
+        entry.residentMip = entry.tailMip;
+        entry.wantedMip = entry.tailMip;
+        entry.pendingMip = INVALID_ID;
+        entry.lastUsedFrame = frame;
+
+        uint32_t id;
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+            entries[id] = entry;
+        }
+        else {
+            id = (uint32_t)entries.size();
+            entries.push_back(entry);
+        }
+        return id;
+    }
+
+    void Unregister(uint32_t id) {
+        if (!IsActive(id)) return;
+        entries[id] = Entry();
+        freeIds.push_back(id);
+    }
+
+    uint32_t GetResidentMip(uint32_t id) const {
+        return IsActive(id) ? entries[id].residentMip : 0;
+    }
+
+    // Мип, текселей в котором примерно столько же, сколько пикселей на экране
+    static uint32_t GetMipForScreenSize(int width, int height, float screenPixels) {
+        float texels = (float)std::max(width, height);
+        if (screenPixels <= 0.0f) return MAX_STREAM_MIPS - 1;
+        if (screenPixels >= texels) return 0;
+        return (uint32_t)std::min(floorf(log2f(texels / screenPixels)), (float)(MAX_STREAM_MIPS - 1));
+    }
+
+    // Текстура видна в этом кадре размером screenPixels; из нескольких запросов берётся больший
+    void RequestScreenSize(uint32_t id, float screenPixels) {
+        if (!IsActive(id)) return;
+        Entry& entry = entries[id];
+        uint32_t mip = std::min(GetMipForScreenSize(entry.width, entry.height, screenPixels), entry.tailMip);
+        entry.wantedMip = (entry.lastUsedFrame == frame) ? std::min(entry.wantedMip, mip) : mip;
+        entry.lastUsedFrame = frame;
+    }
+
+    void OnMipsLoaded(uint32_t id, uint32_t topMip) {
+        if (!IsActive(id) || entries[id].pendingMip != topMip) return;
+        Entry& entry = entries[id];
+        entry.residentMip = std::min(entry.residentMip, topMip);
+        entry.pendingMip = INVALID_ID;
+    }
+
+    void OnLoadFailed(uint32_t id) {
+        if (IsActive(id)) entries[id].pendingMip = INVALID_ID;
+    }
+
+    // Раз в кадр, после всех RequestScreenSize: загрузки по нехватке, вытеснение по бюджету
+    void Update() {
+        stats.requestedBytes = 0;
+        stats.requests = 0;
+        stats.evictions = 0;
+
+        // Недостающие уровни видимых текстур; сильнее всего размытые - первыми
+        std::vector<uint32_t> upgrades;
+        for (uint32_t id = 0; id < (uint32_t)entries.size(); id++) {
+            const Entry& entry = entries[id];
+            if (entry.active && entry.lastUsedFrame == frame && entry.pendingMip == INVALID_ID &&
+                entry.wantedMip < entry.residentMip) {
+                upgrades.push_back(id);
+            }
+        }
+        std::sort(upgrades.begin(), upgrades.end(), [this](uint32_t a, uint32_t b) {
+            uint32_t deficitA = entries[a].residentMip - entries[a].wantedMip;
+            uint32_t deficitB = entries[b].residentMip - entries[b].wantedMip;
+            return deficitA != deficitB ? deficitA > deficitB : a < b;
+        });
+
+        for (uint32_t id : upgrades) {
+            Entry& entry = entries[id];
+            uint32_t topMip = entry.wantedMip;
+            while (topMip < entry.residentMip) {
+                uint64_t need = GetBytes(entry, topMip) - GetBytes(entry, entry.residentMip);
+                if (GetCommittedBytes() + need <= stats.budgetBytes || Evict(need, id)) {
+                    entry.pendingMip = topMip;
+                    stats.requestedBytes += need;
+                    stats.requests++;
+                    target->LoadMips(id, topMip);
+                    break;
+                }
+                topMip++; // Целиком не влезает - хотя бы на уровень ближе
+            }
+        }
+
+        stats.residentBytes = 0;
+        stats.pendingBytes = 0;
+        stats.streamedTextures = 0;
+        for (const Entry& entry : entries) {
+            if (!entry.active) continue;
+            stats.residentBytes += GetBytes(entry, entry.residentMip);
+            if (entry.pendingMip != INVALID_ID) {
+                stats.pendingBytes += GetBytes(entry, entry.pendingMip) - GetBytes(entry, entry.residentMip);
+            }
+            stats.streamedTextures++;
+        }
+        frame++;
+    }
+
+    const TextureStreamStats& GetStats() const { return stats; }
+
+    void Clear() {
+        entries.clear();
+        freeIds.clear();
+        frame = 0;
+    }
+
+private:
+    struct Entry {
+        bool active = false;
+        int width = 0;
+        int height = 0;
+        uint32_t levelCount = 0;
+        uint64_t levelBytes[MAX_STREAM_MIPS] = {};
+        uint32_t tailMip = 0;     // Самый грубый допустимый верхний уровень - всегда в памяти
+        uint32_t residentMip = 0; // Верхний уровень в памяти
+        uint32_t pendingMip = INVALID_ID;
+        uint32_t wantedMip = 0;   // Действует, только если lastUsedFrame == текущий кадр
+        uint64_t lastUsedFrame = 0;
+    };
+
+    TextureResidencyTarget* target = nullptr;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> freeIds;
+    uint64_t frame = 0;
+    TextureStreamStats stats;
+
+    bool IsActive(uint32_t id) const {
+        return id < entries.size() && entries[id].active;
+    }
+
+    static uint64_t GetBytes(const Entry& entry, uint32_t topMip) {
+        uint64_t bytes = 0;
+        for (uint32_t level = topMip; level < entry.levelCount; level++) bytes += entry.levelBytes[level];
+        return bytes;
+    }
+
+    // В памяти и в загрузке - загрузка уже заняла место в бюджете
+    uint64_t GetCommittedBytes() const {
+        uint64_t bytes = 0;
+        for (const Entry& entry : entries) {
+            if (!entry.active) continue;
+            uint32_t top = (entry.pendingMip != INVALID_ID) ? entry.pendingMip : entry.residentMip;
+            bytes += GetBytes(entry, top);
+        }
+        return bytes;
+    }
+
+    // Освобождает место под need байт: уровни сверх нужного, начиная с давно не
+    // использованных текстур (LRU). Видимым в этом кадре оставляется их wantedMip,
+    // загружающиеся не трогаются. false - столько не освободить, ничего не выброшено.
+    bool Evict(uint64_t need, uint32_t exceptId) {
+        std::vector<uint32_t> victims;
+        uint64_t available = 0;
+        for (uint32_t id = 0; id < (uint32_t)entries.size(); id++) {
+            const Entry& entry = entries[id];
+            if (!entry.active || id == exceptId || entry.pendingMip != INVALID_ID) continue;
+            uint32_t keepMip = GetKeepMip(entry);
+            if (entry.residentMip >= keepMip) continue;
+            victims.push_back(id);
+            available += GetBytes(entry, entry.residentMip) - GetBytes(entry, keepMip);
+        }
+
+        uint64_t committed = GetCommittedBytes();
+        uint64_t overBudget = (committed + need > stats.budgetBytes) ? committed + need - stats.budgetBytes : 0;
+        if (available < overBudget) return false;
+
+        std::sort(victims.begin(), victims.end(), [this](uint32_t a, uint32_t b) {
+            return entries[a].lastUsedFrame != entries[b].lastUsedFrame ?
+                entries[a].lastUsedFrame < entries[b].lastUsedFrame : a < b;
+        });
+
+        uint64_t freed = 0;
+        for (uint32_t id : victims) {
+            if (freed >= overBudget) break;
+            Entry& entry = entries[id];
+            uint32_t keepMip = GetKeepMip(entry);
+            // По уровню за раз - не больше, чем нужно
+            uint32_t topMip = entry.residentMip;
+            while (topMip < keepMip && freed + GetBytes(entry, entry.residentMip) - GetBytes(entry, topMip) < overBudget) {
+                topMip++;
+            }
+            freed += GetBytes(entry, entry.residentMip) - GetBytes(entry, topMip);
+            stats.evictions += topMip - entry.residentMip;
+            entry.residentMip = topMip;
+            target->EvictMips(id, topMip);
+        }
+        return true;
+    }
+
+    // До какого уровня можно выбросить: видимой - до нужного ей, остальным - до хвоста
+    uint32_t GetKeepMip(const Entry& entry) const {
+        return (entry.lastUsedFrame == frame) ? entry.wantedMip : entry.tailMip;
+    }
+};
+
+// ==================== ДЕСКРИПТОРЫ ТЕКСТУР ====================
+// Учёт ячеек TextureManager отдельно от устройства, чтобы его проверял thames-cook --selftest.
+// Дескриптор - индекс ячейки в плотном массиве и её поколение: после освобождения ячейки
+// поколение растёт, и старый дескриптор больше ничего не находит, даже когда ячейку
+// заняла другая текстура.
+const uint32_t TEXTURE_RELEASE_DELAY_FRAMES = 3;
+
+struct TextureHandle {
+    uint32_t index = 0;
+    uint32_t generation = 0; // 0 - пустой дескриптор
+
+    bool IsValid() const { return generation != 0; }
+    bool operator==(const TextureHandle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const TextureHandle& other) const { return !(*this == other); }
+};
+
+// Ячейки со счётчиком ссылок, список свободных и ключ -> живой дескриптор.
+// Value - содержимое ячейки; Cleanup() освобождает его ресурсы.
+template<class Value>
+class TextureSlotTable {
+public:
+    struct Slot : Value {
+        std::wstring key;        // Путь, [DEBUG] или [IMAGE]имя
+        uint32_t generation = 1; // Растёт при освобождении ячейки; 0 не выдаётся
+        uint32_t refCount = 0;   // 0 - ячейка свободна
+    };
+
+    // Новая ячейка с одной ссылкой
+    TextureHandle Add(const std::wstring& key, const Value& value) {
+        uint32_t index;
+        if (!freeSlots.empty()) {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else {
+            index = (uint32_t)slots.size();
+            slots.emplace_back();
+        }
+
+        Slot& slot = slots[index];
+        static_cast<Value&>(slot) = value;
+        slot.key = key;
+        slot.refCount = 1;
+
+        TextureHandle handle = { index, slot.generation };
+        handles[key] = handle;
+        return handle;
+    }
+
+    // Ещё одна ссылка на живую ячейку по ключу; пустой дескриптор - такой нет
+    TextureHandle AcquireExisting(const std::wstring& key) {
+        TextureHandle handle = FindKey(key);
+        if (handle.IsValid()) slots[handle.index].refCount++;
+        return handle;
+    }
+
+    // Дескриптор по ключу без новой ссылки
+    TextureHandle FindKey(const std::wstring& key) const {
+        auto it = handles.find(key);
+        return (it != handles.end()) ? it->second : TextureHandle();
+    }
+
+    // Живая ячейка дескриптора; устаревший дескриптор - nullptr
+    Slot* Find(TextureHandle handle) {
+        if (!handle.IsValid() || handle.index >= slots.size()) return nullptr;
+        Slot& slot = slots[handle.index];
+        return (slot.generation == handle.generation && slot.refCount > 0) ? &slot : nullptr;
+    }
+
+    TextureHandle AddRef(TextureHandle handle) {
+        Slot* slot = Find(handle);
+        if (!slot) return TextureHandle();
+        slot->refCount++;
+        return handle;
+    }
+
+    // Последняя ссылка освобождает ячейку: содержимое уходит в released (освобождает
+    // его вызывающий), поколение растёт. false - ссылки остались или дескриптор устарел
+    bool Release(TextureHandle handle, Value& released) {
+        Slot* slot = Find(handle);
+        if (!slot || --slot->refCount > 0) return false;
+
+        handles.erase(slot->key);
+        slot->key.clear();
+        released = static_cast<Value&>(*slot);
+        static_cast<Value&>(*slot) = Value();
+        if (++slot->generation == 0) slot->generation = 1;
+        freeSlots.push_back(handle.index);
+        return true;
+    }
+
+    const std::unordered_map<std::wstring, TextureHandle>& GetHandles() const { return handles; }
+    size_t GetLiveCount() const { return handles.size(); }
+
+    // Освобождает содержимое всех ячеек; выданные дескрипторы больше не действуют
+    void Clear() {
+        for (Slot& slot : slots) {
+            slot.Cleanup();
+        }
+        slots.clear();
+        freeSlots.clear();
+        handles.clear();
+    }
+
+private:
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<std::wstring, TextureHandle> handles;
+};
+
+// Ресурсы, которые ещё может читать очередь команд GPU: Cleanup() через
+// TEXTURE_RELEASE_DELAY_FRAMES кадров после Push
+template<class Resource>
+class DeferredReleaseQueue {
+public:
+    void Push(const Resource& resource, uint64_t frame) {
+        pending.push_back({ resource, frame + TEXTURE_RELEASE_DELAY_FRAMES });
+    }
+
+    // Освобождает всё, что отложено до frame включительно
+    void Collect(uint64_t frame) {
+        size_t kept = 0;
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (pending[i].releaseFrame <= frame) {
+                pending[i].resource.Cleanup();
+            }
+            else {
+                pending[kept++] = pending[i];
+            }
+        }
+        pending.resize(kept);
+    }
+
+    void Clear() {
+        for (auto& item : pending) {
+            item.resource.Cleanup();
+        }
+        pending.clear();
+    }
+
+    size_t GetCount() const { return pending.size(); }
+
+private:
+    struct PendingRelease {
+        Resource resource;
+        uint64_t releaseFrame = 0;
+    };
+
+    std::vector<PendingRelease> pending;
+};
+
+// ==================== КОМАНДНЫЙ БУФЕР РЕНДЕРА ====================
+// Игровой код не трогает контекст напрямую: за кадр он складывает в RenderCommandBuffer
+// пакеты отрисовки с 64-битным ключом, буфер сортирует их поразрядно и проигрывает через
+// RenderBackend. При проигрывании повторная привязка того же состояния пропускается, так что
+// соседние пакеты с общим шейдером, материалами и текстурой стоят только вызова отрисовки.
+// RecordingRenderBackend ничего не рисует и только записывает команды - для thames-cook --selftest.
+
+// Ключ, старшие биты важнее: слой | конвейер | таблица материалов | текстура | глубина
+const uint32_t SORT_KEY_LAYER_BITS = 4;
+const uint32_t SORT_KEY_PIPELINE_BITS = 8;
+const uint32_t SORT_KEY_MATERIAL_BITS = 12;
+const uint32_t SORT_KEY_TEXTURE_BITS = 16;
+const uint32_t SORT_KEY_DEPTH_BITS = 24;
+
+enum RenderLayer : uint32_t {
+    RENDER_LAYER_BACKGROUND = 0, // Фон под всем остальным
+    RENDER_LAYER_WORLD = 1,      // Непрозрачные модели, спереди назад
+    RENDER_LAYER_TRANSPARENT = 2 // Полупрозрачное, сзади наперёд
+};
+
+struct RenderSortKey {
+    // Идентификаторы обрезаются до своих полей: совпадение после обрезки лишь хуже группирует
+    // пакеты, на результат отрисовки порядок внутри слоя не влияет
+    static uint64_t Make(uint32_t layer, uint32_t pipeline, uint32_t material, uint32_t texture, float depth) {
+        uint64_t key = layer & ((1u << SORT_KEY_LAYER_BITS) - 1);
+        key = (key << SORT_KEY_PIPELINE_BITS) | (pipeline & ((1u << SORT_KEY_PIPELINE_BITS) - 1));
+        key = (key << SORT_KEY_MATERIAL_BITS) | (material & ((1u << SORT_KEY_MATERIAL_BITS) - 1));
+        key = (key << SORT_KEY_TEXTURE_BITS) | (texture & ((1u << SORT_KEY_TEXTURE_BITS) - 1));
+
+        uint32_t depthBits = QuantizeDepth(depth);
+        if (layer == RENDER_LAYER_TRANSPARENT) depthBits = ((1u << SORT_KEY_DEPTH_BITS) - 1) - depthBits;
+        return (key << SORT_KEY_DEPTH_BITS) | depthBits;
+    }
+
+    // Биты неотрицательного float растут вместе с числом - старшие 24 и есть глубина в ключе
+    static uint32_t QuantizeDepth(float depth) {
+        if (!(depth > 0.0f)) return 0;
+        uint32_t bits;
+        memcpy(&bits, &depth, sizeof(bits));
+        return bits >> (32 - SORT_KEY_DEPTH_BITS);
+    }
+
+    static uint32_t GetLayer(uint64_t key) {
+        return (uint32_t)(key >> (64 - SORT_KEY_LAYER_BITS));
+    }
+};
+
+// Раскладка cbuffer MatrixBuffer (b0): матрицы транспонированы под mul(v, M) в HLSL
+struct ShaderConstants {
+    XMFLOAT4X4 world;
+    XMFLOAT4X4 view;
+    XMFLOAT4X4 proj;
+    XMFLOAT4 lightDir;
+    XMFLOAT4 eyeDir; // Направление на камеру для бликов
+
+    static ShaderConstants Make(const XMMATRIX& world, const XMMATRIX& view, const XMMATRIX& proj) {
+        ShaderConstants constants;
+        XMStoreFloat4x4(&constants.world, XMMatrixTranspose(world));
+        XMStoreFloat4x4(&constants.view, XMMatrixTranspose(view));
+        XMStoreFloat4x4(&constants.proj, XMMatrixTranspose(proj));
+        constants.lightDir = XMFLOAT4(1.0f, 1.0f, 0.5f, 0.0f);
+
+        // Обратная ось взгляда в мировых координатах
+        XMVECTOR forward = XMVector3Normalize(XMMatrixInverse(nullptr, view).r[2]);
+        XMStoreFloat4(&constants.eyeDir, XMVectorNegate(forward));
+        constants.eyeDir.w = 0.0f;
+        return constants;
+    }
+};
+
+// Шейдеры и неизменное за кадр состояние; держит ShaderManager
+struct RenderPipeline {
+    uint32_t id = 0; // Поле конвейера в ключе сортировки
+    ID3D11VertexShader* vertexShader = nullptr;
+    ID3D11PixelShader* pixelShader = nullptr;
+    ID3D11InputLayout* inputLayout = nullptr;
+    ID3D11RasterizerState* rasterizerState = nullptr;
+    D3D11_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+    ID3D11Buffer* constantBuffer = nullptr; // b0 обоих шейдеров, ShaderConstants
+    ID3D11Buffer* instanceBuffer = nullptr; // Слот 1: индексы материалов
+    UINT instanceStride = 0;
+};
+
+// Один вызов DrawIndexedInstanced со всем нужным ему состоянием. Пустые texture, sampler,
+// materials и meshConstants значат "не важно" - остаётся привязанное ранее.
+struct DrawPacket {
+    uint64_t key = 0;
+    const RenderPipeline* pipeline = nullptr;
+    ID3D11Buffer* vertexBuffer = nullptr;
+    ID3D11Buffer* indexBuffer = nullptr;
+    ID3D11Buffer* meshConstants = nullptr;         // b1 вершинного шейдера (деквантование)
+    ID3D11ShaderResourceView* materials = nullptr; // t1
+    ID3D11ShaderResourceView* texture = nullptr;   // t0
+    ID3D11SamplerState* sampler = nullptr;         // s0
+    UINT vertexStride = 0;
+    DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT;
+    uint32_t constants = 0;  // Номер из RenderCommandBuffer::AddConstants
+    uint32_t indexCount = 0;
+    uint32_t startIndex = 0;
+    int baseVertex = 0;
+    uint32_t material = 0;   // StartInstanceLocation - запись в таблице материалов
+};
+
+// Сколько команд дошло до бэкенда за проигрывание
+struct RenderStats {
+    uint32_t drawCalls = 0;
+    uint32_t pipelineChanges = 0; // Шейдеры, input layout, растеризатор, топология
+    uint32_t constantUpdates = 0;
+    uint32_t geometryChanges = 0; // Буферы вершин и индексов, константы меша
+    uint32_t materialChanges = 0;
+    uint32_t textureChanges = 0;
+    uint32_t samplerChanges = 0;
+
+    uint32_t GetStateChanges() const {
+        return pipelineChanges + constantUpdates + geometryChanges +
+            materialChanges + textureChanges + samplerChanges;
+    }
+};
+
+// Исполнитель отсортированного списка: D3D11 в игре или запись команд в проверках.
+// Вызовы приходят только при смене состояния, Begin - в начале каждого проигрывания.
+class RenderBackend {
+protected:
+    RenderStats stats;
+
+public:
+    virtual ~RenderBackend() = default;
+
+    // Всё привязанное ранее считается неизвестным
+    virtual void Begin() {
+        stats = RenderStats();
+    }
+
+    virtual void SetPipeline(const RenderPipeline& pipeline) = 0;
+    virtual void SetConstants(const RenderPipeline& pipeline, const ShaderConstants& constants) = 0;
+    virtual void SetGeometry(ID3D11Buffer* vertexBuffer, UINT vertexStride,
+        ID3D11Buffer* indexBuffer, DXGI_FORMAT indexFormat, ID3D11Buffer* meshConstants) = 0;
+    virtual void SetMaterials(ID3D11ShaderResourceView* materials) = 0;
+    virtual void SetTexture(ID3D11ShaderResourceView* texture) = 0;
+    virtual void SetSampler(ID3D11SamplerState* sampler) = 0;
+    virtual void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int baseVertex, uint32_t material) = 0;
+
+    const RenderStats& GetStats() const { return stats; }
+};
+
+// Без GPU: запоминает вызовы, а состояния - только как указатели
+class RecordingRenderBackend : public RenderBackend {
+public:
+    struct RecordedDraw {
+        uint32_t pipeline = 0; // RenderPipeline::id
+        ID3D11Buffer* vertexBuffer = nullptr;
+        ID3D11ShaderResourceView* materials = nullptr;
+        ID3D11ShaderResourceView* texture = nullptr;
+        uint32_t indexCount = 0;
+        uint32_t startIndex = 0;
+        int baseVertex = 0;
+        uint32_t material = 0;
+    };
+
+private:
+    RecordedDraw current;
+    std::vector<RecordedDraw> draws;
+
+public:
+    void Begin() override {
+        RenderBackend::Begin();
+        current = RecordedDraw();
+        draws.clear();
+    }
+
+    void SetPipeline(const RenderPipeline& pipeline) override {
+        current.pipeline = pipeline.id;
+        stats.pipelineChanges++;
+    }
+
+    void SetConstants(const RenderPipeline&, const ShaderConstants&) override {
+        stats.constantUpdates++;
+    }
+
+    void SetGeometry(ID3D11Buffer* vertexBuffer, UINT, ID3D11Buffer*, DXGI_FORMAT, ID3D11Buffer*) override {
+        current.vertexBuffer = vertexBuffer;
+        stats.geometryChanges++;
+    }
+
+    void SetMaterials(ID3D11ShaderResourceView* materials) override {
+        current.materials = materials;
+        stats.materialChanges++;
+    }
+
+    void SetTexture(ID3D11ShaderResourceView* texture) override {
+        current.texture = texture;
+        stats.textureChanges++;
+    }
+
+    void SetSampler(ID3D11SamplerState*) override {
+        stats.samplerChanges++;
+    }
+
+    void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int baseVertex, uint32_t material) override {
+        current.indexCount = indexCount;
+        current.startIndex = startIndex;
+        current.baseVertex = baseVertex;
+        current.material = material;
+        draws.push_back(current);
+        stats.drawCalls++;
+    }
+
+    const std::vector<RecordedDraw>& GetDraws() const { return draws; }
+};
+
+class RenderCommandBuffer {
+private:
+    struct SortEntry {
+        uint64_t key;
+        uint32_t packet;
+    };
+
+    XMFLOAT4X4 view;
+    XMFLOAT4X4 proj;
+    std::vector<ShaderConstants> constants;
+    std::vector<DrawPacket> packets;
+    std::vector<SortEntry> order;   // Пакеты в порядке ключей после Sort
+    std::vector<SortEntry> scratch; // Второй буфер поразрядной сортировки
+    bool sorted = false;
+
+public:
+    // Начало кадра: пакеты прошлого кадра отбрасываются, ёмкость остаётся
+    void Begin(const XMMATRIX& viewMatrix, const XMMATRIX& projMatrix) {
+        XMStoreFloat4x4(&view, viewMatrix);
+        XMStoreFloat4x4(&proj, projMatrix);
+        constants.clear();
+        packets.clear();
+        order.clear();
+        sorted = false;
+    }
+
+    // Константы объекта с матрицами кадра; номер - для DrawPacket::constants
+    uint32_t AddConstants(const XMMATRIX& world) {
+        constants.push_back(ShaderConstants::Make(world, XMLoadFloat4x4(&view), XMLoadFloat4x4(&proj)));
+        return (uint32_t)constants.size() - 1;
+    }
+
+    void Submit(const DrawPacket& packet) {
+        if (!packet.pipeline || packet.indexCount == 0 || packet.constants >= constants.size()) return;
+        packets.push_back(packet);
+        sorted = false;
+    }
+
+    // LSD по байтам ключа: гистограммы всех восьми разрядов за один проход, разряд, в
+    // котором у всех пакетов одно значение, пропускается. Сортировка устойчива - пакеты
+    // с равными ключами идут в порядке Submit.
+    void Sort() {
+        if (sorted) return;
+        size_t count = packets.size();
+        order.resize(count);
+        scratch.resize(count);
+
+        uint32_t histograms[8][256] = {};
+        for (size_t i = 0; i < count; i++) {
+            uint64_t key = packets[i].key;
+            order[i] = { key, (uint32_t)i };
+            for (int digit = 0; digit < 8; digit++) {
+                histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+            }
+        }
+
+        for (int digit = 0; digit < 8 && count > 1; digit++) {
+            uint32_t* histogram = histograms[digit];
+            if (histogram[(order[0].key >> (digit * 8)) & 0xFF] == count) continue;
+
+            uint32_t offset = 0;
+            for (int value = 0; value < 256; value++) {
+                uint32_t bucket = histogram[value];
+                histogram[value] = offset;
+                offset += bucket;
+            }
+            for (const SortEntry& entry : order) {
+                scratch[histogram[(entry.key >> (digit * 8)) & 0xFF]++] = entry;
+            }
+            order.swap(scratch);
+        }
+        sorted = true;
+    }
+
+    // Проигрывание отсортированного списка: бэкенд получает только смены состояния
+    void Execute(RenderBackend& backend) {
+        Sort();
+        backend.Begin();
+
+        const RenderPipeline* pipeline = nullptr;
+        uint32_t boundConstants = UINT32_MAX;
+        DrawPacket geometry;
+        bool geometryBound = false;
+        ID3D11ShaderResourceView* materials = nullptr;
+        ID3D11ShaderResourceView* texture = nullptr;
+        ID3D11SamplerState* sampler = nullptr;
+
+        for (const SortEntry& entry : order) {
+            const DrawPacket& packet = packets[entry.packet];
+            if (packet.pipeline != pipeline) {
+                // Другой конвейер может держать свой константный буфер
+                if (!pipeline || packet.pipeline->constantBuffer != pipeline->constantBuffer) {
+                    boundConstants = UINT32_MAX;
+                }
+                pipeline = packet.pipeline;
+                backend.SetPipeline(*pipeline);
+            }
+            if (packet.constants != boundConstants) {
+                boundConstants = packet.constants;
+                backend.SetConstants(*pipeline, constants[packet.constants]);
+            }
+            if (!geometryBound || packet.vertexBuffer != geometry.vertexBuffer ||
+                packet.vertexStride != geometry.vertexStride ||
+                packet.indexBuffer != geometry.indexBuffer ||
+                packet.indexFormat != geometry.indexFormat ||
+                (packet.meshConstants && packet.meshConstants != geometry.meshConstants)) {
+                backend.SetGeometry(packet.vertexBuffer, packet.vertexStride,
+                    packet.indexBuffer, packet.indexFormat, packet.meshConstants);
+                geometry.vertexBuffer = packet.vertexBuffer;
+                geometry.vertexStride = packet.vertexStride;
+                geometry.indexBuffer = packet.indexBuffer;
+                geometry.indexFormat = packet.indexFormat;
+                if (packet.meshConstants) geometry.meshConstants = packet.meshConstants;
+                geometryBound = true;
+            }
+            if (packet.materials && packet.materials != materials) {
+                materials = packet.materials;
+                backend.SetMaterials(materials);
+            }
+            if (packet.texture && packet.texture != texture) {
+                texture = packet.texture;
+                backend.SetTexture(texture);
+            }
+            if (packet.sampler && packet.sampler != sampler) {
+                sampler = packet.sampler;
+                backend.SetSampler(sampler);
+            }
+            backend.DrawIndexed(packet.indexCount, packet.startIndex, packet.baseVertex, packet.material);
+        }
+    }
+
+    size_t GetPacketCount() const { return packets.size(); }
+
+    // Пакет по месту в отсортированном порядке (после Sort или Execute)
+    const DrawPacket& GetSortedPacket(size_t position) const { return packets[order[position].packet]; }
+};
+
+// ==================== САМОПРОВЕРКА ====================
+// thames-cook --selftest: проверки частей игры, которым не нужны окно и видеокарта.
+// Объекты D3D подменены счётчиками вызовов и ссылок, поэтому проверки идут и на Linux.
+#ifdef ASSET_COOKER
+#define SELFTEST_EXPECT(condition) SelfTest::Expect((condition), #condition, __LINE__)
+
+class SelfTest {
+public:
+    static bool Run() {
+        Counts& counts = GetCounts();
+        counts = Counts();
+        TestPipelineStateCache();
+        TestTextureStreamer();
+        TestTextureSlots();
+        TestRenderCommandBuffer();
+        TestVertexQuantizer();
+        TestObjParser();
+        TestObjParallel();
+        TestMeshOptimizer();
+        TestAssetIndex();
+
+        char buffer[256];
+        sprintf_s(buffer, "Самопроверка: проверок %d, провалено %d", counts.passed + counts.failed, counts.failed);
+        if (counts.failed == 0) {
+            DEBUG_SUCCESS(buffer);
+        }
+        else {
+            DEBUG_ERROR(buffer);
+        }
+        return counts.failed == 0;
+    }
+
+    static void Expect(bool passed, const char* expression, int line) {
+        if (passed) {
+            GetCounts().passed++;
+            return;
+        }
+        GetCounts().failed++;
+        char buffer[256];
+        sprintf_s(buffer, "Самопроверка, строка %d: %s", line, expression);
+        DEBUG_ERROR(buffer);
+    }
+
+private:
+    struct Counts {
+        int passed = 0;
+        int failed = 0;
+    };
+
+    static Counts& GetCounts() {
+        static Counts counts;
+        return counts;
+    }
+
+    // Объект состояния со своим счётчиком ссылок; live - живые объекты устройства
+    template<class Interface>
+    struct CountedState final : Interface {
+        int* live;
+        unsigned long references = 1;
+
+        explicit CountedState(int* live) : live(live) { (*live)++; }
+
+        unsigned long AddRef() override { return ++references; }
+
+        unsigned long Release() override {
+            unsigned long left = --references;
+            if (left == 0) {
+                (*live)--;
+                delete this;
+            }
+            return left;
+        }
+    };
+
+    template<class Interface>
+    static unsigned long GetReferences(Interface* state) {
+        return static_cast<CountedState<Interface>*>(state)->references;
+    }
+
+    struct CountingDevice final : ID3D11Device {
+        int createCalls = 0;
+        int live = 0;
+
+        HRESULT CreateSamplerState(const D3D11_SAMPLER_DESC*, ID3D11SamplerState** state) override {
+            createCalls++;
+            *state = new CountedState<ID3D11SamplerState>(&live);
+            return S_OK;
+        }
+
+        HRESULT CreateRasterizerState(const D3D11_RASTERIZER_DESC*, ID3D11RasterizerState** state) override {
+            createCalls++;
+            *state = new CountedState<ID3D11RasterizerState>(&live);
+            return S_OK;
+        }
+
+        HRESULT CreateBlendState(const D3D11_BLEND_DESC*, ID3D11BlendState** state) override {
+            createCalls++;
+            *state = new CountedState<ID3D11BlendState>(&live);
+            return S_OK;
+        }
+    };
+
+    // Одинаковые описания - один объект, ссылки сходятся после Release и Clear,
+    // разные устройства не делят объекты
+    static void TestPipelineStateCache() {
+        PipelineStateCache::Clear();
+        SELFTEST_EXPECT(PipelineStateCache::GetCount() == 0);
+
+        CountingDevice device;
+        D3D11_SAMPLER_DESC pointDesc = {};
+        pointDesc.Filter = 0;
+        pointDesc.AddressU = pointDesc.AddressV = pointDesc.AddressW = 1;
+        pointDesc.MaxLOD = FLT_MAX;
+        D3D11_SAMPLER_DESC linearDesc = pointDesc;
+        linearDesc.Filter = 0x15;
+
+        ID3D11SamplerState* first = nullptr;
+        ID3D11SamplerState* second = nullptr;
+        ID3D11SamplerState* linear = nullptr;
+        SELFTEST_EXPECT(SUCCEEDED(PipelineStateCache::GetSamplerState(&device, pointDesc, &first)));
+        SELFTEST_EXPECT(SUCCEEDED(PipelineStateCache::GetSamplerState(&device, pointDesc, &second)));
+        SELFTEST_EXPECT(SUCCEEDED(PipelineStateCache::GetSamplerState(&device, linearDesc, &linear)));
+        SELFTEST_EXPECT(first != nullptr && first == second);
+        SELFTEST_EXPECT(linear != nullptr && linear != first);
+        SELFTEST_EXPECT(device.createCalls == 2);
+
+        D3D11_RASTERIZER_DESC rasterizerDesc = {};
+        rasterizerDesc.FillMode = 3;
+        rasterizerDesc.CullMode = 3;
+        rasterizerDesc.DepthClipEnable = 1;
+        D3D11_BLEND_DESC blendDesc = {};
+        blendDesc.RenderTarget[0].BlendEnable = 1;
+        blendDesc.RenderTarget[0].RenderTargetWriteMask = 0x0F;
+        ID3D11RasterizerState* rasterizers[2] = {};
+        ID3D11BlendState* blends[2] = {};
+        for (int i = 0; i < 2; i++) {
+            SELFTEST_EXPECT(SUCCEEDED(PipelineStateCache::GetRasterizerState(&device, rasterizerDesc, &rasterizers[i])));
+            SELFTEST_EXPECT(SUCCEEDED(PipelineStateCache::GetBlendState(&device, blendDesc, &blends[i])));
+        }
+        SELFTEST_EXPECT(rasterizers[0] == rasterizers[1] && blends[0] == blends[1]);
+        SELFTEST_EXPECT(device.createCalls == 4);
+        SELFTEST_EXPECT(PipelineStateCache::GetCount() == 4);
+
+        // Каждый вызов - своя ссылка, плюс одна у кэша
+        SELFTEST_EXPECT(GetReferences(first) == 3);
+        SELFTEST_EXPECT(GetReferences(rasterizers[0]) == 3);
+        first->Release();
+        second->Release();
+        linear->Release();
+        for (int i = 0; i < 2; i++) {
+            rasterizers[i]->Release();
+            blends[i]->Release();
+        }
+        SELFTEST_EXPECT(device.live == 4);
+        SELFTEST_EXPECT(GetReferences(first) == 1);
+        SELFTEST_EXPECT(GetReferences(blends[0]) == 1);
+
+        // То же описание на другом устройстве - свой объект
+        CountingDevice otherDevice;
+        ID3D11SamplerState* other = nullptr;
+        SELFTEST_EXPECT(SUCCEEDED(PipelineStateCache::GetSamplerState(&otherDevice, pointDesc, &other)));
+        SELFTEST_EXPECT(other != nullptr && other != first);
+        SELFTEST_EXPECT(otherDevice.createCalls == 1 && device.createCalls == 4);
+        other->Release();
+
+        // Clear отдаёт последние ссылки - объекты уничтожаются
+        PipelineStateCache::Clear();
+        SELFTEST_EXPECT(PipelineStateCache::GetCount() == 0);
+        SELFTEST_EXPECT(device.live == 0 && otherDevice.live == 0);
+    }
+
+    // Исполнитель решений стримера: записывает вызовы, загрузку может завершить сразу
+    struct RecordingResidencyTarget final : TextureResidencyTarget {
+        TextureStreamer* streamer = nullptr;
+        bool completeLoads = true;
+        std::vector<std::pair<uint32_t, uint32_t>> loads;  // (текстура, верхний мип)
+        std::vector<std::pair<uint32_t, uint32_t>> evicts;
+
+        void LoadMips(uint32_t streamId, uint32_t topMip) override {
+            loads.push_back({ streamId, topMip });
+            if (completeLoads) streamer->OnMipsLoaded(streamId, topMip);
+        }
+
+        void EvictMips(uint32_t streamId, uint32_t topMip) override {
+            evicts.push_back({ streamId, topMip });
+        }
+    };
+
+    static uint64_t GetMipChainBytes(TextureFormat format, int width, int height, uint32_t topMip, uint32_t levelCount) {
+        uint64_t bytes = 0;
+        for (uint32_t level = topMip; level < levelCount; level++) {
+            bytes += BlockCompressor::GetLevelSize(format, std::max(1, width >> level), std::max(1, height >> level));
+        }
+        return bytes;
+    }
+
+    // Хвост мипов в памяти сразу, сильнее размытые грузятся первыми, по бюджету
+    // вытесняется давно не видимая текстура, счётчики кадра сбрасываются
+    static void TestTextureStreamer() {
+        const uint64_t fullBytes = GetMipChainBytes(TEXTURE_RGBA8, 1024, 1024, 0, 11);
+        const uint64_t tailBytes = GetMipChainBytes(TEXTURE_RGBA8, 1024, 1024, 4, 11);
+
+        // Хвост: верхний уровень не больше STREAM_MIN_RESIDENT_SIZE, у BC - кратный 4
+        {
+            RecordingResidencyTarget target;
+            TextureStreamer streamer;
+            target.streamer = &streamer;
+            streamer.Initialize(&target, fullBytes);
+            uint32_t rgba = streamer.Register(1024, 1024, TEXTURE_RGBA8, 11);
+            uint32_t bc = streamer.Register(96, 96, TEXTURE_BC1, 7);
+            uint32_t small = streamer.Register(32, 32, TEXTURE_BC3, 6);
+            SELFTEST_EXPECT(streamer.GetResidentMip(rgba) == 4);
+            SELFTEST_EXPECT(streamer.GetResidentMip(bc) == 1);
+            SELFTEST_EXPECT(streamer.GetResidentMip(small) == 0);
+
+            streamer.Update();
+            const TextureStreamStats& stats = streamer.GetStats();
+            SELFTEST_EXPECT(stats.streamedTextures == 3 && stats.requests == 0 && target.loads.empty());
+            SELFTEST_EXPECT(stats.residentBytes == tailBytes + GetMipChainBytes(TEXTURE_BC1, 96, 96, 1, 7) +
+                GetMipChainBytes(TEXTURE_BC3, 32, 32, 0, 6));
+
+            streamer.Unregister(small);
+            SELFTEST_EXPECT(streamer.GetResidentMip(small) == 0);
+            streamer.Update();
+            SELFTEST_EXPECT(streamer.GetStats().streamedTextures == 2);
+        }
+
+        // Порядок загрузок: больше недостающих уровней - раньше; счётчики - за кадр
+        {
+            RecordingResidencyTarget target;
+            TextureStreamer streamer;
+            target.streamer = &streamer;
+            target.completeLoads = false;
+            streamer.Initialize(&target, 4 * fullBytes);
+            uint32_t ids[3];
+            for (uint32_t& id : ids) id = streamer.Register(1024, 1024, TEXTURE_RGBA8, 11);
+            streamer.RequestScreenSize(ids[0], 512.0f);  // мип 1, не хватает трёх
+            streamer.RequestScreenSize(ids[1], 128.0f);  // мип 3, не хватает одного
+            streamer.RequestScreenSize(ids[2], 2048.0f); // мип 0, не хватает четырёх
+            streamer.RequestScreenSize(ids[1], 64.0f);   // меньший запрос того же кадра не мешает
+            streamer.Update();
+
+            SELFTEST_EXPECT(target.loads.size() == 3);
+            if (target.loads.size() == 3) {
+                SELFTEST_EXPECT(target.loads[0] == std::make_pair(ids[2], 0u));
+                SELFTEST_EXPECT(target.loads[1] == std::make_pair(ids[0], 1u));
+                SELFTEST_EXPECT(target.loads[2] == std::make_pair(ids[1], 3u));
+            }
+            uint64_t requested = fullBytes +
+                GetMipChainBytes(TEXTURE_RGBA8, 1024, 1024, 1, 11) + GetMipChainBytes(TEXTURE_RGBA8, 1024, 1024, 3, 11) - 3 * tailBytes;
+            const TextureStreamStats& stats = streamer.GetStats();
+            SELFTEST_EXPECT(stats.requests == 3 && stats.requestedBytes == requested);
+            SELFTEST_EXPECT(stats.pendingBytes == requested && stats.residentBytes == 3 * tailBytes);
+
+            // Пока грузится - повторно не просится
+            for (uint32_t id : ids) streamer.RequestScreenSize(id, 2048.0f);
+            streamer.Update();
+            SELFTEST_EXPECT(target.loads.size() == 3 && streamer.GetStats().requests == 0);
+            SELFTEST_EXPECT(streamer.GetStats().requestedBytes == 0);
+
+            for (const auto& load : target.loads) streamer.OnMipsLoaded(load.first, load.second);
+            streamer.Update();
+            SELFTEST_EXPECT(streamer.GetResidentMip(ids[2]) == 0 && streamer.GetResidentMip(ids[1]) == 3);
+            SELFTEST_EXPECT(streamer.GetStats().pendingBytes == 0 && streamer.GetStats().residentBytes == requested + 3 * tailBytes);
+        }
+
+        // Бюджет на полторы текстуры: вторая вытесняет уровни первой, невидимой в этом кадре
+        {
+            RecordingResidencyTarget target;
+            TextureStreamer streamer;
+            target.streamer = &streamer;
+            streamer.Initialize(&target, fullBytes * 3 / 2);
+            uint32_t first = streamer.Register(1024, 1024, TEXTURE_RGBA8, 11);
+            uint32_t second = streamer.Register(1024, 1024, TEXTURE_RGBA8, 11);
+
+            streamer.RequestScreenSize(first, 2048.0f);
+            streamer.Update();
+            SELFTEST_EXPECT(streamer.GetResidentMip(first) == 0 && target.evicts.empty());
+            SELFTEST_EXPECT(streamer.GetStats().evictions == 0);
+
+            streamer.RequestScreenSize(second, 2048.0f);
+            streamer.Update();
+            const TextureStreamStats& stats = streamer.GetStats();
+            SELFTEST_EXPECT(streamer.GetResidentMip(second) == 0);
+            SELFTEST_EXPECT(streamer.GetResidentMip(first) == 1);
+            SELFTEST_EXPECT(target.evicts.size() == 1 && target.evicts[0] == std::make_pair(first, 1u));
+            SELFTEST_EXPECT(stats.evictions == 1 && stats.requests == 1);
+            SELFTEST_EXPECT(stats.residentBytes <= stats.budgetBytes);
+
+            // Обе видимы и хотят всё - видимую не вытесняют, первая остаётся как есть
+            streamer.RequestScreenSize(first, 2048.0f);
+            streamer.RequestScreenSize(second, 2048.0f);
+            streamer.Update();
+            SELFTEST_EXPECT(streamer.GetResidentMip(first) == 1 && streamer.GetResidentMip(second) == 0);
+            SELFTEST_EXPECT(stats.evictions == 0 && stats.requests == 0 && target.evicts.size() == 1);
+        }
+    }
+
+    // Содержимое ячейки в проверке TextureSlotTable: объект устройства со своим счётчиком ссылок
+    struct StubTexture {
+        ID3D11SamplerState* state = nullptr;
+
+        void Cleanup() {
+            if (state) state->Release();
+            state = nullptr;
+        }
+    };
+
+    // Общий ключ - одна ячейка со счётчиком ссылок; освобождённая ячейка получает новое
+    // поколение, и старый дескриптор не находит текстуру, занявшую её; объект устройства
+    // освобождается через TEXTURE_RELEASE_DELAY_FRAMES кадров после последнего Release
+    static void TestTextureSlots() {
+        CountingDevice device;
+        auto create = [&device]() {
+            StubTexture texture;
+            D3D11_SAMPLER_DESC desc = {};
+            device.CreateSamplerState(&desc, &texture.state);
+            return texture;
+        };
+
+        TextureSlotTable<StubTexture> slots;
+        DeferredReleaseQueue<StubTexture> releases;
+        TextureHandle brick = slots.Add(L"brick.png", create());
+        SELFTEST_EXPECT(brick.IsValid() && slots.AcquireExisting(L"brick.png") == brick);
+        SELFTEST_EXPECT(slots.AddRef(brick) == brick && slots.Find(brick)->refCount == 3);
+        SELFTEST_EXPECT(!slots.AcquireExisting(L"slate.png").IsValid());
+
+        StubTexture released;
+        uint64_t frame = 0;
+        SELFTEST_EXPECT(!slots.Release(brick, released) && !slots.Release(brick, released));
+        SELFTEST_EXPECT(slots.Find(brick) != nullptr && released.state == nullptr);
+        SELFTEST_EXPECT(slots.Release(brick, released) && released.state != nullptr);
+        releases.Push(released, frame);
+        SELFTEST_EXPECT(slots.Find(brick) == nullptr && !slots.FindKey(L"brick.png").IsValid());
+        SELFTEST_EXPECT(slots.GetLiveCount() == 0);
+
+        TextureHandle slate = slots.Add(L"slate.png", create());
+        SELFTEST_EXPECT(slate.index == brick.index && slate.generation != brick.generation);
+        SELFTEST_EXPECT(slots.Find(brick) == nullptr && !slots.AddRef(brick).IsValid());
+        SELFTEST_EXPECT(!slots.Release(brick, released));
+        SELFTEST_EXPECT(slots.Find(slate) != nullptr && slots.Find(slate)->refCount == 1);
+
+        // Освобождённый объект живёт, пока его может читать очередь команд
+        for (frame = 1; frame < TEXTURE_RELEASE_DELAY_FRAMES; frame++) {
+            releases.Collect(frame);
+        }
+        SELFTEST_EXPECT(device.live == 2 && releases.GetCount() == 1);
+        releases.Collect(frame);
+        SELFTEST_EXPECT(device.live == 1 && releases.GetCount() == 0);
+
+        slots.Clear();
+        SELFTEST_EXPECT(device.live == 0 && slots.Find(slate) == nullptr);
+    }
+
+    // Ресурсы в проверках командного буфера только сравниваются - хватает различимых адресов
+    template<class Resource>
+    static Resource* FakeResource(size_t index) {
+        static char storage[64];
+        return reinterpret_cast<Resource*>(&storage[index]);
+    }
+
+    // Слои по порядку, в прозрачном - сзади наперёд, равные ключи - в порядке Submit,
+    // повторные привязки не доходят до бэкенда, поразрядная сортировка совпадает с устойчивой
+    static void TestRenderCommandBuffer() {
+        SELFTEST_EXPECT(RenderSortKey::Make(RENDER_LAYER_BACKGROUND, 255, 4095, 65535, 1e9f) <
+            RenderSortKey::Make(RENDER_LAYER_WORLD, 0, 0, 0, 0.0f));
+        SELFTEST_EXPECT(RenderSortKey::Make(RENDER_LAYER_WORLD, 1, 1, 1, 1.0f) < RenderSortKey::Make(RENDER_LAYER_WORLD, 1, 1, 1, 2.0f));
+        SELFTEST_EXPECT(RenderSortKey::Make(RENDER_LAYER_TRANSPARENT, 1, 1, 1, 1.0f) > RenderSortKey::Make(RENDER_LAYER_TRANSPARENT, 1, 1, 1, 2.0f));
+        SELFTEST_EXPECT(RenderSortKey::Make(RENDER_LAYER_WORLD, 1, 1, 1, -5.0f) == RenderSortKey::Make(RENDER_LAYER_WORLD, 1, 1, 1, 0.0f));
+        SELFTEST_EXPECT(RenderSortKey::GetLayer(RenderSortKey::Make(RENDER_LAYER_TRANSPARENT, 255, 4095, 65535, 1.0f)) == RENDER_LAYER_TRANSPARENT);
+
+        XMMATRIX identity = XMMatrixIdentity();
+        RenderPipeline opaque;
+        opaque.id = 1;
+        opaque.constantBuffer = FakeResource<ID3D11Buffer>(0);
+        RenderPipeline packed = opaque;
+        packed.id = 2;
+
+        RenderCommandBuffer buffer;
+        RecordingRenderBackend backend;
+        auto makePacket = [&](const RenderPipeline& pipeline, uint32_t constants, uint32_t startIndex, uint64_t key) {
+            DrawPacket packet;
+            packet.key = key;
+            packet.pipeline = &pipeline;
+            packet.vertexBuffer = FakeResource<ID3D11Buffer>(1);
+            packet.indexBuffer = FakeResource<ID3D11Buffer>(2);
+            packet.vertexStride = 32;
+            packet.constants = constants;
+            packet.indexCount = 3;
+            packet.startIndex = startIndex;
+            return packet;
+        };
+
+        // Слои и глубина: пакеты поданы вперемешку, номер пакета - в startIndex
+        buffer.Begin(identity, identity);
+        uint32_t constants = buffer.AddConstants(identity);
+        const uint32_t layers[6] = { RENDER_LAYER_TRANSPARENT, RENDER_LAYER_WORLD, RENDER_LAYER_TRANSPARENT,
+            RENDER_LAYER_BACKGROUND, RENDER_LAYER_WORLD, RENDER_LAYER_TRANSPARENT };
+        const float depths[6] = { 1.0f, 5.0f, 3.0f, 9.0f, 1.0f, 2.0f };
+        for (uint32_t i = 0; i < 6; i++) {
+            buffer.Submit(makePacket(opaque, constants, i, RenderSortKey::Make(layers[i], 1, 0, 0, depths[i])));
+        }
+        buffer.Execute(backend);
+        const uint32_t expectedOrder[6] = { 3, 4, 1, 2, 5, 0 };
+        const std::vector<RecordingRenderBackend::RecordedDraw>& draws = backend.GetDraws();
+        SELFTEST_EXPECT(draws.size() == 6);
+        for (uint32_t i = 0; i < 6 && i < draws.size(); i++) {
+            SELFTEST_EXPECT(draws[i].startIndex == expectedOrder[i]);
+            SELFTEST_EXPECT(buffer.GetSortedPacket(i).startIndex == expectedOrder[i]);
+        }
+        for (uint32_t i = 1; i < 6; i++) {
+            SELFTEST_EXPECT(RenderSortKey::GetLayer(buffer.GetSortedPacket(i - 1).key) <=
+                RenderSortKey::GetLayer(buffer.GetSortedPacket(i).key));
+        }
+
+        // Два конвейера с общим буфером констант, текстуры чередуются: сортировка собирает
+        // пакеты по конвейеру и текстуре, остальное привязывается один раз
+        buffer.Begin(identity, identity);
+        constants = buffer.AddConstants(identity);
+        for (uint32_t i = 0; i < 8; i++) {
+            const RenderPipeline& pipeline = (i & 2) ? packed : opaque;
+            DrawPacket packet = makePacket(pipeline, constants, i * 3,
+                RenderSortKey::Make(RENDER_LAYER_WORLD, pipeline.id, 1, i & 1, 1.0f));
+            packet.materials = FakeResource<ID3D11ShaderResourceView>(8);
+            packet.texture = FakeResource<ID3D11ShaderResourceView>(10 + (i & 1));
+            packet.sampler = FakeResource<ID3D11SamplerState>(16);
+            buffer.Submit(packet);
+        }
+        DrawPacket invalid = makePacket(opaque, constants + 1, 0, 0); // Нет таких констант
+        buffer.Submit(invalid);
+        invalid.pipeline = nullptr;
+        invalid.constants = constants;
+        buffer.Submit(invalid);
+        SELFTEST_EXPECT(buffer.GetPacketCount() == 8);
+
+        buffer.Execute(backend);
+        const RenderStats& stats = backend.GetStats();
+        SELFTEST_EXPECT(stats.drawCalls == 8 && stats.pipelineChanges == 2 && stats.constantUpdates == 1);
+        SELFTEST_EXPECT(stats.geometryChanges == 1 && stats.materialChanges == 1 && stats.samplerChanges == 1);
+        SELFTEST_EXPECT(stats.textureChanges == 4);
+        // Равные ключи - в порядке Submit: пакеты 0 и 4, затем 1 и 5
+        SELFTEST_EXPECT(draws.size() == 8);
+        if (draws.size() == 8) {
+            SELFTEST_EXPECT(draws[0].pipeline == 1 && draws[0].startIndex == 0 && draws[1].startIndex == 12);
+            SELFTEST_EXPECT(draws[2].startIndex == 3 && draws[3].startIndex == 15);
+            SELFTEST_EXPECT(draws[4].pipeline == 2 && draws[4].startIndex == 6);
+        }
+
+        // Повторное проигрывание считает заново
+        buffer.Execute(backend);
+        SELFTEST_EXPECT(backend.GetStats().drawCalls == 8 && backend.GetStats().textureChanges == 4);
+
+        // Пустая текстура оставляет привязанную ранее
+        buffer.Begin(identity, identity);
+        constants = buffer.AddConstants(identity);
+        for (uint32_t i = 0; i < 3; i++) {
+            DrawPacket packet = makePacket(opaque, constants, i, i);
+            packet.texture = (i == 1) ? nullptr : FakeResource<ID3D11ShaderResourceView>(10);
+            buffer.Submit(packet);
+        }
+        buffer.Execute(backend);
+        SELFTEST_EXPECT(backend.GetStats().textureChanges == 1);
+        SELFTEST_EXPECT(draws.size() == 3 && draws[1].texture == FakeResource<ID3D11ShaderResourceView>(10));
+
+        // Поразрядная сортировка против std::stable_sort: случайные ключи, ключи с общими
+        // старшими байтами (пропуск разрядов) и с частыми повторами
+        uint64_t random = 0x9E3779B97F4A7C15ull;
+        auto next = [&random]() {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            return random;
+        };
+        bool matches = true;
+        for (uint32_t batch = 0; batch < 60 && matches; batch++) {
+            buffer.Begin(identity, identity);
+            constants = buffer.AddConstants(identity);
+            uint32_t count = (uint32_t)(next() % 300);
+            std::vector<std::pair<uint64_t, uint32_t>> expected;
+            for (uint32_t i = 0; i < count; i++) {
+                uint64_t key = next();
+                if (batch % 3 == 0) key &= 0xFF00FF;
+                if (batch % 3 == 1) key |= 0xFFFF000000000000ull;
+                buffer.Submit(makePacket(opaque, constants, i, key));
+                expected.push_back({ key, i });
+            }
+            std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) {
+                return a.first < b.first;
+            });
+            buffer.Sort();
+            for (uint32_t i = 0; i < count && matches; i++) {
+                matches = buffer.GetSortedPacket(i).startIndex == expected[i].second;
+            }
+        }
+        SELFTEST_EXPECT(matches);
+    }
+
+    // Ошибка кодирования и декодирования вершин не выходит за теоретическую границу:
+    // случайные вершины, нормали вдоль осей и в нижней полусфере, UV за пределами [0, 1],
+    // цвета вне диапазона и плоский меш (нулевой размер AABB по оси)
+    static void TestVertexQuantizer() {
+        uint64_t random = 0xD1B54A32D192ED03ull;
+        auto next = [&random]() {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            return (float)(random >> 40) / 16777216.0f;
+        };
+
+        std::vector<Vertex> vertices;
+        for (int i = 0; i < 4096; i++) {
+            vertices.emplace_back(
+                next() * 200.0f - 50.0f, next() * 30.0f, next() * 800.0f - 400.0f,
+                next() * 2.0f - 1.0f, next() * 2.0f - 1.0f, next() * 2.0f - 1.0f,
+                next() * 6.0f - 2.0f, next() * 6.0f - 2.0f,
+                next() * 1.4f - 0.2f, next(), next());
+        }
+        const float axes[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+        for (const auto& axis : axes) {
+            vertices.emplace_back(0.0f, 0.0f, 0.0f, axis[0], axis[1], axis[2], 0.5f, 0.5f, 1.0f, 1.0f, 1.0f);
+        }
+
+        uint32_t count = (uint32_t)vertices.size();
+        PackedMeshParams params = VertexQuantizer::ComputeParams(vertices.data(), count);
+        QuantizationError error = VertexQuantizer::MeasureError(vertices.data(), count, params);
+        QuantizationError bound = VertexQuantizer::GetErrorBound(vertices.data(), count, params);
+        SELFTEST_EXPECT(VertexQuantizer::IsWithinBound(error, bound));
+        SELFTEST_EXPECT(error.position > 0.0f && error.normalDegrees > 0.0f);
+
+        // EncodeMesh кодирует так же, как Encode по одной вершине
+        std::vector<PackedVertex> packed;
+        VertexQuantizer::EncodeMesh(vertices.data(), count, params, packed);
+        bool same = packed.size() == count;
+        for (uint32_t i = 0; i < count && same; i++) {
+            PackedVertex single = VertexQuantizer::Encode(vertices[i], params);
+            same = memcmp(&single, &packed[i], sizeof(PackedVertex)) == 0;
+        }
+        SELFTEST_EXPECT(same);
+
+        // Плоский меш: по нулевой оси позиция восстанавливается точно
+        std::vector<Vertex> flat(vertices.begin(), vertices.begin() + 64);
+        for (Vertex& vertex : flat) {
+            vertex.position.y = 2.5f;
+        }
+        params = VertexQuantizer::ComputeParams(flat.data(), (uint32_t)flat.size());
+        error = VertexQuantizer::MeasureError(flat.data(), (uint32_t)flat.size(), params);
+        bound = VertexQuantizer::GetErrorBound(flat.data(), (uint32_t)flat.size(), params);
+        SELFTEST_EXPECT(VertexQuantizer::IsWithinBound(error, bound));
+        Vertex decoded = VertexQuantizer::Decode(VertexQuantizer::Encode(flat[0], params), params);
+        SELFTEST_EXPECT(decoded.position.y == 2.5f);
+    }
+
+    // Папка для временных файлов проверок; удаляется целиком после проверки
+    static std::filesystem::path GetScratchFolder() {
+        std::error_code error;
+        std::filesystem::path folder = std::filesystem::temp_directory_path(error) / "thames-selftest";
+        std::filesystem::create_directories(folder, error);
+        return folder;
+    }
+
+    static bool WriteTextFile(const std::filesystem::path& path, const std::string& text) {
+        std::ofstream out(path, std::ios::binary);
+        out.write(text.data(), (std::streamsize)text.size());
+        return (bool)out;
+    }
+
+    // Тестовый OBJ: атрибуты вперемешку с гранями, n-угольники, все формы "p/t/n",
+    // отрицательные индексы, CRLF, табы, комментарии, "+" и экспонента в числах,
+    // повторный и пустой usemtl
+    static std::string MakeTestObj(const char* mtlFile, int blockCount) {
+        uint64_t random = 0x2545F4914F6CDD1Dull;
+        auto next = [&random](uint32_t range) {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            return (uint32_t)(random >> 32) % range;
+        };
+        auto number = [&next](char* out, size_t size) {
+            int value = (int)next(20001) - 10000;
+            switch (next(4)) {
+            case 0: sprintf_s(out, size, "%.2f", value / 100.0); break;
+            case 1: sprintf_s(out, size, "%+d.5", value / 100); break;
+            case 2: sprintf_s(out, size, "%de-3", value); break;
+            default: sprintf_s(out, size, "%.6g", value / 7.0); break;
+            }
+        };
+        const char* materials[] = { "brick", "slate", "brass" };
+
+        std::string text = "# thames-cook --selftest\nmtllib ";
+        text += mtlFile;
+        text += "\n";
+
+        char line[256];
+        char x[32], y[32], z[32];
+        int attributes = 0;
+        for (int block = 0; block < blockCount; block++) {
+            if (block % 37 == 36) {
+                sprintf_s(line, "usemtl %s\n", (block % 111 == 110) ? "" : materials[next(3)]);
+                text += line;
+            }
+
+            for (uint32_t i = 0, count = 1 + next(4); i < count; i++, attributes++) {
+                number(x, sizeof(x)); number(y, sizeof(y)); number(z, sizeof(z));
+                sprintf_s(line, "v %s %s\t%s\n", x, y, z);
+                text += line;
+                number(x, sizeof(x)); number(y, sizeof(y));
+                sprintf_s(line, "vt %s %s\r\n", x, y);
+                text += line;
+                number(x, sizeof(x)); number(y, sizeof(y)); number(z, sizeof(z));
+                sprintf_s(line, "vn %s %s %s\n", x, y, z);
+                text += line;
+            }
+
+            if (block % 5 == 0) {
+                text += "# comment\n\n";
+            }
+
+            for (uint32_t face = 0, faces = 1 + next(3); face < faces; face++) {
+                text += "f";
+                for (uint32_t corner = 0, corners = 3 + next(4); corner < corners; corner++) {
+                    int back = 1 + (int)next((uint32_t)std::min(attributes, 12));
+                    int index = next(2) ? attributes - back + 1 : -back;
+                    switch (next(4)) {
+                    case 0: sprintf_s(line, " %d/%d/%d", index, index, index); break;
+                    case 1: sprintf_s(line, " %d//%d", index, index); break;
+                    case 2: sprintf_s(line, "\t%d/%d", index, index); break;
+                    default: sprintf_s(line, " %d", index); break;
+                    }
+                    text += line;
+                }
+                text += next(2) ? "\r\n" : "\n";
+            }
+        }
+        return text;
+    }
+
+    struct ObjCorner {
+        int position;
+        int texcoord;
+        int normal;
+
+        bool operator<(const ObjCorner& other) const {
+            if (position != other.position) return position < other.position;
+            if (texcoord != other.texcoord) return texcoord < other.texcoord;
+            return normal < other.normal;
+        }
+    };
+
+    // Прежний разбор OBJ (getline, istringstream на строку, stoi на индекс). Сборка мешей -
+    // как у OBJLoader сейчас: меш на материал, отрицательные индексы, белый цвет вершин
+    static void ParseObjReference(const std::string& text, std::vector<Mesh>& meshes) {
+        std::vector<XMFLOAT3> positions;
+        std::vector<XMFLOAT3> normals;
+        std::vector<XMFLOAT2> texcoords;
+        std::vector<Mesh> groups(1);
+        std::vector<std::map<ObjCorner, uint32_t>> caches(1);
+        std::unordered_map<NameId, size_t> groupByMaterial = { { 0, 0 } };
+        size_t current = 0;
+
+        std::istringstream file(text);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream iss(line);
+            std::string prefix;
+            iss >> prefix;
+
+            if (prefix == "v") {
+                XMFLOAT3 pos;
+                iss >> pos.x >> pos.y >> pos.z;
+                positions.push_back(pos);
+            }
+            else if (prefix == "vn") {
+                XMFLOAT3 norm;
+                iss >> norm.x >> norm.y >> norm.z;
+                normals.push_back(norm);
+            }
+            else if (prefix == "vt") {
+                XMFLOAT2 tex;
+                iss >> tex.x >> tex.y;
+                tex.y = 1.0f - tex.y;
+                texcoords.push_back(tex);
+            }
+            else if (prefix == "f") {
+                std::vector<ObjCorner> corners;
+                std::string vert;
+                while (iss >> vert) {
+                    int sizes[3] = { (int)positions.size(), (int)texcoords.size(), (int)normals.size() };
+                    int indices[3] = { -1, -1, -1 };
+                    std::istringstream fss(vert);
+                    std::string token;
+                    for (int idx = 0; idx < 3 && std::getline(fss, token, '/'); idx++) {
+                        if (token.empty()) continue;
+                        int value = std::stoi(token);
+                        indices[idx] = (value > 0) ? value - 1 : (value < 0) ? sizes[idx] + value : -1;
+                    }
+                    corners.push_back({ indices[0], indices[1], indices[2] });
+                }
+                if (corners.size() < 3) continue;
+
+                Mesh& mesh = groups[current];
+                for (size_t i = 1; i + 1 < corners.size(); i++) {
+                    for (const ObjCorner& corner : { corners[0], corners[i], corners[i + 1] }) {
+                        auto cached = caches[current].emplace(corner, (uint32_t)mesh.vertices.size());
+                        if (cached.second) {
+                            Vertex vertex;
+                            if (corner.position >= 0 && corner.position < (int)positions.size()) vertex.position = positions[corner.position];
+                            if (corner.texcoord >= 0 && corner.texcoord < (int)texcoords.size()) vertex.texcoord = texcoords[corner.texcoord];
+                            if (corner.normal >= 0 && corner.normal < (int)normals.size()) vertex.normal = normals[corner.normal];
+                            mesh.vertices.push_back(vertex);
+                        }
+                        mesh.indices.push_back(cached.first->second);
+                    }
+                }
+            }
+            else if (prefix == "usemtl") {
+                std::string name;
+                iss >> name;
+                NameId materialId = name.empty() ? groups[current].materialId : NameRegistry::Intern(name);
+                auto found = groupByMaterial.find(materialId);
+                if (found == groupByMaterial.end()) {
+                    groups.emplace_back();
+                    groups.back().materialId = materialId;
+                    caches.emplace_back();
+                    found = groupByMaterial.emplace(materialId, groups.size() - 1).first;
+                }
+                current = found->second;
+            }
+        }
+
+        for (Mesh& mesh : groups) {
+            if (!mesh.vertices.empty()) {
+                meshes.push_back(std::move(mesh));
+            }
+        }
+    }
+
+    static bool SameMeshes(const std::vector<Mesh>& a, const std::vector<Mesh>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].materialId != b[i].materialId || a[i].indices != b[i].indices ||
+                a[i].vertices.size() != b[i].vertices.size()) {
+                return false;
+            }
+            if (memcmp(a[i].vertices.data(), b[i].vertices.data(), a[i].vertices.size() * sizeof(Vertex)) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Разбор на месте из отображённого файла совпадает с прежним построчным до бита;
+    // MTL читается с теми же значениями
+    static void TestObjParser() {
+        std::filesystem::path folder = GetScratchFolder();
+        std::string text = MakeTestObj("selftest.mtl", 400);
+        SELFTEST_EXPECT(WriteTextFile(folder / "selftest.obj", text));
+        SELFTEST_EXPECT(WriteTextFile(folder / "selftest.mtl",
+            "newmtl brick\r\nKd 0.5 +0.25 1e-1\nNs\t64\nd 0.75\nmap_Kd brick.png\n"
+            "newmtl slate\nKa 0.1 0.2 0.3\nnewmtl brass\n"));
+
+        std::vector<Mesh> expected;
+        ParseObjReference(text, expected);
+
+        std::vector<Mesh> meshes;
+        MaterialTable materials;
+        OBJLoadOptions options;
+        options.threadCount = 1;
+        SELFTEST_EXPECT(OBJLoader::Load(FileSystemHelper::FromPath(folder / "selftest.obj"), meshes, materials, options));
+        SELFTEST_EXPECT(expected.size() == 4);
+        SELFTEST_EXPECT(SameMeshes(meshes, expected));
+
+        const Material* brick = materials.Get(materials.Find(NameRegistry::Intern("brick")));
+        SELFTEST_EXPECT(materials.Size() == 3 && brick != nullptr);
+        SELFTEST_EXPECT(brick && brick->diffuse.x == 0.5f && brick->diffuse.y == 0.25f && brick->diffuse.z == 0.1f);
+        SELFTEST_EXPECT(brick && brick->shininess == 64.0f && brick->alpha == 0.75f && brick->textureFilename == "brick.png");
+
+        std::error_code error;
+        std::filesystem::remove_all(folder, error);
+    }
+
+    // ParallelFor вызывает каждый индекс ровно один раз; разбор OBJ кусками в N потоков
+    // даёт те же меши, что и в один поток (границы кусков режут группы материалов
+    // и отрицательные индексы ссылаются на вершины из предыдущих кусков)
+    static void TestObjParallel() {
+        std::vector<std::atomic<int>> visits(1000);
+        for (unsigned threads : { 1u, 3u, 8u }) {
+            for (auto& visit : visits) visit = 0;
+            ParallelFor(visits.size(), threads, [&](size_t i) { visits[i]++; });
+            SELFTEST_EXPECT(std::all_of(visits.begin(), visits.end(), [](const std::atomic<int>& visit) { return visit == 1; }));
+        }
+
+        std::filesystem::path folder = GetScratchFolder();
+        SELFTEST_EXPECT(WriteTextFile(folder / "selftest.obj", MakeTestObj("selftest.mtl", 3000)));
+        SELFTEST_EXPECT(WriteTextFile(folder / "selftest.mtl", "newmtl brick\nnewmtl slate\n"));
+        std::wstring path = FileSystemHelper::FromPath(folder / "selftest.obj");
+
+        std::vector<Mesh> expected;
+        MaterialTable materials;
+        OBJLoadOptions options;
+        options.threadCount = 1;
+        SELFTEST_EXPECT(OBJLoader::Load(path, expected, materials, options));
+
+        for (unsigned threads : { 2u, 3u, 8u }) {
+            std::vector<Mesh> meshes;
+            options.threadCount = threads;
+            options.minChunkBytes = 1;
+            SELFTEST_EXPECT(OBJLoader::Load(path, meshes, materials, options));
+            SELFTEST_EXPECT(SameMeshes(meshes, expected));
+        }
+
+        std::error_code error;
+        std::filesystem::remove_all(folder, error);
+    }
+
+    // Треугольники меша по позициям вершин, с поворотом к наименьшей вершине (обход сохраняется)
+    static std::vector<std::vector<float>> GetTriangles(const Mesh& mesh) {
+        std::vector<std::vector<float>> triangles;
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            std::vector<float> corners;
+            for (size_t c = 0; c < 3; c++) {
+                const XMFLOAT3& p = mesh.vertices[mesh.indices[i + c]].position;
+                corners.insert(corners.end(), { p.x, p.y, p.z });
+            }
+            size_t first = 0;
+            for (size_t c = 1; c < 3; c++) {
+                if (std::lexicographical_compare(corners.begin() + c * 3, corners.begin() + c * 3 + 3,
+                    corners.begin() + first * 3, corners.begin() + first * 3 + 3)) {
+                    first = c;
+                }
+            }
+            std::rotate(corners.begin(), corners.begin() + first * 3, corners.end());
+            triangles.push_back(std::move(corners));
+        }
+        std::sort(triangles.begin(), triangles.end());
+        return triangles;
+    }
+
+    // Перемешанная сетка после MeshOptimizer: ACMR и ATVR лучше, набор треугольников
+    // и их обход те же, вершины пронумерованы по первому использованию
+    static void TestMeshOptimizer() {
+        const uint32_t side = 48;
+        Mesh mesh;
+        for (uint32_t y = 0; y <= side; y++) {
+            for (uint32_t x = 0; x <= side; x++) {
+                mesh.vertices.emplace_back((float)x, (float)y, 0.0f, 0.0f, 0.0f, 1.0f,
+                    x / (float)side, y / (float)side, 1.0f, 1.0f, 1.0f);
+            }
+        }
+
+        std::vector<uint32_t> quads(side * side);
+        for (uint32_t i = 0; i < quads.size(); i++) quads[i] = i;
+        uint64_t random = 0x94D049BB133111EBull;
+        for (size_t i = quads.size() - 1; i > 0; i--) {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            std::swap(quads[i], quads[random % (i + 1)]);
+        }
+        for (uint32_t quad : quads) {
+            uint32_t corner = quad / side * (side + 1) + quad % side;
+            mesh.indices.insert(mesh.indices.end(), { corner, corner + 1, corner + side + 2 });
+            mesh.indices.insert(mesh.indices.end(), { corner, corner + side + 2, corner + side + 1 });
+        }
+
+        std::vector<std::vector<float>> triangles = GetTriangles(mesh);
+        VertexCacheStats before = MeshOptimizer::AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+        MeshOptimizer::Optimize(mesh);
+        VertexCacheStats after = MeshOptimizer::AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+
+        SELFTEST_EXPECT(after.acmr < before.acmr * 0.5f);
+        SELFTEST_EXPECT(after.acmr < 1.0f);
+        SELFTEST_EXPECT(after.atvr < before.atvr);
+        SELFTEST_EXPECT(mesh.vertices.size() == (side + 1) * (side + 1));
+        SELFTEST_EXPECT(GetTriangles(mesh) == triangles);
+
+        uint32_t nextNew = 0;
+        bool fetchOrder = true;
+        for (uint32_t index : mesh.indices) {
+            if (index > nextNew) fetchOrder = false;
+            if (index == nextNew) nextNew++;
+        }
+        SELFTEST_EXPECT(fetchOrder);
+    }
+
+    // Каталог ассетов на POSIX-бэкенде (корень - рабочая папка): регистр и разделители
+    // не важны, промах запоминается до Invalidate или Update, новые папки и удалённые
+    // файлы приходят событиями FileWatcher, Rebuild забывает всё
+    static void TestAssetIndex() {
+        std::error_code error;
+        std::filesystem::path folder = GetScratchFolder() / "assets";
+        std::filesystem::create_directories(folder / "Textures", error);
+        SELFTEST_EXPECT(WriteTextFile(folder / "Textures" / "Brick.PNG", "png"));
+
+        std::filesystem::path workingFolder = std::filesystem::current_path(error);
+        std::filesystem::current_path(folder, error);
+        SELFTEST_EXPECT(!error);
+        AssetIndex::Rebuild();
+
+        const std::vector<std::wstring> images = { L"", L".png" };
+        const std::vector<std::wstring> models = { L".obj" };
+        std::wstring brick = AssetIndex::Find(L"textures\\BRICK", images, false);
+        SELFTEST_EXPECT(brick.size() >= 18 && brick.compare(brick.size() - 18, 18, L"Textures/Brick.PNG") == 0);
+
+        SELFTEST_EXPECT(AssetIndex::Find(L"textures/slate", images, false).empty());
+        SELFTEST_EXPECT(AssetIndex::GetLookupCount() == 2);
+        SELFTEST_EXPECT(WriteTextFile(folder / "Textures" / "slate.png", "png"));
+        SELFTEST_EXPECT(AssetIndex::Find(L"textures/slate", images, false).empty());
+        AssetIndex::Invalidate(L"Textures/slate.png");
+        SELFTEST_EXPECT(!AssetIndex::Find(L"textures/slate", images, false).empty());
+
+        SELFTEST_EXPECT(AssetIndex::Find(L"models/crate", models, false).empty());
+        std::filesystem::create_directories(folder / "Models", error);
+        SELFTEST_EXPECT(WriteTextFile(folder / "Models" / "crate.obj", "v 0 0 0\n"));
+        std::filesystem::remove(folder / "Textures" / "Brick.PNG", error);
+        SELFTEST_EXPECT(AssetIndex::Find(L"models/crate", models, false).empty());
+        SELFTEST_EXPECT(AssetIndex::Find(L"textures/brick", images, false) == brick);
+
+        // Как в thames-cook --watch: пауза опроса, затем события
+        std::this_thread::sleep_for(std::chrono::milliseconds(FileWatcher::POLL_INTERVAL_MS));
+        AssetIndex::Update();
+        SELFTEST_EXPECT(AssetIndex::GetLookupCount() == 0);
+        SELFTEST_EXPECT(!AssetIndex::Find(L"models/crate", models, false).empty());
+        SELFTEST_EXPECT(AssetIndex::Find(L"textures/brick", images, false).empty());
+
+        std::filesystem::remove(folder / "Textures" / "slate.png", error);
+        AssetIndex::Rebuild();
+        SELFTEST_EXPECT(AssetIndex::Find(L"textures/slate", images, false).empty());
+
+        std::filesystem::current_path(workingFolder, error);
+        AssetIndex::Rebuild();
+        std::filesystem::remove_all(GetScratchFolder(), error);
+    }
+};
+#endif
+
+// ==================== ПОДГОТОВКА АССЕТОВ ====================
+// "Готовка" меша: разбор исходника, оптимизация, LOD и кластеры - результат пишется
+// в MeshCache рядом с исходником. Игра грузит только готовые .meshcache; готовить
+// из исходника на старте она может лишь при ALLOW_SOURCE_ASSETS (отладочная сборка).
+// Сборка с ASSET_COOKER - консольный кукер без графики: готовит OBJ/MTL и через
+// Assimp FBX и другие форматы (со скелетом) параллельно по файлам, пропуская те,
+// у которых не изменилось содержимое исходников.
+#ifdef _DEBUG
+const bool ALLOW_SOURCE_ASSETS = true;
+#else
+const bool ALLOW_SOURCE_ASSETS = false;
+#endif
+
+class AssetCooker {
+public:
+    // Оптимизация порядка до LOD: уровни строятся из уже оптимизированного LOD 0
+    static void ProcessMeshes(std::vector<Mesh>& meshes, unsigned threadCount) {
+        if (!OPTIMIZE_MESHES_ON_LOAD && !GENERATE_MESH_LODS && !BUILD_MESHLETS) return;
+
+        ParallelFor(meshes.size(), GetWorkerThreadCount(threadCount), [&](size_t i) {
+            if (OPTIMIZE_MESHES_ON_LOAD) MeshOptimizer::Optimize(meshes[i]);
+            if (GENERATE_MESH_LODS) MeshSimplifier::BuildLods(meshes[i]);
+            if (BUILD_MESHLETS) MeshletBuilder::Build(meshes[i]);
+        });
+    }
+
+    // Разбирает исходник и обрабатывает меши; sources - все прочитанные файлы (для кэша)
+    static bool LoadAndProcess(const std::wstring& sourcePath,
+        std::vector<Mesh>& meshes,
+        MaterialTable& materials,
+        std::vector<Bone>& bones,
+        std::vector<std::wstring>& sources,
+        unsigned threadCount) {
+
+        sources = { sourcePath };
+        if (IsObjFile(sourcePath)) {
+            OBJLoadOptions options;
+            options.threadCount = threadCount;
+            std::vector<std::wstring> mtlPaths;
+            if (!OBJLoader::Load(sourcePath, meshes, materials, options, &mtlPaths)) return false;
+            sources.insert(sources.end(), mtlPaths.begin(), mtlPaths.end());
+        }
+        else {
+#ifdef ASSET_COOKER
+            if (!ImportScene(sourcePath, meshes, materials, bones)) return false;
+#else
+            DEBUG_WARNING_W(L"Формат готовит только кукер ассетов: " + sourcePath);
+            return false;
+#endif
+        }
+
+        ProcessMeshes(meshes, threadCount);
+        return !meshes.empty();
+    }
+
+#ifdef ASSET_COOKER
+    // thames-cook [-j N] [--force] [--pack <файл.pack>] [--watch] <файл|папка>...
+    // thames-cook --bench-mips [размер]
+    // thames-cook [-j N] --bench-decode <файл|папка>...
+    // thames-cook --selftest
+    static int Run(int argc, char** argv) {
+        unsigned jobs = 0;
+        bool force = false;
+        bool watch = false;
+        bool benchDecode = false;
+        std::wstring packPath;
+        std::vector<std::wstring> inputs;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--force") {
+                force = true;
+            }
+            else if (arg == "--pack" && i + 1 < argc) {
+                packPath = FileSystemHelper::FromUtf8(argv[++i]);
+            }
+            else if (arg == "--watch") {
+                watch = true;
+            }
+            else if (arg == "--bench-mips") {
+                // Замер генерации мипов на картинке 4K, ассеты не трогает
+                int size = (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) ? atoi(argv[++i]) : 4096;
+                return MipGenerator::Benchmark(std::max(1, size), 5) ? 0 : 1;
+            }
+            else if (arg == "--selftest") {
+                // Проверки частей игры без устройства, ассеты не трогает
+                return SelfTest::Run() ? 0 : 1;
+            }
+            else if (arg == "--bench-decode") {
+                // Замер декодера на картинках из остальных аргументов, ассеты не трогает
+                benchDecode = true;
+            }
+            else if (arg == "-j" && i + 1 < argc) {
+                jobs = (unsigned)std::max(0, atoi(argv[++i]));
+            }
+            else if (arg == "-h" || arg == "--help") {
+                PrintUsage();
+                return 0;
+            }
+            else {
+                inputs.push_back(FileSystemHelper::FromUtf8(arg));
+            }
+        }
+        if (inputs.empty()) {
+            PrintUsage();
+            return 1;
+        }
+        if (benchDecode) {
+            return ImageDecoder::Benchmark(inputs, 5, jobs) ? 0 : 1;
+        }
+
+        Assimp::Importer importer;
+        std::vector<std::wstring> files;
+        for (const auto& input : inputs) {
+            std::error_code ec;
+            std::filesystem::path inputPath = FileSystemHelper::ToPath(input);
+            if (std::filesystem::is_directory(inputPath, ec)) {
+                for (const auto& entry : std::filesystem::recursive_directory_iterator(inputPath, ec)) {
+                    std::wstring path = FileSystemHelper::FromPath(entry.path());
+                    if (entry.is_regular_file(ec) && IsCookable(importer, path)) {
+                        files.push_back(path);
+                    }
+                }
+            }
+            else if (std::filesystem::is_regular_file(inputPath, ec)) {
+                files.push_back(input);
+            }
+            else {
+                DEBUG_WARNING_W(L"Нет такого файла или папки: " + input);
+            }
+        }
+        std::sort(files.begin(), files.end());
+        files.erase(std::unique(files.begin(), files.end()), files.end());
+
+        // Много файлов - по файлу на поток; один файл - все потоки внутри него
+        unsigned threadCount = GetWorkerThreadCount(jobs);
+        unsigned innerThreads = (files.size() == 1) ? threadCount : 1;
+        std::atomic<size_t> cooked = 0;
+        std::atomic<size_t> skipped = 0;
+        std::atomic<size_t> failed = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        ParallelFor(files.size(), threadCount, [&](size_t i) {
+            switch (CookFile(files[i], force, innerThreads)) {
+            case COOK_DONE: cooked++; break;
+            case COOK_UP_TO_DATE: skipped++; break;
+            case COOK_FAILED: failed++; break;
+            }
+        });
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        char buffer[256];
+        sprintf_s(buffer, "Кукер: приготовлено %zu, без изменений %zu, ошибок %zu (%.2f с, потоков %u)",
+            cooked.load(), skipped.load(), failed.load(), seconds, threadCount);
+        DEBUG_LOG(buffer);
+        if (failed > 0 && !watch) return 1;
+
+        if (!packPath.empty() && !BuildPack(importer, packPath, inputs, threadCount) && !watch) return 1;
+        if (watch) WatchAndCook(importer, files, packPath, inputs, threadCount);
+        return 0;
+    }
+
+    enum CookResult { COOK_DONE, COOK_UP_TO_DATE, COOK_FAILED };
+
+    static CookResult CookFile(const std::wstring& file, bool force, unsigned innerThreads) {
+        std::wstring cachePath = MeshCache::GetCachePath(file);
+        if (!force) {
+            MeshCache existing;
+            if (existing.Open(cachePath)) {
+                return COOK_UP_TO_DATE;
+            }
+        }
+
+        std::vector<Mesh> meshes;
+        MaterialTable materials;
+        std::vector<Bone> bones;
+        std::vector<std::wstring> sources;
+        if (!LoadAndProcess(file, meshes, materials, bones, sources, innerThreads) ||
+            !MeshCache::Write(cachePath, sources, meshes, materials, bones)) {
+            DEBUG_ERROR_W(L"Не удалось приготовить: " + file);
+            return COOK_FAILED;
+        }
+        DEBUG_SUCCESS_W(L"Приготовлен: " + cachePath);
+        return COOK_DONE;
+    }
+
+    // Следит за исходниками (и их MTL) и готовит заново только изменившиеся; игра
+    // с горячей перезагрузкой подхватывает новый .meshcache. Работает до Ctrl+C.
+    static void WatchAndCook(const Assimp::Importer& importer, const std::vector<std::wstring>& files,
+        const std::wstring& packPath, const std::vector<std::wstring>& inputs, unsigned threadCount) {
+
+        FileWatcher watcher;
+        std::unordered_map<std::wstring, std::vector<size_t>> dependents; // Исходник -> файлы
+        auto watchSources = [&](size_t i) {
+            std::vector<std::wstring> sources = { files[i] };
+            MeshCache cache;
+            if (cache.Open(MeshCache::GetCachePath(files[i]))) {
+                sources.insert(sources.end(), cache.GetSources().begin(), cache.GetSources().end());
+            }
+            for (const auto& source : sources) {
+                if (!watcher.Watch(source)) continue;
+                auto& list = dependents[source];
+                if (std::find(list.begin(), list.end(), i) == list.end()) list.push_back(i);
+            }
+        };
+        for (size_t i = 0; i < files.size(); i++) watchSources(i);
+
+        DEBUG_LOG("Кукер: слежу за исходниками, Ctrl+C - выход");
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(FileWatcher::POLL_INTERVAL_MS));
+            AssetIndex::Update();
+
+            std::vector<size_t> changed;
+            for (const auto& path : watcher.Poll()) {
+                auto it = dependents.find(path);
+                if (it == dependents.end()) continue;
+                for (size_t i : it->second) {
+                    if (std::find(changed.begin(), changed.end(), i) == changed.end()) changed.push_back(i);
+                }
+            }
+            if (changed.empty()) continue;
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i : changed) {
+                CookFile(files[i], true, threadCount);
+                watchSources(i); // Мог появиться новый mtllib
+            }
+            if (!packPath.empty()) BuildPack(importer, packPath, inputs, threadCount);
+
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            char buffer[256];
+            sprintf_s(buffer, "Кукер: перерасчёт %zu файлов за %.1f мс", changed.size(), ms);
+            DEBUG_LOG(buffer);
+        }
+    }
+
+    // Пакет из уже приготовленных ассетов: файлы папки - с путями относительно неё,
+    // отдельные файлы - по имени. Исходники мешей, у которых есть .meshcache, не кладутся.
+    static bool BuildPack(const Assimp::Importer& importer, const std::wstring& packPath,
+        const std::vector<std::wstring>& inputs, unsigned threadCount) {
+
+        std::vector<AssetPackWriter::Input> packInputs;
+        auto addFile = [&](const std::filesystem::path& path, const std::filesystem::path& relative) {
+            std::wstring fullPath = FileSystemHelper::FromPath(path);
+            std::wstring extension = FileSystemHelper::GetLowerExtension(fullPath);
+            if (extension == L".pack" || extension == L".tmp") return;
+            if (IsCookable(importer, fullPath) &&
+                FileSystemHelper::FileExists(MeshCache::GetCachePath(fullPath))) {
+                return;
+            }
+            packInputs.push_back({ FileSystemHelper::ToUtf8(FileSystemHelper::FromPath(relative)), fullPath });
+        };
+
+        for (const auto& input : inputs) {
+            std::error_code ec;
+            std::filesystem::path inputPath = FileSystemHelper::ToPath(input);
+            if (std::filesystem::is_directory(inputPath, ec)) {
+                for (const auto& entry : std::filesystem::recursive_directory_iterator(inputPath, ec)) {
+                    if (entry.is_regular_file(ec)) {
+                        addFile(entry.path(), entry.path().lexically_relative(inputPath));
+                    }
+                }
+            }
+            else if (std::filesystem::is_regular_file(inputPath, ec)) {
+                addFile(inputPath, inputPath.filename());
+            }
+        }
+
+        if (!AssetPackWriter::Write(packPath, packInputs, threadCount)) {
+            DEBUG_ERROR_W(L"Не удалось собрать пакет: " + packPath);
+            return false;
+        }
+        DEBUG_SUCCESS_W(L"Собран пакет: " + packPath);
+        return true;
+    }
+#endif
+
+private:
+    static bool IsObjFile(const std::wstring& path) {
+        return FileSystemHelper::GetLowerExtension(path) == L".obj";
+    }
+
+#ifdef ASSET_COOKER
+    static void PrintUsage() {
+        fputs("Использование: thames-cook [-j N] [--force] [--pack F] [--watch] <файл|папка>...\n"
+            "  Готовит OBJ/MTL, FBX и другие форматы Assimp в <файл>.meshcache\n"
+            "  -j N     число потоков (по умолчанию - по числу ядер)\n"
+            "  --force  готовить заново, даже если исходники не изменились\n"
+            "  --pack F затем собрать всё в пакет F (пути - относительно папок-аргументов;\n"
+            "           игра подключает *.pack из папки EXE)\n"
+            "  --watch  затем следить за исходниками и готовить изменившиеся заново\n"
+            "       thames-cook --bench-mips [N]\n"
+            "  Замер генерации мипов на картинке NxN (по умолчанию 4096)\n"
+            "       thames-cook [-j N] --bench-decode <файл|папка>...\n"
+            "  Замер декодера PNG/JPEG/BMP/TGA: один поток, N потоков и без SSE2\n"
+            "       thames-cook --selftest\n"
+            "  Проверки частей игры без видеокарты (кэш состояний, стриминг и ячейки текстур,\n"
+            "  командный буфер рендера, квантование вершин, разбор OBJ в один и несколько\n"
+            "  потоков, оптимизация мешей, каталог ассетов)\n", stderr);
+    }
+
+    static bool IsCookable(const Assimp::Importer& importer, const std::wstring& path) {
+        std::wstring extension = FileSystemHelper::GetLowerExtension(path);
+        if (extension == L".obj") return true;
+        if (extension.empty() || extension == L".mtl" || extension == L".meshcache") return false;
+        return importer.IsExtensionSupported(FileSystemHelper::ToUtf8(extension).c_str());
+    }
+
+    // Assimp хранит матрицы для векторов-столбцов, у нас - строки
+    static XMFLOAT4X4 ToRowVectorMatrix(const aiMatrix4x4& matrix) {
+        XMFLOAT4X4 result;
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 4; c++) {
+                result.m[r][c] = matrix[c][r];
+            }
+        }
+        return result;
+    }
+
+    // Импорт через Assimp в те же Mesh/Material, что даёт OBJLoader: UV перевёрнуты,
+    // система координат и обход как в исходнике, цвет вершины - диффузный цвет материала.
+    // Статические меши переводятся в пространство модели трансформами узлов, меши
+    // со скелетом остаются в позе привязки. Один меш на (материал, со скелетом или нет).
+    static bool ImportScene(const std::wstring& path, std::vector<Mesh>& meshes,
+        MaterialTable& materials, std::vector<Bone>& bones) {
+
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(FileSystemHelper::ToUtf8(path),
+            aiProcess_Triangulate |
+            aiProcess_JoinIdenticalVertices |
+            aiProcess_LimitBoneWeights |
+            aiProcess_GenSmoothNormals |
+            aiProcess_SortByPType |
+            aiProcess_FlipUVs);
+        if (!scene || !scene->mRootNode) {
+            DEBUG_ERROR(std::string("Assimp: ") + importer.GetErrorString());
+            return false;
+        }
+
+        std::vector<uint32_t> materialIndices(scene->mNumMaterials, MaterialTable::INVALID_INDEX);
+        for (unsigned m = 0; m < scene->mNumMaterials; m++) {
+            const aiMaterial* source = scene->mMaterials[m];
+            Material mat;
+
+            aiString name;
+            if (source->Get(AI_MATKEY_NAME, name) == AI_SUCCESS && name.length > 0) {
+                mat.name = name.C_Str();
+            }
+            else {
+                char buffer[32];
+                sprintf_s(buffer, "material_%u", m);
+                mat.name = buffer;
+            }
+
+            aiColor3D color;
+            if (source->Get(AI_MATKEY_COLOR_AMBIENT, color) == AI_SUCCESS) mat.ambient = XMFLOAT3(color.r, color.g, color.b);
+            if (source->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS) mat.diffuse = XMFLOAT3(color.r, color.g, color.b);
+            if (source->Get(AI_MATKEY_COLOR_SPECULAR, color) == AI_SUCCESS) mat.specular = XMFLOAT3(color.r, color.g, color.b);
+            source->Get(AI_MATKEY_SHININESS, mat.shininess);
+            source->Get(AI_MATKEY_OPACITY, mat.alpha);
+
+            aiString texture;
+            if (source->GetTexture(aiTextureType_DIFFUSE, 0, &texture) == AI_SUCCESS) {
+                mat.textureFilename = texture.C_Str();
+            }
+
+            mat.id = NameRegistry::Intern(mat.name);
+            materialIndices[m] = materials.Add(mat);
+        }
+
+        std::map<std::pair<unsigned, bool>, size_t> meshByKey;
+        std::unordered_map<std::string, uint32_t> boneByName;
+        std::vector<uint8_t> skinnedEmitted(scene->mNumMeshes, 0);
+        bool success = true;
+
+        std::function<void(const aiNode*, const aiMatrix4x4&)> visit =
+            [&](const aiNode* node, const aiMatrix4x4& parentTransform) {
+            aiMatrix4x4 transform = parentTransform * node->mTransformation;
+
+            for (unsigned k = 0; k < node->mNumMeshes && success; k++) {
+                unsigned meshIndex = node->mMeshes[k];
+                const aiMesh* source = scene->mMeshes[meshIndex];
+                if (source->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) continue; // Точки и линии
+
+                bool skinned = source->HasBones();
+                if (skinned) {
+                    if (skinnedEmitted[meshIndex]) continue;
+                    skinnedEmitted[meshIndex] = 1;
+                }
+
+                auto key = std::make_pair(source->mMaterialIndex, skinned);
+                auto it = meshByKey.find(key);
+                if (it == meshByKey.end()) {
+                    it = meshByKey.emplace(key, meshes.size()).first;
+                    meshes.emplace_back();
+                }
+
+                const Material* material = (source->mMaterialIndex < materialIndices.size()) ?
+                    materials.Get(materialIndices[source->mMaterialIndex]) : nullptr;
+                Mesh& mesh = meshes[it->second];
+                mesh.materialId = material ? material->id : 0;
+                success = AppendMesh(source, skinned ? aiMatrix4x4() : transform, boneByName, bones, mesh);
+            }
+
+            for (unsigned c = 0; c < node->mNumChildren && success; c++) {
+                visit(node->mChildren[c], transform);
+            }
+        };
+        visit(scene->mRootNode, aiMatrix4x4());
+        if (!success) return false;
+
+        size_t skinnedCount = 0;
+        for (const auto& mesh : meshes) {
+            if (!mesh.skin.empty()) skinnedCount++;
+        }
+
+        char buffer[256];
+        sprintf_s(buffer, "Assimp: %zu мешей (со скелетом %zu), %zu материалов, %zu костей, анимаций %u",
+            meshes.size(), skinnedCount, materials.Size(), bones.size(), scene->mNumAnimations);
+        DEBUG_LOG(buffer);
+        return true;
+    }
+
+    static bool AppendMesh(const aiMesh* source, const aiMatrix4x4& transform,
+        std::unordered_map<std::string, uint32_t>& boneByName, std::vector<Bone>& bones, Mesh& mesh) {
+
+        uint32_t base = (uint32_t)mesh.vertices.size();
+        aiMatrix3x3 normalTransform = aiMatrix3x3(transform);
+        normalTransform.Inverse().Transpose();
+
+        for (unsigned v = 0; v < source->mNumVertices; v++) {
+            Vertex vertex;
+            aiVector3D position = transform * source->mVertices[v];
+            vertex.position = XMFLOAT3(position.x, position.y, position.z);
+            if (source->HasNormals()) {
+                aiVector3D normal = normalTransform * source->mNormals[v];
+                normal.NormalizeSafe();
+                vertex.normal = XMFLOAT3(normal.x, normal.y, normal.z);
+            }
+            if (source->HasTextureCoords(0)) {
+                vertex.texcoord = XMFLOAT2(source->mTextureCoords[0][v].x, source->mTextureCoords[0][v].y);
+            }
+            // Цвет материала - в таблице материалов; в вершине только собственный цвет
+            if (source->HasVertexColors(0)) {
+                const aiColor4D& color = source->mColors[0][v];
+                vertex.color = XMFLOAT3(color.r, color.g, color.b);
+            }
+            mesh.vertices.push_back(vertex);
+        }
+
+        for (unsigned f = 0; f < source->mNumFaces; f++) {
+            const aiFace& face = source->mFaces[f];
+            if (face.mNumIndices != 3) continue;
+            mesh.indices.push_back(base + face.mIndices[0]);
+            mesh.indices.push_back(base + face.mIndices[1]);
+            mesh.indices.push_back(base + face.mIndices[2]);
+        }
+
+        if (!source->HasBones()) return true;
+
+        // Индексы костей общие на модель; на вершину - 4 самых тяжёлых влияния
+        mesh.skin.resize(mesh.vertices.size(), VertexSkin{});
+        for (unsigned b = 0; b < source->mNumBones; b++) {
+            const aiBone* bone = source->mBones[b];
+            auto it = boneByName.find(bone->mName.C_Str());
+            if (it == boneByName.end()) {
+                if (bones.size() > UINT8_MAX) {
+                    DEBUG_ERROR("Больше 256 костей: индексы не помещаются в BYTE");
+                    return false;
+                }
+                Bone entry;
+                entry.name = bone->mName.C_Str();
+                entry.offset = ToRowVectorMatrix(bone->mOffsetMatrix);
+                it = boneByName.emplace(entry.name, (uint32_t)bones.size()).first;
+                bones.push_back(entry);
+            }
+
+            for (unsigned w = 0; w < bone->mNumWeights; w++) {
+                const aiVertexWeight& weight = bone->mWeights[w];
+                if (weight.mVertexId >= source->mNumVertices) continue;
+
+                VertexSkin& skin = mesh.skin[base + weight.mVertexId];
+                int lightest = 0;
+                for (int slot = 1; slot < 4; slot++) {
+                    if (skin.boneWeights[slot] < skin.boneWeights[lightest]) lightest = slot;
+                }
+                if (weight.mWeight > skin.boneWeights[lightest]) {
+                    skin.boneIndices[lightest] = (BYTE)it->second;
+                    skin.boneWeights[lightest] = weight.mWeight;
+                }
+            }
+        }
+
+        for (size_t v = base; v < mesh.skin.size(); v++) {
+            VertexSkin& skin = mesh.skin[v];
+            float total = skin.boneWeights[0] + skin.boneWeights[1] + skin.boneWeights[2] + skin.boneWeights[3];
+            if (total <= 0.0f) continue;
+            for (int slot = 0; slot < 4; slot++) skin.boneWeights[slot] /= total;
+        }
+        return true;
+    }
+#endif
+};
+
+#ifdef ASSET_COOKER
+// ==================== MAIN (КУКЕР) ====================
+int main(int argc, char** argv) {
+    return AssetCooker::Run(argc, argv);
+}
+#else
+
+// ==================== АСИНХРОННАЯ ЗАГРУЗКА ====================
+// Пул потоков загрузки: чтение файла, разбор и декодирование идут в фоне, а создание
+// ресурсов D3D - в потоке рендера (ProcessUploads) с бюджетом времени на кадр.
+// Пока задача не завершилась, на месте ассета рисуется заглушка.
+const double ASSET_UPLOAD_BUDGET_MS = 2.0;
+const bool HOT_RELOAD_ASSETS = true; // Следить за файлами ассетов и перечитывать изменённые
+
+class AssetLoader {
+public:
+    // load выполняется в фоновом потоке, upload(результат load) - затем в потоке рендера
+    using LoadFunc = std::function<bool()>;
+    using UploadFunc = std::function<void(bool)>;
+
+    AssetLoader() = default;
+    ~AssetLoader() { Shutdown(); }
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    // threadCount = 0 - по числу ядер минус поток рендера
+    void Start(unsigned threadCount = 0) {
+        if (!workers.empty()) return;
+
+        unsigned count = threadCount ? threadCount : std::max(1u, GetWorkerThreadCount(0) - 1);
+        stopping = false;
+        startTime = std::chrono::steady_clock::now();
+        reportedIdle = false;
+        for (unsigned i = 0; i < count; i++) {
+            try {
+                workers.emplace_back([this]() { WorkerLoop(); });
+            }
+            catch (const std::system_error&) {
+                break;
+            }
+        }
+
+        char buffer[256];
+        sprintf_s(buffer, "Загрузчик ассетов: %zu потоков", workers.size());
+        DEBUG_LOG(buffer);
+    }
+
+    void Submit(const std::wstring& name, LoadFunc load, UploadFunc upload) {
+        // Потоков нет (не запущен или не создались) - грузим сразу, как раньше
+        if (workers.empty()) {
+            bool loaded = load();
+            upload(loaded);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back({ name, std::move(load), std::move(upload), false });
+            pending++;
+            reportedIdle = false;
+        }
+        wake.notify_one();
+    }
+
+    // Завершает готовые задачи, пока не исчерпан бюджет (хотя бы одну за вызов)
+    size_t ProcessUploads(double budgetMs) {
+        auto start = std::chrono::steady_clock::now();
+        size_t processed = 0;
+        for (;;) {
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (completed.empty()) break;
+                job = std::move(completed.front());
+                completed.pop_front();
+            }
+
+            job.upload(job.loaded);
+            processed++;
+            pending--;
+
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= budgetMs) break;
+        }
+
+        if (processed > 0 && pending == 0 && !reportedIdle) {
+            reportedIdle = true;
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+            char buffer[256];
+            sprintf_s(buffer, "Фоновая загрузка завершена через %.1f мс после запуска", ms);
+            DEBUG_SUCCESS(buffer);
+        }
+        return processed;
+    }
+
+    size_t GetPendingCount() const { return pending; }
+
+    // Останавливает потоки; задачи, не дошедшие до потока рендера, отбрасываются
+    void Shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+        workers.clear();
+        completed.clear();
+        pending = 0;
+    }
+
+private:
+    struct Job {
+        std::wstring name;
+        LoadFunc load;
+        UploadFunc upload;
+        bool loaded = false;
+    };
+
+    void WorkerLoop() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (stopping) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            job.loaded = job.load();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            char buffer[256];
+            sprintf_s(buffer, " (%.1f мс)", ms);
+            if (job.loaded) {
+                DEBUG_LOG_W(L"Загружено в фоне: " + job.name + FileSystemHelper::FromUtf8(buffer));
+            }
+            else {
+                DEBUG_WARNING_W(L"Фоновая загрузка не удалась, остаётся заглушка: " + job.name);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) return;
+            completed.push_back(std::move(job));
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> queue;
+    std::deque<Job> completed;
+    std::atomic<size_t> pending = 0;
+    bool stopping = false;
+    bool reportedIdle = false;
+    std::chrono::steady_clock::time_point startTime;
+};
+
+// ==================== ТЕКСТУРНЫЙ МЕНЕДЖЕР ====================
+// Текстуры лежат в плотном массиве ячеек; дескриптор - индекс ячейки и её поколение.
+// Дескриптор не меняется, даже когда заглушку на его месте сменяет загруженная
+// текстура, а после освобождения ячейки (поколение растёт) больше ничего не находит.
+// Одинаковые файлы, дебажные и цветные текстуры общие: каждый Load/Create - ещё одна
+// ссылка, которую владелец возвращает через Release. Ресурсы текстуры без ссылок
+// освобождаются через TEXTURE_RELEASE_DELAY_FRAMES кадров (CollectGarbage раз в кадр).
+// Текстуры из файлов с мипами отдаются TextureStreamer: в ячейке лежит изображение-источник,
+// а текстура пересоздаётся с того уровня, который стример оставил в памяти.
+// Учёт ячеек и отложенное освобождение - TextureSlotTable и DeferredReleaseQueue.
+class TextureManager : public TextureResidencyTarget {
+private:
+    struct TextureSlot {
+        Texture2D texture;
+        uint32_t streamId = TextureStreamer::INVALID_ID;
+        std::shared_ptr<DecodedImage> source; // Все уровни (кэш отображён в память) - для стриминга
+
+        void Cleanup() { texture.Cleanup(); }
+    };
+
+    using Slot = TextureSlotTable<TextureSlot>::Slot;
+
+    TextureSlotTable<TextureSlot> slots;
+    DeferredReleaseQueue<Texture2D> pendingReleases;
+    uint64_t frame = 0;
+    Texture2D placeholder; // Шахматка, общая для всех текстур в загрузке
+    ID3D11Device* device = nullptr;
+    AssetLoader* streamLoader = nullptr; // nullptr - уровни подгружаются сразу
+    TextureStreamer streamer;
+    std::vector<TextureHandle> streamOwners; // streamId -> дескриптор ячейки
+
+    TextureHandle AddTexture(const std::wstring& key, const Texture2D& texture) {
+        TextureSlot slot;
+        slot.texture = texture;
+        return slots.Add(key, slot);
+    }
+
+    // Ещё одна ссылка на уже загруженную по ключу; пустой дескриптор - такой нет
+    TextureHandle AcquireExisting(const std::wstring& key) {
+        return slots.AcquireExisting(key);
+    }
+
+    Slot* FindSlot(TextureHandle handle) {
+        return slots.Find(handle);
+    }
+
+    // Старые ресурсы могут ещё стоять в очереди команд - освобождаются позже
+    void DeferRelease(Texture2D& texture) {
+        if (texture.texture || texture.srv || texture.samplerState) {
+            pendingReleases.Push(texture, frame);
+        }
+        texture = Texture2D();
+    }
+
+    void SubmitDecode(TextureHandle handle, const std::wstring& path, AssetLoader& loader) {
+        auto image = std::make_shared<DecodedImage>();
+        loader.Submit(path,
+            [image, path]() {
+                return Texture2D::DecodeFile(path.c_str(), *image);
+            },
+            [this, handle, image, path](bool decoded) {
+                // Пока грузилась, текстуру могли отпустить - дескриптор уже ничего не находит
+                Slot* slot = FindSlot(handle);
+                if (!slot) return;
+
+                if (!decoded || !SetImage(handle, *slot, path, image)) return;
+                DEBUG_LOG_W(L"Текстура загружена: " + path);
+            });
+    }
+
+    // Ставит в ячейку текстуру из изображения. С мипами она регистрируется в стримере
+    // и сначала создаётся только с хвоста уровней - остальные он подгрузит по размеру на экране.
+    bool SetImage(TextureHandle handle, Slot& slot, const std::wstring& path,
+        const std::shared_ptr<DecodedImage>& image) {
+        uint32_t levelCount = Texture2D::GetLevelCount(*image);
+        bool streamed = STREAM_TEXTURES && levelCount > 1;
+        uint32_t streamId = streamed ?
+            streamer.Register(image->width, image->height, image->format, levelCount) : TextureStreamer::INVALID_ID;
+
+        Texture2D texture;
+        texture.filename = path;
+        if (!texture.CreateFromImage(device, *image, streamer.GetResidentMip(streamId))) {
+            streamer.Unregister(streamId);
+            return false;
+        }
+
+        StopStreaming(slot);
+        DeferRelease(slot.texture);
+        slot.texture = texture;
+        if (streamed) {
+            slot.streamId = streamId;
+            slot.source = image;
+            if (streamOwners.size() <= streamId) streamOwners.resize(streamId + 1);
+            streamOwners[streamId] = handle;
+        }
+        return true;
+    }
+
+    void StopStreaming(TextureSlot& slot) {
+        streamer.Unregister(slot.streamId);
+        slot.streamId = TextureStreamer::INVALID_ID;
+        slot.source.reset();
+    }
+
+    Slot* FindStreamSlot(uint32_t streamId) {
+        if (streamId >= streamOwners.size()) return nullptr;
+        Slot* slot = FindSlot(streamOwners[streamId]);
+        return (slot && slot->streamId == streamId) ? slot : nullptr;
+    }
+
+    // Пересоздаёт текстуру ячейки с уровня topMip; прежняя освобождается с задержкой
+    bool ApplyMips(Slot& slot, uint32_t topMip) {
+        Texture2D texture;
+        texture.filename = slot.texture.filename;
+        if (!texture.CreateFromImage(device, *slot.source, topMip)) {
+            DEBUG_ERROR_W(L"Не удалось сменить мипы текстуры: " + slot.key);
+            return false;
+        }
+        DeferRelease(slot.texture);
+        slot.texture = texture;
+        return true;
+    }
+
+    // Фоновая часть подгрузки: читает байты новых уровней, чтобы страницы отображённого
+    // кэша оказались в памяти до выгрузки в потоке рендера
+    static void PrefetchLevels(const DecodedImage& image, uint32_t firstLevel, uint32_t endLevel) {
+        if (!image.cache) return; // Уровни уже в памяти
+        const auto& levels = image.cache->GetLevels();
+        volatile uint8_t sink = 0;
+        for (uint32_t level = firstLevel; level < endLevel && level < levels.size(); level++) {
+            for (uint64_t offset = 0; offset < levels[level].size; offset += 4096) {
+                sink = sink ^ levels[level].data[offset];
+            }
+        }
+    }
+
+    // Ещё одна ссылка на ресурсы заглушки: у каждой ячейки свои, Cleanup освобождает их
+    Texture2D SharePlaceholder() {
+        if (!placeholder.srv && !placeholder.CreateDebugTexture(device, L"loading")) {
+            return Texture2D();
+        }
+        Texture2D texture = placeholder;
+        texture.texture->AddRef();
+        texture.srv->AddRef();
+        texture.samplerState->AddRef();
+        return texture;
+    }
+
+public:
+    void Initialize(ID3D11Device* dev, AssetLoader* loader = nullptr) {
+        device = dev;
+        streamLoader = loader;
+        streamer.Initialize(this, TEXTURE_STREAMING_BUDGET);
+    }
+
+    // TextureResidencyTarget: новые уровни читаются в фоне, текстура меняется между кадрами
+    void LoadMips(uint32_t streamId, uint32_t topMip) override {
+        Slot* slot = FindStreamSlot(streamId);
+        if (!slot) {
+            streamer.OnLoadFailed(streamId);
+            return;
+        }
+        if (!streamLoader) {
+            if (ApplyMips(*slot, topMip)) streamer.OnMipsLoaded(streamId, topMip);
+            else streamer.OnLoadFailed(streamId);
+            return;
+        }
+
+        TextureHandle handle = streamOwners[streamId];
+        std::shared_ptr<DecodedImage> image = slot->source;
+        uint32_t residentMip = streamer.GetResidentMip(streamId);
+        streamLoader->Submit(slot->key,
+            [image, topMip, residentMip]() {
+                PrefetchLevels(*image, topMip, residentMip);
+                return true;
+            },
+            [this, handle, streamId, image, topMip](bool) {
+                // Текстуру отпустили или перезагрузили - её запись в стримере уже снята
+                Slot* slot = FindSlot(handle);
+                if (!slot || slot->streamId != streamId || slot->source != image) return;
+                if (ApplyMips(*slot, topMip)) streamer.OnMipsLoaded(streamId, topMip);
+                else streamer.OnLoadFailed(streamId);
+            });
+    }
+
+    void EvictMips(uint32_t streamId, uint32_t topMip) override {
+        Slot* slot = FindStreamSlot(streamId);
+        if (slot) ApplyMips(*slot, topMip);
+    }
+
+    // Текстура видна в этом кадре размером screenPixels (по большей стороне)
+    void RequestResidency(TextureHandle handle, float screenPixels) {
+        Slot* slot = FindSlot(handle);
+        if (slot && slot->streamId != TextureStreamer::INVALID_ID) {
+            streamer.RequestScreenSize(slot->streamId, screenPixels);
+        }
+    }
+
+    const TextureStreamStats& GetStreamStats() const { return streamer.GetStats(); }
+
+    TextureHandle LoadTexture(const std::wstring& filename) {
+        // Ищем файл
+        std::wstring foundPath = FileSystemHelper::FindFile(filename);
+        if (foundPath.empty()) {
+            DEBUG_WARNING("Не удалось найти текстуру, создаю дебажную");
+            return CreateDebugTexture(filename);
+        }
+
+        // Проверяем, не загружена ли уже эта текстура
+        TextureHandle existing = AcquireExisting(foundPath);
+        if (existing.IsValid()) {
+            return existing;
+        }
+
+        // Загружаем новую текстуру
+        auto image = std::make_shared<DecodedImage>();
+        if (Texture2D::DecodeFile(foundPath.c_str(), *image)) {
+            TextureHandle handle = AddTexture(foundPath, Texture2D());
+            if (SetImage(handle, *FindSlot(handle), foundPath, image)) {
+                DEBUG_LOG_W(L"Текстура загружена: " + foundPath);
+                return handle;
+            }
+            Release(handle);
+        }
+        return CreateDebugTexture(filename);
+    }
+
+    // Возвращает дескриптор сразу: до конца загрузки по нему лежит шахматка,
+    // затем в потоке рендера её заменяет текстура (или она остаётся при ошибке)
+    TextureHandle LoadTextureAsync(const std::wstring& filename, AssetLoader& loader) {
+        std::wstring foundPath = FileSystemHelper::FindImageFile(filename);
+        if (foundPath.empty()) {
+            foundPath = FileSystemHelper::FindFile(filename);
+        }
+        if (foundPath.empty()) {
+            DEBUG_WARNING("Не удалось найти текстуру, создаю дебажную");
+            return CreateDebugTexture(filename);
+        }
+
+        TextureHandle existing = AcquireExisting(foundPath);
+        if (existing.IsValid()) {
+            return existing;
+        }
+
+        TextureHandle handle = AddTexture(foundPath, SharePlaceholder());
+        SubmitDecode(handle, foundPath, loader);
+        return handle;
+    }
+
+    // Файл загруженной текстуры изменился: декодируется в фоне и заменяет её
+    // под тем же дескриптором. false - такой текстуры нет.
+    bool ReloadTextureAsync(const std::wstring& path, AssetLoader& loader) {
+        TextureHandle handle = slots.FindKey(path);
+        if (!handle.IsValid()) return false;
+        SubmitDecode(handle, path, loader);
+        return true;
+    }
+
+    // Файлы, из которых загружены текстуры (без дебажных, цветных и страниц атласа)
+    std::vector<std::wstring> GetTextureFiles() const {
+        std::vector<std::wstring> files;
+        for (const auto& pair : slots.GetHandles()) {
+            if (pair.first.compare(0, 1, L"[") != 0) files.push_back(pair.first);
+        }
+        return files;
+    }
+
+    // Шахматка одинаковая для любого имени: все дебажные текстуры - одна ячейка [DEBUG]
+    // на ресурсах заглушки загрузки; name нужно только для лога
+    TextureHandle CreateDebugTexture(const std::wstring& name) {
+        TextureHandle existing = AcquireExisting(L"[DEBUG]");
+        if (existing.IsValid()) {
+            return existing;
+        }
+
+        Texture2D texture = SharePlaceholder();
+        if (!texture.srv) {
+            return TextureHandle();
+        }
+        DEBUG_LOG_W(L"Дебажная текстура вместо: " + name);
+        return AddTexture(L"[DEBUG]", texture);
+    }
+
+    // Текстура из готового изображения (страница атласа); name должно быть уникальным -
+    // одноимённая живая текстура возвращается как есть
+    TextureHandle CreateImageTexture(const std::wstring& name, const DecodedImage& image) {
+        std::wstring imageKey = L"[IMAGE]" + name;
+        TextureHandle existing = AcquireExisting(imageKey);
+        if (existing.IsValid()) {
+            return existing;
+        }
+
+        Texture2D texture;
+        texture.filename = name;
+        if (texture.CreateFromImage(device, image)) {
+            DEBUG_LOG_W(L"Создана текстура из изображения: " + name);
+            return AddTexture(imageKey, texture);
+        }
+        return TextureHandle();
+    }
+
+    // Ещё одна ссылка на ту же текстуру (для второго владельца)
+    TextureHandle AddRef(TextureHandle handle) {
+        return slots.AddRef(handle);
+    }
+
+    // Последняя ссылка освобождает ячейку сразу, а ресурсы - через несколько кадров
+    void Release(TextureHandle handle) {
+        TextureSlot released;
+        if (!slots.Release(handle, released)) return;
+
+        StopStreaming(released);
+        DeferRelease(released.texture);
+    }
+
+    // Раз в кадр: решения стримера по запросам прошлого кадра, затем освобождение
+    // ресурсов, отложенных достаточно давно
+    void CollectGarbage() {
+        streamer.Update();
+        const TextureStreamStats& stats = streamer.GetStats();
+        if (stats.requests > 0 || stats.evictions > 0) {
+            char buffer[256];
+            sprintf_s(buffer, "Стриминг текстур: в памяти %.1f МБ из %.1f, запрошено %.1f МБ (%u), вытеснено уровней %u",
+                stats.residentBytes / 1048576.0, stats.budgetBytes / 1048576.0,
+                stats.requestedBytes / 1048576.0, stats.requests, stats.evictions);
+            DEBUG_LOG(buffer);
+        }
+
+        frame++;
+        pendingReleases.Collect(frame);
+    }
+
+    // O(1): проверка поколения вместо поиска; устаревший дескриптор - nullptr
+    Texture2D* GetTexture(TextureHandle handle) {
+        Slot* slot = FindSlot(handle);
+        return slot ? &slot->texture : nullptr;
+    }
+
+    // Файл, из которого загружена текстура; пусто - дебажная или страница атласа
+    std::wstring GetTextureFile(TextureHandle handle) {
+        Slot* slot = FindSlot(handle);
+        if (!slot || slot->key.compare(0, 1, L"[") == 0) return L"";
+        return slot->key;
+    }
+
+    size_t GetLiveCount() const { return slots.GetLiveCount(); }
+
+    void Cleanup() {
+        slots.Clear();
+        pendingReleases.Clear();
+        streamer.Clear();
+        streamOwners.clear();
+        placeholder.Cleanup();
+        placeholder = Texture2D();
+    }
+};
+
+// ==================== ЗАГРУЗКА ТЕКСТУР ====================
+// Только чтение и декодирование, без устройства - можно звать из фонового потока.
+// Свежий кэш рядом с картинкой отдаётся как есть; иначе картинка декодируется,
+// строятся мипы, уровни сжимаются и кэш записывается для следующего запуска.
+bool Texture2D::DecodeFile(const wchar_t* filename, DecodedImage& image) {
+    if (USE_TEXTURE_CACHE) {
+        auto cache = std::make_shared<TextureCache>();
+        if (cache->Open(TextureCache::GetCachePath(filename), filename)) {
+            image.width = cache->GetWidth();
+            image.height = cache->GetHeight();
+            image.format = cache->GetFormat();
+            image.cache = cache;
+            DEBUG_LOG_W(L"Текстура из кэша: " + std::wstring(filename));
+            return true;
+        }
+    }
+
+    if (!DecodeSource(filename, image)) {
+        return false;
+    }
+
+    // Мипы считаются здесь же, в фоновом потоке - поток рендера только выгружает уровни
+    if (GENERATE_TEXTURE_MIPS) {
+        MipGenerator::Build(image.pixels.data(), image.width, image.height, image.mips);
+    }
+    if (USE_TEXTURE_CACHE) {
+        CompressImage(filename, image);
+    }
+    return true;
+}
+
+// Сжимает все уровни (BC1/BC3/BC7 по содержимому) и пишет кэш рядом с картинкой
+void Texture2D::CompressImage(const std::wstring& sourcePath, DecodedImage& image) {
+    auto start = std::chrono::steady_clock::now();
+    TextureFormat format = BlockCompressor::ChooseFormat(image.pixels.data(), image.width, image.height);
+
+    std::vector<std::vector<uint8_t>> levels(1 + image.mips.size());
+    BlockCompressor::CompressLevel(image.pixels.data(), image.width, image.height, format, levels[0]);
+    for (size_t i = 0; i < image.mips.size(); i++) {
+        int levelWidth = std::max(1, image.width >> (i + 1));
+        int levelHeight = std::max(1, image.height >> (i + 1));
+        BlockCompressor::CompressLevel(image.mips[i].data(), levelWidth, levelHeight, format, levels[i + 1]);
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    char buffer[256];
+    sprintf_s(buffer, "Текстура %dx%d сжата в %s за %.1f мс", image.width, image.height,
+        BlockCompressor::GetFormatName(format), ms);
+    DEBUG_LOG(buffer);
+
+    // Кэш пишется только рядом с картинкой на диске, не для записи пакета
+    std::error_code ec;
+    if (std::filesystem::exists(FileSystemHelper::ToPath(sourcePath), ec)) {
+        TextureCache::Write(TextureCache::GetCachePath(sourcePath), sourcePath,
+            format, image.width, image.height, levels);
+    }
+
+    image.format = format;
+    image.pixels = std::move(levels[0]);
+    for (size_t i = 0; i < image.mips.size(); i++) {
+        image.mips[i] = std::move(levels[i + 1]);
+    }
+}
+
+// Декодирование картинки в RGBA8: PNG/JPEG/BMP/TGA - ImageDecoder, остальное - WIC;
+// sizeOnly - только размеры из заголовка
+bool Texture2D::DecodeSource(const wchar_t* filename, DecodedImage& image, bool sizeOnly) {
+    // Файл с диска или запись пакета - декодер читает прямо из памяти
+    AssetFile asset;
+    if (!asset.Open(filename)) {
+        DEBUG_LOG_W(L"Файл не существует: " + std::wstring(filename));
+        return false;
+    }
+
+    if (!sizeOnly) DEBUG_LOG_W(L"Загрузка текстуры: " + std::wstring(filename));
+
+    // Свой декодер не требует COM и фабрики WIC на каждую картинку
+    const uint8_t* bytes = (const uint8_t*)asset.Data();
+    if (USE_IMAGE_DECODER && ImageDecoder::DetectType(bytes, asset.Size()) != IMAGE_UNKNOWN) {
+        if (ImageDecoder::Decode(bytes, asset.Size(), image.width, image.height, sizeOnly ? nullptr : &image.pixels)) {
+            return true;
+        }
+        DEBUG_WARNING_W(L"Декодер не справился, пробую WIC: " + std::wstring(filename));
+    }
+
+    // Инициализируем COM для WIC
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr) && hr != RPC_E_CHANGED_MODE) {
+        DEBUG_ERROR("Ошибка инициализации COM");
+        return false;
+    }
+
+    IWICImagingFactory* wicFactory = nullptr;
+    hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr,
+        CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&wicFactory));
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка создания WIC фабрики");
+        CoUninitialize();
+        return false;
+    }
+
+    IWICStream* stream = nullptr;
+    hr = wicFactory->CreateStream(&stream);
+    if (SUCCEEDED(hr)) {
+        hr = stream->InitializeFromMemory((BYTE*)asset.Data(), (DWORD)asset.Size());
+        if (FAILED(hr)) stream->Release();
+    }
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка создания потока WIC");
+        wicFactory->Release();
+        CoUninitialize();
+        return false;
+    }
+
+    IWICBitmapDecoder* decoder = nullptr;
+    hr = wicFactory->CreateDecoderFromStream(stream, nullptr,
+        WICDecodeMetadataCacheOnLoad,
+        &decoder);
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка создания декодера");
+        stream->Release();
+        wicFactory->Release();
+        CoUninitialize();
+        return false;
+    }
+
+    IWICBitmapFrameDecode* frame = nullptr;
+    hr = decoder->GetFrame(0, &frame);
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка получения фрейма");
+        decoder->Release();
+        stream->Release();
+        wicFactory->Release();
+        CoUninitialize();
+        return false;
+    }
+
+    // Получаем размеры
+    UINT w, h;
+    frame->GetSize(&w, &h);
+    image.width = (int)w;
+    image.height = (int)h;
+
+    if (sizeOnly) {
+        frame->Release();
+        decoder->Release();
+        stream->Release();
+        wicFactory->Release();
+        CoUninitialize();
+        return true;
+    }
+
+    // Конвертируем в RGBA
+    IWICFormatConverter* converter = nullptr;
+    hr = wicFactory->CreateFormatConverter(&converter);
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка создания конвертера");
+        frame->Release();
+        decoder->Release();
+        stream->Release();
+        wicFactory->Release();
+        CoUninitialize();
+        return false;
+    }
+
+    hr = converter->Initialize(frame, GUID_WICPixelFormat32bppRGBA,
+        WICBitmapDitherTypeNone, nullptr, 0.0,
+        WICBitmapPaletteTypeCustom);
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка инициализации конвертера");
+        converter->Release();
+        frame->Release();
+        decoder->Release();
+        stream->Release();
+        wicFactory->Release();
+        CoUninitialize();
+        return false;
+    }
+
+    // Копируем пиксели
+    image.pixels.resize((size_t)image.width * image.height * 4);
+    hr = converter->CopyPixels(nullptr, image.width * 4,
+        (UINT)image.pixels.size(), image.pixels.data());
+
+    // Освобождаем ресурсы
+    converter->Release();
+    frame->Release();
+    decoder->Release();
+    stream->Release();
+    wicFactory->Release();
+    CoUninitialize();
+
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка копирования пикселей");
+        return false;
+    }
+    return true;
+}
+
+DXGI_FORMAT Texture2D::GetDxgiFormat(TextureFormat format) {
+    switch (format) {
+    case TEXTURE_BC1: return DXGI_FORMAT_BC1_UNORM;
+    case TEXTURE_BC3: return DXGI_FORMAT_BC3_UNORM;
+    case TEXTURE_BC7: return DXGI_FORMAT_BC7_UNORM;
+    default: return DXGI_FORMAT_R8G8B8A8_UNORM;
+    }
+}
+
+uint32_t Texture2D::GetLevelCount(const DecodedImage& image) {
+    return image.cache ? (uint32_t)image.cache->GetLevels().size() : 1 + (uint32_t)image.mips.size();
+}
+
+// Создание ресурсов D3D из декодированных пикселей - в потоке рендера.
+// firstLevel > 0 - в видеопамять идут только уровни начиная с него (стриминг)
+bool Texture2D::CreateFromImage(ID3D11Device* device, const DecodedImage& image, uint32_t firstLevel) {
+    firstLevel = std::min(firstLevel, GetLevelCount(image) - 1);
+    width = std::max(1, image.width >> firstLevel);
+    height = std::max(1, image.height >> firstLevel);
+
+    // Создаем текстуру DirectX
+    D3D11_TEXTURE2D_DESC texDesc = {};
+    texDesc.Width = width;
+    texDesc.Height = height;
+    texDesc.MipLevels = GetLevelCount(image) - firstLevel;
+    texDesc.ArraySize = 1;
+    texDesc.Format = GetDxgiFormat(image.format);
+    texDesc.SampleDesc.Count = 1;
+    texDesc.SampleDesc.Quality = 0;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    texDesc.CPUAccessFlags = 0;
+
+    // По подресурсу на уровень: ширина уровня i - max(1, width >> i), для BC шаг - строка блоков
+    std::vector<D3D11_SUBRESOURCE_DATA> initData(texDesc.MipLevels);
+    for (UINT level = 0; level < texDesc.MipLevels; level++) {
+        UINT sourceLevel = firstLevel + level;
+        if (image.cache) {
+            const TextureCache::Level& cached = image.cache->GetLevels()[sourceLevel];
+            initData[level].pSysMem = cached.data;
+            initData[level].SysMemPitch = cached.rowPitch;
+        }
+        else {
+            initData[level].pSysMem = (sourceLevel == 0) ? image.pixels.data() : image.mips[sourceLevel - 1].data();
+            initData[level].SysMemPitch = BlockCompressor::GetRowPitch(image.format, std::max(1, image.width >> sourceLevel));
+        }
+        initData[level].SysMemSlicePitch = 0;
+    }
+
+    HRESULT hr = device->CreateTexture2D(&texDesc, initData.data(), &texture);
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка создания текстуры DirectX");
+        texture = nullptr;
+        return false;
+    }
+
+    // Создаем шейдерный ресурс
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = texDesc.Format;
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+    srvDesc.Texture2D.MostDetailedMip = 0;
+    srvDesc.Texture2D.MipLevels = texDesc.MipLevels;
+
+    hr = device->CreateShaderResourceView(texture, &srvDesc, &srv);
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка создания SRV");
+        texture->Release();
+        texture = nullptr;
+        srv = nullptr;
+        return false;
+    }
+
+    // Создаем сэмплер
+    D3D11_SAMPLER_DESC sampDesc = {};
+    sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+    sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+    sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+    sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+    sampDesc.MinLOD = 0;
+    sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+    hr = PipelineStateCache::GetSamplerState(device, sampDesc, &samplerState);
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка создания сэмплера");
+        srv->Release();
+        texture->Release();
+        texture = nullptr;
+        srv = nullptr;
+        samplerState = nullptr;
+        return false;
+    }
+
+    char buffer[256];
+    sprintf_s(buffer, "Текстура загружена успешно: %dx%d %s, мип-уровней: %u", width, height,
+        BlockCompressor::GetFormatName(image.format), texDesc.MipLevels);
+    DEBUG_SUCCESS(buffer);
+
+    return true;
+}
+
+bool Texture2D::CreateDebugTexture(ID3D11Device* device, const wchar_t* name) {
+    this->filename = L"[DEBUG]" + std::wstring(name);
+    width = 256;
+    height = 256;
+
+    DEBUG_LOG_W(L"Создание дебажной текстуры: " + std::wstring(name));
+
+    // Создаем пиксели для дебажной текстуры (шахматный паттерн)
+    std::vector<BYTE> pixels(width * height * 4);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int idx = (y * width + x) * 4;
+            bool isChecker = ((x / 32) + (y / 32)) % 2 == 0;
+
+            if (isChecker) {
+                pixels[idx] = 150;     // Red
+                pixels[idx + 1] = 200; // Green
+                pixels[idx + 2] = 255; // Blue
+            }
+            else {
+                pixels[idx] = 200;     // Red
+                pixels[idx + 1] = 150; // Green
+                pixels[idx + 2] = 100; // Blue
+            }
+            pixels[idx + 3] = 255; // Alpha
+        }
+    }
+
+    // Создаем текстуру DirectX
+    D3D11_TEXTURE2D_DESC texDesc = {};
+    texDesc.Width = width;
+    texDesc.Height = height;
+    texDesc.MipLevels = 1;
+    texDesc.ArraySize = 1;
+    texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    texDesc.SampleDesc.Count = 1;
+    texDesc.SampleDesc.Quality = 0;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    texDesc.CPUAccessFlags = 0;
+
+    D3D11_SUBRESOURCE_DATA initData = {};
+    initData.pSysMem = pixels.data();
+    initData.SysMemPitch = width * 4;
+    initData.SysMemSlicePitch = 0;
+
+    HRESULT hr = device->CreateTexture2D(&texDesc, &initData, &texture);
+    if (FAILED(hr)) {
+        DEBUG_ERROR("Ошибка создания дебажной текстуры");
+        return false;
+    }
+
+    // Создаем шейдерный ресурс
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = texDesc.Format;
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+    srvDesc.Texture2D.MostDetailedMip = 0;
+    srvDesc.Texture2D.MipLevels = 1;
 
     hr = device->CreateShaderResourceView(texture, &srvDesc, &srv);
     if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания SRV");
+        DEBUG_ERROR("Ошибка создания SRV для дебажной текстуры");
         texture->Release();
-        converter->Release();
-        frame->Release();
-        decoder->Release();
-        wicFactory->Release();
-        CoUninitialize();
         return false;
     }
 
@@ -850,380 +10501,1499 @@ bool Texture2D::LoadFromFile(ID3D11Device* device, const wchar_t* filename) {
     sampDesc.MinLOD = 0;
     sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
 
-    hr = device->CreateSamplerState(&sampDesc, &samplerState);
+    hr = PipelineStateCache::GetSamplerState(device, sampDesc, &samplerState);
     if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания сэмплера");
+        DEBUG_ERROR("Ошибка создания сэмплера для дебажной текстуры");
         srv->Release();
         texture->Release();
-        converter->Release();
-        frame->Release();
-        decoder->Release();
-        wicFactory->Release();
-        CoUninitialize();
         return false;
     }
 
-    // Освобождаем ресурсы
-    converter->Release();
-    frame->Release();
-    decoder->Release();
-    wicFactory->Release();
-    CoUninitialize();
-
-    char buffer[256];
-    sprintf_s(buffer, "Текстура загружена успешно: %dx%d", width, height);
-    DEBUG_SUCCESS(buffer);
-
+    DEBUG_SUCCESS("Дебажная текстура создана");
     return true;
 }
 
-bool Texture2D::CreateDebugTexture(ID3D11Device* device, const wchar_t* name) {
-    this->filename = L"[DEBUG]" + std::wstring(name);
-    width = 256;
-    height = 256;
+void Texture2D::Cleanup() {
+    if (samplerState) samplerState->Release();
+    if (srv) srv->Release();
+    if (texture) texture->Release();
+}
 
-    DEBUG_LOG_W(L"Создание дебажной текстуры: " + std::wstring(name));
+// ==================== АТЛАС ТЕКСТУР ====================
+// Мелкие текстуры материалов модели собираются при загрузке в общие страницы атласа,
+// UV вершин переносятся в прямоугольник текстуры на странице. Сабмеши таких материалов
+// делят одну текстуру и сэмплер - привязка на страницу, а не на материал.
+const bool USE_TEXTURE_ATLAS = true;
+const int ATLAS_MAX_TEXTURE_SIZE = 256; // Текстуры больше по любой стороне остаются отдельными
+const int ATLAS_PAGE_SIZE = 2048;       // Наибольшая страница; меньший набор - меньшая страница
+const int ATLAS_MIN_PAGE_SIZE = 256;
+// Поле вокруг текстуры, залитое её краевыми пикселями. Места кратны ему, поэтому на мипах
+// 1..log2(ATLAS_PADDING) усреднение не смешивает соседей; более грубые мипы не строятся.
+const int ATLAS_PADDING = 8;
+const int ATLAS_MIP_LEVELS = 4; // 1 + log2(ATLAS_PADDING)
+const float ATLAS_UV_EPSILON = 0.001f;
+
+// Упаковка прямоугольников MaxRects (Best Short Side Fit): свободное место - набор
+// максимальных пересекающихся прямоугольников, новый кладётся туда, где меньше остаток
+// по короткой стороне. Без поворота - иначе пришлось бы менять местами U и V.
+class RectPacker {
+public:
+    struct Rect {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+    };
 
-    // Создаем пиксели для дебажной текстуры (шахматный паттерн)
-    std::vector<BYTE> pixels(width * height * 4);
+    void Reset(int width, int height) {
+        pageWidth = width;
+        pageHeight = height;
+        usedArea = 0;
+        freeRects.clear();
+        freeRects.push_back({ 0, 0, width, height });
+    }
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = (y * width + x) * 4;
-            bool isChecker = ((x / 32) + (y / 32)) % 2 == 0;
+    bool Insert(int width, int height, Rect& placed) {
+        int bestShort = INT_MAX;
+        int bestLong = INT_MAX;
+        for (const Rect& free : freeRects) {
+            if (width > free.width || height > free.height) continue;
+            int leftoverX = free.width - width;
+            int leftoverY = free.height - height;
+            int shortSide = std::min(leftoverX, leftoverY);
+            int longSide = std::max(leftoverX, leftoverY);
+            if (shortSide < bestShort || (shortSide == bestShort && longSide < bestLong)) {
+                placed = { free.x, free.y, width, height };
+                bestShort = shortSide;
+                bestLong = longSide;
+            }
+        }
+        if (bestShort == INT_MAX) return false;
+
+        SplitFreeRects(placed);
+        PruneFreeRects();
+        usedArea += (int64_t)width * height;
+        return true;
+    }
+
+    float GetOccupancy() const {
+        return (pageWidth > 0 && pageHeight > 0) ? (float)usedArea / ((float)pageWidth * pageHeight) : 0.0f;
+    }
+
+private:
+    int pageWidth = 0;
+    int pageHeight = 0;
+    int64_t usedArea = 0;
+    std::vector<Rect> freeRects;
+
+    static bool Contains(const Rect& outer, const Rect& inner) {
+        return inner.x >= outer.x && inner.y >= outer.y &&
+            inner.x + inner.width <= outer.x + outer.width &&
+            inner.y + inner.height <= outer.y + outer.height;
+    }
+
+    // Каждый свободный прямоугольник, задетый занятым, заменяется до четырёх остатками
+    void SplitFreeRects(const Rect& used) {
+        size_t count = freeRects.size();
+        for (size_t i = 0; i < count;) {
+            Rect free = freeRects[i];
+            if (used.x >= free.x + free.width || used.x + used.width <= free.x ||
+                used.y >= free.y + free.height || used.y + used.height <= free.y) {
+                i++;
+                continue;
+            }
+
+            if (used.x > free.x) {
+                freeRects.push_back({ free.x, free.y, used.x - free.x, free.height });
+            }
+            if (used.x + used.width < free.x + free.width) {
+                freeRects.push_back({ used.x + used.width, free.y, free.x + free.width - used.x - used.width, free.height });
+            }
+            if (used.y > free.y) {
+                freeRects.push_back({ free.x, free.y, free.width, used.y - free.y });
+            }
+            if (used.y + used.height < free.y + free.height) {
+                freeRects.push_back({ free.x, used.y + used.height, free.width, free.y + free.height - used.y - used.height });
+            }
+
+            freeRects[i] = freeRects.back();
+            freeRects.pop_back();
+            if (freeRects.size() < count) count--;
+        }
+    }
+
+    // Прямоугольники, целиком лежащие в других, не нужны
+    void PruneFreeRects() {
+        for (size_t i = 0; i < freeRects.size(); i++) {
+            for (size_t j = i + 1; j < freeRects.size();) {
+                if (Contains(freeRects[i], freeRects[j])) {
+                    freeRects.erase(freeRects.begin() + j);
+                    continue;
+                }
+                if (Contains(freeRects[j], freeRects[i])) {
+                    freeRects.erase(freeRects.begin() + i);
+                    i--;
+                    break;
+                }
+                j++;
+            }
+        }
+    }
+};
+
+// Результат сборки: страницы для выгрузки и страница каждого попавшего в атлас материала
+struct TextureAtlas {
+    std::vector<DecodedImage> pages;
+    std::unordered_map<NameId, uint32_t> pageByMaterial;
+    std::vector<std::wstring> sources; // Картинки в атласе - для горячей перезагрузки модели
+};
+
+// Место материала на странице: uv' = offset + clamp(uv, 0, 1) * scale
+struct AtlasPlacement {
+    uint32_t page = 0;
+    float offsetU = 0.0f;
+    float offsetV = 0.0f;
+    float scaleU = 1.0f;
+    float scaleV = 1.0f;
+};
+
+// Собранный атлас рядом с мешем модели: <модель>.atlascache. Сжатые уровни страниц и места
+// материалов - повторный запуск не декодирует, не упаковывает и не сжимает картинки.
+// Устаревает при смене кэша меша (UV), картинок материалов или найденных для них путей.
+const uint32_t ATLAS_CACHE_MAGIC = 0x43415453; // 'STAC'
+const uint32_t ATLAS_CACHE_VERSION = 1;
+
+class TextureAtlasCache {
+public:
+    // Кэш меша - <модель>.meshcache, атлас - <модель>.atlascache
+    static std::wstring GetCachePath(const std::wstring& meshCachePath) {
+        size_t dot = meshCachePath.rfind(L'.');
+        size_t slash = meshCachePath.find_last_of(L"/\\");
+        if (dot == std::wstring::npos || (slash != std::wstring::npos && dot < slash)) {
+            return meshCachePath + L".atlascache";
+        }
+        return meshCachePath.substr(0, dot) + L".atlascache";
+    }
+
+    // inputs - всё, от чего зависит атлас (меш и картинки материалов); inputHash - материалы,
+    // пути их картинок и настройки сборки
+    static bool Write(const std::wstring& cachePath, uint64_t inputHash, const std::vector<std::wstring>& inputs,
+        const TextureAtlas& atlas, const std::unordered_map<NameId, AtlasPlacement>& placements) {
+
+        std::vector<char> blob(sizeof(CacheHeader), 0);
+        auto append = [&blob](const void* bytes, size_t size) {
+            blob.resize((size_t)AlignUp(blob.size(), 16), 0);
+            uint64_t offset = blob.size();
+            if (size > 0) blob.insert(blob.end(), (const char*)bytes, (const char*)bytes + size);
+            return offset;
+        };
+
+        std::vector<CacheSource> sourceRecords;
+        for (const std::wstring& input : inputs) {
+            CacheSource record = {};
+            SourceStamp stamp = SourceStamp::Of(input);
+            record.size = stamp.size;
+            record.modifiedTime = stamp.modifiedTime;
+            record.contentHash = SourceStamp::ContentHash(input);
+            record.inAtlas = std::find(atlas.sources.begin(), atlas.sources.end(), input) != atlas.sources.end() ? 1 : 0;
+            std::string path = FileSystemHelper::ToUtf8(input);
+            record.pathLength = (uint32_t)path.size();
+            record.pathOffset = append(path.data(), path.size());
+            sourceRecords.push_back(record);
+        }
+
+        std::vector<CachePlacement> placementRecords;
+        for (const auto& entry : placements) {
+            CachePlacement record = {};
+            record.materialId = entry.first;
+            record.page = entry.second.page;
+            record.offsetU = entry.second.offsetU;
+            record.offsetV = entry.second.offsetV;
+            record.scaleU = entry.second.scaleU;
+            record.scaleV = entry.second.scaleV;
+            placementRecords.push_back(record);
+        }
+
+        std::vector<CachePage> pageRecords;
+        for (const DecodedImage& page : atlas.pages) {
+            std::vector<CacheLevel> levels(1 + page.mips.size());
+            for (size_t i = 0; i < levels.size(); i++) {
+                const std::vector<BYTE>& level = (i == 0) ? page.pixels : page.mips[i - 1];
+                levels[i].size = level.size();
+                levels[i].offset = append(level.data(), level.size());
+            }
+
+            CachePage record = {};
+            record.format = page.format;
+            record.width = (uint32_t)page.width;
+            record.height = (uint32_t)page.height;
+            record.levelCount = (uint32_t)levels.size();
+            record.levelsOffset = append(levels.data(), sizeof(CacheLevel) * levels.size());
+            pageRecords.push_back(record);
+        }
+
+        CacheHeader header = {};
+        header.magic = ATLAS_CACHE_MAGIC;
+        header.version = ATLAS_CACHE_VERSION;
+        header.sourceCount = (uint32_t)sourceRecords.size();
+        header.placementCount = (uint32_t)placementRecords.size();
+        header.pageCount = (uint32_t)pageRecords.size();
+        header.inputHash = inputHash;
+        header.sourcesOffset = append(sourceRecords.data(), sizeof(CacheSource) * sourceRecords.size());
+        header.placementsOffset = append(placementRecords.data(), sizeof(CachePlacement) * placementRecords.size());
+        header.pagesOffset = append(pageRecords.data(), sizeof(CachePage) * pageRecords.size());
+        header.fileSize = blob.size();
+        memcpy(blob.data(), &header, sizeof(header));
+
+        // Пишем во временный файл и переименовываем, чтобы не оставить обрезанный кэш
+        std::wstring tempPath = cachePath + L".tmp";
+        {
+            std::ofstream out(FileSystemHelper::ToPath(tempPath), std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) {
+                DEBUG_WARNING("Не удалось создать файл кэша атласа");
+                return false;
+            }
+            out.write(blob.data(), (std::streamsize)blob.size());
+            if (!out.good()) {
+                DEBUG_WARNING("Ошибка записи кэша атласа");
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(FileSystemHelper::ToPath(tempPath), FileSystemHelper::ToPath(cachePath), ec);
+        if (ec) {
+            std::filesystem::remove(FileSystemHelper::ToPath(tempPath), ec);
+            DEBUG_WARNING("Не удалось переименовать файл кэша атласа");
+            return false;
+        }
+
+        char buffer[256];
+        sprintf_s(buffer, "Кэш атласа записан: %zu страниц, %zu материалов, %zu байт",
+            pageRecords.size(), placementRecords.size(), blob.size());
+        DEBUG_LOG(buffer);
+        return true;
+    }
+
+    // Страницы копируются в atlas.pages, картинки атласа - в atlas.sources
+    static bool Read(const std::wstring& cachePath, uint64_t inputHash, TextureAtlas& atlas,
+        std::unordered_map<NameId, AtlasPlacement>& placements) {
+        AssetFile file;
+        if (!file.Open(cachePath)) return false;
+
+        TextureAtlas result;
+        std::unordered_map<NameId, AtlasPlacement> resultPlacements;
+        if (!Validate(file, inputHash, result, resultPlacements)) return false;
+
+        atlas = std::move(result);
+        placements = std::move(resultPlacements);
+        return true;
+    }
+
+private:
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t sourceCount;
+        uint32_t placementCount;
+        uint32_t pageCount;
+        uint32_t padding;
+        uint64_t inputHash;
+        uint64_t sourcesOffset;
+        uint64_t placementsOffset;
+        uint64_t pagesOffset;
+        uint64_t fileSize;
+    };
+
+    struct CacheSource {
+        uint64_t pathOffset;
+        uint32_t pathLength;
+        uint32_t inAtlas; // 1 - картинка на странице, 0 - меш или картинка вне атласа
+        uint64_t size;
+        int64_t modifiedTime;
+        uint64_t contentHash;
+    };
+
+    struct CachePlacement {
+        NameId materialId;
+        uint32_t page;
+        float offsetU;
+        float offsetV;
+        float scaleU;
+        float scaleV;
+    };
+
+    struct CachePage {
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+        uint64_t levelsOffset;
+    };
+
+    struct CacheLevel {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    static uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static bool InRange(uint64_t offset, uint64_t size, uint64_t total) {
+        return offset <= total && size <= total - offset;
+    }
+
+    static bool Validate(const AssetFile& file, uint64_t inputHash, TextureAtlas& atlas,
+        std::unordered_map<NameId, AtlasPlacement>& placements) {
+        const char* data = file.Data();
+        uint64_t total = file.Size();
+        if (total < sizeof(CacheHeader)) return false;
+
+        CacheHeader header;
+        memcpy(&header, data, sizeof(header));
+        if (header.magic != ATLAS_CACHE_MAGIC || header.version != ATLAS_CACHE_VERSION || header.fileSize != total) {
+            DEBUG_LOG("Кэш атласа другой версии или повреждён");
+            return false;
+        }
+        if (header.inputHash != inputHash) {
+            DEBUG_LOG("Кэш атласа устарел: изменились материалы или пути их картинок");
+            return false;
+        }
+        if (!InRange(header.sourcesOffset, sizeof(CacheSource) * (uint64_t)header.sourceCount, total) ||
+            !InRange(header.placementsOffset, sizeof(CachePlacement) * (uint64_t)header.placementCount, total) ||
+            !InRange(header.pagesOffset, sizeof(CachePage) * (uint64_t)header.pageCount, total)) {
+            DEBUG_LOG("Кэш атласа повреждён: таблицы выходят за пределы файла");
+            return false;
+        }
+
+        // Как у кэша меша: отсутствующий файл - данные поставлены без исходников
+        for (uint32_t i = 0; i < header.sourceCount; i++) {
+            CacheSource source;
+            memcpy(&source, data + header.sourcesOffset + sizeof(CacheSource) * i, sizeof(source));
+            if (!InRange(source.pathOffset, source.pathLength, total)) return false;
+
+            std::string path(data + source.pathOffset, source.pathLength);
+            std::wstring sourcePath = FileSystemHelper::FromUtf8(path);
+            if (source.inAtlas) atlas.sources.push_back(sourcePath);
+
+            std::error_code ec;
+            if (!std::filesystem::exists(FileSystemHelper::ToPath(sourcePath), ec)) continue;
+            SourceStamp stamp = SourceStamp::Of(sourcePath);
+            if (stamp.size == source.size && stamp.modifiedTime == source.modifiedTime) continue;
+            if (stamp.size != source.size || SourceStamp::ContentHash(sourcePath) != source.contentHash) {
+                DEBUG_LOG("Кэш атласа устарел: изменился " + path);
+                return false;
+            }
+        }
+
+        for (uint32_t page = 0; page < header.pageCount; page++) {
+            CachePage record;
+            memcpy(&record, data + header.pagesOffset + sizeof(CachePage) * page, sizeof(record));
+            TextureFormat format = (TextureFormat)record.format;
+            if (record.format > TEXTURE_BC7 || record.width != record.height ||
+                record.width < (uint32_t)ATLAS_MIN_PAGE_SIZE || record.width > (uint32_t)ATLAS_PAGE_SIZE ||
+                record.levelCount == 0 || record.levelCount > (uint32_t)ATLAS_MIP_LEVELS ||
+                !InRange(record.levelsOffset, sizeof(CacheLevel) * (uint64_t)record.levelCount, total)) {
+                DEBUG_LOG("Кэш атласа повреждён: неверная страница");
+                return false;
+            }
+
+            DecodedImage image;
+            image.width = (int)record.width;
+            image.height = (int)record.height;
+            image.format = format;
+            image.mips.resize(record.levelCount - 1);
+            for (uint32_t i = 0; i < record.levelCount; i++) {
+                CacheLevel level;
+                memcpy(&level, data + record.levelsOffset + sizeof(CacheLevel) * i, sizeof(level));
+                int levelWidth = std::max(1, image.width >> i);
+                int levelHeight = std::max(1, image.height >> i);
+                if (level.size != BlockCompressor::GetLevelSize(format, levelWidth, levelHeight) ||
+                    !InRange(level.offset, level.size, total)) {
+                    DEBUG_LOG("Кэш атласа повреждён: уровни выходят за пределы файла");
+                    return false;
+                }
+                std::vector<BYTE>& target = (i == 0) ? image.pixels : image.mips[i - 1];
+                target.assign((const BYTE*)data + level.offset, (const BYTE*)data + level.offset + level.size);
+            }
+            atlas.pages.push_back(std::move(image));
+        }
+
+        for (uint32_t i = 0; i < header.placementCount; i++) {
+            CachePlacement record;
+            memcpy(&record, data + header.placementsOffset + sizeof(CachePlacement) * i, sizeof(record));
+            if (record.page >= header.pageCount) {
+                DEBUG_LOG("Кэш атласа повреждён: материал на несуществующей странице");
+                return false;
+            }
+
+            AtlasPlacement placement;
+            placement.page = record.page;
+            placement.offsetU = record.offsetU;
+            placement.offsetV = record.offsetV;
+            placement.scaleU = record.scaleU;
+            placement.scaleV = record.scaleV;
+            placements[record.materialId] = placement;
+        }
+        return true;
+    }
+};
+
+class TextureAtlasBuilder {
+public:
+    // Без устройства - можно звать из фонового потока. Вершины сабмешей с материалами
+    // из атласа копируются в remapped с новыми UV, сабмеши переключаются на копии.
+    // Готовый атлас берётся из кэша рядом с meshCachePath, собранный - туда пишется.
+    static void Build(const MaterialTable& materials, std::vector<MeshCache::Submesh>& submeshes,
+        std::vector<std::vector<Vertex>>& remapped, TextureAtlas& atlas, const std::wstring& meshCachePath) {
+        if (!USE_TEXTURE_ATLAS) return;
+        auto start = std::chrono::steady_clock::now();
+
+        // UV берутся из меша, картинки - по путям материалов: всё это ключ кэша
+        std::vector<std::wstring> inputs = { meshCachePath };
+        uint64_t inputHash = HashInputs(materials, inputs);
+        std::wstring cachePath = TextureAtlasCache::GetCachePath(meshCachePath);
+        std::unordered_map<NameId, AtlasPlacement> placements;
+        if (TextureAtlasCache::Read(cachePath, inputHash, atlas, placements)) {
+            ApplyPlacements(placements, submeshes, remapped, atlas);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            char buffer[256];
+            sprintf_s(buffer, "Атлас из кэша: %zu текстур на %zu страницах за %.1f мс",
+                atlas.sources.size(), atlas.pages.size(), ms);
+            DEBUG_LOG(buffer);
+            return;
+        }
+
+        std::vector<Item> items = CollectItems(materials, submeshes);
+        if (items.size() < 2) return; // Одну текстуру собирать не с чем
+
+        // Декодирование - основная часть работы, картинки независимы
+        std::vector<char> decoded(items.size(), 0);
+        ParallelFor(items.size(), GetWorkerThreadCount(0), [&](size_t i) {
+            decoded[i] = Texture2D::DecodeSource(items[i].path.c_str(), items[i].image) ? 1 : 0;
+        });
+        size_t kept = 0;
+        for (size_t i = 0; i < items.size(); i++) {
+            if (!decoded[i]) continue;
+            // Перемещение в себя опустошило бы картинку
+            if (kept != i) items[kept] = std::move(items[i]);
+            kept++;
+        }
+        items.resize(kept);
+        if (items.size() < 2) return;
+
+        // Крупные первыми - MaxRects плотнее укладывает по убыванию
+        std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+            int sideA = std::max(SlotSize(a.image.width), SlotSize(a.image.height));
+            int sideB = std::max(SlotSize(b.image.width), SlotSize(b.image.height));
+            return sideA != sideB ? sideA > sideB : a.image.width * a.image.height > b.image.width * b.image.height;
+        });
+
+        std::vector<PageLayout> layouts = Pack(items);
+        for (uint32_t page = 0; page < (uint32_t)layouts.size(); page++) {
+            atlas.pages.push_back(ComposePage(items, layouts[page], page));
+        }
+
+        // Место текстуры без полей в долях страницы
+        for (const Item& item : items) {
+            int size = layouts[item.page].size;
+            AtlasPlacement placement;
+            placement.page = item.page;
+            placement.scaleU = (float)item.image.width / size;
+            placement.scaleV = (float)item.image.height / size;
+            placement.offsetU = (float)(item.slot.x + ATLAS_PADDING) / size;
+            placement.offsetV = (float)(item.slot.y + ATLAS_PADDING) / size;
+            for (NameId material : item.materials) placements[material] = placement;
+            atlas.sources.push_back(item.path);
+        }
+        ApplyPlacements(placements, submeshes, remapped, atlas);
+        TextureAtlasCache::Write(cachePath, inputHash, inputs, atlas, placements);
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        char buffer[256];
+        sprintf_s(buffer, "Атлас: %zu текстур на %zu страницах за %.1f мс", items.size(), layouts.size(), ms);
+        DEBUG_LOG(buffer);
+        for (uint32_t page = 0; page < (uint32_t)layouts.size(); page++) {
+            const PageLayout& layout = layouts[page];
+            sprintf_s(buffer, "  Страница %u: %dx%d, текстур %u, занято %.1f%% (с полями %.1f%%)",
+                page, layout.size, layout.size, layout.textureCount,
+                100.0f * (float)layout.textureArea / ((float)layout.size * layout.size), 100.0f * layout.occupancy);
+            DEBUG_LOG(buffer);
+        }
+    }
+
+private:
+    struct Item {
+        std::wstring path;
+        std::vector<NameId> materials; // Материалы с этой картинкой
+        DecodedImage image;
+        RectPacker::Rect slot;         // Место с полями на странице
+        uint32_t page = 0;
+    };
+
+    struct PageLayout {
+        int size = 0;
+        uint32_t textureCount = 0;
+        int64_t textureArea = 0;
+        float occupancy = 0.0f;
+    };
+
+    // Место текстуры: размер, выровненный по полю, плюс поле с каждой стороны
+    static int SlotSize(int size) {
+        return (size + ATLAS_PADDING - 1) / ATLAS_PADDING * ATLAS_PADDING + 2 * ATLAS_PADDING;
+    }
+
+    // Перенос UV: (u, v) в 0..1 -> прямоугольник текстуры на странице
+    static void ApplyPlacements(const std::unordered_map<NameId, AtlasPlacement>& placements,
+        std::vector<MeshCache::Submesh>& submeshes, std::vector<std::vector<Vertex>>& remapped, TextureAtlas& atlas) {
+        for (MeshCache::Submesh& submesh : submeshes) {
+            auto found = placements.find(submesh.materialId);
+            if (found == placements.end()) continue;
+            const AtlasPlacement& placement = found->second;
+
+            remapped.emplace_back(submesh.vertices, submesh.vertices + submesh.vertexCount);
+            for (Vertex& v : remapped.back()) {
+                v.texcoord.x = placement.offsetU + std::min(std::max(v.texcoord.x, 0.0f), 1.0f) * placement.scaleU;
+                v.texcoord.y = placement.offsetV + std::min(std::max(v.texcoord.y, 0.0f), 1.0f) * placement.scaleV;
+            }
+            submesh.vertices = remapped.back().data();
+        }
+        for (const auto& entry : placements) atlas.pageByMaterial[entry.first] = entry.second.page;
+    }
+
+    // FNV-1a по настройкам сборки, материалам и путям их картинок; найденные картинки
+    // добавляются в inputs - кэш проверит их содержимое
+    static uint64_t HashInputs(const MaterialTable& materials, std::vector<std::wstring>& inputs) {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const void* data, size_t size) {
+            const BYTE* bytes = (const BYTE*)data;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+        };
+
+        const int settings[] = { ATLAS_MAX_TEXTURE_SIZE, ATLAS_PAGE_SIZE, ATLAS_MIN_PAGE_SIZE, ATLAS_PADDING,
+            ATLAS_MIP_LEVELS, GENERATE_TEXTURE_MIPS ? 1 : 0, USE_TEXTURE_CACHE ? 1 : 0, TEXTURE_CACHE_USE_BC7 ? 1 : 0 };
+        mix(settings, sizeof(settings));
+
+        for (const Material& mat : materials) {
+            if (mat.textureFilename.empty()) continue;
+            std::wstring input = FindTexture(mat);
+            std::string path = FileSystemHelper::ToUtf8(input);
+            mix(&mat.id, sizeof(mat.id));
+            mix(mat.textureFilename.data(), mat.textureFilename.size() + 1);
+            mix(path.data(), path.size() + 1);
+            if (!input.empty() && std::find(inputs.begin(), inputs.end(), input) == inputs.end()) {
+                inputs.push_back(input);
+            }
+        }
+        return hash;
+    }
+
+    // Мелкие картинки материалов; повтор текстуры (UV вне 0..1) в атласе невозможен
+    static std::vector<Item> CollectItems(const MaterialTable& materials,
+        const std::vector<MeshCache::Submesh>& submeshes) {
+        std::vector<Item> items;
+        for (const Material& mat : materials) {
+            if (mat.textureFilename.empty()) continue;
+
+            std::wstring path = FindTexture(mat);
+            if (path.empty()) continue;
+
+            auto existing = std::find_if(items.begin(), items.end(), [&](const Item& item) { return item.path == path; });
+            if (existing != items.end()) {
+                if (HasUvInRange(submeshes, mat.id)) existing->materials.push_back(mat.id);
+                continue;
+            }
+
+            DecodedImage header;
+            if (!Texture2D::DecodeSource(path.c_str(), header, true)) continue;
+            if (header.width > ATLAS_MAX_TEXTURE_SIZE || header.height > ATLAS_MAX_TEXTURE_SIZE) continue;
+            if (!HasUvInRange(submeshes, mat.id)) {
+                DEBUG_LOG("Материал " + mat.name + ": UV вне 0..1, текстура не идёт в атлас");
+                continue;
+            }
+
+            Item item;
+            item.path = path;
+            item.materials.push_back(mat.id);
+            items.push_back(std::move(item));
+        }
+
+        // Материал с той же картинкой, но с повтором, оставил бы её и отдельной текстурой
+        items.erase(std::remove_if(items.begin(), items.end(), [&](const Item& item) {
+            for (const Material& mat : materials) {
+                if (mat.textureFilename.empty() ||
+                    std::find(item.materials.begin(), item.materials.end(), mat.id) != item.materials.end()) {
+                    continue;
+                }
+                if (FindTexture(mat) == item.path) return true;
+            }
+            return false;
+        }), items.end());
+        return items;
+    }
+
+    // Поиск как у TextureManager::LoadTextureAsync - путь тот же, что у отдельной текстуры
+    static std::wstring FindTexture(const Material& mat) {
+        std::wstring textureFile = FileSystemHelper::FromUtf8(mat.textureFilename);
+        std::wstring path = FileSystemHelper::FindImageFile(textureFile);
+        return path.empty() ? FileSystemHelper::FindFile(textureFile) : path;
+    }
+
+    static bool HasUvInRange(const std::vector<MeshCache::Submesh>& submeshes, NameId material) {
+        for (const MeshCache::Submesh& submesh : submeshes) {
+            if (submesh.materialId != material) continue;
+            for (uint32_t i = 0; i < submesh.vertexCount; i++) {
+                const XMFLOAT2& uv = submesh.vertices[i].texcoord;
+                if (uv.x < -ATLAS_UV_EPSILON || uv.x > 1.0f + ATLAS_UV_EPSILON ||
+                    uv.y < -ATLAS_UV_EPSILON || uv.y > 1.0f + ATLAS_UV_EPSILON) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Всё на одну страницу наименьшего подходящего размера; не влезает в ATLAS_PAGE_SIZE -
+    // страницы наибольшего размера, пока не уложится всё
+    static std::vector<PageLayout> Pack(std::vector<Item>& items) {
+        RectPacker packer;
+        for (int size = ATLAS_MIN_PAGE_SIZE; size <= ATLAS_PAGE_SIZE; size *= 2) {
+            packer.Reset(size, size);
+            bool fits = true;
+            for (Item& item : items) {
+                item.page = 0;
+                if (!packer.Insert(SlotSize(item.image.width), SlotSize(item.image.height), item.slot)) {
+                    fits = false;
+                    break;
+                }
+            }
+            if (fits) {
+                PageLayout layout;
+                layout.size = size;
+                layout.occupancy = packer.GetOccupancy();
+                std::vector<PageLayout> layouts = { layout };
+                CountTextures(items, layouts);
+                return layouts;
+            }
+        }
+
+        std::vector<RectPacker> packers;
+        for (Item& item : items) {
+            int slotWidth = SlotSize(item.image.width);
+            int slotHeight = SlotSize(item.image.height);
+            bool placed = false;
+            for (uint32_t page = 0; page < (uint32_t)packers.size() && !placed; page++) {
+                placed = packers[page].Insert(slotWidth, slotHeight, item.slot);
+                if (placed) item.page = page;
+            }
+            if (!placed) {
+                packers.emplace_back();
+                packers.back().Reset(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+                packers.back().Insert(slotWidth, slotHeight, item.slot);
+                item.page = (uint32_t)packers.size() - 1;
+            }
+        }
+
+        std::vector<PageLayout> layouts(packers.size());
+        for (size_t page = 0; page < packers.size(); page++) {
+            layouts[page].size = ATLAS_PAGE_SIZE;
+            layouts[page].occupancy = packers[page].GetOccupancy();
+        }
+        CountTextures(items, layouts);
+        return layouts;
+    }
+
+    static void CountTextures(const std::vector<Item>& items, std::vector<PageLayout>& layouts) {
+        for (const Item& item : items) {
+            layouts[item.page].textureCount++;
+            layouts[item.page].textureArea += (int64_t)item.image.width * item.image.height;
+        }
+    }
 
-            if (isChecker) {
-                pixels[idx] = 255;     // Blue
-                pixels[idx + 1] = 200; // Green
-                pixels[idx + 2] = 150; // Red
-            }
-            else {
-                pixels[idx] = 100;     // Blue
-                pixels[idx + 1] = 150; // Green
-                pixels[idx + 2] = 200; // Red
+    // Копирует текстуры страницы на места и заливает поля краевыми пикселями, затем мипы
+    // (только безопасные для полей) и то же сжатие, что у отдельных текстур
+    static DecodedImage ComposePage(const std::vector<Item>& items, const PageLayout& layout, uint32_t page) {
+        DecodedImage image;
+        image.width = layout.size;
+        image.height = layout.size;
+        image.pixels.assign((size_t)layout.size * layout.size * 4, 0);
+
+        for (const Item& item : items) {
+            if (item.page != page) continue;
+            const DecodedImage& source = item.image;
+            for (int y = 0; y < item.slot.height; y++) {
+                int sourceY = std::min(std::max(y - ATLAS_PADDING, 0), source.height - 1);
+                BYTE* row = &image.pixels[((size_t)(item.slot.y + y) * layout.size + item.slot.x) * 4];
+                const BYTE* sourceRow = &source.pixels[(size_t)sourceY * source.width * 4];
+                for (int x = 0; x < item.slot.width; x++) {
+                    int sourceX = std::min(std::max(x - ATLAS_PADDING, 0), source.width - 1);
+                    memcpy(row + (size_t)x * 4, sourceRow + (size_t)sourceX * 4, 4);
+                }
             }
-            pixels[idx + 3] = 255; // Alpha
         }
+
+        if (GENERATE_TEXTURE_MIPS) {
+            MipGenerator::Build(image.pixels.data(), image.width, image.height, image.mips);
+            if (image.mips.size() > (size_t)ATLAS_MIP_LEVELS - 1) image.mips.resize(ATLAS_MIP_LEVELS - 1);
+        }
+        if (USE_TEXTURE_CACHE) {
+            // Не файл на диске - кэш рядом не пишется
+            Texture2D::CompressImage(L"[ATLAS]", image);
+        }
+        return image;
     }
+};
 
-    // Создаем текстуру DirectX
-    D3D11_TEXTURE2D_DESC texDesc = {};
-    texDesc.Width = width;
-    texDesc.Height = height;
-    texDesc.MipLevels = 1;
-    texDesc.ArraySize = 1;
-    texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    texDesc.SampleDesc.Count = 1;
-    texDesc.SampleDesc.Quality = 0;
-    texDesc.Usage = D3D11_USAGE_DEFAULT;
-    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-    texDesc.CPUAccessFlags = 0;
+// ==================== МАТЕРИАЛЫ НА GPU ====================
+// Все материалы модели лежат в одном структурированном буфере (t1), пиксельный шейдер
+// читает свой по индексу. Индекс приходит из потока экземпляров: ShaderManager держит
+// буфер 0..MAX_GPU_MATERIALS-1 в слоте 1, и DrawIndexedInstanced с StartInstanceLocation =
+// индексу материала отдаёт его вершинам без обновления констант на каждый вызов.
+const uint32_t MAX_GPU_MATERIALS = 1024;
+
+// 48 байт, как MaterialData в шейдере
+struct GpuMaterial {
+    XMFLOAT4 diffuse;  // rgb - Kd, a - d
+    XMFLOAT4 ambient;  // rgb - оттенок фонового света (Ka), a - 1, если есть map_Kd
+    XMFLOAT4 specular; // rgb - Ks, a - Ns
+};
 
-    D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = pixels.data();
-    initData.SysMemPitch = width * 4;
-    initData.SysMemSlicePitch = 0;
+class GpuMaterialTable {
+private:
+    ID3D11Buffer* buffer = nullptr;
+    ID3D11ShaderResourceView* srv = nullptr;
+    uint32_t count = 0;
+    uint32_t id = 0; // Новый при каждом Create - поле материала в ключе сортировки
 
-    HRESULT hr = device->CreateTexture2D(&texDesc, &initData, &texture);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания дебажной текстуры");
-        return false;
+public:
+    // Ka нормируется по яркости: от него берётся только оттенок фонового света,
+    // уровень остаётся прежним (серый Ka даёт тот же свет, что и без материала)
+    static GpuMaterial FromMaterial(const Material& mat, bool textured) {
+        float ambientMax = std::max(mat.ambient.x, std::max(mat.ambient.y, mat.ambient.z));
+        XMFLOAT3 tint = (ambientMax > 0.0f) ?
+            XMFLOAT3(mat.ambient.x / ambientMax, mat.ambient.y / ambientMax, mat.ambient.z / ambientMax) :
+            XMFLOAT3(1.0f, 1.0f, 1.0f);
+
+        GpuMaterial record;
+        record.diffuse = XMFLOAT4(mat.diffuse.x, mat.diffuse.y, mat.diffuse.z, mat.alpha);
+        record.ambient = XMFLOAT4(tint.x, tint.y, tint.z, textured ? 1.0f : 0.0f);
+        record.specular = XMFLOAT4(mat.specular.x, mat.specular.y, mat.specular.z, mat.shininess);
+        return record;
     }
 
-    // Создаем шейдерный ресурс
-    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-    srvDesc.Format = texDesc.Format;
-    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-    srvDesc.Texture2D.MostDetailedMip = 0;
-    srvDesc.Texture2D.MipLevels = 1;
-
-    hr = device->CreateShaderResourceView(texture, &srvDesc, &srv);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания SRV для дебажной текстуры");
-        texture->Release();
-        return false;
+    // Белый матовый материал: цвет целиком из текстуры и вершин
+    static GpuMaterial Textured() {
+        GpuMaterial record;
+        record.diffuse = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+        record.ambient = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+        record.specular = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+        return record;
     }
 
-    // Создаем сэмплер
-    D3D11_SAMPLER_DESC sampDesc = {};
-    sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-    sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-    sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-    sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-    sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-    sampDesc.MinLOD = 0;
-    sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+    bool Create(ID3D11Device* device, const std::vector<GpuMaterial>& records) {
+        if (records.empty() || records.size() > MAX_GPU_MATERIALS) {
+            DEBUG_ERROR("Неверное число материалов для буфера");
+            return false;
+        }
 
-    hr = device->CreateSamplerState(&sampDesc, &samplerState);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания сэмплера для дебажной текстуры");
-        srv->Release();
-        texture->Release();
-        return false;
-    }
+        D3D11_BUFFER_DESC desc = {};
+        desc.Usage = D3D11_USAGE_IMMUTABLE;
+        desc.ByteWidth = (UINT)(sizeof(GpuMaterial) * records.size());
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+        desc.StructureByteStride = sizeof(GpuMaterial);
 
-    DEBUG_SUCCESS("Дебажная текстура создана");
-    return true;
-}
+        D3D11_SUBRESOURCE_DATA init = {};
+        init.pSysMem = records.data();
 
-bool Texture2D::CreateColorTexture(ID3D11Device* device, const wchar_t* name, float r, float g, float b) {
-    this->filename = L"[COLOR]" + std::wstring(name);
-    width = 1;
-    height = 1;
+        ID3D11Buffer* newBuffer = nullptr;
+        if (FAILED(device->CreateBuffer(&desc, &init, &newBuffer))) {
+            DEBUG_ERROR("Ошибка создания буфера материалов");
+            return false;
+        }
 
-    DEBUG_LOG_W(L"Создание цветной текстуры: " + std::wstring(name));
+        D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+        srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+        srvDesc.Buffer.FirstElement = 0;
+        srvDesc.Buffer.NumElements = (UINT)records.size();
 
-    // Создаем пиксели для цветной текстуры (1x1 пиксель)
-    std::vector<BYTE> pixels(4);
-    pixels[0] = (BYTE)(b * 255);  // Blue
-    pixels[1] = (BYTE)(g * 255);  // Green
-    pixels[2] = (BYTE)(r * 255);  // Red
-    pixels[3] = 255;              // Alpha
+        ID3D11ShaderResourceView* newSrv = nullptr;
+        if (FAILED(device->CreateShaderResourceView(newBuffer, &srvDesc, &newSrv))) {
+            DEBUG_ERROR("Ошибка создания SRV буфера материалов");
+            newBuffer->Release();
+            return false;
+        }
 
-    // Создаем текстуру DirectX
-    D3D11_TEXTURE2D_DESC texDesc = {};
-    texDesc.Width = 1;
-    texDesc.Height = 1;
-    texDesc.MipLevels = 1;
-    texDesc.ArraySize = 1;
-    texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    texDesc.SampleDesc.Count = 1;
-    texDesc.SampleDesc.Quality = 0;
-    texDesc.Usage = D3D11_USAGE_DEFAULT;
-    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-    texDesc.CPUAccessFlags = 0;
+        // Прежняя таблица заменяется только после успешного создания новой
+        Release();
+        buffer = newBuffer;
+        srv = newSrv;
+        count = (uint32_t)records.size();
+        static uint32_t nextId = 0;
+        id = ++nextId;
+        return true;
+    }
 
-    D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = pixels.data();
-    initData.SysMemPitch = 4;
-    initData.SysMemSlicePitch = 0;
+    ID3D11ShaderResourceView* GetView() const { return srv; }
+    uint32_t GetId() const { return id; }
+    uint32_t GetCount() const { return count; }
 
-    HRESULT hr = device->CreateTexture2D(&texDesc, &initData, &texture);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания цветной текстуры");
-        return false;
+    void Release() {
+        if (srv) srv->Release();
+        if (buffer) buffer->Release();
+        srv = nullptr;
+        buffer = nullptr;
+        count = 0;
     }
+};
 
-    // Создаем шейдерный ресурс
-    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-    srvDesc.Format = texDesc.Format;
-    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-    srvDesc.Texture2D.MostDetailedMip = 0;
-    srvDesc.Texture2D.MipLevels = 1;
+// ==================== ВЫВОД КОМАНД В D3D11 ====================
+// Поля конвейера сравниваются по отдельности: у обычного и упакованного вариантов
+// общие пиксельный шейдер, растеризатор и буферы - их заново не привязываем
+class D3D11RenderBackend : public RenderBackend {
+private:
+    ID3D11DeviceContext* context = nullptr;
+    RenderPipeline bound;
+    ID3D11Buffer* boundVertexBuffer = nullptr;
+    UINT boundVertexStride = 0;
+    ID3D11Buffer* boundIndexBuffer = nullptr;
+    DXGI_FORMAT boundIndexFormat = DXGI_FORMAT_UNKNOWN;
+    ID3D11Buffer* boundMeshConstants = nullptr;
 
-    hr = device->CreateShaderResourceView(texture, &srvDesc, &srv);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания SRV для цветной текстуры");
-        texture->Release();
-        return false;
+public:
+    void Initialize(ID3D11DeviceContext* ctx) {
+        context = ctx;
     }
 
-    // Создаем сэмплер
-    D3D11_SAMPLER_DESC sampDesc = {};
-    sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-    sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-    sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-    sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-    sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-    sampDesc.MinLOD = 0;
-    sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+    void Begin() override {
+        RenderBackend::Begin();
+        bound = RenderPipeline();
+        bound.topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+        boundVertexBuffer = nullptr;
+        boundVertexStride = 0;
+        boundIndexBuffer = nullptr;
+        boundIndexFormat = DXGI_FORMAT_UNKNOWN;
+        boundMeshConstants = nullptr;
+    }
 
-    hr = device->CreateSamplerState(&sampDesc, &samplerState);
-    if (FAILED(hr)) {
-        DEBUG_ERROR("Ошибка создания сэмплера для цветной текстуры");
-        srv->Release();
-        texture->Release();
-        return false;
+    void SetPipeline(const RenderPipeline& pipeline) override {
+        bool changed = false;
+        if (pipeline.vertexShader != bound.vertexShader) {
+            context->VSSetShader(pipeline.vertexShader, nullptr, 0);
+            changed = true;
+        }
+        if (pipeline.pixelShader != bound.pixelShader) {
+            context->PSSetShader(pipeline.pixelShader, nullptr, 0);
+            changed = true;
+        }
+        if (pipeline.inputLayout != bound.inputLayout) {
+            context->IASetInputLayout(pipeline.inputLayout);
+            changed = true;
+        }
+        if (pipeline.rasterizerState != bound.rasterizerState) {
+            context->RSSetState(pipeline.rasterizerState);
+            changed = true;
+        }
+        if (pipeline.topology != bound.topology) {
+            context->IASetPrimitiveTopology(pipeline.topology);
+            changed = true;
+        }
+        if (pipeline.constantBuffer != bound.constantBuffer) {
+            context->VSSetConstantBuffers(0, 1, &pipeline.constantBuffer);
+            context->PSSetConstantBuffers(0, 1, &pipeline.constantBuffer);
+            changed = true;
+        }
+        if (pipeline.instanceBuffer != bound.instanceBuffer || pipeline.instanceStride != bound.instanceStride) {
+            UINT offset = 0;
+            context->IASetVertexBuffers(1, 1, &pipeline.instanceBuffer, &pipeline.instanceStride, &offset);
+            changed = true;
+        }
+        bound = pipeline;
+        if (changed) stats.pipelineChanges++;
     }
 
-    DEBUG_SUCCESS("Цветная текстура создана");
-    return true;
-}
+    void SetConstants(const RenderPipeline& pipeline, const ShaderConstants& constants) override {
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        if (SUCCEEDED(context->Map(pipeline.constantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+            memcpy(mapped.pData, &constants, sizeof(constants));
+            context->Unmap(pipeline.constantBuffer, 0);
+            stats.constantUpdates++;
+        }
+    }
 
-void Texture2D::Cleanup() {
-    if (samplerState) samplerState->Release();
-    if (srv) srv->Release();
-    if (texture) texture->Release();
-}
+    void SetGeometry(ID3D11Buffer* vertexBuffer, UINT vertexStride,
+        ID3D11Buffer* indexBuffer, DXGI_FORMAT indexFormat, ID3D11Buffer* meshConstants) override {
+        bool changed = false;
+        if (vertexBuffer != boundVertexBuffer || vertexStride != boundVertexStride) {
+            UINT offset = 0;
+            context->IASetVertexBuffers(0, 1, &vertexBuffer, &vertexStride, &offset);
+            boundVertexBuffer = vertexBuffer;
+            boundVertexStride = vertexStride;
+            changed = true;
+        }
+        if (indexBuffer != boundIndexBuffer || indexFormat != boundIndexFormat) {
+            context->IASetIndexBuffer(indexBuffer, indexFormat, 0);
+            boundIndexBuffer = indexBuffer;
+            boundIndexFormat = indexFormat;
+            changed = true;
+        }
+        if (meshConstants && meshConstants != boundMeshConstants) {
+            context->VSSetConstantBuffers(1, 1, &meshConstants);
+            boundMeshConstants = meshConstants;
+            changed = true;
+        }
+        if (changed) stats.geometryChanges++;
+    }
+
+    void SetMaterials(ID3D11ShaderResourceView* materials) override {
+        context->PSSetShaderResources(1, 1, &materials);
+        stats.materialChanges++;
+    }
+
+    void SetTexture(ID3D11ShaderResourceView* texture) override {
+        context->PSSetShaderResources(0, 1, &texture);
+        stats.textureChanges++;
+    }
+
+    void SetSampler(ID3D11SamplerState* sampler) override {
+        context->PSSetSamplers(0, 1, &sampler);
+        stats.samplerChanges++;
+    }
+
+    void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int baseVertex, uint32_t material) override {
+        context->DrawIndexedInstanced(indexCount, 1, startIndex, baseVertex, material);
+        stats.drawCalls++;
+    }
+};
 
 // ==================== 3D МОДЕЛЬ ====================
 class Model3D
 {
 private:
+    // Сабмеш - диапазон в общих буферах модели (один на материал)
     struct ModelMesh {
-        ID3D11Buffer* vertexBuffer = nullptr;
-        ID3D11Buffer* indexBuffer = nullptr;
-        int textureIndex = -1;
+        TextureHandle texture; // Только map_Kd; без него шейдер текстуру не читает
+        uint32_t firstIndex = 0; // Начало в общем индексном буфере
+        int baseVertex = 0;      // Начало в общем вершинном буфере, индексы локальные
         int indexCount = 0;
         int vertexCount = 0;
-        std::string materialName;
+        NameId materialId = 0;
+        uint32_t materialIndex = MaterialTable::INVALID_INDEX;
+        uint32_t gpuMaterial = 0;  // Запись в gpuMaterials (StartInstanceLocation)
+        MeshLod lods[MAX_MESH_LODS];
+        uint32_t lodCount = 1;
+        uint32_t firstMeshlet = 0; // Начало в Model3D::meshlets, диапазоны уровней относительны ему
     };
 
     std::vector<ModelMesh> meshes;
+    std::vector<Meshlet> meshlets;
+
+    // Все сабмеши модели лежат в одной паре буферов и рисуются с одной привязкой
+    ID3D11Buffer* vertexBuffer = nullptr;
+    ID3D11Buffer* indexBuffer = nullptr;
+    ID3D11Buffer* quantizationBuffer = nullptr; // PackedMeshParams, только для упакованных вершин
+    UINT vertexStride = sizeof(Vertex);
+    DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT;
     XMFLOAT3 position = { 0, 0, 0 };
     XMFLOAT3 rotation = { 0, 0, 0 };
     XMFLOAT3 scale = { 1, 1, 1 };
     bool isVisible = true;
     bool hasError = false;
+    bool packedVertices = USE_PACKED_VERTICES;
+
+    // Ограничивающая сфера в локальных координатах (для выбора LOD)
+    XMFLOAT3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+    XMFLOAT3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    float lodPixelsPerUnit = FLT_MAX; // Пикселей на единицу модели в текущем кадре
+    float viewDepth = 0.0f;           // Глубина центра в пространстве вида - для ключа сортировки
+    uint32_t lastLodLevel = 0;
+
+    // Отсечение кластеров: пирамида видимости и направление взгляда в пространстве модели
+    XMFLOAT4 frustumPlanes[6] = {};
+    XMFLOAT3 viewDirection = { 0, 0, 1 };
+    bool cullMeshlets = false;
+    bool cullBackfacingMeshlets = false; // Только для ортогональной камеры
+    uint32_t visibleTriangles = 0;
+    uint32_t totalTriangles = 0;
+
+    // Горячая перезагрузка: откуда модель загружена и от каких файлов зависит
+    std::wstring sourceName;
+    std::vector<std::wstring> sourceDependencies; // Кэш, исходники, картинки атласа
+    std::vector<std::wstring> textureFiles;       // Файлы текстур map_Kd вне атласа
+    std::vector<std::wstring> dependencies;       // Всё вместе - за этим следит GameScene
+    uint32_t dependencyRevision = 0;              // Растёт при смене списка зависимостей
+    MaterialTable materials;
+    uint32_t revision = 0; // Растёт при каждой замене геометрии
+    std::vector<TextureHandle> textureRefs; // Ссылки на текстуры, взятые моделью (сабмеши их делят)
+    GpuMaterialTable gpuMaterials;          // Материалы модели на GPU (t1)
+    std::vector<TextureHandle> atlasPages;  // Страницы атласа этой модели (свои ссылки)
+    std::unordered_map<NameId, uint32_t> atlasPageByMaterial; // UV материала уже на странице
+
+    // Общие вершинный/индексный буферы для сабмешей (meshes[i] соответствует parts[i]).
+    // При packedVertices вершины квантуются в PackedVertex по общим границам модели;
+    // индексы остаются локальными (BaseVertexLocation) и сужаются до 16 бит, если
+    // в каждом сабмеше меньше 65536 вершин.
+    bool CreateModelBuffers(ID3D11Device* device, const std::vector<MeshCache::Submesh>& parts) {
+        size_t totalVertices = 0;
+        size_t totalIndices = 0;
+        bool shortIndexRange = true;
+        for (const auto& part : parts) {
+            totalVertices += part.vertexCount;
+            totalIndices += part.indexCount;
+            shortIndexRange = shortIndexRange && part.vertexCount <= 0xFFFF;
+        }
+        if (totalVertices == 0 || totalIndices == 0) return false;
+
+        std::vector<Vertex> vertices;
+        vertices.reserve(totalVertices);
+        for (size_t i = 0; i < parts.size(); i++) {
+            ModelMesh& mesh = meshes[i];
+            mesh.baseVertex = (int)vertices.size();
+            mesh.vertexCount = (int)parts[i].vertexCount;
+            vertices.insert(vertices.end(), parts[i].vertices, parts[i].vertices + parts[i].vertexCount);
+        }
+
+        std::vector<PackedVertex> packed;
+        const void* vertexData = vertices.data();
+        vertexStride = sizeof(Vertex);
+
+        if (packedVertices) {
+            PackedMeshParams params = VertexQuantizer::ComputeParams(vertices.data(), (uint32_t)vertices.size());
+            VertexQuantizer::EncodeMesh(vertices.data(), (uint32_t)vertices.size(), params, packed);
+            vertexData = packed.data();
+            vertexStride = sizeof(PackedVertex);
+
+            D3D11_BUFFER_DESC cbd = {};
+            cbd.Usage = D3D11_USAGE_IMMUTABLE;
+            cbd.ByteWidth = sizeof(PackedMeshParams);
+            cbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+
+            D3D11_SUBRESOURCE_DATA cinit = {};
+            cinit.pSysMem = &params;
+
+            if (FAILED(device->CreateBuffer(&cbd, &cinit, &quantizationBuffer))) {
+                DEBUG_ERROR("Ошибка создания буфера параметров квантования");
+                return false;
+            }
+        }
+
+        // Создаем вершинный буфер
+        D3D11_BUFFER_DESC vbd = {};
+        vbd.Usage = D3D11_USAGE_DEFAULT;
+        vbd.ByteWidth = vertexStride * (UINT)totalVertices;
+        vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        vbd.CPUAccessFlags = 0;
+
+        D3D11_SUBRESOURCE_DATA vinit = {};
+        vinit.pSysMem = vertexData;
+        vinit.SysMemPitch = 0;
+        vinit.SysMemSlicePitch = 0;
+
+        HRESULT hr = device->CreateBuffer(&vbd, &vinit, &vertexBuffer);
+        if (FAILED(hr)) {
+            DEBUG_ERROR("Ошибка создания вершинного буфера");
+            ReleaseBuffers();
+            return false;
+        }
+
+        // Создаем индексный буфер
+        std::vector<uint32_t> indices32;
+        std::vector<uint16_t> indices16;
+        indexFormat = shortIndexRange ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+        for (size_t i = 0; i < parts.size(); i++) {
+            const auto& part = parts[i];
+            ModelMesh& mesh = meshes[i];
+            mesh.firstIndex = (uint32_t)(shortIndexRange ? indices16.size() : indices32.size());
+            mesh.indexCount = (int)part.indexCount;
+            if (shortIndexRange) {
+                indices16.insert(indices16.end(), part.indices, part.indices + part.indexCount);
+            }
+            else {
+                indices32.insert(indices32.end(), part.indices, part.indices + part.indexCount);
+            }
+
+            // Диапазоны LOD относительны началу сабмеша
+            mesh.lodCount = 1;
+            mesh.lods[0].firstIndex = 0;
+            mesh.lods[0].indexCount = part.indexCount;
+            mesh.lods[0].error = 0.0f;
+            if (part.lodCount > 0) {
+                mesh.lodCount = part.lodCount;
+                std::copy(part.lods, part.lods + part.lodCount, mesh.lods);
+            }
+            if (part.meshletCount == 0) {
+                for (uint32_t l = 0; l < mesh.lodCount; l++) mesh.lods[l].meshletCount = 0;
+            }
+
+            mesh.firstMeshlet = (uint32_t)meshlets.size();
+            meshlets.insert(meshlets.end(), part.meshlets, part.meshlets + part.meshletCount);
+        }
+
+        UINT indexSize = shortIndexRange ? sizeof(uint16_t) : sizeof(uint32_t);
+        D3D11_BUFFER_DESC ibd = {};
+        ibd.Usage = D3D11_USAGE_DEFAULT;
+        ibd.ByteWidth = indexSize * (UINT)totalIndices;
+        ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+        ibd.CPUAccessFlags = 0;
+
+        D3D11_SUBRESOURCE_DATA iinit = {};
+        iinit.pSysMem = shortIndexRange ? (const void*)indices16.data() : (const void*)indices32.data();
+        iinit.SysMemPitch = 0;
+        iinit.SysMemSlicePitch = 0;
+
+        hr = device->CreateBuffer(&ibd, &iinit, &indexBuffer);
+        if (FAILED(hr)) {
+            DEBUG_ERROR("Ошибка создания индексного буфера");
+            ReleaseBuffers();
+            return false;
+        }
+
+        for (const auto& v : vertices) {
+            const XMFLOAT3& p = v.position;
+            boundsMin.x = std::min(boundsMin.x, p.x); boundsMax.x = std::max(boundsMax.x, p.x);
+            boundsMin.y = std::min(boundsMin.y, p.y); boundsMax.y = std::max(boundsMax.y, p.y);
+            boundsMin.z = std::min(boundsMin.z, p.z); boundsMax.z = std::max(boundsMax.z, p.z);
+        }
+
+        char buffer[256];
+        sprintf_s(buffer, "Буферы модели (%zu сабмешей): %u байт вершин + %u байт индексов (без упаковки %zu + %zu)",
+            parts.size(), vbd.ByteWidth, ibd.ByteWidth,
+            sizeof(Vertex) * totalVertices, sizeof(uint32_t) * totalIndices);
+        DEBUG_LOG(buffer);
+        return true;
+    }
+
+    // Перед заменой модели: буферы, сабмеши, кластеры и границы - с нуля
+    void ResetGeometry() {
+        ReleaseBuffers();
+        meshes.clear();
+        meshlets.clear();
+        boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        lastLodLevel = 0;
+    }
+
+    // Собирает таблицу материалов на GPU и назначает сабмешам записи и текстуры map_Kd.
+    // Последняя запись - для сабмешей без материала. Новые ссылки на текстуры берутся
+    // до того, как отданы старые, - общие текстуры не пересоздаются. loader = nullptr -
+    // текстуры грузятся сразу.
+    bool ApplyMaterials(ID3D11Device* device, TextureManager& texManager, AssetLoader* loader,
+        const MaterialTable& table) {
+        uint32_t materialCount = (uint32_t)std::min<size_t>(table.Size(), MAX_GPU_MATERIALS - 1);
+        if (materialCount < table.Size()) {
+            char buffer[256];
+            sprintf_s(buffer, "Материалов %zu, на GPU поместится %u - остальные рисуются по умолчанию",
+                table.Size(), materialCount);
+            DEBUG_WARNING(buffer);
+        }
+
+        std::vector<GpuMaterial> records;
+        std::vector<TextureHandle> materialTextures(materialCount + 1);
+        std::vector<TextureHandle> acquired;
+        records.reserve(materialCount + 1);
+        for (uint32_t m = 0; m < materialCount; m++) {
+            const Material& mat = *table.Get(m);
+
+            // UV материала из атласа перенесены при загрузке - он остаётся на странице,
+            // даже если map_Kd в MTL поменялся (новая картинка - с перезагрузкой модели)
+            auto atlasPage = atlasPageByMaterial.find(mat.id);
+            if (atlasPage != atlasPageByMaterial.end()) {
+                materialTextures[m] = texManager.AddRef(atlasPages[atlasPage->second]);
+                if (materialTextures[m].IsValid()) acquired.push_back(materialTextures[m]);
+            }
+            else if (!mat.textureFilename.empty()) {
+                std::wstring textureFile = FileSystemHelper::FromUtf8(mat.textureFilename);
+                materialTextures[m] = loader ? texManager.LoadTextureAsync(textureFile, *loader) :
+                    texManager.LoadTexture(textureFile);
+                if (materialTextures[m].IsValid()) acquired.push_back(materialTextures[m]);
+            }
+            records.push_back(GpuMaterialTable::FromMaterial(mat, materialTextures[m].IsValid()));
+
+            char buffer[256];
+            sprintf_s(buffer, "Материал %u '%s': Kd (%.3f, %.3f, %.3f), d %.2f, Ns %.1f, текстура %s",
+                m, mat.name.c_str(), mat.diffuse.x, mat.diffuse.y, mat.diffuse.z, mat.alpha, mat.shininess,
+                mat.textureFilename.empty() ? "нет" : mat.textureFilename.c_str());
+            DEBUG_LOG(buffer);
+        }
+
+        // Сабмеш без материала (или за пределами таблицы) рисуется шахматкой
+        uint32_t defaultIndex = materialCount;
+        records.push_back(GpuMaterialTable::Textured());
+        for (const ModelMesh& mesh : meshes) {
+            if (mesh.materialIndex < materialCount) continue;
+            materialTextures[defaultIndex] = texManager.CreateDebugTexture(L"default_material");
+            if (materialTextures[defaultIndex].IsValid()) acquired.push_back(materialTextures[defaultIndex]);
+            DEBUG_LOG("Создана дефолтная текстура");
+            break;
+        }
+
+        if (!gpuMaterials.Create(device, records)) {
+            for (TextureHandle handle : acquired) texManager.Release(handle);
+            return false;
+        }
+
+        for (ModelMesh& mesh : meshes) {
+            mesh.gpuMaterial = (mesh.materialIndex < materialCount) ? mesh.materialIndex : defaultIndex;
+            mesh.texture = materialTextures[mesh.gpuMaterial];
+        }
+
+        // Сабмеши с общей текстурой (страницей атласа) подряд - одна привязка на группу
+        std::stable_sort(meshes.begin(), meshes.end(), [](const ModelMesh& a, const ModelMesh& b) {
+            return a.texture.index < b.texture.index;
+        });
+
+        // Файлы map_Kd грузятся только здесь (в том числе после правки MTL) - их правка
+        // должна перезагружать текстуру, поэтому они тоже зависимости модели
+        textureFiles.clear();
+        for (TextureHandle handle : acquired) {
+            std::wstring file = texManager.GetTextureFile(handle);
+            if (!file.empty() && std::find(textureFiles.begin(), textureFiles.end(), file) == textureFiles.end()) {
+                textureFiles.push_back(file);
+            }
+        }
+        SetDependencies(sourceDependencies);
+
+        // Текстуры прежней модели (или прежних материалов) больше не нужны
+        ReleaseTextures(texManager);
+        textureRefs = std::move(acquired);
+        return true;
+    }
+
+    void SetDependencies(const std::vector<std::wstring>& sources) {
+        sourceDependencies = sources;
+        dependencies = sources;
+        for (const auto& file : textureFiles) {
+            if (std::find(dependencies.begin(), dependencies.end(), file) == dependencies.end()) {
+                dependencies.push_back(file);
+            }
+        }
+        dependencyRevision++;
+    }
+
+    void ReleaseBuffers() {
+        if (quantizationBuffer) quantizationBuffer->Release();
+        if (indexBuffer) indexBuffer->Release();
+        if (vertexBuffer) vertexBuffer->Release();
+        quantizationBuffer = nullptr;
+        indexBuffer = nullptr;
+        vertexBuffer = nullptr;
+    }
 
 public:
-    bool LoadFromOBJ(ID3D11Device* device, TextureManager& texManager,
-        const std::wstring& objFile,
-        const std::vector<std::wstring>& textureFiles) {
-        DEBUG_LOG("Начало загрузки 3D модели...");
+    // Модель, прочитанная без устройства: кэш (отображение) или меши, приготовленные из исходника
+    struct ModelData {
+        MeshCache meshCache;
+        std::vector<Mesh> loadedMeshes;
+        MaterialTable materials;
+        std::vector<MeshCache::Submesh> submeshes;
+        std::vector<std::wstring> dependencies; // Кэш и исходники - для горячей перезагрузки
+        TextureAtlas atlas;
+        std::vector<std::vector<Vertex>> remappedVertices; // Вершины с UV на страницах атласа
+    };
 
-        // Ищем OBJ файл
+    // Поиск и чтение модели - можно звать из фонового потока; false - нужна простая модель
+    static bool LoadModelData(const std::wstring& objFile, ModelData& data) {
+        // Ищем исходник (OBJ или другой формат, если его приготовил кукер)
         std::wstring foundObjPath = FileSystemHelper::FindFile(objFile + L".obj");
         if (foundObjPath.empty()) {
             // Пробуем без расширения
             foundObjPath = FileSystemHelper::FindFile(objFile);
         }
 
-        if (foundObjPath.empty()) {
-            DEBUG_WARNING("OBJ файл не найден, создаю простую модель");
+        // Приготовленный меш лежит рядом с исходником; без исходника ищем его самого
+        std::wstring cachePath;
+        if (!foundObjPath.empty()) {
+            DEBUG_LOG_W(L"Исходник модели найден: " + foundObjPath);
+            cachePath = MeshCache::GetCachePath(foundObjPath);
+        }
+        else {
+            for (const wchar_t* extension : { L".obj", L".fbx" }) {
+                cachePath = FileSystemHelper::FindFile(MeshCache::GetCachePath(objFile + extension));
+                if (!cachePath.empty()) break;
+            }
+        }
+
+        if (foundObjPath.empty() && cachePath.empty()) {
+            DEBUG_WARNING("Модель не найдена, создаю простую модель");
             DEBUG_WARNING("Искали файл: " + std::string(objFile.begin(), objFile.end()) + ".obj");
-            CreateSimpleHumanModel(device, texManager);
-            hasError = true;
-            return true;
+            return false;
+        }
+
+        // Сначала пробуем бинарный кэш: он отображается в память и идёт в буферы без разбора
+        data.dependencies = { cachePath };
+        if (data.meshCache.Open(cachePath)) {
+            data.submeshes = data.meshCache.GetSubmeshes();
+            data.materials = data.meshCache.GetMaterials();
+            const auto& sources = data.meshCache.GetSources();
+            data.dependencies.insert(data.dependencies.end(), sources.begin(), sources.end());
+            DEBUG_LOG_W(L"Меш загружен из кэша: " + cachePath);
+        }
+        else if (!ALLOW_SOURCE_ASSETS || foundObjPath.empty()) {
+            DEBUG_WARNING("Нет приготовленного меша (запустите кукер ассетов), создаю простую модель");
+            return false;
+        }
+        else {
+            // Готовим меш из исходника прямо здесь и сохраняем результат для следующих запусков
+            std::vector<Bone> bones;
+            std::vector<std::wstring> sources;
+            if (!AssetCooker::LoadAndProcess(foundObjPath, data.loadedMeshes, data.materials, bones, sources, 0)) {
+                DEBUG_WARNING("Ошибка загрузки исходника модели, создаю простую модель");
+                return false;
+            }
+            MeshCache::Write(cachePath, sources, data.loadedMeshes, data.materials, bones);
+            data.dependencies.insert(data.dependencies.end(), sources.begin(), sources.end());
+
+            for (const auto& mesh : data.loadedMeshes) {
+                MeshCache::Submesh submesh;
+                submesh.vertices = mesh.vertices.data();
+                submesh.vertexCount = (uint32_t)mesh.vertices.size();
+                submesh.indices = mesh.indices.data();
+                submesh.indexCount = (uint32_t)mesh.indices.size();
+                submesh.materialId = mesh.materialId;
+                submesh.lodCount = (uint32_t)std::min<size_t>(mesh.lods.size(), MAX_MESH_LODS);
+                std::copy(mesh.lods.begin(), mesh.lods.begin() + submesh.lodCount, submesh.lods);
+                submesh.meshlets = mesh.meshlets.data();
+                submesh.meshletCount = (uint32_t)mesh.meshlets.size();
+                submesh.skin = mesh.skin.empty() ? nullptr : mesh.skin.data();
+                data.submeshes.push_back(submesh);
+            }
         }
 
-        DEBUG_LOG_W(L"OBJ найден: " + foundObjPath);
-
-        // Загружаем OBJ с материалами
-        std::vector<Mesh> loadedMeshes;
-        std::map<std::string, Material> materials;
+        // Мелкие текстуры материалов - в общие страницы атласа, UV сабмешей переносятся
+        TextureAtlasBuilder::Build(data.materials, data.submeshes, data.remappedVertices, data.atlas, cachePath);
+        data.dependencies.insert(data.dependencies.end(), data.atlas.sources.begin(), data.atlas.sources.end());
+        return true;
+    }
 
-        if (!OBJLoader::Load(foundObjPath, loadedMeshes, materials)) {
-            DEBUG_WARNING("Ошибка загрузки OBJ файла, создаю простую модель");
-            CreateSimpleHumanModel(device, texManager);
-            hasError = true;
-            return true;
-        }
+    // Сразу ставит простую модель; настоящая читается в фоне и подменяет её в потоке
+    // рендера. Положение, поворот и масштаб при подмене сохраняются.
+    void LoadFromOBJAsync(ID3D11Device* device, TextureManager& texManager, AssetLoader& loader,
+        const std::wstring& objFile) {
+        DEBUG_LOG("Начало фоновой загрузки 3D модели...");
+        CreateSimpleHumanModel(device, texManager);
+        hasError = true;
 
-        // Создаем текстуры для материалов
-        std::map<std::string, int> materialTextures;
-        for (const auto& matPair : materials) {
-            const Material& mat = matPair.second;
+        sourceName = objFile;
+        ReloadAsync(device, texManager, loader);
+    }
 
-            // Создаем цветную текстуру на основе диффузного цвета
-            std::wstring matName(mat.name.begin(), mat.name.end());
-            int texIndex = texManager.CreateColorTexture(matName,
-                mat.diffuse.x,
-                mat.diffuse.y,
-                mat.diffuse.z);
+    // Перечитывает модель в фоне и подменяет между кадрами; при ошибке чтения
+    // остаётся текущая модель
+    void ReloadAsync(ID3D11Device* device, TextureManager& texManager, AssetLoader& loader) {
+        auto data = std::make_shared<ModelData>();
+        std::wstring objFile = sourceName;
+        loader.Submit(objFile,
+            [data, objFile]() {
+                return LoadModelData(objFile, *data);
+            },
+            [this, device, &texManager, &loader, data](bool loaded) {
+                if (!loaded) return;
+
+                ResetGeometry();
+                if (!CreateFromData(device, texManager, &loader, *data)) {
+                    DEBUG_ERROR("Ошибка создания модели, возвращаю простую модель");
+                    ResetGeometry();
+                    CreateSimpleHumanModel(device, texManager);
+                    hasError = true;
+                    return;
+                }
+                hasError = false;
+            });
+    }
 
-            if (texIndex >= 0) {
-                materialTextures[mat.name] = texIndex;
+    // Изменился только MTL: таблица материалов на GPU собирается заново (вместе с
+    // текстурами map_Kd), сабмеши получают новые записи, геометрия не трогается.
+    void ReloadMaterialsAsync(ID3D11Device* device, const std::wstring& mtlPath,
+        TextureManager& texManager, AssetLoader& loader) {
+        auto reloaded = std::make_shared<MaterialTable>();
+        loader.Submit(mtlPath,
+            [reloaded, mtlPath]() {
+                return OBJLoader::LoadMTL(mtlPath, *reloaded);
+            },
+            [this, device, &texManager, &loader, reloaded](bool loaded) {
+                if (!loaded) return;
+
+                // Add заменяет одноимённые материалы на месте - materialIndex сабмешей не меняется
+                for (const Material& mat : *reloaded) materials.Add(mat);
+                for (ModelMesh& mesh : meshes) mesh.materialIndex = materials.Find(mesh.materialId);
+
+                if (!ApplyMaterials(device, texManager, &loader, materials)) {
+                    DEBUG_ERROR("Ошибка обновления материалов, остаются прежние");
+                    return;
+                }
 
                 char buffer[256];
-                sprintf_s(buffer, "Создана текстура для материала %s: цвет (%.3f, %.3f, %.3f), индекс %d",
-                    mat.name.c_str(), mat.diffuse.x, mat.diffuse.y, mat.diffuse.z, texIndex);
+                sprintf_s(buffer, "Материалы перезагружены: %zu из MTL, всего %u на GPU",
+                    reloaded->Size(), gpuMaterials.GetCount());
                 DEBUG_LOG(buffer);
-            }
-        }
+            });
+    }
 
-        // Если нет материалов, создаем дефолтную текстуру
-        if (materialTextures.empty()) {
-            int defaultTex = texManager.CreateDebugTexture(L"default_material");
-            materialTextures["default"] = defaultTex;
-            DEBUG_LOG("Создана дефолтная текстура");
+    bool DependsOn(const std::wstring& path) const {
+        return std::find(dependencies.begin(), dependencies.end(), path) != dependencies.end();
+    }
+
+    const std::vector<std::wstring>& GetDependencies() const { return dependencies; }
+    uint32_t GetDependencyRevision() const { return dependencyRevision; }
+
+    // Материалы и буферы - только в потоке рендера; loader = nullptr - текстуры сразу
+    bool CreateFromData(ID3D11Device* device, TextureManager& texManager, AssetLoader* loader,
+        const ModelData& data) {
+        // Создаем общие буферы модели, затем описываем сабмеши
+        meshes.resize(data.submeshes.size());
+        if (!CreateModelBuffers(device, data.submeshes)) {
+            meshes.clear();
+            return false;
         }
 
-        // Создаем DirectX меши
-        for (size_t i = 0; i < loadedMeshes.size(); i++) {
-            ModelMesh dxMesh;
-            dxMesh.materialName = loadedMeshes[i].materialName;
+        for (size_t i = 0; i < data.submeshes.size(); i++) {
+            ModelMesh& dxMesh = meshes[i];
+            dxMesh.materialId = data.submeshes[i].materialId;
+            dxMesh.materialIndex = data.materials.Find(dxMesh.materialId);
 
             char buffer[256];
-            sprintf_s(buffer, "Создание меша %zu: %d вершин, %d индексов, материал: %s",
-                i, loadedMeshes[i].vertices.size(), loadedMeshes[i].indices.size(),
-                loadedMeshes[i].materialName.c_str());
+            sprintf_s(buffer, "Сабмеш %zu: %u вершин, %u индексов, материал: %s",
+                i, data.submeshes[i].vertexCount, data.submeshes[i].indexCount,
+                NameRegistry::GetName(dxMesh.materialId).c_str());
             DEBUG_LOG(buffer);
+        }
 
-            // Создаем вершинный буфер
-            D3D11_BUFFER_DESC vbd = {};
-            vbd.Usage = D3D11_USAGE_DEFAULT;
-            vbd.ByteWidth = (UINT)(sizeof(Vertex) * loadedMeshes[i].vertices.size());
-            vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-            vbd.CPUAccessFlags = 0;
-
-            D3D11_SUBRESOURCE_DATA vinit = {};
-            vinit.pSysMem = loadedMeshes[i].vertices.data();
-            vinit.SysMemPitch = 0;
-            vinit.SysMemSlicePitch = 0;
-
-            HRESULT hr = device->CreateBuffer(&vbd, &vinit, &dxMesh.vertexBuffer);
-            if (FAILED(hr)) {
-                DEBUG_ERROR("Ошибка создания вершинного буфера");
-                return false;
-            }
-
-            // Создаем индексный буфер
-            D3D11_BUFFER_DESC ibd = {};
-            ibd.Usage = D3D11_USAGE_DEFAULT;
-            ibd.ByteWidth = (UINT)(sizeof(uint32_t) * loadedMeshes[i].indices.size());
-            ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-            ibd.CPUAccessFlags = 0;
-
-            D3D11_SUBRESOURCE_DATA iinit = {};
-            iinit.pSysMem = loadedMeshes[i].indices.data();
-            iinit.SysMemPitch = 0;
-            iinit.SysMemSlicePitch = 0;
-
-            hr = device->CreateBuffer(&ibd, &iinit, &dxMesh.indexBuffer);
-            if (FAILED(hr)) {
-                DEBUG_ERROR("Ошибка создания индексного буфера");
-                dxMesh.vertexBuffer->Release();
-                return false;
-            }
-
-            dxMesh.indexCount = (int)loadedMeshes[i].indices.size();
-            dxMesh.vertexCount = (int)loadedMeshes[i].vertices.size();
-
-            // Назначаем текстуру на основе материала
-            if (!dxMesh.materialName.empty() && materialTextures.find(dxMesh.materialName) != materialTextures.end()) {
-                dxMesh.textureIndex = materialTextures[dxMesh.materialName];
-                sprintf_s(buffer, "Меш %zu: текстура %d для материала '%s'",
-                    i, dxMesh.textureIndex, dxMesh.materialName.c_str());
-                DEBUG_LOG(buffer);
-            }
-            else if (!materialTextures.empty()) {
-                // Берем первую доступную текстуру
-                dxMesh.textureIndex = materialTextures.begin()->second;
-                sprintf_s(buffer, "Меш %zu: дефолтная текстура %d", i, dxMesh.textureIndex);
-                DEBUG_LOG(buffer);
-            }
-            else {
-                dxMesh.textureIndex = texManager.CreateDebugTexture(L"fallback");
-                sprintf_s(buffer, "Меш %zu: резервная текстура %d", i, dxMesh.textureIndex);
-                DEBUG_LOG(buffer);
-            }
-
-            meshes.push_back(dxMesh);
+        // Страницы атласа - до материалов: ApplyMaterials ставит их вместо отдельных текстур
+        std::vector<TextureHandle> pages;
+        for (size_t page = 0; page < data.atlas.pages.size(); page++) {
+            std::wstring pageName = sourceName + L"#atlas" + std::to_wstring(revision + 1) + L"." + std::to_wstring(page);
+            pages.push_back(texManager.CreateImageTexture(pageName, data.atlas.pages[page]));
+        }
+        ReleaseAtlas(texManager);
+        atlasPages = std::move(pages);
+        atlasPageByMaterial = data.atlas.pageByMaterial;
+
+        // Все материалы - одна таблица на GPU; текстуры только у материалов с map_Kd
+        if (!ApplyMaterials(device, texManager, loader, data.materials)) {
+            ReleaseBuffers();
+            meshes.clear();
+            return false;
         }
 
+        materials = data.materials;
+        SetDependencies(data.dependencies);
+        revision++;
+
         char buffer[256];
         sprintf_s(buffer, "Модель загружена: %zu мешей, %zu материалов",
-            meshes.size(), materials.size());
+            meshes.size(), data.materials.Size());
         DEBUG_SUCCESS(buffer);
-
-        // Выводим информацию о цветах для отладки
-        for (const auto& matPair : materials) {
-            const Material& mat = matPair.second;
-            sprintf_s(buffer, "Материал '%s': цвет (%.3f, %.3f, %.3f)",
-                mat.name.c_str(), mat.diffuse.x, mat.diffuse.y, mat.diffuse.z);
-            DEBUG_LOG(buffer);
-        }
-
         return true;
     }
 
     void CreateSimpleHumanModel(ID3D11Device* device, TextureManager& texManager) {
         DEBUG_LOG("Создание простой человеческой модели...");
 
-        // Создаем один меш для простой модели
-        ModelMesh humanMesh;
-
         // Создаем простую человеческую фигуру (торс + голова)
         std::vector<Vertex> vertices;
         std::vector<uint32_t> indices;
@@ -1242,45 +12012,34 @@ public:
         CreateBox(vertices, indices, -0.4f, -1.5f, 0, 0.4f, 1.5f, 0.4f, XMFLOAT3(0.3f, 0.2f, 0.1f));
         CreateBox(vertices, indices, 0.4f, -1.5f, 0, 0.4f, 1.5f, 0.4f, XMFLOAT3(0.3f, 0.2f, 0.1f));
 
-        // Создаем вершинный буфер
-        D3D11_BUFFER_DESC vbd = {};
-        vbd.Usage = D3D11_USAGE_DEFAULT;
-        vbd.ByteWidth = (UINT)(sizeof(Vertex) * vertices.size());
-        vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-        vbd.CPUAccessFlags = 0;
-
-        D3D11_SUBRESOURCE_DATA vinit = {};
-        vinit.pSysMem = vertices.data();
-
-        HRESULT hr = device->CreateBuffer(&vbd, &vinit, &humanMesh.vertexBuffer);
-        if (FAILED(hr)) {
-            DEBUG_ERROR("Ошибка создания вершинного буфера для простой модели");
+        // Один сабмеш простой модели
+        MeshCache::Submesh part;
+        part.vertices = vertices.data();
+        part.vertexCount = (uint32_t)vertices.size();
+        part.indices = indices.data();
+        part.indexCount = (uint32_t)indices.size();
+
+        meshes.resize(1);
+        if (!CreateModelBuffers(device, { part })) {
+            DEBUG_ERROR("Ошибка создания буферов для простой модели");
+            meshes.clear();
             return;
         }
 
-        // Создаем индексный буфер
-        D3D11_BUFFER_DESC ibd = {};
-        ibd.Usage = D3D11_USAGE_DEFAULT;
-        ibd.ByteWidth = (UINT)(sizeof(uint32_t) * indices.size());
-        ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-        ibd.CPUAccessFlags = 0;
-
-        D3D11_SUBRESOURCE_DATA iinit = {};
-        iinit.pSysMem = indices.data();
-
-        hr = device->CreateBuffer(&ibd, &iinit, &humanMesh.indexBuffer);
-        if (FAILED(hr)) {
-            DEBUG_ERROR("Ошибка создания индексного буфера для простой модели");
-            humanMesh.vertexBuffer->Release();
+        ModelMesh& humanMesh = meshes[0];
+        TextureHandle humanTexture = texManager.CreateDebugTexture(L"human");
+        if (!gpuMaterials.Create(device, { GpuMaterialTable::Textured() })) {
+            if (humanTexture.IsValid()) texManager.Release(humanTexture);
+            ReleaseBuffers();
+            meshes.clear();
             return;
         }
-
-        humanMesh.indexCount = (int)indices.size();
-        humanMesh.vertexCount = (int)vertices.size();
-        humanMesh.textureIndex = texManager.CreateDebugTexture(L"human");
-        humanMesh.materialName = "human_material";
-
-        meshes.push_back(humanMesh);
+        humanMesh.texture = humanTexture;
+        humanMesh.gpuMaterial = 0;
+        ReleaseTextures(texManager);
+        ReleaseAtlas(texManager);
+        if (humanMesh.texture.IsValid()) textureRefs.push_back(humanMesh.texture);
+        humanMesh.materialId = "human_material"_name;
 
         char buffer[256];
         sprintf_s(buffer, "Простая модель создана: %d вершин, %d индексов",
@@ -1346,7 +12105,9 @@ public:
         }
     }
 
-    void Render(ID3D11DeviceContext* context, TextureManager& texManager) {
+    // Пакеты отрисовки сабмешей в командный буфер; смену состояния между ними отсекает
+    // проигрывание, поэтому каждый пакет несёт всё своё состояние целиком
+    void Submit(RenderCommandBuffer& commands, const RenderPipeline& pipeline, TextureManager& texManager) {
         if (!isVisible) return;
 
         // Отладочная информация для первого кадра
@@ -1358,29 +12119,163 @@ public:
             firstRender = false;
         }
 
+        if (!vertexBuffer || !indexBuffer) return;
+
+        // Общее для всех сабмешей: буферы, деквантование позиции, таблица материалов
+        DrawPacket packet;
+        packet.pipeline = &pipeline;
+        packet.vertexBuffer = vertexBuffer;
+        packet.vertexStride = vertexStride;
+        packet.indexBuffer = indexBuffer;
+        packet.indexFormat = indexFormat;
+        packet.meshConstants = quantizationBuffer;
+        packet.materials = gpuMaterials.GetView();
+        packet.constants = commands.AddConstants(GetWorldMatrix());
+
+        // Экранный размер модели - по нему стример выбирает мипы её текстур
+        XMFLOAT3 extent(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z);
+        float diameter = (boundsMin.x <= boundsMax.x) ?
+            sqrtf(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z) : 0.0f;
+        float screenPixels = diameter * lodPixelsPerUnit;
+
+        uint32_t maxLodLevel = 0;
+        visibleTriangles = 0;
+        totalTriangles = 0;
         for (size_t i = 0; i < meshes.size(); i++) {
             const auto& mesh = meshes[i];
-            if (!mesh.vertexBuffer || !mesh.indexBuffer) continue;
-
-            // Устанавливаем вершинный и индексный буферы
-            UINT stride = sizeof(Vertex);
-            UINT offset = 0;
-            context->IASetVertexBuffers(0, 1, &mesh.vertexBuffer, &stride, &offset);
-            context->IASetIndexBuffer(mesh.indexBuffer, DXGI_FORMAT_R32_UINT, 0);
-            context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-            // Устанавливаем текстуру, если есть
-            if (mesh.textureIndex >= 0) {
-                Texture2D* texture = texManager.GetTexture(mesh.textureIndex);
+            // Текстура map_Kd; без неё шейдер текстуру не читает и привязка остаётся прежней.
+            // Сэмплеры общие (PipelineStateCache) - обычно один на все текстуры модели.
+            packet.texture = nullptr;
+            packet.sampler = nullptr;
+            if (mesh.texture.IsValid()) {
+                texManager.RequestResidency(mesh.texture, screenPixels);
+                Texture2D* texture = texManager.GetTexture(mesh.texture);
                 if (texture && texture->srv && texture->samplerState) {
-                    context->PSSetShaderResources(0, 1, &texture->srv);
-                    context->PSSetSamplers(0, 1, &texture->samplerState);
+                    packet.texture = texture->srv;
+                    packet.sampler = texture->samplerState;
+                }
+            }
+            packet.key = RenderSortKey::Make(RENDER_LAYER_WORLD, pipeline.id, gpuMaterials.GetId(),
+                packet.texture ? mesh.texture.index : 0, viewDepth);
+            packet.baseVertex = mesh.baseVertex;
+            packet.material = mesh.gpuMaterial;
+
+            // Отрисовываем самый грубый уровень, ошибка которого на экране не больше LOD_ERROR_PIXELS
+            uint32_t lodLevel = 0;
+            for (uint32_t l = mesh.lodCount; l-- > 1;) {
+                if (mesh.lods[l].error * lodPixelsPerUnit <= LOD_ERROR_PIXELS) {
+                    lodLevel = l;
+                    break;
+                }
+            }
+            maxLodLevel = std::max(maxLodLevel, lodLevel);
+
+            const MeshLod& lod = mesh.lods[lodLevel];
+            totalTriangles += lod.indexCount / 3;
+            if (lod.meshletCount == 0) {
+                visibleTriangles += lod.indexCount / 3;
+                packet.indexCount = lod.indexCount;
+                packet.startIndex = mesh.firstIndex + lod.firstIndex;
+                commands.Submit(packet);
+                continue;
+            }
+
+            // Видимые кластеры лежат в индексах подряд - соседние сливаем в один вызов
+            uint32_t runStart = 0;
+            uint32_t runCount = 0;
+            const Meshlet* lodMeshlets = &meshlets[mesh.firstMeshlet + lod.firstMeshlet];
+            for (uint32_t m = 0; m < lod.meshletCount; m++) {
+                const Meshlet& meshlet = lodMeshlets[m];
+                bool visible = !cullMeshlets ||
+                    (!MeshletBuilder::IsOutsideFrustum(meshlet, frustumPlanes) &&
+                        !(cullBackfacingMeshlets && MeshletBuilder::IsBackfacing(meshlet, viewDirection)));
+                if (!visible) continue;
+
+                visibleTriangles += meshlet.triangleCount;
+                if (runCount > 0 && runStart + runCount == meshlet.firstIndex) {
+                    runCount += meshlet.triangleCount * 3;
+                    continue;
+                }
+                if (runCount > 0) {
+                    packet.indexCount = runCount;
+                    packet.startIndex = mesh.firstIndex + runStart;
+                    commands.Submit(packet);
                 }
+                runStart = meshlet.firstIndex;
+                runCount = meshlet.triangleCount * 3;
+            }
+            if (runCount > 0) {
+                packet.indexCount = runCount;
+                packet.startIndex = mesh.firstIndex + runStart;
+                commands.Submit(packet);
+            }
+        }
+
+        if (maxLodLevel != lastLodLevel) {
+            char buffer[128];
+            sprintf_s(buffer, "LOD модели: %u (%.1f пикс. на единицу)", maxLodLevel, lodPixelsPerUnit);
+            DEBUG_LOG(buffer);
+            lastLodLevel = maxLodLevel;
+        }
+    }
+
+    // Подготовка к кадру, вызывается перед Render: масштаб модели на экране (сколько
+    // пикселей занимает единица длины в центре ограничивающей сферы) для выбора LOD,
+    // плоскости пирамиды видимости и направление взгляда в пространстве модели.
+    void PrepareView(const XMMATRIX& view, const XMMATRIX& proj, float viewportHeight) {
+        if (boundsMin.x > boundsMax.x) return;
+
+        // Плоскости из столбцов W*V*P (строковые векторы, глубина D3D 0..w), нормали внутрь
+        XMFLOAT4X4 m;
+        XMStoreFloat4x4(&m, GetWorldMatrix() * view * proj);
+        auto column = [&m](int c) { return XMFLOAT4(m.m[0][c], m.m[1][c], m.m[2][c], m.m[3][c]); };
+        XMFLOAT4 cx = column(0), cy = column(1), cz = column(2), cw = column(3);
+        frustumPlanes[0] = XMFLOAT4(cw.x + cx.x, cw.y + cx.y, cw.z + cx.z, cw.w + cx.w); // Левая
+        frustumPlanes[1] = XMFLOAT4(cw.x - cx.x, cw.y - cx.y, cw.z - cx.z, cw.w - cx.w); // Правая
+        frustumPlanes[2] = XMFLOAT4(cw.x + cy.x, cw.y + cy.y, cw.z + cy.z, cw.w + cy.w); // Нижняя
+        frustumPlanes[3] = XMFLOAT4(cw.x - cy.x, cw.y - cy.y, cw.z - cy.z, cw.w - cy.w); // Верхняя
+        frustumPlanes[4] = cz;                                                            // Ближняя
+        frustumPlanes[5] = XMFLOAT4(cw.x - cz.x, cw.y - cz.y, cw.z - cz.z, cw.w - cz.w); // Дальняя
+        for (XMFLOAT4& plane : frustumPlanes) {
+            float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+            if (length > 0.0f) {
+                plane = XMFLOAT4(plane.x / length, plane.y / length, plane.z / length, plane.w / length);
             }
+        }
 
-            // Отрисовываем
-            context->DrawIndexed(mesh.indexCount, 0, 0);
+        // Направление взгляда (+Z вида) в пространстве модели: нормаль к прообразам осей X и Y
+        // вида, знак - по определителю (отражающий масштаб). Для перспективы направление на
+        // каждый кластер своё, поэтому там отсекаем только по пирамиде.
+        XMFLOAT4X4 wv;
+        XMStoreFloat4x4(&wv, GetWorldMatrix() * view);
+        XMFLOAT3 ax(wv.m[0][0], wv.m[1][0], wv.m[2][0]);
+        XMFLOAT3 ay(wv.m[0][1], wv.m[1][1], wv.m[2][1]);
+        XMFLOAT3 d(ax.y * ay.z - ax.z * ay.y, ax.z * ay.x - ax.x * ay.z, ax.x * ay.y - ax.y * ay.x);
+        float dLength = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+        float determinant = wv.m[0][0] * (wv.m[1][1] * wv.m[2][2] - wv.m[1][2] * wv.m[2][1]) -
+            wv.m[0][1] * (wv.m[1][0] * wv.m[2][2] - wv.m[1][2] * wv.m[2][0]) +
+            wv.m[0][2] * (wv.m[1][0] * wv.m[2][1] - wv.m[1][1] * wv.m[2][0]);
+        XMFLOAT4X4 p;
+        XMStoreFloat4x4(&p, proj);
+        cullMeshlets = true;
+        cullBackfacingMeshlets = p.m[2][3] == 0.0f && dLength > 0.0f && determinant != 0.0f;
+        if (cullBackfacingMeshlets) {
+            float sign = determinant > 0.0f ? 1.0f : -1.0f;
+            viewDirection = XMFLOAT3(d.x * sign / dLength, d.y * sign / dLength, d.z * sign / dLength);
         }
+
+        XMFLOAT3 center((boundsMin.x + boundsMax.x) * 0.5f,
+            (boundsMin.y + boundsMax.y) * 0.5f,
+            (boundsMin.z + boundsMax.z) * 0.5f);
+        XMVECTOR viewCenter = XMVector3TransformCoord(XMLoadFloat3(&center), GetWorldMatrix() * view);
+
+        // Строковые векторы: w = z * m[2][3] + m[3][3] (ортогональная проекция - всегда 1)
+        float w = XMVectorGetZ(viewCenter) * p.m[2][3] + p.m[3][3];
+        float maxScale = std::max(fabsf(scale.x), std::max(fabsf(scale.y), fabsf(scale.z)));
+
+        lodPixelsPerUnit = maxScale * fabsf(p.m[1][1]) * viewportHeight * 0.5f / std::max(w, 0.0001f);
+        viewDepth = XMVectorGetZ(viewCenter);
     }
 
     void SetPosition(float x, float y, float z) {
@@ -1394,6 +12289,10 @@ public:
     // Добавляем метод для получения текущего поворота
     XMFLOAT3 GetRotation() const { return rotation; }
 
+    // Треугольники последнего кадра: отрисованные после отсечения кластеров / всего в LOD
+    uint32_t GetVisibleTriangles() const { return visibleTriangles; }
+    uint32_t GetTotalTriangles() const { return totalTriangles; }
+
     void SetScale(float x, float y, float z) {
         scale = { x, y, z };
     }
@@ -1406,17 +12305,33 @@ public:
 
     XMFLOAT3 GetPosition() const { return position; }
 
+    // Модель использует PackedVertex - в Submit нужен конвейер ShaderManager::GetPipeline(true)
+    bool UsesPackedVertices() const { return packedVertices; }
+
     void Move(float dx, float dy, float dz) {
         position.x += dx;
         position.y += dy;
         position.z += dz;
     }
 
-    void Cleanup() {
-        for (auto& mesh : meshes) {
-            if (mesh.indexBuffer) mesh.indexBuffer->Release();
-            if (mesh.vertexBuffer) mesh.vertexBuffer->Release();
-        }
+    // Отдаёт все ссылки модели на текстуры
+    void ReleaseTextures(TextureManager& texManager) {
+        for (TextureHandle handle : textureRefs) texManager.Release(handle);
+        textureRefs.clear();
+    }
+
+    // Отдаёт страницы атласа (сабмеши держат свои ссылки через textureRefs)
+    void ReleaseAtlas(TextureManager& texManager) {
+        for (TextureHandle handle : atlasPages) texManager.Release(handle);
+        atlasPages.clear();
+        atlasPageByMaterial.clear();
+    }
+
+    void Cleanup(TextureManager& texManager) {
+        ReleaseTextures(texManager);
+        ReleaseAtlas(texManager);
+        gpuMaterials.Release();
+        ReleaseBuffers();
         meshes.clear();
     }
 };
@@ -1464,8 +12379,43 @@ private:
     ID3D11VertexShader* vertexShader = nullptr;
     ID3D11PixelShader* pixelShader = nullptr;
     ID3D11InputLayout* inputLayout = nullptr;
+    ID3D11VertexShader* packedVertexShader = nullptr;
+    ID3D11InputLayout* packedInputLayout = nullptr;
     ID3D11Buffer* constantBuffer = nullptr;
     ID3D11RasterizerState* rasterizerState = nullptr;
+    ID3D11Buffer* materialIndexBuffer = nullptr; // 0..MAX_GPU_MATERIALS-1, поток экземпляров в слоте 1
+    GpuMaterialTable defaultMaterials;           // Одна запись для фона и прочего без своей таблицы
+    RenderPipeline pipeline;                     // Vertex
+    RenderPipeline packedPipeline;               // PackedVertex: свой вершинный шейдер и input layout
+
+    // Исходник shaders/<sourceFile> (из пакета или с диска) заменяет встроенный code -
+    // шейдер можно поправить без пересборки
+    bool CompileShader(const wchar_t* sourceFile, const char* code, const char* profile, ID3DBlob** blob) {
+        const char* source = code;
+        size_t sourceSize = strlen(code);
+        std::string sourceName = FileSystemHelper::ToUtf8(sourceFile);
+
+        AssetFile file;
+        std::wstring path = FileSystemHelper::FindFile(std::wstring(L"shaders/") + sourceFile);
+        if (!path.empty() && file.Open(path)) {
+            DEBUG_LOG_W(L"Шейдер из файла: " + path);
+            source = file.Data();
+            sourceSize = file.Size();
+        }
+
+        ID3DBlob* errorBlob = nullptr;
+        HRESULT hr = D3DCompile(source, sourceSize, sourceName.c_str(), nullptr, nullptr,
+            "main", profile, D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION, 0, blob, &errorBlob);
+
+        if (FAILED(hr)) {
+            if (errorBlob) {
+                DEBUG_ERROR((char*)errorBlob->GetBufferPointer());
+                errorBlob->Release();
+            }
+            return false;
+        }
+        return true;
+    }
 
 public:
     bool Initialize(ID3D11Device* device) {
@@ -1479,6 +12429,8 @@ public:
                 float4x4 proj;
                 float3 lightDir;
                 float padding;
+                float3 eyeDir;
+                float padding2;
             };
             
             struct VS_IN {
@@ -1486,6 +12438,7 @@ public:
                 float3 normal : NORMAL;
                 float2 tex : TEXCOORD;
                 float3 color : COLOR;
+                uint material : MATERIAL; // Из потока экземпляров
             };
             
             struct VS_OUT {
@@ -1493,6 +12446,7 @@ public:
                 float2 tex : TEXCOORD0;
                 float3 color : COLOR;
                 float3 normal : NORMAL;
+                nointerpolation uint material : MATERIAL;
             };
             
             VS_OUT main(VS_IN input) {
@@ -1503,13 +12457,32 @@ public:
                 output.tex = input.tex;
                 output.color = input.color;
                 output.normal = mul(input.normal, (float3x3)world);
+                output.material = input.material;
                 return output;
             }
         )";
 
         // Пиксельный шейдер
+        // Материал - запись таблицы в t1 (GpuMaterial); текстура t0 только у материалов с map_Kd
         const char* psCode = R"(
+            cbuffer MatrixBuffer : register(b0) {
+                float4x4 world;
+                float4x4 view;
+                float4x4 proj;
+                float3 lightDir;
+                float padding;
+                float3 eyeDir;
+                float padding2;
+            };
+
+            struct MaterialData {
+                float4 diffuse;  // rgb - Kd, a - d
+                float4 ambient;  // rgb - оттенок фона (Ka), a - 1 при map_Kd
+                float4 specular; // rgb - Ks, a - Ns
+            };
+
             Texture2D tex : register(t0);
+            StructuredBuffer<MaterialData> materials : register(t1);
             SamplerState sam : register(s0);
             
             struct PS_IN {
@@ -1517,60 +12490,116 @@ public:
                 float2 tex : TEXCOORD0;
                 float3 color : COLOR;
                 float3 normal : NORMAL;
+                nointerpolation uint material : MATERIAL;
             };
             
             float4 main(PS_IN input) : SV_TARGET {
-                float4 textureColor = tex.Sample(sam, input.tex);
+                MaterialData mat = materials[input.material];
+                float4 textureColor = (mat.ambient.a > 0.5) ? tex.Sample(sam, input.tex) : float4(1.0, 1.0, 1.0, 1.0);
                 
-                if (textureColor.a < 0.1) discard;
+                // Цвет текстуры, материала и вершины
+                float4 base = textureColor * float4(mat.diffuse.rgb * input.color, mat.diffuse.a);
+                if (base.a < 0.1) discard;
                 
-                float3 lightDir = normalize(float3(1.0, 1.0, 0.5));
-                float diff = max(dot(normalize(input.normal), lightDir), 0.2);
-                float3 diffuse = diff * float3(1.0, 1.0, 1.0);
+                float3 normal = normalize(input.normal);
+                float3 light = normalize(lightDir);
+                float diff = max(dot(normal, light), 0.0);
+                float3 lighting = max(diff, 0.2 * mat.ambient.rgb);
                 
-                // Смешиваем цвет текстуры с цветом вершины
-                return textureColor * float4(input.color * diffuse, 1.0);
+                // Блик по Блинну-Фонгу из Ks и Ns
+                float3 halfway = normalize(light + eyeDir);
+                float spec = (diff > 0.0) ? pow(saturate(dot(normal, halfway)), max(mat.specular.a, 1.0)) : 0.0;
+                
+                return float4(base.rgb * lighting + mat.specular.rgb * spec, base.a);
+            }
+        )";
+
+        // Вершинный шейдер для PackedVertex: те же выходы, деквантование на входе
+        const char* packedVsCode = R"(
+            cbuffer MatrixBuffer : register(b0) {
+                float4x4 world;
+                float4x4 view;
+                float4x4 proj;
+                float3 lightDir;
+                float padding;
+                float3 eyeDir;
+                float padding2;
+            };
+
+            cbuffer PackedMeshBuffer : register(b1) {
+                float4 positionOffset;
+                float4 positionScale;
+            };
+
+            struct VS_IN {
+                float4 pos : POSITION;   // UNORM16
+                float2 normal : NORMAL;  // SNORM16, октаэдрическая развёртка
+                float2 tex : TEXCOORD;   // half
+                float4 color : COLOR;    // UNORM8
+                uint material : MATERIAL; // Из потока экземпляров
+            };
+
+            struct VS_OUT {
+                float4 pos : SV_POSITION;
+                float2 tex : TEXCOORD0;
+                float3 color : COLOR;
+                float3 normal : NORMAL;
+                nointerpolation uint material : MATERIAL;
+            };
+
+            float3 DecodeOctahedral(float2 e) {
+                float3 n = float3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+                float t = saturate(-n.z);
+                n.xy += (n.xy >= 0.0) ? -t : t;
+                return normalize(n);
+            }
+
+            VS_OUT main(VS_IN input) {
+                VS_OUT output;
+                float3 pos = positionOffset.xyz + input.pos.xyz * positionScale.xyz;
+                output.pos = mul(float4(pos, 1.0), world);
+                output.pos = mul(output.pos, view);
+                output.pos = mul(output.pos, proj);
+                output.tex = input.tex;
+                output.color = input.color.rgb;
+                output.normal = mul(DecodeOctahedral(input.normal), (float3x3)world);
+                output.material = input.material;
+                return output;
             }
         )";
 
         // Компилируем шейдеры
         ID3DBlob* vsBlob = nullptr;
         ID3DBlob* psBlob = nullptr;
-        ID3DBlob* errorBlob = nullptr;
+        ID3DBlob* packedVsBlob = nullptr;
 
-        HRESULT hr = D3DCompile(vsCode, strlen(vsCode), nullptr, nullptr, nullptr,
-            "main", "vs_5_0", D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION, 0, &vsBlob, &errorBlob);
-
-        if (FAILED(hr)) {
-            if (errorBlob) {
-                DEBUG_ERROR((char*)errorBlob->GetBufferPointer());
-                errorBlob->Release();
-            }
+        if (!CompileShader(L"model_vs.hlsl", vsCode, "vs_5_0", &vsBlob)) {
             DEBUG_ERROR("Ошибка компиляции вершинного шейдера");
             return false;
         }
 
-        hr = D3DCompile(psCode, strlen(psCode), nullptr, nullptr, nullptr,
-            "main", "ps_5_0", D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION, 0, &psBlob, &errorBlob);
-
-        if (FAILED(hr)) {
-            if (errorBlob) {
-                DEBUG_ERROR((char*)errorBlob->GetBufferPointer());
-                errorBlob->Release();
-            }
+        if (!CompileShader(L"model_ps.hlsl", psCode, "ps_5_0", &psBlob)) {
             DEBUG_ERROR("Ошибка компиляции пиксельного шейдера");
             vsBlob->Release();
             return false;
         }
 
+        if (!CompileShader(L"packed_vs.hlsl", packedVsCode, "vs_5_0", &packedVsBlob)) {
+            DEBUG_ERROR("Ошибка компиляции вершинного шейдера упакованных вершин");
+            vsBlob->Release();
+            psBlob->Release();
+            return false;
+        }
+
         // Создаем шейдеры
-        hr = device->CreateVertexShader(vsBlob->GetBufferPointer(),
+        HRESULT hr = device->CreateVertexShader(vsBlob->GetBufferPointer(),
             vsBlob->GetBufferSize(),
             nullptr, &vertexShader);
         if (FAILED(hr)) {
             DEBUG_ERROR("Ошибка создания вершинного шейдера");
             vsBlob->Release();
             psBlob->Release();
+            packedVsBlob->Release();
             return false;
         }
 
@@ -1581,6 +12610,18 @@ public:
             DEBUG_ERROR("Ошибка создания пиксельного шейдера");
             vsBlob->Release();
             psBlob->Release();
+            packedVsBlob->Release();
+            return false;
+        }
+
+        hr = device->CreateVertexShader(packedVsBlob->GetBufferPointer(),
+            packedVsBlob->GetBufferSize(),
+            nullptr, &packedVertexShader);
+        if (FAILED(hr)) {
+            DEBUG_ERROR("Ошибка создания вершинного шейдера упакованных вершин");
+            vsBlob->Release();
+            psBlob->Release();
+            packedVsBlob->Release();
             return false;
         }
 
@@ -1589,10 +12630,11 @@ public:
             {"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
             {"NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
             {"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0},
-            {"COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 32, D3D11_INPUT_PER_VERTEX_DATA, 0}
+            {"COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 32, D3D11_INPUT_PER_VERTEX_DATA, 0},
+            {"MATERIAL", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1}
         };
 
-        hr = device->CreateInputLayout(layout, 4,
+        hr = device->CreateInputLayout(layout, 5,
             vsBlob->GetBufferPointer(),
             vsBlob->GetBufferSize(),
             &inputLayout);
@@ -1602,12 +12644,34 @@ public:
 
         if (FAILED(hr)) {
             DEBUG_ERROR("Ошибка создания input layout");
+            packedVsBlob->Release();
+            return false;
+        }
+
+        // Input layout для PackedVertex (20 байт)
+        D3D11_INPUT_ELEMENT_DESC packedLayout[] = {
+            {"POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
+            {"NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0},
+            {"TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
+            {"COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0},
+            {"MATERIAL", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1}
+        };
+
+        hr = device->CreateInputLayout(packedLayout, 5,
+            packedVsBlob->GetBufferPointer(),
+            packedVsBlob->GetBufferSize(),
+            &packedInputLayout);
+
+        packedVsBlob->Release();
+
+        if (FAILED(hr)) {
+            DEBUG_ERROR("Ошибка создания input layout упакованных вершин");
             return false;
         }
 
         // Создаем константный буфер
         D3D11_BUFFER_DESC cbDesc = {};
-        cbDesc.ByteWidth = sizeof(XMMATRIX) * 3 + sizeof(XMFLOAT4);
+        cbDesc.ByteWidth = sizeof(ShaderConstants);
         cbDesc.Usage = D3D11_USAGE_DYNAMIC;
         cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
         cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
@@ -1625,49 +12689,66 @@ public:
         rsDesc.FrontCounterClockwise = FALSE;
         rsDesc.DepthClipEnable = TRUE;
 
-        hr = device->CreateRasterizerState(&rsDesc, &rasterizerState);
+        hr = PipelineStateCache::GetRasterizerState(device, rsDesc, &rasterizerState);
         if (FAILED(hr)) {
             DEBUG_ERROR("Ошибка создания rasterizer state");
             return false;
         }
 
-        DEBUG_SUCCESS("Шейдеры инициализированы");
-        return true;
-    }
+        // Индексы материалов: экземпляр с номером StartInstanceLocation читает свой
+        std::vector<uint32_t> materialIndices(MAX_GPU_MATERIALS);
+        for (uint32_t i = 0; i < MAX_GPU_MATERIALS; i++) materialIndices[i] = i;
 
-    void SetShaderParameters(ID3D11DeviceContext* context,
-        const XMMATRIX& world,
-        const XMMATRIX& view,
-        const XMMATRIX& proj) {
-        D3D11_MAPPED_SUBRESOURCE mapped;
-        if (SUCCEEDED(context->Map(constantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
-            XMMATRIX* matrices = (XMMATRIX*)mapped.pData;
-            matrices[0] = XMMatrixTranspose(world);
-            matrices[1] = XMMatrixTranspose(view);
-            matrices[2] = XMMatrixTranspose(proj);
+        D3D11_BUFFER_DESC mbd = {};
+        mbd.Usage = D3D11_USAGE_IMMUTABLE;
+        mbd.ByteWidth = (UINT)(sizeof(uint32_t) * materialIndices.size());
+        mbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+        D3D11_SUBRESOURCE_DATA minit = {};
+        minit.pSysMem = materialIndices.data();
 
-            float* lightDir = (float*)(matrices + 3);
-            lightDir[0] = 1.0f;
-            lightDir[1] = 1.0f;
-            lightDir[2] = 0.5f;
-            lightDir[3] = 0.0f;
+        hr = device->CreateBuffer(&mbd, &minit, &materialIndexBuffer);
+        if (FAILED(hr)) {
+            DEBUG_ERROR("Ошибка создания буфера индексов материалов");
+            return false;
+        }
 
-            context->Unmap(constantBuffer, 0);
+        if (!defaultMaterials.Create(device, { GpuMaterialTable::Textured() })) {
+            return false;
         }
 
-        context->VSSetConstantBuffers(0, 1, &constantBuffer);
+        pipeline.id = 1;
+        pipeline.vertexShader = vertexShader;
+        pipeline.pixelShader = pixelShader;
+        pipeline.inputLayout = inputLayout;
+        pipeline.rasterizerState = rasterizerState;
+        pipeline.constantBuffer = constantBuffer;
+        pipeline.instanceBuffer = materialIndexBuffer;
+        pipeline.instanceStride = sizeof(uint32_t);
+
+        packedPipeline = pipeline;
+        packedPipeline.id = 2;
+        packedPipeline.vertexShader = packedVertexShader;
+        packedPipeline.inputLayout = packedInputLayout;
+
+        DEBUG_SUCCESS("Шейдеры инициализированы");
+        return true;
     }
 
-    void Apply(ID3D11DeviceContext* context) {
-        context->VSSetShader(vertexShader, nullptr, 0);
-        context->PSSetShader(pixelShader, nullptr, 0);
-        context->IASetInputLayout(inputLayout);
-        context->RSSetState(rasterizerState);
+    const RenderPipeline& GetPipeline(bool packedVertices) const {
+        return packedVertices ? packedPipeline : pipeline;
     }
 
+    // Модель с таблицей материалов передаёт свою
+    const GpuMaterialTable& GetDefaultMaterials() const { return defaultMaterials; }
+
     void Cleanup() {
+        defaultMaterials.Release();
+        if (materialIndexBuffer) materialIndexBuffer->Release();
         if (rasterizerState) rasterizerState->Release();
         if (constantBuffer) constantBuffer->Release();
+        if (packedInputLayout) packedInputLayout->Release();
+        if (packedVertexShader) packedVertexShader->Release();
         if (inputLayout) inputLayout->Release();
         if (pixelShader) pixelShader->Release();
         if (vertexShader) vertexShader->Release();
@@ -1700,7 +12781,9 @@ public:
 
     XMMATRIX GetProjectionMatrix(float aspectRatio) const {
         // ИЗОМЕТРИЧЕСКАЯ ПРОЕКЦИЯ (ортогональная)
-        float viewWidth = 40.0f;
+        // В ортогональной проекции расстояние не меняет размер, поэтому зум
+        // масштабирует видимую область (при distance = 20 ширина 40, как раньше)
+        float viewWidth = 40.0f * distance / 20.0f;
         float viewHeight = viewWidth / aspectRatio;
         return XMMatrixOrthographicLH(viewWidth, viewHeight, 0.1f, 100.0f);
     }
@@ -1723,48 +12806,26 @@ class IsometricBackground {
 private:
     ID3D11Buffer* vertexBuffer = nullptr;
     ID3D11Buffer* indexBuffer = nullptr;
-    Texture2D backgroundTexture;
+    TextureHandle texture; // В TextureManager: шахматка, пока картинка грузится
     XMFLOAT3 position = { 0, 0, 0 };
     float size = 40.0f; // Размер соответствует камере
+    float screenPixels = FLT_MAX; // Размер на экране - для стриминга текстуры
+    float viewDepth = 0.0f;
 
 public:
-    bool Initialize(ID3D11Device* device, const wchar_t* textureFilename) {
+    bool Initialize(ID3D11Device* device, TextureManager& textures, AssetLoader& loader,
+        const wchar_t* textureFilename) {
         DEBUG_LOG("Инициализация фона с картинкой...");
 
         if (!textureFilename || wcslen(textureFilename) == 0) {
             DEBUG_WARNING("Не указано имя файла фона, создаем простой фон");
             // Создаем дебажную текстуру
-            backgroundTexture.CreateDebugTexture(device, L"background");
+            texture = textures.CreateDebugTexture(L"background");
         }
         else {
-            // Ищем файл с разными расширениями
-            std::wstring filename = textureFilename;
-            std::vector<std::wstring> extensions = { L"", L".jpg", L".jpeg", L".png", L".bmp", L".dds" };
-
-            bool textureLoaded = false;
-
-            for (const auto& ext : extensions) {
-                std::wstring fullFilename = filename + ext;
-                std::wstring foundPath = FileSystemHelper::FindImageFile(fullFilename);
-                if (foundPath.empty()) {
-                    foundPath = FileSystemHelper::FindFile(fullFilename);
-                }
-
-                if (!foundPath.empty()) {
-                    DEBUG_LOG_W(L"Найден файл фона: " + foundPath);
-
-                    if (backgroundTexture.LoadFromFile(device, foundPath.c_str())) {
-                        textureLoaded = true;
-                        DEBUG_SUCCESS("Текстура фона успешно загружена");
-                        break;
-                    }
-                }
-            }
-
-            if (!textureLoaded) {
-                DEBUG_WARNING("Не удалось загрузить текстуру фона, создаем простой фон");
-                backgroundTexture.CreateDebugTexture(device, L"background");
-            }
+            // Каталог ассетов сам перебирает расширения изображений и папки; картинка
+            // декодируется в фоне, а если её нет - остаётся шахматка
+            texture = textures.LoadTextureAsync(textureFilename, loader);
         }
 
         // Создаем геометрию фона (большая плоскость)
@@ -1852,24 +12913,38 @@ public:
         DEBUG_LOG("Геометрия фона создана");
     }
 
-    void Render(ID3D11DeviceContext* context) {
-        if (!vertexBuffer || !indexBuffer || !backgroundTexture.srv) {
+    // Как Model3D::PrepareView: пикселей на единицу в центре фона, умноженные на его размер
+    void PrepareView(const XMMATRIX& view, const XMMATRIX& proj, float viewportHeight) {
+        XMFLOAT4X4 p;
+        XMStoreFloat4x4(&p, proj);
+        XMVECTOR viewCenter = XMVector3TransformCoord(XMLoadFloat3(&position), view);
+        float w = XMVectorGetZ(viewCenter) * p.m[2][3] + p.m[3][3];
+        screenPixels = size * fabsf(p.m[1][1]) * viewportHeight * 0.5f / std::max(w, 0.0001f);
+        viewDepth = XMVectorGetZ(viewCenter);
+    }
+
+    void Submit(RenderCommandBuffer& commands, const RenderPipeline& pipeline,
+        const GpuMaterialTable& materials, TextureManager& textures) {
+        textures.RequestResidency(texture, screenPixels);
+        Texture2D* current = textures.GetTexture(texture);
+        if (!vertexBuffer || !indexBuffer || !current || !current->srv) {
             return;
         }
 
-        // Устанавливаем текстуру
-        context->PSSetShaderResources(0, 1, &backgroundTexture.srv);
-        context->PSSetSamplers(0, 1, &backgroundTexture.samplerState);
-
-        // Устанавливаем буферы
-        UINT stride = sizeof(Vertex);
-        UINT offset = 0;
-        context->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-        context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
-        context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-        // Рендерим
-        context->DrawIndexed(6, 0, 0);
+        DrawPacket packet;
+        packet.key = RenderSortKey::Make(RENDER_LAYER_BACKGROUND, pipeline.id, materials.GetId(),
+            texture.index, viewDepth);
+        packet.pipeline = &pipeline;
+        packet.vertexBuffer = vertexBuffer;
+        packet.vertexStride = sizeof(Vertex);
+        packet.indexBuffer = indexBuffer;
+        packet.indexFormat = DXGI_FORMAT_R32_UINT;
+        packet.materials = materials.GetView();
+        packet.texture = current->srv;
+        packet.sampler = current->samplerState;
+        packet.constants = commands.AddConstants(GetWorldMatrix());
+        packet.indexCount = 6;
+        commands.Submit(packet);
     }
 
     XMMATRIX GetWorldMatrix() const {
@@ -1877,8 +12952,9 @@ public:
         return XMMatrixTranslation(position.x, position.y, position.z);
     }
 
-    void Cleanup() {
-        backgroundTexture.Cleanup();
+    void Cleanup(TextureManager& textures) {
+        textures.Release(texture);
+        texture = TextureHandle();
         if (indexBuffer) indexBuffer->Release();
         if (vertexBuffer) vertexBuffer->Release();
     }
@@ -1890,8 +12966,15 @@ private:
     IsometricCamera camera;
     ShaderManager shader;
     TextureManager textures;
+    AssetLoader loader;
+    FileWatcher watcher;
+    uint32_t watchedDependencyRevision = 0;
     ID3D11Device* device = nullptr;
     ID3D11DeviceContext* context = nullptr;
+    RenderCommandBuffer commands;
+    D3D11RenderBackend renderBackend;
+    RenderStats lastRenderStats;
+    size_t lastPacketCount = 0;
 
     // Добавляем фон
     IsometricBackground background;
@@ -1900,10 +12983,16 @@ private:
     float rotationSpeed = 3.0f;
     float currentRotation = XM_PI; // Начинаем смотрит на камеру
 
+    // Время до первого кадра: модель и фон грузятся в фоне, кадр не ждёт их
+    std::chrono::steady_clock::time_point initStart;
+    bool firstFrameReported = false;
+
 public:
     bool Initialize(ID3D11Device* dev, ID3D11DeviceContext* ctx) {
         device = dev;
         context = ctx;
+        renderBackend.Initialize(context);
+        initStart = std::chrono::steady_clock::now();
 
         DEBUG_LOG("=== ИНИЦИАЛИЗАЦИЯ ИГРОВОЙ СЦЕНЫ ===");
 
@@ -1921,25 +13010,23 @@ public:
             return false;
         }
 
-        // Инициализируем менеджер текстур
-        textures.Initialize(device);
+        // Инициализируем менеджер текстур и фоновый загрузчик
+        textures.Initialize(device, &loader);
+        loader.Start();
 
         // Инициализируем фон
         DEBUG_LOG("Загрузка фона...");
-        background.Initialize(device, L"background");
+        background.Initialize(device, textures, loader, L"background");
 
         // Загружаем модель character2
         DEBUG_LOG("Попытка загрузки модели X_Bot.fbx...");
         std::wstring objFile = L"character2";
 
-        // Загружаем модель (список текстур пустой, так как используем материалы из MTL)
-        std::vector<std::wstring> textureFiles = {
-            // Пусто - текстуры будут созданы из материалов
-        };
+        // Пока модель грузится (текстуры - из материалов MTL), на её месте простая модель
+        player.LoadFromOBJAsync(device, textures, loader, objFile);
 
-        if (!player.LoadFromOBJ(device, textures, objFile, textureFiles)) {
-            DEBUG_ERROR("Критическая ошибка загрузки модели");
-            return false;
+        if (HOT_RELOAD_ASSETS) {
+            for (const auto& path : textures.GetTextureFiles()) watcher.Watch(path);
         }
 
         // Настраиваем игрока - ОЧЕНЬ МАЛЕНЬКИЙ МАСШТАБ для моделей из Blender!
@@ -1965,6 +13052,9 @@ public:
     }
 
     void Update(float deltaTime) {
+        AssetIndex::Update();
+        if (HOT_RELOAD_ASSETS) ReloadChangedAssets();
+
         // Управление игроком (изометрическое)
         bool isMoving = false;
         XMFLOAT3 moveDir = { 0, 0, 0 };
@@ -2083,31 +13173,75 @@ public:
             sprintf_s(buffer, "Игрок: Pos(%.2f, %.2f, %.2f) RotY: %.1f° (%.2f рад) Масштаб: проверьте 1/2/3/4",
                 pos.x, pos.y, pos.z, rot.y * 180.0f / XM_PI, rot.y);
             DEBUG_LOG(buffer);
+            sprintf_s(buffer, "Треугольники игрока: %u из %u после отсечения кластеров",
+                player.GetVisibleTriangles(), player.GetTotalTriangles());
+            DEBUG_LOG(buffer);
+            sprintf_s(buffer, "Кадр: %zu пакетов, %u вызовов отрисовки, %u смен состояния",
+                lastPacketCount, lastRenderStats.drawCalls, lastRenderStats.GetStateChanges());
+            DEBUG_LOG(buffer);
             debugTimer = 0.0f;
         }
     }
 
+    // Изменённые на диске файлы перечитываются в фоне, подмена - между кадрами
+    // (ProcessUploads в начале Render). Перезагружается только то, что от файла зависит.
+    void ReloadChangedAssets() {
+        // Новая модель или новые материалы - и новые файлы (в том числе текстуры map_Kd)
+        if (player.GetDependencyRevision() != watchedDependencyRevision) {
+            watchedDependencyRevision = player.GetDependencyRevision();
+            for (const auto& path : player.GetDependencies()) watcher.Watch(path);
+        }
+
+        for (const auto& path : watcher.Poll()) {
+            DEBUG_LOG_W(L"Файл изменён: " + path);
+            if (textures.ReloadTextureAsync(path, loader)) continue;
+            if (!player.DependsOn(path)) continue;
+
+            if (FileSystemHelper::GetLowerExtension(path) == L".mtl") {
+                player.ReloadMaterialsAsync(device, path, textures, loader);
+            }
+            else {
+                player.ReloadAsync(device, textures, loader);
+            }
+        }
+    }
+
     void Render(float aspectRatio) {
+        // Готовые в фоне ассеты создаются на GPU в пределах бюджета кадра;
+        // ресурсы отпущенных текстур освобождаются с задержкой в кадры
+        loader.ProcessUploads(ASSET_UPLOAD_BUDGET_MS);
+        textures.CollectGarbage();
+
+        if (!firstFrameReported) {
+            firstFrameReported = true;
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - initStart).count();
+            char buffer[256];
+            sprintf_s(buffer, "Первый кадр через %.1f мс после начала инициализации (в загрузке: %zu)",
+                ms, loader.GetPendingCount());
+            DEBUG_LOG(buffer);
+        }
+
         // Получаем матрицы камеры
         XMMATRIX view = camera.GetViewMatrix();
         XMMATRIX proj = camera.GetProjectionMatrix(aspectRatio);
 
-        // 1. Сначала рендерим фон
-        XMMATRIX backgroundWorld = background.GetWorldMatrix();
-        shader.SetShaderParameters(context, backgroundWorld, view, proj);
-        shader.Apply(context);
-        background.Render(context);
+        // Фон и игрок складывают пакеты; слой фона в ключе меньше, он рисуется первым
+        commands.Begin(view, proj);
+        background.PrepareView(view, proj, (float)SCREEN_HEIGHT);
+        background.Submit(commands, shader.GetPipeline(false), shader.GetDefaultMaterials(), textures);
+        player.PrepareView(view, proj, (float)SCREEN_HEIGHT);
+        player.Submit(commands, shader.GetPipeline(player.UsesPackedVertices()), textures);
 
-        // 2. Затем рендерим игрока поверх фона
-        XMMATRIX playerWorld = player.GetWorldMatrix();
-        shader.SetShaderParameters(context, playerWorld, view, proj);
-        player.Render(context, textures);
+        commands.Execute(renderBackend);
+        lastRenderStats = renderBackend.GetStats();
+        lastPacketCount = commands.GetPacketCount();
     }
 
     void Cleanup() {
         DEBUG_LOG("Очистка игровой сцены...");
-        background.Cleanup(); // Очищаем фон
-        player.Cleanup();
+        loader.Shutdown(); // Фоновые задачи ссылаются на модель и текстуры
+        background.Cleanup(textures); // Очищаем фон
+        player.Cleanup(textures);
         textures.Cleanup();
         shader.Cleanup();
         DEBUG_LOG("Игровая сцена очищена");
@@ -2157,7 +13291,6 @@ public:
             DEBUG_ERROR("Ошибка создания устройства DirectX 11");
             return false;
         }
-        TestAssimp();
         // Получаем back buffer
         ID3D11Texture2D* backBuffer = nullptr;
         hr = swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)&backBuffer);
@@ -2217,32 +13350,6 @@ public:
         DEBUG_SUCCESS("DirectX 11 инициализирован");
         return true;
     }
-    void TestAssimp() {
-        Assimp::Importer importer;
-
-        const aiScene* scene = importer.ReadFile(
-            "C:/dev/GameDev/animation/Walking.fbx",
-            aiProcess_Triangulate |
-            aiProcess_JoinIdenticalVertices |
-            aiProcess_LimitBoneWeights |
-            aiProcess_CalcTangentSpace
-        );
-
-        if (!scene) {
-            DEBUG_ERROR(importer.GetErrorString());
-            return;
-        }
-
-        DEBUG_SUCCESS("Assimp FBX загружен успешно!");
-
-        if (scene->HasAnimations()) {
-            DEBUG_LOG("FBX содержит анимации");
-        }
-        else {
-            DEBUG_WARNING("FBX без анимаций");
-        }
-    }
-
     void BeginFrame() {
         float clearColor[4] = { 0.1f, 0.2f, 0.3f, 1.0f }; // Темно-синий фон
 
@@ -2263,6 +13370,7 @@ public:
     ID3D11DeviceContext* GetContext() { return context; }
 
     void Cleanup() {
+        PipelineStateCache::Clear(); // Ссылки кэша - до освобождения устройства
         if (depthStencilView) depthStencilView->Release();
         if (renderTargetView) renderTargetView->Release();
         if (swapChain) swapChain->Release();
@@ -2346,6 +13454,10 @@ int WINAPI WinMain(
         return 1;
     }
 
+    // Пакеты ассетов рядом с EXE - до первой загрузки, затем каталог ассетов по корням
+    AssetPacks::MountDirectory(FileSystemHelper::GetExecutableDirectory());
+    AssetIndex::Rebuild();
+
     // Инициализируем игровую сцену
     GameScene game;
     if (!game.Initialize(renderer.GetDevice(), renderer.GetContext())) {
@@ -2433,4 +13545,5 @@ int WINAPI WinMain(
     DEBUG_LOG("Игра завершена");
 
     return (int)msg.wParam;
-}
\ No newline at end of file
+}
+#endif // ASSET_COOKER